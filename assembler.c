@@ -0,0 +1,994 @@
+/********************************************************************************
+* assembler.c: Contains function definitions for a two-pass text assembler.
+*              The first pass collects the addresses of all labels, the second
+*              pass evaluates the operands and emits the machine code. Since
+*              both passes run the same code, the label addresses are always
+*              consistent with the emitted instructions.
+********************************************************************************/
+#include "assembler.h"
+#include "cpu_context.h"
+#include "control_unit.h"
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <string.h>
+
+/* Macro definitions: */
+#define ASSEMBLER_LINE_SIZE 256 /* Max length of a source line (including '\0'). */
+
+/********************************************************************************
+* operand_format: Enumeration for the operand formats of the instructions.
+********************************************************************************/
+enum operand_format
+{
+   FORMAT_NONE,      /* No operands, for instance RET. */
+   FORMAT_REG,       /* Rd, for instance INC R16. */
+   FORMAT_REG_REG,   /* Rd, Rr, for instance MOV R16, R17 or LD R16, X. */
+   FORMAT_REG_BYTE,  /* Rd, K, for instance LDI R16, 0x01 or IN R16, PINB. */
+   FORMAT_BYTE_REG,  /* A, Rr, for instance OUT PORTB, R16. */
+   FORMAT_ADDRESS,   /* k, for instance JMP main. */
+   FORMAT_REG_PAIR   /* Rd, Rr with even registers, expanded to two MOV (MOVW). */
+};
+
+/********************************************************************************
+* mnemonic: Entry in the instruction table.
+********************************************************************************/
+struct mnemonic
+{
+   const char* name;           /* Name of the instruction. */
+   uint8_t op_code;            /* OP code of the instruction. */
+   enum operand_format format; /* Operand format of the instruction. */
+};
+
+/********************************************************************************
+* predefined_symbol: Symbol predefined by the CPU, see cpu.h.
+********************************************************************************/
+struct predefined_symbol
+{
+   const char* name; /* Name of the symbol. */
+   int32_t value;    /* Value of the symbol. */
+};
+
+/********************************************************************************
+* parser: State of the assembler while processing the source text.
+********************************************************************************/
+struct parser
+{
+   struct assembler_program* program;         /* The program being assembled. */
+   const char* pos;                           /* Current position in the line. */
+   int line_number;                           /* Current line number. */
+   int pass;                                  /* Current pass (1 or 2). */
+   bool data_segment;                         /* Indicates if the data segment is selected. */
+   int32_t code_address;                      /* Current address in the code segment. */
+   int32_t data_address;                      /* Current address in the data segment. */
+   bool undefined;                            /* Set when an undefined symbol is evaluated. */
+   bool failed;                               /* Indicates if an error has occured. */
+   bool used[PROGRAM_MEMORY_ADDRESS_WIDTH];   /* Indicates used program memory addresses. */
+};
+
+/* Static variables: */
+static const struct mnemonic mnemonics[] =
+{
+   { "NOP",  NOP,  FORMAT_NONE     }, { "LDI",  LDI,  FORMAT_REG_BYTE },
+   { "MOV",  MOV,  FORMAT_REG_REG  }, { "OUT",  OUT,  FORMAT_BYTE_REG },
+   { "IN",   IN,   FORMAT_REG_BYTE }, { "STS",  STS,  FORMAT_BYTE_REG },
+   { "LDS",  LDS,  FORMAT_REG_BYTE }, { "CLR",  CLR,  FORMAT_REG      },
+   { "ORI",  ORI,  FORMAT_REG_BYTE }, { "ANDI", ANDI, FORMAT_REG_BYTE },
+   { "XORI", XORI, FORMAT_REG_BYTE }, { "OR",   OR,   FORMAT_REG_REG  },
+   { "AND",  AND,  FORMAT_REG_REG  }, { "XOR",  XOR,  FORMAT_REG_REG  },
+   { "ADDI", ADDI, FORMAT_REG_BYTE }, { "SUBI", SUBI, FORMAT_REG_BYTE },
+   { "ADD",  ADD,  FORMAT_REG_REG  }, { "SUB",  SUB,  FORMAT_REG_REG  },
+   { "INC",  INC,  FORMAT_REG      }, { "DEC",  DEC,  FORMAT_REG      },
+   { "CPI",  CPI,  FORMAT_REG_BYTE }, { "CP",   CP,   FORMAT_REG_REG  },
+   { "JMP",  JMP,  FORMAT_ADDRESS  }, { "BREQ", BREQ, FORMAT_ADDRESS  },
+   { "BRNE", BRNE, FORMAT_ADDRESS  }, { "BRGE", BRGE, FORMAT_ADDRESS  },
+   { "BRGT", BRGT, FORMAT_ADDRESS  }, { "BRLE", BRLE, FORMAT_ADDRESS  },
+   { "BRLT", BRLT, FORMAT_ADDRESS  }, { "CALL", CALL, FORMAT_ADDRESS  },
+   { "RET",  RET,  FORMAT_NONE     }, { "RETI", RETI, FORMAT_NONE     },
+   { "PUSH", PUSH, FORMAT_REG      }, { "POP",  POP,  FORMAT_REG      },
+   { "LSL",  LSL,  FORMAT_REG      }, { "LSR",  LSR,  FORMAT_REG      },
+   { "SEI",  SEI,  FORMAT_NONE     }, { "CLI",  CLI,  FORMAT_NONE     },
+   { "STIO", STIO, FORMAT_REG_REG  }, { "LDIO", LDIO, FORMAT_REG_REG  },
+   { "ST",   ST,   FORMAT_REG_REG  }, { "LD",   LD,   FORMAT_REG_REG  },
+   { "RJMP", JMP,  FORMAT_ADDRESS  }, { "RCALL", CALL, FORMAT_ADDRESS },
+   { "EOR",  XOR,  FORMAT_REG_REG  }, { "MOVW", MOV,  FORMAT_REG_PAIR },
+};
+
+#define PREDEFINED(name) { #name, name }
+
+static const struct predefined_symbol predefined_symbols[] =
+{
+   PREDEFINED(R0),  PREDEFINED(R1),  PREDEFINED(R2),  PREDEFINED(R3),
+   PREDEFINED(R4),  PREDEFINED(R5),  PREDEFINED(R6),  PREDEFINED(R7),
+   PREDEFINED(R8),  PREDEFINED(R9),  PREDEFINED(R10), PREDEFINED(R11),
+   PREDEFINED(R12), PREDEFINED(R13), PREDEFINED(R14), PREDEFINED(R15),
+   PREDEFINED(R16), PREDEFINED(R17), PREDEFINED(R18), PREDEFINED(R19),
+   PREDEFINED(R20), PREDEFINED(R21), PREDEFINED(R22), PREDEFINED(R23),
+   PREDEFINED(R24), PREDEFINED(R25), PREDEFINED(R26), PREDEFINED(R27),
+   PREDEFINED(R28), PREDEFINED(R29), PREDEFINED(R30), PREDEFINED(R31),
+   PREDEFINED(XL),  PREDEFINED(XH),  PREDEFINED(YL),  PREDEFINED(YH),
+   PREDEFINED(X),   PREDEFINED(Y),   { "ZL", R30 },    { "ZH", R31 },
+   { "Z", R30 },
+   PREDEFINED(DDRB),   PREDEFINED(PORTB),  PREDEFINED(PINB),
+   PREDEFINED(DDRC),   PREDEFINED(PORTC),  PREDEFINED(PINC),
+   PREDEFINED(DDRD),   PREDEFINED(PORTD),  PREDEFINED(PIND),
+   PREDEFINED(PCICR),  PREDEFINED(PCIFR),
+   PREDEFINED(PCMSK0), PREDEFINED(PCMSK1), PREDEFINED(PCMSK2),
+   PREDEFINED(PCIE0),  PREDEFINED(PCIE1),  PREDEFINED(PCIE2),
+   PREDEFINED(PCIF0),  PREDEFINED(PCIF1),  PREDEFINED(PCIF2),
+   PREDEFINED(PORTB0), PREDEFINED(PORTB1), PREDEFINED(PORTB2), PREDEFINED(PORTB3),
+   PREDEFINED(PORTB4), PREDEFINED(PORTB5), PREDEFINED(PORTB6), PREDEFINED(PORTB7),
+   PREDEFINED(PORTC0), PREDEFINED(PORTC1), PREDEFINED(PORTC2), PREDEFINED(PORTC3),
+   PREDEFINED(PORTC4), PREDEFINED(PORTC5), PREDEFINED(PORTC6), PREDEFINED(PORTC7),
+   PREDEFINED(PORTD0), PREDEFINED(PORTD1), PREDEFINED(PORTD2), PREDEFINED(PORTD3),
+   PREDEFINED(PORTD4), PREDEFINED(PORTD5), PREDEFINED(PORTD6), PREDEFINED(PORTD7),
+   PREDEFINED(RESET_vect),  PREDEFINED(PCINT0_vect),
+   PREDEFINED(PCINT1_vect), PREDEFINED(PCINT2_vect),
+};
+
+/* Static functions: */
+static void assemble_pass(struct parser* self,
+                          const char* source);
+static void assemble_line(struct parser* self,
+                          char* line);
+static void assemble_directive(struct parser* self,
+                               const char* name);
+static void assemble_instruction(struct parser* self,
+                                 const char* name);
+static void emit(struct parser* self,
+                 const uint8_t op_code,
+                 const uint8_t op1,
+                 const uint8_t op2);
+static void define_symbol(struct parser* self,
+                          const char* name,
+                          const int32_t value,
+                          const enum assembler_symbol_type type);
+static bool lookup_symbol(struct parser* self,
+                          const char* name,
+                          int32_t* value);
+static int32_t parse_expression(struct parser* self);
+static int32_t parse_binary(struct parser* self,
+                            const int level);
+static int32_t parse_unary(struct parser* self);
+static int32_t parse_primary(struct parser* self);
+static int32_t parse_register(struct parser* self);
+static int32_t parse_byte(struct parser* self);
+static bool parse_identifier(struct parser* self,
+                             char* name);
+static bool expect(struct parser* self,
+                   const char c);
+static bool at_end(struct parser* self);
+static inline void skip_spaces(struct parser* self);
+static void error(struct parser* self,
+                  const char* format, ...);
+
+/********************************************************************************
+* assembler_assemble: Assembles specified null terminated source text into
+*                     referenced program. Success code 0 is returned on
+*                     success, otherwise error code 1 is returned and the
+*                     error message of the program is set.
+*
+*                     - self  : Reference to the program to store the result.
+*                     - source: The assembly source text.
+********************************************************************************/
+int assembler_assemble(struct assembler_program* self,
+                       const char* source)
+{
+   struct parser parser;
+   memset(self, 0, sizeof(*self));
+   memset(&parser, 0, sizeof(parser));
+   parser.program = self;
+
+   for (parser.pass = 1; parser.pass <= 2 && !parser.failed; ++parser.pass)
+   {
+      assemble_pass(&parser, source);
+   }
+   return parser.failed ? 1 : 0;
+}
+
+/********************************************************************************
+* assembler_assemble_file: Assembles the source file at specified path into
+*                          referenced program. Success code 0 is returned on
+*                          success, otherwise error code 1 is returned and the
+*                          error message of the program is set.
+*
+*                          - self: Reference to the program to store the result.
+*                          - path: Path to the assembly source file.
+********************************************************************************/
+int assembler_assemble_file(struct assembler_program* self,
+                            const char* path)
+{
+   FILE* file = fopen(path, "rb");
+   char* source = 0;
+   long size = 0;
+   int result = 1;
+
+   memset(self, 0, sizeof(*self));
+
+   if (!file)
+   {
+      snprintf(self->error, ASSEMBLER_ERROR_SIZE, "Could not open file %s!", path);
+      return 1;
+   }
+
+   if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) >= 0 && fseek(file, 0, SEEK_SET) == 0)
+   {
+      source = (char*)malloc((size_t)size + 1);
+   }
+
+   if (source && fread(source, 1, (size_t)size, file) == (size_t)size)
+   {
+      source[size] = '\0';
+      result = assembler_assemble(self, source);
+   }
+   else
+   {
+      snprintf(self->error, ASSEMBLER_ERROR_SIZE, "Could not read file %s!", path);
+   }
+
+   free(source);
+   fclose(file);
+   return result;
+}
+
+/********************************************************************************
+* assembler_symbol_find: Returns the user defined symbol with specified name
+*                        (case insensitive) in referenced program. If no such
+*                        symbol exists, a null pointer is returned.
+*
+*                        - self: Reference to the assembled program.
+*                        - name: The name of the symbol.
+********************************************************************************/
+const struct assembler_symbol* assembler_symbol_find(const struct assembler_program* self,
+                                                     const char* name)
+{
+   for (uint16_t i = 0; i < self->num_symbols; ++i)
+   {
+      if (names_equal(self->symbols[i].name, name))
+      {
+         return &self->symbols[i];
+      }
+   }
+   return 0;
+}
+
+/********************************************************************************
+* assembler_print_symbols: Prints the symbol table of referenced program.
+*
+*                          - self   : Reference to the assembled program.
+*                          - ostream: Reference to the output stream.
+********************************************************************************/
+void assembler_print_symbols(const struct assembler_program* self,
+                             FILE* ostream)
+{
+   fprintf(ostream, "Symbol table (%u instructions):\n", (unsigned)self->code_size);
+
+   for (uint16_t i = 0; i < self->num_symbols; ++i)
+   {
+      const struct assembler_symbol* symbol = &self->symbols[i];
+      const char* type = "constant";
+      if (symbol->type == ASSEMBLER_SYMBOL_CODE_LABEL) type = "code";
+      else if (symbol->type == ASSEMBLER_SYMBOL_DATA_LABEL) type = "data";
+      fprintf(ostream, "%-32s0x%04X\t%s\n", symbol->name, (unsigned)(symbol->value & 0xFFFF), type);
+   }
+
+   fprintf(ostream, "\n");
+   return;
+}
+
+/********************************************************************************
+* assembler_load_ctx: Loads referenced program into the program memory of
+*                     specified CPU context together with its initial data
+*                     memory content and its code labels,
+*                     which are used as subroutine names. Unless labeled,
+*                     the reset vector is named RESET_vect. The CPU context
+*                     is reset so that the new program is decoded and run
+*                     from the reset vector.
+*
+*                     - self   : Reference to the CPU context.
+*                     - program: Reference to the assembled program.
+********************************************************************************/
+void assembler_load_ctx(struct cpu_context* self,
+                        const struct assembler_program* program)
+{
+   program_memory_load_ctx(self, program->code, program->code_size, RESET_vect);
+   data_memory_set_initial_ctx(self, program->data_start, program->data + program->data_start,
+                               program->data_end - program->data_start);
+
+   for (uint16_t i = 0; i < program->num_symbols; ++i)
+   {
+      const struct assembler_symbol* symbol = &program->symbols[i];
+
+      if (symbol->type == ASSEMBLER_SYMBOL_CODE_LABEL && symbol->value < PROGRAM_MEMORY_ADDRESS_WIDTH &&
+          !program_memory_label_ctx(self, (uint16_t)symbol->value))
+      {
+         program_memory_set_label_ctx(self, (uint16_t)symbol->value, symbol->name);
+      }
+   }
+
+   if (!program_memory_label_ctx(self, RESET_vect))
+   {
+      program_memory_set_label_ctx(self, RESET_vect, "RESET_vect");
+   }
+
+   control_unit_reset_ctx(self);
+   return;
+}
+
+/********************************************************************************
+* assemble_pass: Runs one pass over specified source text, line by line.
+*
+*                - self  : Reference to the parser.
+*                - source: The assembly source text.
+********************************************************************************/
+static void assemble_pass(struct parser* self,
+                          const char* source)
+{
+   char line[ASSEMBLER_LINE_SIZE];
+   self->line_number = 0;
+   self->data_segment = false;
+   self->code_address = 0;
+   self->data_address = ASSEMBLER_DATA_SEGMENT_START;
+
+   while (*source && !self->failed)
+   {
+      const char* line_end = source;
+      while (*line_end && *line_end != '\n') ++line_end;
+      const size_t length = (size_t)(line_end - source);
+      self->line_number++;
+
+      if (length >= ASSEMBLER_LINE_SIZE)
+      {
+         error(self, "Line too long");
+         return;
+      }
+
+      memcpy(line, source, length);
+      line[length] = '\0';
+      assemble_line(self, line);
+      source = *line_end ? line_end + 1 : line_end;
+   }
+   return;
+}
+
+/********************************************************************************
+* assemble_line: Assembles one line, consisting of an optional label followed
+*                by an optional directive or instruction.
+*
+*                - self: Reference to the parser.
+*                - line: The line, which is modified by removing the comment.
+********************************************************************************/
+static void assemble_line(struct parser* self,
+                          char* line)
+{
+   char name[ASSEMBLER_SYMBOL_SIZE];
+   char* comment = strchr(line, ';');
+   if (comment) *comment = '\0';
+
+   self->pos = line;
+   if (at_end(self)) return;
+   if (!parse_identifier(self, name)) return;
+
+   skip_spaces(self);
+
+   if (*self->pos == ':')
+   {
+      self->pos++;
+
+      if (self->data_segment)
+      {
+         define_symbol(self, name, self->data_address, ASSEMBLER_SYMBOL_DATA_LABEL);
+      }
+      else
+      {
+         define_symbol(self, name, self->code_address, ASSEMBLER_SYMBOL_CODE_LABEL);
+      }
+
+      if (self->failed || at_end(self)) return;
+      if (!parse_identifier(self, name)) return;
+   }
+
+   if (name[0] == '.')
+   {
+      assemble_directive(self, name);
+   }
+   else
+   {
+      assemble_instruction(self, name);
+   }
+
+   if (!self->failed && !at_end(self))
+   {
+      error(self, "Unexpected characters '%s'", self->pos);
+   }
+   return;
+}
+
+/********************************************************************************
+* assemble_directive: Assembles a directive with specified name.
+*
+*                     - self: Reference to the parser.
+*                     - name: The name of the directive, including the dot.
+********************************************************************************/
+static void assemble_directive(struct parser* self,
+                               const char* name)
+{
+   if (names_equal(name, ".CSEG"))
+   {
+      self->data_segment = false;
+   }
+   else if (names_equal(name, ".DSEG"))
+   {
+      self->data_segment = true;
+   }
+   else if (names_equal(name, ".EQU"))
+   {
+      char symbol[ASSEMBLER_SYMBOL_SIZE];
+      if (!parse_identifier(self, symbol) || !expect(self, '=')) return;
+      self->undefined = false;
+      const int32_t value = parse_expression(self);
+      if (self->failed) return;
+      if (self->undefined) error(self, "Undefined symbol in .EQU %s", symbol);
+      else define_symbol(self, symbol, value, ASSEMBLER_SYMBOL_CONSTANT);
+   }
+   else if (names_equal(name, ".DB"))
+   {
+      if (!self->data_segment)
+      {
+         error(self, ".DB is only allowed in the data segment");
+         return;
+      }
+
+      while (1)
+      {
+         const uint8_t value = (uint8_t)parse_byte(self);
+         const int32_t address = self->data_address++ + DATA_MEMORY_DATA_OFFSET;
+         if (self->failed) return;
+
+         if (address < 0 || address >= DATA_MEMORY_ADDRESS_WIDTH)
+         {
+            error(self, "Address %d outside data memory", address - DATA_MEMORY_DATA_OFFSET);
+            return;
+         }
+         else if (self->pass == 2)
+         {
+            struct assembler_program* program = self->program;
+            if (program->data_end == 0 || address < program->data_start) program->data_start = (uint16_t)address;
+            if ((uint32_t)address >= program->data_end) program->data_end = (uint32_t)(address + 1);
+            program->data[address] = value;
+         }
+
+         skip_spaces(self);
+         if (*self->pos != ',') break;
+         self->pos++;
+      }
+   }
+   else if (names_equal(name, ".ORG") || names_equal(name, ".BYTE"))
+   {
+      const bool org = names_equal(name, ".ORG");
+      self->undefined = false;
+      const int32_t value = parse_expression(self);
+      if (self->failed) return;
+
+      if (self->undefined)
+      {
+         error(self, "Undefined symbol in %s", name);
+      }
+      else if (!org && !self->data_segment)
+      {
+         error(self, ".BYTE is only allowed in the data segment");
+      }
+      else if (value < 0)
+      {
+         error(self, "Negative value in %s", name);
+      }
+      else if (!org && (int64_t)self->data_address + value + DATA_MEMORY_DATA_OFFSET > DATA_MEMORY_ADDRESS_WIDTH)
+      {
+         error(self, "Reservation of %d bytes at address %d outside data memory", value, self->data_address);
+      }
+      else if (!org)
+      {
+         self->data_address += value;
+      }
+      else if (self->data_segment)
+      {
+         self->data_address = value;
+      }
+      else
+      {
+         self->code_address = value;
+      }
+   }
+   else
+   {
+      error(self, "Unknown directive %s", name);
+   }
+   return;
+}
+
+/********************************************************************************
+* assemble_instruction: Assembles an instruction with specified mnemonic.
+*
+*                       - self: Reference to the parser.
+*                       - name: The mnemonic of the instruction.
+********************************************************************************/
+static void assemble_instruction(struct parser* self,
+                                 const char* name)
+{
+   const struct mnemonic* mnemonic = 0;
+
+   for (size_t i = 0; i < sizeof(mnemonics) / sizeof(mnemonics[0]); ++i)
+   {
+      if (names_equal(mnemonics[i].name, name))
+      {
+         mnemonic = &mnemonics[i];
+         break;
+      }
+   }
+
+   if (!mnemonic)
+   {
+      error(self, "Unknown instruction %s", name);
+      return;
+   }
+   else if (self->data_segment)
+   {
+      error(self, "Instruction %s in the data segment", mnemonic->name);
+      return;
+   }
+
+   self->undefined = false;
+   int32_t op1 = 0;
+   int32_t op2 = 0;
+
+   if (mnemonic->format == FORMAT_REG)
+   {
+      op1 = parse_register(self);
+   }
+   else if (mnemonic->format == FORMAT_REG_REG || mnemonic->format == FORMAT_REG_PAIR)
+   {
+      op1 = parse_register(self);
+      if (expect(self, ',')) op2 = parse_register(self);
+   }
+   else if (mnemonic->format == FORMAT_REG_BYTE)
+   {
+      op1 = parse_register(self);
+      if (expect(self, ',')) op2 = parse_byte(self);
+   }
+   else if (mnemonic->format == FORMAT_BYTE_REG)
+   {
+      op1 = parse_byte(self);
+      if (expect(self, ',')) op2 = parse_register(self);
+   }
+   else if (mnemonic->format == FORMAT_ADDRESS)
+   {
+      op1 = parse_expression(self);
+
+      if (!self->undefined && (op1 < 0 || op1 >= PROGRAM_MEMORY_ADDRESS_WIDTH))
+      {
+         error(self, "Address %d outside program memory", op1);
+      }
+   }
+
+   if (self->failed) return;
+
+   if (mnemonic->format == FORMAT_REG_PAIR)
+   {
+      if ((op1 & 1) || (op2 & 1))
+      {
+         error(self, "%s requires even registers", mnemonic->name);
+         return;
+      }
+
+      emit(self, MOV, (uint8_t)op1, (uint8_t)op2);
+      emit(self, MOV, (uint8_t)(op1 + 1), (uint8_t)(op2 + 1));
+   }
+   else if (mnemonic->format == FORMAT_ADDRESS)
+   {
+      emit(self, mnemonic->op_code, (uint8_t)op1, (uint8_t)(op1 >> 8)); /* Low byte first, see program_memory.h. */
+   }
+   else
+   {
+      emit(self, mnemonic->op_code, (uint8_t)op1, (uint8_t)op2);
+   }
+   return;
+}
+
+/********************************************************************************
+* emit: Writes an instruction to the current address of the code segment.
+*       Symbols must be defined in the second pass.
+*
+*       - self   : Reference to the parser.
+*       - op_code: OP code of the instruction.
+*       - op1    : First operand (destination).
+*       - op2    : Second operand (constant or read location).
+********************************************************************************/
+static void emit(struct parser* self,
+                 const uint8_t op_code,
+                 const uint8_t op1,
+                 const uint8_t op2)
+{
+   const int32_t address = self->code_address++;
+
+   if (address < 0 || address >= PROGRAM_MEMORY_ADDRESS_WIDTH)
+   {
+      error(self, "Address %d outside program memory", address);
+   }
+   else if (self->pass == 2)
+   {
+      if (self->undefined)
+      {
+         error(self, "Undefined symbol");
+      }
+      else if (self->used[address])
+      {
+         error(self, "Address %d is already used", address);
+      }
+      else
+      {
+         self->program->code[address] = ((uint32_t)op_code << 16) | ((uint32_t)op1 << 8) | op2;
+         self->used[address] = true;
+         if ((uint32_t)address >= self->program->code_size) self->program->code_size = (uint32_t)(address + 1);
+      }
+   }
+   return;
+}
+
+/********************************************************************************
+* define_symbol: Adds a symbol to the symbol table in the first pass. In the
+*                second pass, the symbol is updated, since constants may be
+*                defined by expressions containing labels.
+*
+*                - self : Reference to the parser.
+*                - name : The name of the symbol.
+*                - value: The value of the symbol.
+*                - type : The kind of symbol.
+********************************************************************************/
+static void define_symbol(struct parser* self,
+                          const char* name,
+                          const int32_t value,
+                          const enum assembler_symbol_type type)
+{
+   struct assembler_program* program = self->program;
+   struct assembler_symbol* symbol = (struct assembler_symbol*)assembler_symbol_find(program, name);
+
+   if (self->pass == 2)
+   {
+      if (symbol) symbol->value = value;
+      return;
+   }
+   else if (symbol)
+   {
+      error(self, "Symbol %s is already defined", name);
+      return;
+   }
+   else if (program->num_symbols >= ASSEMBLER_MAX_SYMBOLS)
+   {
+      error(self, "Too many symbols");
+      return;
+   }
+
+   symbol = &program->symbols[program->num_symbols++];
+   snprintf(symbol->name, ASSEMBLER_SYMBOL_SIZE, "%s", name);
+   symbol->value = value;
+   symbol->type = type;
+   return;
+}
+
+/********************************************************************************
+* lookup_symbol: Looks up the value of specified symbol. User defined symbols
+*                take precedence over the predefined ones. True is returned
+*                if the symbol exists.
+*
+*                - self : Reference to the parser.
+*                - name : The name of the symbol.
+*                - value: Reference to variable storing the value.
+********************************************************************************/
+static bool lookup_symbol(struct parser* self,
+                          const char* name,
+                          int32_t* value)
+{
+   const struct assembler_symbol* symbol = assembler_symbol_find(self->program, name);
+
+   if (symbol)
+   {
+      *value = symbol->value;
+      return true;
+   }
+
+   for (size_t i = 0; i < sizeof(predefined_symbols) / sizeof(predefined_symbols[0]); ++i)
+   {
+      if (names_equal(predefined_symbols[i].name, name))
+      {
+         *value = predefined_symbols[i].value;
+         return true;
+      }
+   }
+   return false;
+}
+
+/********************************************************************************
+* parse_expression: Parses and returns the value of an expression. Undefined
+*                   symbols are evaluated as 0 and reported by setting the
+*                   undefined flag of the parser.
+*
+*                   - self: Reference to the parser.
+********************************************************************************/
+static int32_t parse_expression(struct parser* self)
+{
+   return parse_binary(self, 0);
+}
+
+/********************************************************************************
+* parse_binary: Parses binary operators with precedence of specified level or
+*               higher, from lowest (|) to highest (* and /) as in C.
+*
+*               - self : Reference to the parser.
+*               - level: The lowest precedence level to parse.
+********************************************************************************/
+static int32_t parse_binary(struct parser* self,
+                            const int level)
+{
+   static const char* const operators[] = { "|", "^", "&", "<<>>", "+-", "*/" };
+   const int num_levels = (int)(sizeof(operators) / sizeof(operators[0]));
+
+   if (level >= num_levels) return parse_unary(self);
+   int32_t result = parse_binary(self, level + 1);
+
+   while (!self->failed)
+   {
+      skip_spaces(self);
+      const char c = *self->pos;
+      const bool shift = (c == '<' || c == '>') && self->pos[1] == c;
+
+      if (!c || !strchr(operators[level], c) || ((c == '<' || c == '>') && !shift))
+      {
+         return result;
+      }
+      else if (c == '&' && self->pos[1] == '&')
+      {
+         return result;
+      }
+
+      self->pos += shift ? 2 : 1;
+      const int32_t operand = parse_binary(self, level + 1);
+
+      if (c == '|') result |= operand;
+      else if (c == '^') result ^= operand;
+      else if (c == '&') result &= operand;
+      else if (c == '<') result = (int32_t)((uint32_t)result << (operand & 31));
+      else if (c == '>') result >>= (operand & 31);
+      else if (c == '+') result += operand;
+      else if (c == '-') result -= operand;
+      else if (c == '*') result *= operand;
+      else if (operand) result /= operand;
+      else if (!self->undefined) error(self, "Division by zero");
+   }
+   return result;
+}
+
+/********************************************************************************
+* parse_unary: Parses the unary operators -, ~ and !.
+*
+*              - self: Reference to the parser.
+********************************************************************************/
+static int32_t parse_unary(struct parser* self)
+{
+   skip_spaces(self);
+   const char c = *self->pos;
+
+   if (c == '-' || c == '~' || c == '!')
+   {
+      self->pos++;
+      const int32_t operand = parse_unary(self);
+      if (c == '-') return -operand;
+      else if (c == '~') return ~operand;
+      else return !operand;
+   }
+   return parse_primary(self);
+}
+
+/********************************************************************************
+* parse_primary: Parses a number, a symbol, an expression within parentheses
+*                or a call to low() or high().
+*
+*                - self: Reference to the parser.
+********************************************************************************/
+static int32_t parse_primary(struct parser* self)
+{
+   skip_spaces(self);
+   const char* start = self->pos;
+
+   if (*self->pos == '(')
+   {
+      self->pos++;
+      const int32_t result = parse_expression(self);
+      expect(self, ')');
+      return result;
+   }
+   else if (isdigit((unsigned char)*self->pos) || *self->pos == '$')
+   {
+      int base = 10;
+      char* end = 0;
+
+      if (*self->pos == '$')
+      {
+         base = 16;
+         self->pos++;
+      }
+      else if (self->pos[0] == '0' && (self->pos[1] == 'x' || self->pos[1] == 'X'))
+      {
+         base = 16;
+         self->pos += 2;
+      }
+      else if (self->pos[0] == '0' && (self->pos[1] == 'b' || self->pos[1] == 'B'))
+      {
+         base = 2;
+         self->pos += 2;
+      }
+
+      const long value = strtol(self->pos, &end, base);
+
+      if (end == self->pos || isalnum((unsigned char)*end) || *end == '_')
+      {
+         error(self, "Invalid number '%s'", start);
+         return 0;
+      }
+
+      self->pos = end;
+      return (int32_t)value;
+   }
+   else
+   {
+      char name[ASSEMBLER_SYMBOL_SIZE];
+      int32_t value = 0;
+
+      if (!parse_identifier(self, name)) return 0;
+      skip_spaces(self);
+
+      if (*self->pos == '(' && (names_equal(name, "low") || names_equal(name, "high")))
+      {
+         self->pos++;
+         value = parse_expression(self);
+         expect(self, ')');
+         return names_equal(name, "low") ? (value & 0xFF) : ((value >> 8) & 0xFF);
+      }
+      else if (!lookup_symbol(self, name, &value))
+      {
+         self->undefined = true;
+         if (self->pass == 2) error(self, "Undefined symbol %s", name);
+      }
+      return value;
+   }
+}
+
+/********************************************************************************
+* parse_register: Parses an expression that must evaluate to a CPU register.
+*
+*                 - self: Reference to the parser.
+********************************************************************************/
+static int32_t parse_register(struct parser* self)
+{
+   const int32_t value = parse_expression(self);
+
+   if (!self->failed && !self->undefined && (value < 0 || value >= CPU_REGISTER_ADDRESS_WIDTH))
+   {
+      error(self, "Invalid register %d", value);
+   }
+   return value;
+}
+
+/********************************************************************************
+* parse_byte: Parses an expression that must fit in 8 bits, either signed or
+*             unsigned. Negative values are stored as two's complement.
+*
+*             - self: Reference to the parser.
+********************************************************************************/
+static int32_t parse_byte(struct parser* self)
+{
+   const int32_t value = parse_expression(self);
+
+   if (!self->failed && !self->undefined && (value < -128 || value > 255))
+   {
+      error(self, "Value %d out of range", value);
+   }
+   return value & 0xFF;
+}
+
+/********************************************************************************
+* parse_identifier: Parses an identifier, which may start with a dot. False is
+*                   returned and an error is reported if no valid identifier
+*                   is found.
+*
+*                   - self: Reference to the parser.
+*                   - name: Reference to string storing the identifier.
+********************************************************************************/
+static bool parse_identifier(struct parser* self,
+                             char* name)
+{
+   size_t length = 0;
+   skip_spaces(self);
+
+   if (!isalpha((unsigned char)*self->pos) && *self->pos != '_' && *self->pos != '.')
+   {
+      error(self, "Expected identifier at '%s'", self->pos);
+      return false;
+   }
+
+   do
+   {
+      if (length + 1 >= ASSEMBLER_SYMBOL_SIZE)
+      {
+         error(self, "Identifier too long");
+         return false;
+      }
+      name[length++] = *self->pos++;
+   } while (isalnum((unsigned char)*self->pos) || *self->pos == '_');
+
+   name[length] = '\0';
+   return true;
+}
+
+/********************************************************************************
+* expect: Skips specified character, which must follow. False is returned
+*         and an error is reported otherwise.
+*
+*         - self: Reference to the parser.
+*         - c   : The expected character.
+********************************************************************************/
+static bool expect(struct parser* self,
+                   const char c)
+{
+   skip_spaces(self);
+
+   if (*self->pos != c)
+   {
+      if (!self->failed) error(self, "Expected '%c'", c);
+      return false;
+   }
+
+   self->pos++;
+   return true;
+}
+
+/********************************************************************************
+* at_end: Indicates if the rest of the line is empty.
+*
+*         - self: Reference to the parser.
+********************************************************************************/
+static bool at_end(struct parser* self)
+{
+   skip_spaces(self);
+   return *self->pos == '\0';
+}
+
+/********************************************************************************
+* skip_spaces: Skips whitespace, including carriage returns of CRLF files.
+*
+*              - self: Reference to the parser.
+********************************************************************************/
+static inline void skip_spaces(struct parser* self)
+{
+   while (*self->pos && isspace((unsigned char)*self->pos)) self->pos++;
+   return;
+}
+
+/********************************************************************************
+* error: Stores an error message prefixed by the current line number. Only
+*        the first error is stored.
+*
+*        - self  : Reference to the parser.
+*        - format: Format string of the message, followed by its arguments.
+********************************************************************************/
+static void error(struct parser* self,
+                  const char* format, ...)
+{
+   if (self->failed) return;
+   va_list args;
+   const int length = snprintf(self->program->error, ASSEMBLER_ERROR_SIZE, "Line %d: ", self->line_number);
+   va_start(args, format);
+   vsnprintf(self->program->error + length, ASSEMBLER_ERROR_SIZE - (size_t)length, format, args);
+   va_end(args);
+   self->failed = true;
+   return;
+}
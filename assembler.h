@@ -0,0 +1,137 @@
+/********************************************************************************
+* assembler.h: Contains function declarations and macro definitions for a
+*              two-pass text assembler, which translates AVR-style assembly
+*              programs into 24-bit machine code for the program memory.
+*
+*              Each line holds an optional label followed by an instruction or
+*              a directive. Comments start with a semicolon. Mnemonics,
+*              directives and symbols are case insensitive. Operands are
+*              expressions of numbers (decimal, 0x-prefixed hexadecimal or
+*              0b-prefixed binary), symbols and the C operators | ^ & << >>
+*              + - * / ~ together with parentheses and the functions low()
+*              and high(). All CPU registers, I/O registers, bit numbers and
+*              interrupt vectors defined in cpu.h are predefined as symbols.
+*
+*              Supported directives:
+*              - .EQU name = expression: Defines a constant.
+*              - .ORG expression       : Sets the address of the current segment.
+*              - .CSEG                 : Selects the code segment (program memory).
+*              - .DSEG                 : Selects the data segment (data memory).
+*              - .BYTE expression      : Reserves bytes in the data segment.
+*              - .DB expression, ...   : Initializes bytes in the data segment.
+*
+*              For compatibility with AVR sources, RJMP, RCALL and EOR are
+*              accepted as aliases for JMP, CALL and XOR, MOVW is expanded to
+*              two MOV instructions and Z, ZL and ZH refer to R30 and R31.
+********************************************************************************/
+#ifndef ASSEMBLER_H_
+#define ASSEMBLER_H_
+
+/* Include directives: */
+#include "cpu.h"
+#include "program_memory.h"
+#include "data_memory.h"
+
+/* Macro definitions: */
+#define ASSEMBLER_MAX_SYMBOLS        256   /* Max number of user defined symbols. */
+#define ASSEMBLER_SYMBOL_SIZE        32    /* Max length of symbol names (including '\0'). */
+#define ASSEMBLER_ERROR_SIZE         128   /* Capacity of the error message. */
+#define ASSEMBLER_DATA_SEGMENT_START 0x100 /* Default start address of the data segment. */
+
+/********************************************************************************
+* assembler_symbol_type: Enumeration for the kinds of user defined symbols.
+********************************************************************************/
+enum assembler_symbol_type
+{
+   ASSEMBLER_SYMBOL_CONSTANT,   /* Constant defined by the .EQU directive. */
+   ASSEMBLER_SYMBOL_CODE_LABEL, /* Label in the code segment (program memory address). */
+   ASSEMBLER_SYMBOL_DATA_LABEL  /* Label in the data segment (data memory address). */
+};
+
+/********************************************************************************
+* assembler_symbol: Entry in the symbol table of an assembled program.
+********************************************************************************/
+struct assembler_symbol
+{
+   char name[ASSEMBLER_SYMBOL_SIZE]; /* Name of the symbol. */
+   int32_t value;                    /* Value or address of the symbol. */
+   enum assembler_symbol_type type;  /* Kind of symbol. */
+};
+
+/********************************************************************************
+* assembler_program: Result of an assembly, holding the machine code and the
+*                    symbol table. If the assembly fails, the error message
+*                    contains the line number and the reason.
+********************************************************************************/
+struct assembler_program
+{
+   uint32_t code[PROGRAM_MEMORY_ADDRESS_WIDTH];              /* Assembled machine code. */
+   uint32_t code_size;                                       /* Highest used address + 1. */
+   struct assembler_symbol symbols[ASSEMBLER_MAX_SYMBOLS];   /* User defined symbols. */
+   uint16_t num_symbols;                                     /* Number of user defined symbols. */
+   uint8_t data[DATA_MEMORY_ADDRESS_WIDTH];                  /* Initial content of the data memory. */
+   uint16_t data_start;                                      /* First address with initial content. */
+   uint32_t data_end;                                        /* Last address with initial content + 1. */
+   char error[ASSEMBLER_ERROR_SIZE];                         /* Error message at failure. */
+};
+
+/********************************************************************************
+* assembler_assemble: Assembles specified null terminated source text into
+*                     referenced program. Success code 0 is returned on
+*                     success, otherwise error code 1 is returned and the
+*                     error message of the program is set.
+*
+*                     - self  : Reference to the program to store the result.
+*                     - source: The assembly source text.
+********************************************************************************/
+int assembler_assemble(struct assembler_program* self,
+                       const char* source);
+
+/********************************************************************************
+* assembler_assemble_file: Assembles the source file at specified path into
+*                          referenced program. Success code 0 is returned on
+*                          success, otherwise error code 1 is returned and the
+*                          error message of the program is set.
+*
+*                          - self: Reference to the program to store the result.
+*                          - path: Path to the assembly source file.
+********************************************************************************/
+int assembler_assemble_file(struct assembler_program* self,
+                            const char* path);
+
+/********************************************************************************
+* assembler_symbol_find: Returns the user defined symbol with specified name
+*                        (case insensitive) in referenced program. If no such
+*                        symbol exists, a null pointer is returned.
+*
+*                        - self: Reference to the assembled program.
+*                        - name: The name of the symbol.
+********************************************************************************/
+const struct assembler_symbol* assembler_symbol_find(const struct assembler_program* self,
+                                                     const char* name);
+
+/********************************************************************************
+* assembler_print_symbols: Prints the symbol table of referenced program.
+*
+*                          - self   : Reference to the assembled program.
+*                          - ostream: Reference to the output stream.
+********************************************************************************/
+void assembler_print_symbols(const struct assembler_program* self,
+                             FILE* ostream);
+
+/********************************************************************************
+* assembler_load_ctx: Loads referenced program into the program memory of
+*                     specified CPU context together with its initial data
+*                     memory content and its code labels,
+*                     which are used as subroutine names. Unless labeled,
+*                     the reset vector is named RESET_vect. The CPU context
+*                     is reset so that the new program is decoded and run
+*                     from the reset vector.
+*
+*                     - self   : Reference to the CPU context.
+*                     - program: Reference to the assembled program.
+********************************************************************************/
+void assembler_load_ctx(struct cpu_context* self,
+                        const struct assembler_program* program);
+
+#endif /* ASSEMBLER_H_ */
@@ -0,0 +1,436 @@
+/********************************************************************************
+* bench.c: Benchmark suite measuring the speed of the emulator on Linux. A set
+*          of guest workloads is run with each execution engine, i.e. the state
+*          machine (one state at a time), the interpreter (batch runs), the JIT
+*          compiler and the lockstep engine, which runs one instance of the
+*          workload per SIMD lane. Each combination is run a number of times
+*          after an unmeasured warm-up run and the median time is reported.
+*
+*          The result is printed as JSON to stdout, holding guest instructions
+*          per second, nanoseconds per instruction and a hash of the final
+*          machine state per combination (equal hashes for the interpreter and
+*          the JIT compiler show that the same work was done, and the lockstep
+*          engine reports the hash of its first lane and counts the instructions
+*          of all lanes) as well as the peak resident set size of the process.
+*          The number of instructions per workload can be scaled by passing a
+*          factor as the first argument, for instance "bench 0.1" for a quick
+*          run.
+********************************************************************************/
+#define _POSIX_C_SOURCE 200809L /* For clock_gettime. */
+
+/* Include directives: */
+#include <sys/resource.h> /* Included before cpu.h, which defines short macro names. */
+#include <time.h>
+
+#include "cpu_context.h"
+#include "control_unit.h"
+#include "data_memory.h"
+#include "assembler.h"
+#include "lockstep.h"
+
+/* Macro definitions: */
+#define BENCH_REPETITIONS 5  /* Number of measured runs per workload and engine. */
+#define BENCH_STEP_DIVISOR 8 /* The state machine runs 1/N of the instructions. */
+
+/********************************************************************************
+* bench_engine: Execution engines measured by the benchmark.
+********************************************************************************/
+enum bench_engine
+{
+   BENCH_ENGINE_STEP,        /* One state at a time via the state machine. */
+   BENCH_ENGINE_INTERPRETER, /* Batch runs via the interpreter. */
+   BENCH_ENGINE_JIT,         /* Batch runs via the JIT compiler. */
+   BENCH_ENGINE_LOCKSTEP,    /* Batch runs of one instance per lane via the lockstep engine. */
+   BENCH_NUM_ENGINES         /* Number of engines. */
+};
+
+/********************************************************************************
+* bench_workload: Guest program run by the benchmark.
+********************************************************************************/
+struct bench_workload
+{
+   const char* name;          /* Name of the workload. */
+   const char* source;        /* Assembly source (null = the built-in program). */
+   uint64_t num_instructions; /* Number of instructions per run at scale 1. */
+   uint64_t toggle_interval;  /* Instructions between toggles of PINB (0 = never). */
+};
+
+/* Static variables: */
+static const char* engine_names[BENCH_NUM_ENGINES] = { "step", "interpreter", "jit", "lockstep" };
+
+/********************************************************************************
+* alu_loop: Tight loop of arithmetic and logic instructions on registers.
+********************************************************************************/
+static const char* alu_loop =
+   "main:\n"
+   "   LDI R16, 0x00\n"
+   "   LDI R17, 0x01\n"
+   "   LDI R18, 0x55\n"
+   "alu_loop:\n"
+   "   ADD R16, R17\n"
+   "   XOR R16, R18\n"
+   "   SUBI R17, 0x03\n"
+   "   ANDI R16, 0x7F\n"
+   "   ORI R18, 0x01\n"
+   "   LSL R17\n"
+   "   INC R19\n"
+   "   CPI R19, 0x00\n"
+   "   BRNE alu_loop\n"
+   "   DEC R20\n"
+   "   JMP alu_loop\n";
+
+/********************************************************************************
+* ldst_loop: Loop reading and writing a buffer in data memory via pointer X,
+*            walking upwards, and pointer Y, walking downwards.
+********************************************************************************/
+static const char* ldst_loop =
+   ".DSEG\n"
+   ".ORG 0x100\n"
+   "buffer: .BYTE 256\n"
+   ".CSEG\n"
+   "main:\n"
+   "   LDI XL, low(buffer)\n"
+   "   LDI XH, high(buffer)\n"
+   "   LDI YL, low(buffer)\n"
+   "   LDI YH, high(buffer)\n"
+   "ldst_loop:\n"
+   "   LD R16, X\n"
+   "   INC R16\n"
+   "   ST X, R16\n"
+   "   INC XL\n"
+   "   LD R17, Y\n"
+   "   ADD R17, R16\n"
+   "   ST Y, R17\n"
+   "   DEC YL\n"
+   "   JMP ldst_loop\n";
+
+/********************************************************************************
+* call_ret: Recursion 32 calls deep, saving a register on the stack per call.
+********************************************************************************/
+static const char* call_ret =
+   "main:\n"
+   "   LDI R16, 32\n"
+   "   CALL recurse\n"
+   "   INC R17\n"
+   "   JMP main\n"
+   "recurse:\n"
+   "   DEC R16\n"
+   "   BREQ recurse_end\n"
+   "   PUSH R16\n"
+   "   CALL recurse\n"
+   "   POP R16\n"
+   "recurse_end:\n"
+   "   RET\n";
+
+/********************************************************************************
+* interrupt_storm: Idle loop interrupted by a pin change interrupt each time
+*                  PINB5 is toggled by the benchmark.
+********************************************************************************/
+static const char* interrupt_storm =
+   ".ORG RESET_vect\n"
+   "   JMP main\n"
+   ".ORG PCINT0_vect\n"
+   "   JMP ISR_PCINT0\n"
+   ".ORG 0x08\n"
+   "main:\n"
+   "   LDI R16, (1 << PCIE0)\n"
+   "   STS PCICR, R16\n"
+   "   LDI R16, (1 << PORTB5)\n"
+   "   STS PCMSK0, R16\n"
+   "   SEI\n"
+   "storm_loop:\n"
+   "   INC R17\n"
+   "   JMP storm_loop\n"
+   "ISR_PCINT0:\n"
+   "   IN R18, PINB\n"
+   "   INC R19\n"
+   "   RETI\n";
+
+/* Static functions: */
+static int load_workload(struct cpu_context* self,
+                         const struct bench_workload* workload);
+static double run_workload(struct cpu_context* self,
+                           const struct bench_workload* workload,
+                           const enum bench_engine engine,
+                           const uint64_t num_instructions);
+static double run_lockstep_workload(struct lockstep* lanes,
+                                    const struct bench_workload* workload,
+                                    const uint64_t num_instructions);
+static uint32_t state_hash(const struct cpu_context* self);
+static double now(void);
+static int compare_doubles(const void* a,
+                           const void* b);
+
+/********************************************************************************
+* main: Runs each workload with each engine and prints the result as JSON.
+*       Engines that aren't supported on this platform are left out.
+*
+*       - argc: Number of command line arguments.
+*       - argv: Command line arguments, optionally holding the scale factor.
+********************************************************************************/
+int main(const int argc,
+         const char** argv)
+{
+   const struct bench_workload workloads[] =
+   {
+      { "led_toggle",      0,               20000000, 5000 },
+      { "alu_loop",        alu_loop,        50000000, 0    },
+      { "ldst_loop",       ldst_loop,       50000000, 0    },
+      { "call_ret",        call_ret,        20000000, 0    },
+      { "interrupt_storm", interrupt_storm, 20000000, 16   },
+   };
+   const size_t num_workloads = sizeof(workloads) / sizeof(workloads[0]);
+   const double scale = argc > 1 ? atof(argv[1]) : 1.0;
+   bool first = true;
+
+   if (scale <= 0.0)
+   {
+      fprintf(stderr, "Usage: %s [scale]\n", argv[0]);
+      return 1;
+   }
+
+   printf("{\n");
+   printf("  \"repetitions\": %d,\n", BENCH_REPETITIONS);
+   printf("  \"scale\": %g,\n", scale);
+   printf("  \"benchmarks\": [");
+
+   for (size_t i = 0; i < num_workloads; ++i)
+   {
+      for (int engine = 0; engine < BENCH_NUM_ENGINES; ++engine)
+      {
+         struct cpu_context* cpu = cpu_context_new();
+         struct lockstep* lanes = 0;
+         double seconds[BENCH_REPETITIONS];
+         uint64_t num_instructions = (uint64_t)(workloads[i].num_instructions * scale);
+         uint32_t hash;
+
+         if (!cpu || load_workload(cpu, &workloads[i]))
+         {
+            cpu_context_delete(&cpu);
+            return 1;
+         }
+
+         if (engine == BENCH_ENGINE_JIT && control_unit_enable_jit_ctx(cpu, true))
+         {
+            cpu_context_delete(&cpu);
+            continue;
+         }
+
+         if (engine == BENCH_ENGINE_LOCKSTEP && !(lanes = lockstep_new(cpu, LOCKSTEP_LANES)))
+         {
+            cpu_context_delete(&cpu);
+            return 1;
+         }
+
+         if (engine == BENCH_ENGINE_STEP) num_instructions /= BENCH_STEP_DIVISOR;
+         if (num_instructions == 0) num_instructions = 1;
+
+         if (lanes) run_lockstep_workload(lanes, &workloads[i], num_instructions);
+         else       run_workload(cpu, &workloads[i], engine, num_instructions);
+
+         for (int j = 0; j < BENCH_REPETITIONS; ++j)
+         {
+            seconds[j] = lanes ? run_lockstep_workload(lanes, &workloads[i], num_instructions) :
+               run_workload(cpu, &workloads[i], engine, num_instructions);
+         }
+
+         if (lanes)
+         {
+            lockstep_save_lane(lanes, 0, cpu);
+            lockstep_delete(&lanes);
+            num_instructions *= LOCKSTEP_LANES;
+         }
+
+         hash = state_hash(cpu);
+
+         qsort(seconds, BENCH_REPETITIONS, sizeof(double), compare_doubles);
+         const double median = seconds[BENCH_REPETITIONS / 2];
+
+         printf("%s\n    {\"workload\": \"%s\", \"engine\": \"%s\", ", first ? "" : ",",
+                workloads[i].name, engine_names[engine]);
+         printf("\"instructions\": %llu, \"seconds\": %.6f, \"best_seconds\": %.6f, ",
+                (unsigned long long)num_instructions, median, seconds[0]);
+         printf("\"mips\": %.2f, \"ns_per_instruction\": %.3f, \"state_hash\": \"%08x\"}",
+                num_instructions / median / 1e6, median * 1e9 / num_instructions, hash);
+         fflush(stdout);
+         first = false;
+         cpu_context_delete(&cpu);
+      }
+   }
+
+   struct rusage usage;
+   getrusage(RUSAGE_SELF, &usage);
+   printf("\n  ],\n");
+   printf("  \"peak_rss_kb\": %ld\n", usage.ru_maxrss);
+   printf("}\n");
+   return 0;
+}
+
+/********************************************************************************
+* load_workload: Assembles the program of specified workload and loads it into
+*                specified CPU context, unless the built-in program is used.
+*                Success code 0 is returned on success, otherwise error code 1
+*                is returned if the program couldn't be assembled.
+*
+*                - self    : Reference to the CPU context.
+*                - workload: Reference to the workload.
+********************************************************************************/
+static int load_workload(struct cpu_context* self,
+                         const struct bench_workload* workload)
+{
+   static struct assembler_program program;
+   if (!workload->source) return 0;
+
+   if (assembler_assemble(&program, workload->source))
+   {
+      fprintf(stderr, "%s: %s\n", workload->name, program.error);
+      return 1;
+   }
+
+   assembler_load_ctx(self, &program);
+   return 0;
+}
+
+/********************************************************************************
+* run_workload: Resets specified CPU context and runs specified number of
+*               instructions with specified engine. If the workload toggles
+*               PINB, the run is split so that the pin is toggled at the
+*               interval of the workload. The elapsed time in seconds is
+*               returned.
+*
+*               - self            : Reference to the CPU context.
+*               - workload        : Reference to the workload.
+*               - engine          : The engine to run with.
+*               - num_instructions: Number of instructions to run.
+********************************************************************************/
+static double run_workload(struct cpu_context* self,
+                           const struct bench_workload* workload,
+                           const enum bench_engine engine,
+                           const uint64_t num_instructions)
+{
+   uint64_t executed = 0;
+   control_unit_reset_ctx(self);
+   const double start = now();
+
+   while (executed < num_instructions)
+   {
+      uint64_t count = num_instructions - executed;
+      if (workload->toggle_interval && workload->toggle_interval < count)
+      {
+         count = workload->toggle_interval;
+      }
+
+      if (engine == BENCH_ENGINE_STEP)
+      {
+         for (uint64_t i = 0; i < count * 3; ++i)
+         {
+            control_unit_run_next_state_ctx(self);
+         }
+      }
+      else
+      {
+         const struct control_unit_run_config config = { count, 0, 0, 0 };
+         control_unit_run_ctx(self, &config);
+      }
+
+      executed += count;
+
+      if (workload->toggle_interval)
+      {
+         const uint8_t pinb = data_memory_read_ctx(self, PINB);
+         data_memory_write_ctx(self, PINB, pinb ^ (1 << PORTB5));
+      }
+   }
+   return now() - start;
+}
+
+/********************************************************************************
+* run_lockstep_workload: Resets specified lanes and runs specified number of
+*                        instructions in each lane, toggling PINB of every
+*                        lane at the interval of the workload, see
+*                        run_workload. The elapsed time in seconds is
+*                        returned.
+*
+*                        - lanes           : Reference to the lanes.
+*                        - workload        : Reference to the workload.
+*                        - num_instructions: Number of instructions to run
+*                                            per lane.
+********************************************************************************/
+static double run_lockstep_workload(struct lockstep* lanes,
+                                    const struct bench_workload* workload,
+                                    const uint64_t num_instructions)
+{
+   uint64_t executed = 0;
+   lockstep_reset(lanes);
+   const double start = now();
+
+   while (executed < num_instructions)
+   {
+      uint64_t count = num_instructions - executed;
+      if (workload->toggle_interval && workload->toggle_interval < count)
+      {
+         count = workload->toggle_interval;
+      }
+
+      lockstep_run(lanes, count);
+      executed += count;
+
+      for (uint8_t lane = 0; workload->toggle_interval && lane < LOCKSTEP_LANES; ++lane)
+      {
+         const uint8_t pinb = lockstep_read(lanes, lane, PINB);
+         lockstep_write(lanes, lane, PINB, pinb ^ (1 << PORTB5));
+      }
+   }
+   return now() - start;
+}
+
+/********************************************************************************
+* state_hash: Returns a FNV-1a hash of the CPU registers, the program counter,
+*             the status register and the data memory of specified CPU
+*             context.
+*
+*             - self: Reference to the CPU context.
+********************************************************************************/
+static uint32_t state_hash(const struct cpu_context* self)
+{
+   uint32_t hash = 2166136261u;
+
+   for (size_t i = 0; i < CPU_REGISTER_ADDRESS_WIDTH; ++i)
+   {
+      hash = (hash ^ self->reg[i]) * 16777619u;
+   }
+
+   hash = (hash ^ self->pc) * 16777619u;
+   hash = (hash ^ self->sr) * 16777619u;
+
+   for (size_t i = 0; i < DATA_MEMORY_ADDRESS_WIDTH; ++i)
+   {
+      const uint8_t* page = i < DATA_MEMORY_IO_SIZE ? &self->data[i & ~0xFF] : self->data_pages[i >> 8];
+      hash = (hash ^ (page ? page[i & 0xFF] : 0x00)) * 16777619u;
+   }
+   return hash;
+}
+
+/********************************************************************************
+* now: Returns the current time of the monotonic clock in seconds.
+********************************************************************************/
+static double now(void)
+{
+   struct timespec time;
+   clock_gettime(CLOCK_MONOTONIC, &time);
+   return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/********************************************************************************
+* compare_doubles: Compares two doubles for sorting in ascending order.
+*
+*                  - a: Reference to the first double.
+*                  - b: Reference to the second double.
+********************************************************************************/
+static int compare_doubles(const void* a,
+                           const void* b)
+{
+   const double x = *(const double*)a;
+   const double y = *(const double*)b;
+   return (x > y) - (x < y);
+}
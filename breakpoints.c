@@ -0,0 +1,302 @@
+/********************************************************************************
+* breakpoints.c: Contains function definitions for breakpoints and data
+*                watchpoints. Watched pages of the data memory are remapped
+*                to watch handlers, which record the hit and forward the
+*                access to the page table kept in the breakpoints.
+********************************************************************************/
+#include "breakpoints.h"
+#include "control_unit.h"
+#include "cpu_context.h"
+
+#include <string.h>
+
+/* Static functions: */
+static struct breakpoints* arm(struct cpu_context* self);
+static void disarm_if_unused(struct cpu_context* self);
+static uint8_t watch_read(struct cpu_context* self,
+                          const uint16_t address);
+static int watch_write(struct cpu_context* self,
+                       const uint16_t address,
+                       const uint8_t value);
+static inline bool armed_bit(const uint64_t* bitmap,
+                             const uint16_t address);
+static inline bool update_bit(uint64_t* bitmap,
+                              const uint16_t address,
+                              const bool armed);
+static inline void record_hit(struct cpu_context* self,
+                              const uint16_t address,
+                              const uint8_t access);
+
+/********************************************************************************
+* breakpoints_set_ctx: Arms or disarms the breakpoint at specified program
+*                      address of specified CPU context. Success code 0 is
+*                      returned on success, otherwise error code 1 is returned
+*                      if memory can't be allocated.
+*
+*                      - self   : Reference to the CPU context.
+*                      - address: The program address.
+*                      - armed  : Indicates if the breakpoint is armed.
+********************************************************************************/
+int breakpoints_set_ctx(struct cpu_context* self,
+                        const uint16_t address,
+                        const bool armed)
+{
+   if (!armed && !self->breakpoints) return 0;
+   struct breakpoints* breakpoints = arm(self);
+   if (!breakpoints) return 1;
+
+   if (update_bit(breakpoints->pc, address, armed))
+   {
+      breakpoints->num_breakpoints += armed ? 1 : -1;
+   }
+
+   disarm_if_unused(self);
+   return 0;
+}
+
+/********************************************************************************
+* breakpoints_watch_ctx: Arms or disarms watchpoints on specified accesses of
+*                        specified data memory address of specified CPU
+*                        context. Success code 0 is returned on success,
+*                        otherwise error code 1 is returned if no access is
+*                        specified or if memory can't be allocated.
+*
+*                        - self   : Reference to the CPU context.
+*                        - address: The data memory address.
+*                        - access : The watched accesses, BREAKPOINTS_READ
+*                                   and/or BREAKPOINTS_WRITE.
+*                        - armed  : Indicates if the watchpoints are armed.
+********************************************************************************/
+int breakpoints_watch_ctx(struct cpu_context* self,
+                          const uint16_t address,
+                          const uint8_t access,
+                          const bool armed)
+{
+   if (!(access & (BREAKPOINTS_READ | BREAKPOINTS_WRITE))) return 1;
+   if (!armed && !self->breakpoints) return 0;
+   struct breakpoints* breakpoints = arm(self);
+   if (!breakpoints) return 1;
+
+   const bool watched = armed_bit(breakpoints->read, address) || armed_bit(breakpoints->write, address);
+   if (access & BREAKPOINTS_READ) update_bit(breakpoints->read, address, armed);
+   if (access & BREAKPOINTS_WRITE) update_bit(breakpoints->write, address, armed);
+   const bool now_watched = armed_bit(breakpoints->read, address) || armed_bit(breakpoints->write, address);
+
+   if (watched != now_watched)
+   {
+      const uint8_t page = address >> 8;
+      breakpoints->num_watchpoints += now_watched ? 1 : -1;
+      breakpoints->page_watchpoints[page] += now_watched ? 1 : -1;
+
+      if (breakpoints->page_watchpoints[page])
+      {
+         self->pages[page].memory = 0;
+         self->pages[page].read_handler = watch_read;
+         self->pages[page].write_handler = watch_write;
+      }
+      else
+      {
+         self->pages[page] = breakpoints->pages[page];
+      }
+   }
+
+   disarm_if_unused(self);
+   return 0;
+}
+
+/********************************************************************************
+* breakpoints_clear_ctx: Disarms all breakpoints and watchpoints of specified
+*                        CPU context.
+*
+*                        - self: Reference to the CPU context.
+********************************************************************************/
+void breakpoints_clear_ctx(struct cpu_context* self)
+{
+   if (!self->breakpoints) return;
+   memcpy(self->pages, self->breakpoints->pages, sizeof(self->pages));
+   free(self->breakpoints);
+   self->breakpoints = 0;
+   return;
+}
+
+/********************************************************************************
+* breakpoints_set: Arms or disarms the breakpoint at specified program address
+*                  of the default CPU context, see breakpoints_set_ctx.
+*
+*                  - address: The program address.
+*                  - armed  : Indicates if the breakpoint is armed.
+********************************************************************************/
+int breakpoints_set(const uint16_t address,
+                    const bool armed)
+{
+   return breakpoints_set_ctx(cpu_context_default(), address, armed);
+}
+
+/********************************************************************************
+* breakpoints_watch: Arms or disarms watchpoints on specified accesses of
+*                    specified data memory address of the default CPU context,
+*                    see breakpoints_watch_ctx.
+*
+*                    - address: The data memory address.
+*                    - access : The watched accesses, BREAKPOINTS_READ and/or
+*                               BREAKPOINTS_WRITE.
+*                    - armed  : Indicates if the watchpoints are armed.
+********************************************************************************/
+int breakpoints_watch(const uint16_t address,
+                      const uint8_t access,
+                      const bool armed)
+{
+   return breakpoints_watch_ctx(cpu_context_default(), address, access, armed);
+}
+
+/********************************************************************************
+* breakpoints_clear: Disarms all breakpoints and watchpoints of the default
+*                    CPU context.
+********************************************************************************/
+void breakpoints_clear(void)
+{
+   breakpoints_clear_ctx(cpu_context_default());
+   return;
+}
+
+/********************************************************************************
+* arm: Returns the breakpoints of specified CPU context, which are allocated
+*      along with a copy of the page table of the data memory if nothing is
+*      armed yet. A null pointer is returned if memory can't be allocated.
+*
+*      - self: Reference to the CPU context.
+********************************************************************************/
+static struct breakpoints* arm(struct cpu_context* self)
+{
+   if (self->breakpoints) return self->breakpoints;
+   struct breakpoints* breakpoints = (struct breakpoints*)calloc(1, sizeof(struct breakpoints));
+   if (!breakpoints) return 0;
+
+   if (!self->pages_initialized) data_memory_reset_ctx(self);
+   memcpy(breakpoints->pages, self->pages, sizeof(breakpoints->pages));
+   self->breakpoints = breakpoints;
+   return breakpoints;
+}
+
+/********************************************************************************
+* disarm_if_unused: Deletes the breakpoints of specified CPU context if none
+*                   is armed anymore, so that runs pay nothing for them.
+*
+*                   - self: Reference to the CPU context.
+********************************************************************************/
+static void disarm_if_unused(struct cpu_context* self)
+{
+   if (!self->breakpoints->num_breakpoints && !self->breakpoints->num_watchpoints)
+   {
+      breakpoints_clear_ctx(self);
+   }
+   return;
+}
+
+/********************************************************************************
+* watch_read: Read handler of watched pages. Records a hit if the address is
+*             watched for reads and reads the page as if it wasn't watched.
+*
+*             - self   : Reference to the CPU context.
+*             - address: Read location in data memory.
+********************************************************************************/
+static uint8_t watch_read(struct cpu_context* self,
+                          const uint16_t address)
+{
+   const struct data_memory_page* page = &self->breakpoints->pages[address >> 8];
+   if (armed_bit(self->breakpoints->read, address)) record_hit(self, address, BREAKPOINTS_READ);
+
+   if (page->memory)
+   {
+      return page->memory[address & 0xFF];
+   }
+   else if (page->read_handler)
+   {
+      return page->read_handler(self, address);
+   }
+   else
+   {
+      return 0x00;
+   }
+}
+
+/********************************************************************************
+* watch_write: Write handler of watched pages. Records a hit if the address is
+*              watched for writes and writes to the page as if it wasn't
+*              watched. Since RAM pages point into the data memory at their
+*              own addresses, they're written by the default I/O handler,
+*              which also marks the page as dirty.
+*
+*              - self   : Reference to the CPU context.
+*              - address: Write location in data memory.
+*              - value  : The 8-bit value to write.
+********************************************************************************/
+static int watch_write(struct cpu_context* self,
+                       const uint16_t address,
+                       const uint8_t value)
+{
+   const struct data_memory_page* page = &self->breakpoints->pages[address >> 8];
+   if (armed_bit(self->breakpoints->write, address)) record_hit(self, address, BREAKPOINTS_WRITE);
+
+   if (page->memory)
+   {
+      return data_memory_io_write_ctx(self, address, value);
+   }
+   else if (page->write_handler)
+   {
+      return page->write_handler(self, address, value);
+   }
+   else
+   {
+      return 1;
+   }
+}
+
+/********************************************************************************
+* armed_bit: Indicates if specified address is set in specified bitmap.
+*
+*            - bitmap : Reference to the bitmap.
+*            - address: The address to check.
+********************************************************************************/
+static inline bool armed_bit(const uint64_t* bitmap,
+                             const uint16_t address)
+{
+   return (bitmap[address / 64] >> (address % 64)) & 1;
+}
+
+/********************************************************************************
+* update_bit: Sets or clears specified address in specified bitmap. True is
+*             returned if the bit was changed.
+*
+*             - bitmap : Reference to the bitmap.
+*             - address: The address to update.
+*             - armed  : Indicates if the bit is set or cleared.
+********************************************************************************/
+static inline bool update_bit(uint64_t* bitmap,
+                              const uint16_t address,
+                              const bool armed)
+{
+   if (armed_bit(bitmap, address) == armed) return false;
+   bitmap[address / 64] ^= (uint64_t)1 << (address % 64);
+   return true;
+}
+
+/********************************************************************************
+* record_hit: Records a watchpoint hit on specified address of specified CPU
+*             context, so that the current batch run stops after the running
+*             instruction.
+*
+*             - self   : Reference to the CPU context.
+*             - address: The accessed address.
+*             - access : The access, BREAKPOINTS_READ or BREAKPOINTS_WRITE.
+********************************************************************************/
+static inline void record_hit(struct cpu_context* self,
+                              const uint16_t address,
+                              const uint8_t access)
+{
+   self->breakpoints->hit_address = address;
+   self->breakpoints->hit_access = access;
+   self->breakpoints->hit_pc = self->mar;
+   self->events |= CONTROL_UNIT_STOP_ON_WATCHPOINT;
+   return;
+}
@@ -0,0 +1,134 @@
+/********************************************************************************
+* breakpoints.h: Contains function declarations and macro definitions for
+*                breakpoints on program addresses and watchpoints on reads
+*                and writes of data memory addresses, including the I/O
+*                registers, for instance PORTB and PCIFR.
+*
+*                The armed addresses are stored as bitmaps over the program
+*                memory and the data memory, which are only allocated while
+*                anything is armed, so that a run without breakpoints pays
+*                nothing. Breakpoints are checked by batch runs along with the
+*                other stop conditions. Watchpoints are checked by watch
+*                handlers installed in the page table of the data memory for
+*                the pages holding watched addresses only, so accesses to
+*                other pages are made as usual.
+*
+*                A batch run stops when the program counter reaches an armed
+*                breakpoint, see CONTROL_UNIT_STOP_BREAKPOINT, or after the
+*                instruction accessing a watched address, including writes
+*                made by the hardware such as the pin change interrupt flags,
+*                see CONTROL_UNIT_STOP_WATCHPOINT. Reads made by the hardware
+*                don't trigger watchpoints, see data_memory_peek_ctx. While a
+*                watchpoint is armed, batch runs are interpreted instruction
+*                by instruction, also when JIT compilation is enabled.
+********************************************************************************/
+#ifndef BREAKPOINTS_H_
+#define BREAKPOINTS_H_
+
+/* Include directives: */
+#include "cpu.h"
+#include "data_memory.h"
+#include "program_memory.h"
+
+/* Macro definitions: */
+#define BREAKPOINTS_READ  (1 << 0) /* Watch reads of an address. */
+#define BREAKPOINTS_WRITE (1 << 1) /* Watch writes to an address. */
+
+#define BREAKPOINTS_PC_WORDS   (PROGRAM_MEMORY_ADDRESS_WIDTH / 64)          /* 64-bit words in the breakpoint bitmap. */
+#define BREAKPOINTS_DATA_WORDS ((DATA_MEMORY_ADDRESS_WIDTH + 63) / 64)     /* 64-bit words in each watchpoint bitmap. */
+
+/* Forward declarations: */
+struct cpu_context;
+
+/********************************************************************************
+* breakpoints: Armed breakpoints and watchpoints of a CPU context. Bit i % 64
+*              of word i / 64 of a bitmap is set if address i is armed. The
+*              page table of the data memory is kept here as it would be
+*              without the watch handlers, so that the handlers can forward
+*              each access to the page it was meant for.
+********************************************************************************/
+struct breakpoints
+{
+   uint64_t pc[BREAKPOINTS_PC_WORDS];                /* Program addresses with a breakpoint. */
+   uint64_t read[BREAKPOINTS_DATA_WORDS];            /* Data addresses watched for reads. */
+   uint64_t write[BREAKPOINTS_DATA_WORDS];           /* Data addresses watched for writes. */
+   uint16_t num_breakpoints;                         /* Number of armed breakpoints. */
+   uint32_t num_watchpoints;                         /* Number of watched data addresses. */
+   uint16_t page_watchpoints[DATA_MEMORY_NUM_PAGES]; /* Number of watched data addresses per page. */
+   struct data_memory_page pages[DATA_MEMORY_NUM_PAGES]; /* Page table without the watch handlers. */
+   uint16_t hit_address;                             /* Data address of the last watchpoint hit. */
+   uint8_t hit_access;                               /* Access of the last hit, BREAKPOINTS_READ or _WRITE. */
+   uint16_t hit_pc;                                  /* Address of the instruction running at the last hit. */
+};
+
+/********************************************************************************
+* breakpoints_set_ctx: Arms or disarms the breakpoint at specified program
+*                      address of specified CPU context. Success code 0 is
+*                      returned on success, otherwise error code 1 is returned
+*                      if memory can't be allocated.
+*
+*                      - self   : Reference to the CPU context.
+*                      - address: The program address.
+*                      - armed  : Indicates if the breakpoint is armed.
+********************************************************************************/
+int breakpoints_set_ctx(struct cpu_context* self,
+                        const uint16_t address,
+                        const bool armed);
+
+/********************************************************************************
+* breakpoints_watch_ctx: Arms or disarms watchpoints on specified accesses of
+*                        specified data memory address of specified CPU
+*                        context. Success code 0 is returned on success,
+*                        otherwise error code 1 is returned if no access is
+*                        specified or if memory can't be allocated.
+*
+*                        - self   : Reference to the CPU context.
+*                        - address: The data memory address.
+*                        - access : The watched accesses, BREAKPOINTS_READ
+*                                   and/or BREAKPOINTS_WRITE.
+*                        - armed  : Indicates if the watchpoints are armed.
+********************************************************************************/
+int breakpoints_watch_ctx(struct cpu_context* self,
+                          const uint16_t address,
+                          const uint8_t access,
+                          const bool armed);
+
+/********************************************************************************
+* breakpoints_clear_ctx: Disarms all breakpoints and watchpoints of specified
+*                        CPU context.
+*
+*                        - self: Reference to the CPU context.
+********************************************************************************/
+void breakpoints_clear_ctx(struct cpu_context* self);
+
+/********************************************************************************
+* breakpoints_set: Arms or disarms the breakpoint at specified program address
+*                  of the default CPU context, see breakpoints_set_ctx.
+*
+*                  - address: The program address.
+*                  - armed  : Indicates if the breakpoint is armed.
+********************************************************************************/
+int breakpoints_set(const uint16_t address,
+                    const bool armed);
+
+/********************************************************************************
+* breakpoints_watch: Arms or disarms watchpoints on specified accesses of
+*                    specified data memory address of the default CPU context,
+*                    see breakpoints_watch_ctx.
+*
+*                    - address: The data memory address.
+*                    - access : The watched accesses, BREAKPOINTS_READ and/or
+*                               BREAKPOINTS_WRITE.
+*                    - armed  : Indicates if the watchpoints are armed.
+********************************************************************************/
+int breakpoints_watch(const uint16_t address,
+                      const uint8_t access,
+                      const bool armed);
+
+/********************************************************************************
+* breakpoints_clear: Disarms all breakpoints and watchpoints of the default
+*                    CPU context.
+********************************************************************************/
+void breakpoints_clear(void);
+
+#endif /* BREAKPOINTS_H_ */
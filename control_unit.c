@@ -1,537 +1,1952 @@
-/********************************************************************************
-* control_unit.c: Contains static variables and function definitions for 
-*                 implementation of an 8-bit control unit.
-********************************************************************************/
-#include "control_unit.h"
-
-/* Static functions: */
-static void monitor_interrupts(void);
-static void check_for_irq(void);
-static void generate_interrupt(const uint8_t interrupt_vector);
-
-static inline void monitor_pcint0(void);
-static inline void monitor_pcint1(void);
-static inline void monitor_pcint2(void);
-
-/* Static variables: */
-static uint32_t ir; /* Instruction register, stores next instruction to execute. */
-static uint8_t pc;  /* Program counter, stores address to next instruction to fetch. */
-static uint8_t mar; /* Memory address register, stores address for current instruction. */
-static uint8_t sr;  /* Status register, stores status bits ISNZVC. */
-
-static uint8_t op_code; /* Stores OP-code, for example LDI, OUT, JMP etc. */
-static uint8_t op1;     /* Stores first operand, most often a destination. */
-static uint8_t op2;     /* Stores second operand, most often a value or read address. */
-
-static enum cpu_state state;                    /* Stores current state. */
-static uint8_t reg[CPU_REGISTER_ADDRESS_WIDTH]; /* CPU-registers R0 - R31. */
-
-static uint8_t pinb_previous; /* Stores previous input values of PINB (for monitoring). */
-static uint8_t pinc_previous; /* Stores previous input values of PINC (for monitoring). */
-static uint8_t pind_previous; /* Stores previous input values of PIND (for monitoring). */
-
-/********************************************************************************
-* control_unit_reset: Resets control unit registers and corresponding program.
-********************************************************************************/
-void control_unit_reset(void)
-{
-   ir = 0x00;
-   pc = 0x00;
-   mar = 0x00;
-   sr = 0x00;
-
-   op_code = 0x00;
-   op1 = 0x00;
-   op2 = 0x00;
-
-   state = CPU_STATE_FETCH;
-
-   pinb_previous = 0x00;
-   pinc_previous = 0x00;
-   pind_previous = 0x00;
-
-   for (uint8_t i = 0; i < CPU_REGISTER_ADDRESS_WIDTH; ++i)
-   {
-      reg[i] = 0x00;
-   }
-
-   
-   data_memory_reset();
-   stack_reset();
-   program_memory_write();
-   return;
-}
-
-/********************************************************************************
-* control_unit_run_next_state: Runs next state in the CPU instruction cycle:
-********************************************************************************/
-void control_unit_run_next_state(void)
-{
-   switch (state)
-   {
-      case CPU_STATE_FETCH:
-      {
-         ir = program_memory_read(pc); /* Fetches next instruction. */
-         mar = pc;                     /* Stores address of current instruction. */
-         pc++;                         /* Program counter points to next instruction. */
-         state = CPU_STATE_DECODE;     /* Decodes the instruction during next clock cycle. */
-         break;
-      }
-      case CPU_STATE_DECODE:
-      {        
-         op_code = ir >> 16;           /* Bit 23 downto 16 consists of the OP code. */
-         op1 = ir >> 8;                /* Bit 15 downto 8 consists of the first operand. */
-         op2 = ir;                     /* Bit 7 downto 0 consists of the second operand. */
-         state = CPU_STATE_EXECUTE;    /* Executes the instruction during next clock cycle. */
-         break;
-      }
-      case CPU_STATE_EXECUTE:
-      {
-         switch (op_code) /* Checks the OP code.*/
-         {
-            case NOP: /* NOP => do nothing. */
-            {
-               break; 
-            }
-            case LDI: /* Loads constant into specified CPU register. */
-            {
-               reg[op1] = op2; 
-               break;
-            }
-            case MOV: /* Copies value to specified CPU register. */
-            {
-               reg[op1] = reg[op2]; 
-               break;
-            }
-            case OUT: /* Writes value to I/O location (address 0 - 255) in data memory. */
-            {
-               data_memory_write(op1, reg[op2]); 
-               break;
-            }
-            case IN: /* Reads value from I/O location (address 0 - 255) in data memory. */
-            {
-               reg[op1] = data_memory_read(op2); 
-               break;
-            }
-            case STS: /* Stores value to data memory (address 256 - 511, hence an offset of 256). */
-            {
-               data_memory_write(op1 + 256, reg[op2]); 
-               break;
-            }
-            case LDS: /* Loads value from data memory (address 256 - 511, hence an offset of 256). */
-            {
-               reg[op1] = data_memory_read(op2 + 256); 
-               break;
-            }
-            case CLR: /* Clears content of CPU register. */
-            {
-               reg[op1] = 0x00; 
-               break;
-            }
-            case ORI: /* Performs bitwise OR with a constant. */
-            {
-               reg[op1] = alu(OR, reg[op1], op2, &sr);
-               break;
-            }
-            case ANDI: /* Performs bitwise AND with a constant. */
-            {
-               reg[op1] = alu(AND, reg[op1], op2, &sr);
-               break;
-            }
-            case XORI: /* Performs bitwise XOR with a constant. */
-            {
-               reg[op1] = alu(XOR, reg[op1], op2, &sr);
-               break;
-            }
-            case OR: /* Performs bitwise OR with content in CPU register. */
-            {
-               reg[op1] = alu(OR, reg[op1], reg[op2], &sr);
-               break;
-            }
-            case AND: /* Performs bitwise AND with content in CPU register. */
-            {
-               reg[op1] = alu(AND, reg[op1], reg[op2], &sr);
-               break;
-            }
-            case XOR: /* Performs bitwise AND with content in CPU register. */
-            {
-               reg[op1] = alu(XOR, reg[op1], reg[op2], &sr);
-               break;
-            }
-            case ADDI: /* Performs addition with a constant. */
-            {
-               reg[op1] = alu(ADD, reg[op1], op2, &sr);
-               break;
-            }
-            case SUBI: /* Performs subtraction with a constant. */
-            {
-               reg[op1] = alu(SUB, reg[op1], op2, &sr);
-               break;
-            }
-            case ADD: /* Performs addition with a CPU register. */
-            {
-               reg[op1] = alu(ADD, reg[op1], reg[op2], &sr);
-               break;
-            }
-            case SUB: /* Performs subtraction with a CPU register. */
-            {
-               reg[op1] = alu(SUB, reg[op1], reg[op2], &sr);
-               break;
-            }
-            case INC: /* Increments content of a CPU register. */
-            {
-               reg[op1] = alu(ADD, reg[op1], 1, &sr);
-               break;
-            }
-            case DEC: /* Decrements content of a CPU register. */
-            {
-               reg[op1] = alu(SUB, reg[op1], 1, &sr);
-               break;
-            }
-            case CPI: /* Compares content between CPU register with a constant. */
-            {
-               (void)alu(SUB, reg[op1], op2, &sr); /* Return value is not stored. */
-               break;
-            }
-            case CP: /* Compares content between two CPU registers. */
-            {
-               (void)alu(SUB, reg[op1], reg[op2], &sr); /* Return value is not stored. */
-               break;
-            }
-            case JMP: /* Jumps to specified address. */
-            {
-               pc = op1;
-               break;
-            }
-            case BREQ: /* Branches to specified address i Z flag is set. */
-            {
-               if (read(sr, Z)) pc = op1;
-               break;
-            }
-            case BRNE: /* Branches to specified address if Z flag is cleared. */
-            {
-               if (!read(sr, Z)) pc = op1;
-               break;
-            }
-            case BRGE: /* Branches to specified address if S flag is cleared. */
-            {
-               if (!read(sr, S)) pc = op1;
-               break;
-            }
-            case BRGT: /* Branches to specified address if both S and Z flags are cleared. */
-            {
-               if (!read(sr, S) && !read(sr, Z)) pc = op1;
-               break;
-            }
-            case BRLE: /* Branches to specified address if S or Z flag is set. */
-            {
-               if (read(sr, S) || read(sr, Z)) pc = op1;
-               break;
-            }
-            case BRLT: /* Branches to specified address if S flag is set. */
-            {
-               if (read(sr, S)) pc = op1;
-               break;
-            }
-            case CALL: /* Stores the return address on the stack and jumps to specified address. */
-            {
-               stack_push(pc);
-               pc = op1;
-               break;
-            }
-            case RET: /* Jumps to return address stored on the stack. */
-            {
-               pc = stack_pop();
-               break;
-            }
-            case RETI: /* Pops the return address from the stack and sets the global interrupt flag. */
-            {
-               pc = stack_pop();
-               set(sr, I);
-               break;
-            }
-            case PUSH: /* Stores content of specified CPU register on the stack. */
-            {
-               stack_push(reg[op1]);
-               break;
-            }
-            case POP: /* Loads value from the stack to a CPU-register. */
-            {
-               reg[op1] = stack_pop();
-               break;
-            }
-            case LSL: /* Shifts content of CPU register on step to the left. */
-            {
-               reg[op1] = reg[op1] << 1;
-               break;
-            }
-            case LSR: /* Shifts content of CPU register on step to the right. */
-            {
-               reg[op1] = reg[op1] >> 1;
-               break;
-            }
-            case SEI: /* Sets the global interrupt flag in the status register. */
-            {
-               set(sr, I);
-               break;
-            }
-            case CLI: /* Clears the global interrupt flag in the status register. */
-            {
-               clr(sr, I);
-               break;
-            }
-            case STIO:  /* Stores value to referenced I/O location (no offset). */
-            {
-               const uint16_t address = reg[op1] | (reg[op1 + 1] << 8);
-               data_memory_write(address, reg[op2]);
-               break;
-            }
-            case LDIO: /* Loads value from referenced I/O location (no offset). */
-            {
-               const uint16_t address = reg[op2] | (reg[op2 + 1] << 8);
-               reg[op1] = data_memory_read(address);
-               break;
-            }
-            case ST: /* Stores value to referenced data location (offset = 256). */
-            {
-               const uint16_t address = reg[op1] | (reg[op1 + 1] << 8);
-               data_memory_write(address + 256, reg[op2]);
-               break;
-            }
-            case LD: /* Loads value from referenced data location (offset = 256). */
-            {
-               const uint16_t address = reg[op2] | (reg[op2 + 1] << 8);
-               reg[op1] = data_memory_read(address + 256);
-               break;
-            }
-            default:
-            {
-               control_unit_reset(); /* System reset if error occurs. */
-               break;
-            }
-         }
-
-         state = CPU_STATE_FETCH;    /* Fetches next instruction during next clock cycle. */
-         check_for_irq();            /* Checks for interrupt request after each execute cycle. */
-         break;
-      }
-      default:                       /* System reset if error occurs. */
-      {
-         control_unit_reset();
-         break;
-      }
-   }
-
-   monitor_interrupts();            /* Monitors interrupts each clock cycle. */
-   return;
-}
-
-/********************************************************************************
-* control_unit_run_next_state: Runs next CPU instruction cycle, i.e. fetches
-*                              a new instruction from program memory, decodes
-*                              and executes it.
-********************************************************************************/
-void control_unit_run_next_instruction_cycle(void)
-{
-   do
-   {
-      control_unit_run_next_state();
-   } while (state != CPU_STATE_EXECUTE);
-   return;
-}
-
-/********************************************************************************
-* control_unit_print: Prints information about the processor, for instance
-*                     current subroutine, instruction, state, content in
-*                     CPU-registers and I/O registers DDRB, PORTB and PINB.
-********************************************************************************/
-void control_unit_print(void)
-{
-   printf("--------------------------------------------------------------------------------\n");
-   printf("Current subroutine:\t\t\t\t%s\n", program_memory_subroutine_name(mar));
-   printf("Current instruction:\t\t\t\t%s\n", cpu_instruction_name(op_code));
-   printf("Current state:\t\t\t\t\t%s\n", cpu_state_name(state));
-
-   printf("Program counter:\t\t\t\t%hu\n", pc);
-   printf("Stack pointer:\t\t\t\t\t%hu\n", stack_pointer());
-   printf("Last added value to the stack:\t\t\t%hu\n\n", stack_last_added_value());
-
-   printf("Instruction register:\t\t\t\t%s ", get_binary((ir >> 16) & 0xFF, 8));
-   printf("%s ", get_binary((ir >> 8) & 0xFF, 8));
-   printf("%s\n", get_binary(ir & 0xFF, 8));
-
-   printf("Status register (ISNZVC):\t\t\t%s\n\n", get_binary(sr, 6));
-
-   printf("Content in CPU register R16:\t\t\t%s\n", get_binary(reg[R16], 8));
-   printf("Content in CPU register R17:\t\t\t%s\n", get_binary(reg[R17], 8));
-   printf("Content in CPU register R18:\t\t\t%s\n", get_binary(reg[R18], 8));
-   printf("Content in CPU register R24:\t\t\t%s\n\n", get_binary(reg[R24], 8));
-
-   printf("Address in X register:\t\t\t\t%u\n", reg[XL] | (reg[XH] << 8));
-   printf("Address in Y register:\t\t\t\t%u\n\n", reg[YL] | (reg[YH] << 8));
-
-   printf("Content in data direction register DDRB:\t%s\n", get_binary(data_memory_read(DDRB), 8));
-   printf("Content in data register PORTB:\t\t\t%s\n", get_binary(data_memory_read(PORTB), 8));
-   printf("Content in pin input register PINB:\t\t%s\n\n", get_binary(data_memory_read(PINB), 8));
-
-   printf("Content in PCICR:\t\t\t\t%s\n", get_binary(data_memory_read(PCICR + 256), 8));
-   printf("Content in PCMSK0:\t\t\t\t%s\n", get_binary(data_memory_read(PCMSK0 + 256), 8));
-   printf("Content in PCIFR:\t\t\t\t%s\n", get_binary(data_memory_read(PCIFR + 256), 8));
-
-   printf("--------------------------------------------------------------------------------\n\n");
-   return;
-}
-
-/********************************************************************************
-* monitor_interrupts: Monitors all interrupt sources in the system.
-********************************************************************************/
-static void monitor_interrupts(void)
-{
-   monitor_pcint0();
-   monitor_pcint1();
-   monitor_pcint2();
-   return;
-}
-
-
-/********************************************************************************
-* check_for_irq: Checks for interrupt requests and generates an interrupt if
-*                the I flag in status register i set, a specific interrupt flag,
-*                such as PCIF0 in PCIFR, is set and the corresponding interrupt 
-*                enable bit, such as PCIE0 in PCICR, i set. Before an interrupt
-*                is generated, the corresponding flag bit is cleared to
-*                terminate the interrupt request. Otherwise the interrupt
-*                will be generated again and again). A jump is made to the
-*                corresponding interrupt vector, such as PCINT0_vect.
-********************************************************************************/
-static void check_for_irq(void)
-{
-   if (read(sr, I)) 
-   {
-      const uint8_t pcifr = data_memory_read(PCIFR + 256);
-      const uint8_t pcicr = data_memory_read(PCICR + 256);
-
-      if (read(pcifr, PCIF0) && read(pcicr, PCIE0))
-      {
-         data_memory_clear_bit(PCIFR + 256, PCIF0); 
-         generate_interrupt(PCINT0_vect);          
-      }
-      else if (read(pcifr, PCIF1) && read(pcicr, PCIE1))
-      {
-         data_memory_clear_bit(PCIFR + 256, PCIF1); 
-         generate_interrupt(PCINT1_vect);          
-      }
-      else if (read(pcifr, PCIF2) && read(pcicr, PCIE2))
-      {
-         data_memory_clear_bit(PCIFR + 256, PCIF2); 
-         generate_interrupt(PCINT2_vect);          
-      }
-   }
-   return;
-}
-
-/********************************************************************************
-* generate_interrupt: Generates and interrupt by jumping to specified interrupt
-*                     vector. Before the jump, the return address is stored
-*                     on the stack and the I-flag in the status register is
-*                     cleared so that no new interrupts are generated while
-*                     the current interrupt is executed.
-* 
-*                     - interrupt_vector: Jump address for generating interrupt.
-********************************************************************************/
-static void generate_interrupt(const uint8_t interrupt_vector)
-{
-   stack_push(pc);        
-   clr(sr, I);            
-   pc = interrupt_vector;
-   return;
-}
-
-/********************************************************************************
-* monitor_pcint0: Monitors pin change interrupts on I/O port B. All pins where
-*                 pin change monitoring is enabled (corresponding mask bit in
-*                 PCMSK0 i set) is monitored by comparing current input signal
-*                 with the previous one. If they don't match, the corresponding
-*                 interrupt flag PCIF0 in the PCIFR register i set to generate
-*                 an interrupt request (IRQ).
-********************************************************************************/
-static inline void monitor_pcint0(void)
-{
-   const uint8_t pinb_current = data_memory_read(PINB);
-   const uint8_t pcmsk0 = data_memory_read(PCMSK0 + 256);
-
-   for (uint8_t i = 0; i < DATA_MEMORY_DATA_WIDTH; ++i)
-   {
-      if (read(pcmsk0, i))
-      {
-         if (read(pinb_current, i) != read(pinb_previous, i))
-         {
-            data_memory_set_bit(PCIFR + 256, PCIF0);
-            break;
-         }
-      }
-   }
-
-   pinb_previous = pinb_current;
-   return;
-}
-
-/********************************************************************************
-* monitor_pcint1: Monitors pin change interrupts on I/O port C. All pins where
-*                 pin change monitoring is enabled (corresponding mask bit in
-*                 PCMSK1 i set) is monitored by comparing current input signal
-*                 with the previous one. If they don't match, the corresponding
-*                 interrupt flag PCIF1 in the PCIFR register i set to generate
-*                 an interrupt request (IRQ).
-********************************************************************************/
-static inline void monitor_pcint1(void)
-{
-   const uint8_t pinc_current = data_memory_read(PINC);
-   const uint8_t pcmsk1 = data_memory_read(PCMSK1 + 256);
-
-   for (uint8_t i = 0; i < DATA_MEMORY_DATA_WIDTH; ++i)
-   {
-      if (read(pcmsk1, i))
-      {
-         if (read(pinc_current, i) != read(pinc_previous, i))
-         {
-            data_memory_set_bit(PCIFR + 256, PCIF1);
-            break;
-         }
-      }
-   }
-
-   pinc_previous = pinc_current;
-   return;
-}
-
-/********************************************************************************
-* monitor_pcint2: Monitors pin change interrupts on I/O port d. All pins where
-*                 pin change monitoring is enabled (corresponding mask bit in
-*                 PCMSK2 i set) is monitored by comparing current input signal
-*                 with the previous one. If they don't match, the corresponding
-*                 interrupt flag PCIF2 in the PCIFR register i set to generate
-*                 an interrupt request (IRQ).
-********************************************************************************/
-static inline void monitor_pcint2(void)
-{
-   const uint8_t pind_current = data_memory_read(PIND);
-   const uint8_t pcmsk2 = data_memory_read(PCMSK2 + 256);
-
-   for (uint8_t i = 0; i < DATA_MEMORY_DATA_WIDTH; ++i)
-   {
-      if (read(pcmsk2, i))
-      {
-         if (read(pind_current, i) != read(pind_previous, i))
-         {
-            data_memory_set_bit(PCIFR + 256, PCIF2);
-            break;
-         }
-      }
-   }
-
-   pind_previous = pind_current;
-   return;
-}
-
-
+/********************************************************************************
+* control_unit.c: Contains function definitions for implementation of an
+*                 8-bit control unit. The state of the control unit is stored
+*                 in a CPU context, see cpu_context.h.
+********************************************************************************/
+#include "control_unit.h"
+
+#include <string.h>
+
+/* Static functions: */
+static inline void monitor_interrupts(struct cpu_context* self);
+static inline void check_for_irq(struct cpu_context* self);
+static void generate_interrupt(struct cpu_context* self,
+                               const uint8_t interrupt_vector);
+
+static inline void monitor_pcint0(struct cpu_context* self);
+static inline void monitor_pcint1(struct cpu_context* self);
+static inline void monitor_pcint2(struct cpu_context* self);
+
+static void decode_program(struct cpu_context* self);
+static bool operands_valid(const uint8_t op_code,
+                           const uint8_t op1,
+                           const uint8_t op2);
+static void find_idle_loops(struct cpu_context* self);
+static bool idle_loop_instruction(const uint8_t op_code);
+static void fuse_instructions(struct cpu_context* self);
+static inline void run_decoded_instruction(struct cpu_context* self);
+static inline bool fusion_allowed(struct cpu_context* self,
+                                  const struct decoded_instruction* first,
+                                  const uint16_t address,
+                                  const uint64_t num_instructions,
+                                  const struct control_unit_run_config* config);
+static inline void execute_fused(struct cpu_context* self,
+                                 const struct decoded_instruction* first);
+#if !CONTROL_UNIT_THREADED_DISPATCH
+static inline void run_fused_instruction(struct cpu_context* self);
+#endif
+static inline bool stop_address(const struct cpu_context* self,
+                                const struct control_unit_run_config* config,
+                                const uint16_t address);
+static inline bool stop_address_within(const struct cpu_context* self,
+                                       const struct control_unit_run_config* config,
+                                       const uint16_t first,
+                                       const uint8_t length);
+static inline enum control_unit_stop_reason check_stop_conditions(struct cpu_context* self,
+                                                                  const struct control_unit_run_config* config,
+                                                                  uint8_t* portb_previous);
+#if CONTROL_UNIT_THREADED_DISPATCH
+static uint64_t run_threaded_instructions(struct cpu_context* self,
+                                          uint64_t num_instructions,
+                                          const struct control_unit_run_config* config,
+                                          enum control_unit_stop_reason* stop_reason);
+#else
+static uint64_t run_decoded_instruction_loop(struct cpu_context* self,
+                                             uint64_t num_instructions,
+                                             const struct control_unit_run_config* config,
+                                             enum control_unit_stop_reason* stop_reason);
+#endif
+static inline bool irq_pending(struct cpu_context* self);
+static inline uint8_t calculate(struct cpu_context* self,
+                                const uint8_t operation,
+                                const uint8_t a,
+                                const uint8_t b);
+static inline void update_status_flags(struct cpu_context* self);
+static uint64_t run_idle_loop(struct cpu_context* self,
+                              const uint64_t num_instructions,
+                              const struct control_unit_run_config* config,
+                              uint8_t* portb_previous,
+                              enum control_unit_stop_reason* stop_reason);
+static uint64_t run_jit_instructions(struct cpu_context* self,
+                                     uint64_t num_instructions,
+                                     const struct control_unit_run_config* config,
+                                     enum control_unit_stop_reason* stop_reason);
+static uint64_t run_instructions(struct cpu_context* self,
+                                 uint64_t num_instructions,
+                                 const struct control_unit_run_config* config,
+                                 enum control_unit_stop_reason* stop_reason);
+static void execute_traced(struct cpu_context* self);
+static uint64_t run_traced_instructions(struct cpu_context* self,
+                                        uint64_t num_instructions,
+                                        const struct control_unit_run_config* config,
+                                        enum control_unit_stop_reason* stop_reason);
+
+/********************************************************************************
+* control_unit_reset_ctx: Resets control unit registers and corresponding
+*                         program of specified CPU context. The first reset
+*                         after the program or the initial data memory
+*                         content has been changed resets each part of the
+*                         system and decodes the program, after which the
+*                         state is saved as the power-on snapshot. Later
+*                         resets restore the power-on snapshot instead.
+*
+*                         - self: Reference to the CPU context.
+********************************************************************************/
+void control_unit_reset_ctx(struct cpu_context* self)
+{
+   if (self->power_on_valid && !cpu_snapshot_restore_ctx(self, self->power_on))
+   {
+      return;
+   }
+
+   self->ir = 0x00;
+   self->pc = self->entry_point;
+   self->mar = 0x00;
+   self->sr = 0x00;
+   self->flags.pending = false;
+
+   self->op_code = 0x00;
+   self->op1 = 0x00;
+   self->op2 = 0x00;
+
+   self->state = CPU_STATE_FETCH;
+
+   self->pinb_previous = 0x00;
+   self->pinc_previous = 0x00;
+   self->pind_previous = 0x00;
+
+   for (uint8_t i = 0; i < CPU_REGISTER_ADDRESS_WIDTH; ++i)
+   {
+      self->reg[i] = 0x00;
+   }
+
+   data_memory_reset_ctx(self);
+   stack_reset_ctx(self);
+   program_memory_write_ctx(self);
+   decode_program(self);
+   if (self->profiler) profiler_reset_stack(self->profiler);
+
+   if (!self->power_on) self->power_on = cpu_snapshot_new();
+
+   if (self->power_on)
+   {
+      self->power_on_valid = !cpu_snapshot_save_ctx(self, self->power_on);
+   }
+   return;
+}
+
+/********************************************************************************
+* control_unit_reset: Resets control unit registers and corresponding program
+*                     of the default CPU context.
+********************************************************************************/
+void control_unit_reset(void)
+{
+   control_unit_reset_ctx(cpu_context_default());
+   return;
+}
+
+/********************************************************************************
+* control_unit_run_next_state_ctx: Runs next state in the CPU instruction cycle
+*                                  of specified CPU context. The instruction is
+*                                  fetched from the program memory as usual,
+*                                  while the decoded operands and the handler
+*                                  used for execution are taken from the
+*                                  pre-decoded program.
+*
+*                                  - self: Reference to the CPU context.
+********************************************************************************/
+void control_unit_run_next_state_ctx(struct cpu_context* self)
+{
+   if (self->vcd) vcd_sample(self->vcd, self, 0); /* Records input changes made since the last clock cycle. */
+   perf_counters_count_states(&self->counters, 1);
+
+   switch (self->state)
+   {
+      case CPU_STATE_FETCH:
+      {
+         self->ir = program_memory_read_ctx(self, self->pc); /* Fetches next instruction. */
+         self->mar = self->pc;                               /* Stores address of current instruction. */
+         self->pc++;                                         /* Program counter points to next instruction. */
+         self->state = CPU_STATE_DECODE;                     /* Decodes the instruction during next clock cycle. */
+         break;
+      }
+      case CPU_STATE_DECODE:
+      {        
+         const struct decoded_instruction* instruction = &self->decoded_program[self->mar];
+         self->op_code = instruction->op_code; /* Bit 23 downto 16 consists of the OP code. */
+         self->op1 = instruction->op1;         /* Bit 15 downto 8 consists of the first operand. */
+         self->op2 = instruction->op2;         /* Bit 7 downto 0 consists of the second operand. */
+         self->state = CPU_STATE_EXECUTE;      /* Executes the instruction during next clock cycle. */
+         break;
+      }
+      case CPU_STATE_EXECUTE:
+      {
+         perf_counters_retire(&self->counters, self->op_code, 1);
+
+         if (self->trace)
+         {
+            execute_traced(self);
+         }
+         else
+         {
+            self->decoded_program[self->mar].execute(self, self->op1, self->op2); /* Executes the instruction. */
+         }
+         self->state = CPU_STATE_FETCH; /* Fetches next instruction during next clock cycle. */
+         check_for_irq(self);           /* Checks for interrupt request after each execute cycle. */
+         break;
+      }
+      default:                       /* System reset if error occurs. */
+      {
+         control_unit_reset_ctx(self);
+         break;
+      }
+   }
+
+   monitor_interrupts(self);         /* Monitors interrupts each clock cycle. */
+   update_status_flags(self);
+   if (self->profiler) profiler_run_cycles(self->profiler, self, 1);
+   if (self->vcd) vcd_sample(self->vcd, self, 1);
+   return;
+}
+
+/********************************************************************************
+* control_unit_run_next_state: Runs next state in the CPU instruction cycle of
+*                              the default CPU context.
+********************************************************************************/
+void control_unit_run_next_state(void)
+{
+   control_unit_run_next_state_ctx(cpu_context_default());
+   return;
+}
+
+/********************************************************************************
+* control_unit_run_next_instruction_cycle_ctx: Runs next CPU instruction cycle
+*                                              of specified CPU context, i.e.
+*                                              fetches a new instruction from
+*                                              program memory, decodes and
+*                                              executes it.
+*
+*                                              - self: Reference to the CPU context.
+********************************************************************************/
+void control_unit_run_next_instruction_cycle_ctx(struct cpu_context* self)
+{
+   do
+   {
+      control_unit_run_next_state_ctx(self);
+   } while (self->state != CPU_STATE_EXECUTE);
+   return;
+}
+
+/********************************************************************************
+* control_unit_run_next_state: Runs next CPU instruction cycle, i.e. fetches
+*                              a new instruction from program memory, decodes
+*                              and executes it.
+********************************************************************************/
+void control_unit_run_next_instruction_cycle(void)
+{
+   control_unit_run_next_instruction_cycle_ctx(cpu_context_default());
+   return;
+}
+
+/********************************************************************************
+* control_unit_run_decoded_instructions: Runs specified number of instructions
+*                                        straight from the pre-decoded program,
+*                                        i.e. without stepping through the
+*                                        fetch and decode states. If the CPU
+*                                        is in the middle of an instruction
+*                                        cycle, the current instruction is
+*                                        completed first and counted as one
+*                                        of the executed instructions.
+*
+*                                        - num_instructions: The number of
+*                                                            instructions to run.
+********************************************************************************/
+void control_unit_run_decoded_instructions(const uint32_t num_instructions)
+{
+   const struct control_unit_run_config config = { num_instructions, 0, 0, 0 };
+   (void)control_unit_run_ctx(cpu_context_default(), &config);
+   return;
+}
+
+/********************************************************************************
+* control_unit_run_ctx: Runs instructions of specified CPU context from the
+*                       pre-decoded program in a tight loop until the specified
+*                       number of instructions or clock cycles has been run, or
+*                       until one of the specified stop conditions occurs.
+*                       Nothing is printed, instead a result containing the
+*                       stop reason and the number of instructions and cycles
+*                       run is returned. If the CPU is in the middle of an
+*                       instruction cycle, the current instruction is completed
+*                       first. If the cycle limit ends in the middle of an
+*                       instruction, the remaining states are run one by one.
+*                       Idle loops are fast-forwarded to the end of the run,
+*                       see run_idle_loop, so a caller applying inputs at
+*                       specific cycles should end each run at the next input.
+*
+*                       - self  : Reference to the CPU context.
+*                       - config: Reference to the configuration of the run.
+********************************************************************************/
+struct control_unit_result control_unit_run_ctx(struct cpu_context* self,
+                                                const struct control_unit_run_config* config)
+{
+   struct control_unit_result result = { CONTROL_UNIT_STOP_LIMIT_REACHED, 0, 0 };
+   struct control_unit_run_config armed_config = *config;
+   const uint64_t max_instructions = config->max_instructions ? config->max_instructions : UINT64_MAX;
+   const uint64_t max_cycles = config->max_cycles ? config->max_cycles : UINT64_MAX;
+   if (!config->max_instructions && !config->max_cycles) return result;
+
+   /* Adds the stop conditions of the armed breakpoints and watchpoints, if any. */
+   armed_config.stop_conditions &= ~(CONTROL_UNIT_STOP_ON_BREAKPOINT | CONTROL_UNIT_STOP_ON_WATCHPOINT);
+
+   if (self->breakpoints)
+   {
+      if (self->breakpoints->num_breakpoints) armed_config.stop_conditions |= CONTROL_UNIT_STOP_ON_BREAKPOINT;
+      if (self->breakpoints->num_watchpoints) armed_config.stop_conditions |= CONTROL_UNIT_STOP_ON_WATCHPOINT;
+   }
+
+   config = &armed_config;
+   uint8_t portb_previous = data_memory_peek_ctx(self, PORTB);
+   self->events = 0;
+
+   /* Completes the current instruction cycle state by state if needed. */
+   while (self->state != CPU_STATE_FETCH)
+   {
+      if (result.num_cycles == max_cycles) return result;
+      control_unit_run_next_state_ctx(self);
+      result.num_cycles++;
+
+      if (self->state == CPU_STATE_FETCH)
+      {
+         result.num_instructions++;
+         result.stop_reason = check_stop_conditions(self, config, &portb_previous);
+         if (result.stop_reason != CONTROL_UNIT_STOP_LIMIT_REACHED) return result;
+      }
+   }
+
+   monitor_interrupts(self); /* Detects input changes made since the last clock cycle. */
+
+   /* Runs as many complete instructions as the limits allow. */
+   uint64_t num_instructions = max_instructions - result.num_instructions;
+   const uint64_t cycle_limit = (max_cycles - result.num_cycles) / 3;
+   if (cycle_limit < num_instructions) num_instructions = cycle_limit;
+
+   uint64_t executed = 0;
+
+   if (!self->profiler)
+   {
+      executed = run_instructions(self, num_instructions, config, &result.stop_reason);
+   }
+   else
+   {
+      /* Splits the run at the sample points, so the run loops are left as is. */
+      while (executed < num_instructions && result.stop_reason == CONTROL_UNIT_STOP_LIMIT_REACHED)
+      {
+         uint64_t chunk = profiler_instructions_until_sample(self->profiler);
+         if (chunk > num_instructions - executed) chunk = num_instructions - executed;
+         chunk = run_instructions(self, chunk, config, &result.stop_reason);
+         executed += chunk;
+         profiler_run_cycles(self->profiler, self, chunk * 3);
+      }
+   }
+   update_status_flags(self);
+   perf_counters_count_states(&self->counters, executed * 3);
+   result.num_instructions += executed;
+   result.num_cycles += executed * 3;
+   if (result.stop_reason != CONTROL_UNIT_STOP_LIMIT_REACHED) return result;
+
+   /* Runs the remaining clock cycles of an incomplete instruction, if any. */
+   while (result.num_cycles < max_cycles && result.num_instructions < max_instructions)
+   {
+      control_unit_run_next_state_ctx(self);
+      result.num_cycles++;
+   }
+   return result;
+}
+
+/********************************************************************************
+* control_unit_run: Runs instructions of the default CPU context in a tight
+*                   loop until the specified number of instructions or clock
+*                   cycles has been run, or until one of the specified stop
+*                   conditions occurs, see control_unit_run_ctx.
+*
+*                   - config: Reference to the configuration of the run.
+********************************************************************************/
+struct control_unit_result control_unit_run(const struct control_unit_run_config* config)
+{
+   return control_unit_run_ctx(cpu_context_default(), config);
+}
+
+/********************************************************************************
+* control_unit_enable_jit_ctx: Enables or disables JIT compilation of the
+*                              program of specified CPU context. While enabled,
+*                              batch runs execute compiled basic blocks where
+*                              possible and fall back to the interpreter
+*                              otherwise. The architectural state after each
+*                              run is the same as without JIT compilation.
+*                              Success code 0 is returned on success, otherwise
+*                              error code 1 is returned if JIT compilation
+*                              isn't supported on this platform or the
+*                              executable buffer couldn't be allocated.
+*
+*                              - self   : Reference to the CPU context.
+*                              - enabled: Indicates if JIT compilation is enabled.
+********************************************************************************/
+int control_unit_enable_jit_ctx(struct cpu_context* self,
+                                const bool enabled)
+{
+   if (!enabled)
+   {
+      jit_delete(&self->jit);
+      return 0;
+   }
+   if (!self->jit) self->jit = jit_new();
+   return self->jit ? 0 : 1;
+}
+
+/********************************************************************************
+* control_unit_enable_jit: Enables or disables JIT compilation of the program
+*                          of the default CPU context, see
+*                          control_unit_enable_jit_ctx.
+*
+*                          - enabled: Indicates if JIT compilation is enabled.
+********************************************************************************/
+int control_unit_enable_jit(const bool enabled)
+{
+   return control_unit_enable_jit_ctx(cpu_context_default(), enabled);
+}
+
+/********************************************************************************
+* control_unit_jit_enabled: Indicates if JIT compilation is enabled for the
+*                           default CPU context.
+********************************************************************************/
+bool control_unit_jit_enabled(void)
+{
+   return cpu_context_default()->jit != 0;
+}
+
+/********************************************************************************
+* control_unit_stop_reason_name: Returns the name of specified stop reason.
+*
+*                                - stop_reason: The specified stop reason.
+********************************************************************************/
+const char* control_unit_stop_reason_name(const enum control_unit_stop_reason stop_reason)
+{
+   if (stop_reason == CONTROL_UNIT_STOP_LIMIT_REACHED)        return "Limit reached";
+   else if (stop_reason == CONTROL_UNIT_STOP_PC_REACHED)      return "PC reached";
+   else if (stop_reason == CONTROL_UNIT_STOP_PORTB_CHANGED)   return "PORTB changed";
+   else if (stop_reason == CONTROL_UNIT_STOP_INTERRUPT)       return "Interrupt";
+   else if (stop_reason == CONTROL_UNIT_STOP_STACK_ERROR)     return "Stack error";
+   else if (stop_reason == CONTROL_UNIT_STOP_INVALID_OP_CODE) return "Invalid OP code";
+   else if (stop_reason == CONTROL_UNIT_STOP_BREAKPOINT)      return "Breakpoint";
+   else if (stop_reason == CONTROL_UNIT_STOP_WATCHPOINT)      return "Watchpoint";
+   else if (stop_reason == CONTROL_UNIT_STOP_MEMORY_ERROR)    return "Memory error";
+   else return "Unknown";
+}
+
+/********************************************************************************
+* control_unit_print_ctx: Prints information about the processor of specified
+*                         CPU context, for instance current subroutine,
+*                         instruction, state, content in CPU-registers and
+*                         I/O registers DDRB, PORTB and PINB.
+*
+*                         - self: Reference to the CPU context.
+********************************************************************************/
+void control_unit_print_ctx(struct cpu_context* self)
+{
+   update_status_flags(self);
+   printf("--------------------------------------------------------------------------------\n");
+   printf("Current subroutine:\t\t\t\t%s\n", program_memory_subroutine_name_ctx(self, self->mar));
+   printf("Current instruction:\t\t\t\t%s\n", cpu_instruction_name(self->op_code));
+   printf("Current state:\t\t\t\t\t%s\n", cpu_state_name(self->state));
+
+   printf("Program counter:\t\t\t\t%hu\n", self->pc);
+   printf("Stack pointer:\t\t\t\t\t%hu\n", stack_pointer_ctx(self));
+   printf("Last added value to the stack:\t\t\t%hu\n\n", stack_last_added_value_ctx(self));
+
+   printf("Instruction register:\t\t\t\t%s ", get_binary((self->ir >> 16) & 0xFF, 8));
+   printf("%s ", get_binary((self->ir >> 8) & 0xFF, 8));
+   printf("%s\n", get_binary(self->ir & 0xFF, 8));
+
+   printf("Status register (ISNZVC):\t\t\t%s\n\n", get_binary(self->sr, 6));
+
+   printf("Content in CPU register R16:\t\t\t%s\n", get_binary(self->reg[R16], 8));
+   printf("Content in CPU register R17:\t\t\t%s\n", get_binary(self->reg[R17], 8));
+   printf("Content in CPU register R18:\t\t\t%s\n", get_binary(self->reg[R18], 8));
+   printf("Content in CPU register R24:\t\t\t%s\n\n", get_binary(self->reg[R24], 8));
+
+   printf("Address in X register:\t\t\t\t%u\n", self->reg[XL] | (self->reg[XH] << 8));
+   printf("Address in Y register:\t\t\t\t%u\n\n", self->reg[YL] | (self->reg[YH] << 8));
+
+   printf("Content in data direction register DDRB:\t%s\n", get_binary(data_memory_peek_ctx(self, DDRB), 8));
+   printf("Content in data register PORTB:\t\t\t%s\n", get_binary(data_memory_peek_ctx(self, PORTB), 8));
+   printf("Content in pin input register PINB:\t\t%s\n\n", get_binary(data_memory_peek_ctx(self, PINB), 8));
+
+   printf("Content in PCICR:\t\t\t\t%s\n", get_binary(data_memory_peek_ctx(self, DATA_MEMORY_PCICR), 8));
+   printf("Content in PCMSK0:\t\t\t\t%s\n", get_binary(data_memory_peek_ctx(self, DATA_MEMORY_PCMSK0), 8));
+   printf("Content in PCIFR:\t\t\t\t%s\n", get_binary(data_memory_peek_ctx(self, DATA_MEMORY_PCIFR), 8));
+
+   printf("--------------------------------------------------------------------------------\n\n");
+   return;
+}
+
+/********************************************************************************
+* control_unit_print: Prints information about the processor, for instance
+*                     current subroutine, instruction, state, content in
+*                     CPU-registers and I/O registers DDRB, PORTB and PINB.
+********************************************************************************/
+void control_unit_print(void)
+{
+   control_unit_print_ctx(cpu_context_default());
+   return;
+}
+
+/********************************************************************************
+* monitor_interrupts: Monitors all interrupt sources in the system. Only ports
+*                     whose pin input register or pin change mask register
+*                     has been written since the last call are monitored,
+*                     since the input signals of the other ports are
+*                     unchanged.
+********************************************************************************/
+static inline void monitor_interrupts(struct cpu_context* self)
+{
+   if (!self->pcint_dirty) return;
+   if (read(self->pcint_dirty, PCIF0)) monitor_pcint0(self);
+   if (read(self->pcint_dirty, PCIF1)) monitor_pcint1(self);
+   if (read(self->pcint_dirty, PCIF2)) monitor_pcint2(self);
+   self->pcint_dirty = 0x00;
+   return;
+}
+
+
+/********************************************************************************
+* check_for_irq: Checks for interrupt requests and generates an interrupt if
+*                the I flag in status register i set, a specific interrupt flag,
+*                such as PCIF0 in PCIFR, is set and the corresponding interrupt 
+*                enable bit, such as PCIE0 in PCICR, i set. Before an interrupt
+*                is generated, the corresponding flag bit is cleared to
+*                terminate the interrupt request. Otherwise the interrupt
+*                will be generated again and again). A jump is made to the
+*                corresponding interrupt vector, such as PCINT0_vect.
+*                Nothing is done unless an enabled interrupt request exists.
+********************************************************************************/
+static inline void check_for_irq(struct cpu_context* self)
+{
+   if (self->irq_requests && read(self->sr, I)) 
+   {
+      const uint8_t pcifr = data_memory_peek_ctx(self, DATA_MEMORY_PCIFR);
+      const uint8_t pcicr = data_memory_peek_ctx(self, DATA_MEMORY_PCICR);
+
+      if (read(pcifr, PCIF0) && read(pcicr, PCIE0))
+      {
+         data_memory_clear_bit_ctx(self, DATA_MEMORY_PCIFR, PCIF0); 
+         generate_interrupt(self, PCINT0_vect);          
+      }
+      else if (read(pcifr, PCIF1) && read(pcicr, PCIE1))
+      {
+         data_memory_clear_bit_ctx(self, DATA_MEMORY_PCIFR, PCIF1); 
+         generate_interrupt(self, PCINT1_vect);          
+      }
+      else if (read(pcifr, PCIF2) && read(pcicr, PCIE2))
+      {
+         data_memory_clear_bit_ctx(self, DATA_MEMORY_PCIFR, PCIF2); 
+         generate_interrupt(self, PCINT2_vect);          
+      }
+   }
+   return;
+}
+
+/********************************************************************************
+* generate_interrupt: Generates and interrupt by jumping to specified interrupt
+*                     vector. Before the jump, the return address is stored
+*                     on the stack and the I-flag in the status register is
+*                     cleared so that no new interrupts are generated while
+*                     the current interrupt is executed.
+* 
+*                     - interrupt_vector: Jump address for generating interrupt.
+********************************************************************************/
+static void generate_interrupt(struct cpu_context* self,
+                               const uint8_t interrupt_vector)
+{
+   if (stack_push_address_ctx(self, self->pc)) self->events |= CONTROL_UNIT_STOP_ON_STACK_ERROR;
+   clr(self->sr, I);            
+   self->pc = interrupt_vector;
+
+   if (self->trace)
+   {
+      const struct trace_record record = { interrupt_vector, 0, self->mar, self->sr, 0, 0, 0, TRACE_RECORD_INTERRUPT };
+      trace_write(self->trace, &record);
+   }
+
+   if (self->profiler) profiler_call(self->profiler, self->mar, interrupt_vector);
+   perf_counters_count_interrupt(&self->counters, interrupt_vector);
+   self->events |= CONTROL_UNIT_STOP_ON_INTERRUPT;
+   return;
+}
+
+/********************************************************************************
+* monitor_pcint0: Monitors pin change interrupts on I/O port B. All pins where
+*                 pin change monitoring is enabled (corresponding mask bit in
+*                 PCMSK0 i set) is monitored by comparing current input signal
+*                 with the previous one. If they don't match, the corresponding
+*                 interrupt flag PCIF0 in the PCIFR register i set to generate
+*                 an interrupt request (IRQ).
+********************************************************************************/
+static inline void monitor_pcint0(struct cpu_context* self)
+{
+   const uint8_t pinb_current = data_memory_peek_ctx(self, PINB);
+   const uint8_t pcmsk0 = data_memory_peek_ctx(self, DATA_MEMORY_PCMSK0);
+
+   if ((pinb_current ^ self->pinb_previous) & pcmsk0)
+   {
+      data_memory_set_bit_ctx(self, DATA_MEMORY_PCIFR, PCIF0);
+   }
+
+   self->pinb_previous = pinb_current;
+   return;
+}
+
+/********************************************************************************
+* monitor_pcint1: Monitors pin change interrupts on I/O port C. All pins where
+*                 pin change monitoring is enabled (corresponding mask bit in
+*                 PCMSK1 i set) is monitored by comparing current input signal
+*                 with the previous one. If they don't match, the corresponding
+*                 interrupt flag PCIF1 in the PCIFR register i set to generate
+*                 an interrupt request (IRQ).
+********************************************************************************/
+static inline void monitor_pcint1(struct cpu_context* self)
+{
+   const uint8_t pinc_current = data_memory_peek_ctx(self, PINC);
+   const uint8_t pcmsk1 = data_memory_peek_ctx(self, DATA_MEMORY_PCMSK1);
+
+   if ((pinc_current ^ self->pinc_previous) & pcmsk1)
+   {
+      data_memory_set_bit_ctx(self, DATA_MEMORY_PCIFR, PCIF1);
+   }
+
+   self->pinc_previous = pinc_current;
+   return;
+}
+
+/********************************************************************************
+* monitor_pcint2: Monitors pin change interrupts on I/O port d. All pins where
+*                 pin change monitoring is enabled (corresponding mask bit in
+*                 PCMSK2 i set) is monitored by comparing current input signal
+*                 with the previous one. If they don't match, the corresponding
+*                 interrupt flag PCIF2 in the PCIFR register i set to generate
+*                 an interrupt request (IRQ).
+********************************************************************************/
+static inline void monitor_pcint2(struct cpu_context* self)
+{
+   const uint8_t pind_current = data_memory_peek_ctx(self, PIND);
+   const uint8_t pcmsk2 = data_memory_peek_ctx(self, DATA_MEMORY_PCMSK2);
+
+   if ((pind_current ^ self->pind_previous) & pcmsk2)
+   {
+      data_memory_set_bit_ctx(self, DATA_MEMORY_PCIFR, PCIF2);
+   }
+
+   self->pind_previous = pind_current;
+   return;
+}
+
+/********************************************************************************
+* Instruction handlers: Executes one instruction each with specified operands.
+*                       The handlers are stored in the pre-decoded program
+*                       and are called during the execute state.
+*
+*                       - self: Reference to the CPU context.
+*                       - op1 : First operand, most often a destination.
+*                       - op2 : Second operand, most often a value or read address.
+********************************************************************************/
+static void execute_nop(struct cpu_context* self, const uint8_t op1, const uint8_t op2)  /* NOP => do nothing. */
+{
+   return;
+}
+
+static void execute_ldi(struct cpu_context* self, const uint8_t op1, const uint8_t op2)  /* Loads constant into CPU register. */
+{
+   self->reg[op1] = op2;
+}
+
+static void execute_mov(struct cpu_context* self, const uint8_t op1, const uint8_t op2)  /* Copies value to CPU register. */
+{
+   self->reg[op1] = self->reg[op2];
+}
+
+static void execute_out(struct cpu_context* self, const uint8_t op1, const uint8_t op2)  /* Writes to I/O location (address 0 - 255). */
+{
+   perf_counters_count_write(&self->counters, op1);
+   data_memory_write_ctx(self, op1, self->reg[op2]);
+}
+
+static void execute_in(struct cpu_context* self, const uint8_t op1, const uint8_t op2)   /* Reads from I/O location (address 0 - 255). */
+{
+   perf_counters_count_read(&self->counters, op2);
+   self->reg[op1] = data_memory_read_ctx(self, op2);
+}
+
+static void execute_sts(struct cpu_context* self, const uint8_t op1, const uint8_t op2)  /* Stores to data memory (offset = 256). */
+{
+   perf_counters_count_write(&self->counters, op1 + DATA_MEMORY_DATA_OFFSET);
+   data_memory_write_ctx(self, op1 + DATA_MEMORY_DATA_OFFSET, self->reg[op2]);
+}
+
+static void execute_lds(struct cpu_context* self, const uint8_t op1, const uint8_t op2)  /* Loads from data memory (offset = 256). */
+{
+   perf_counters_count_read(&self->counters, op2 + DATA_MEMORY_DATA_OFFSET);
+   self->reg[op1] = data_memory_read_ctx(self, op2 + DATA_MEMORY_DATA_OFFSET);
+}
+
+static void execute_clr(struct cpu_context* self, const uint8_t op1, const uint8_t op2)  /* Clears content of CPU register. */
+{
+   self->reg[op1] = 0x00;
+}
+
+static void execute_ori(struct cpu_context* self, const uint8_t op1, const uint8_t op2)  /* Bitwise OR with a constant. */
+{
+   self->reg[op1] = calculate(self, OR, self->reg[op1], op2);
+}
+
+static void execute_andi(struct cpu_context* self, const uint8_t op1, const uint8_t op2) /* Bitwise AND with a constant. */
+{
+   self->reg[op1] = calculate(self, AND, self->reg[op1], op2);
+}
+
+static void execute_xori(struct cpu_context* self, const uint8_t op1, const uint8_t op2) /* Bitwise XOR with a constant. */
+{
+   self->reg[op1] = calculate(self, XOR, self->reg[op1], op2);
+}
+
+static void execute_or(struct cpu_context* self, const uint8_t op1, const uint8_t op2)   /* Bitwise OR with CPU register. */
+{
+   self->reg[op1] = calculate(self, OR, self->reg[op1], self->reg[op2]);
+}
+
+static void execute_and(struct cpu_context* self, const uint8_t op1, const uint8_t op2)  /* Bitwise AND with CPU register. */
+{
+   self->reg[op1] = calculate(self, AND, self->reg[op1], self->reg[op2]);
+}
+
+static void execute_xor(struct cpu_context* self, const uint8_t op1, const uint8_t op2)  /* Bitwise XOR with CPU register. */
+{
+   self->reg[op1] = calculate(self, XOR, self->reg[op1], self->reg[op2]);
+}
+
+static void execute_addi(struct cpu_context* self, const uint8_t op1, const uint8_t op2) /* Addition with a constant. */
+{
+   self->reg[op1] = calculate(self, ADD, self->reg[op1], op2);
+}
+
+static void execute_subi(struct cpu_context* self, const uint8_t op1, const uint8_t op2) /* Subtraction with a constant. */
+{
+   self->reg[op1] = calculate(self, SUB, self->reg[op1], op2);
+}
+
+static void execute_add(struct cpu_context* self, const uint8_t op1, const uint8_t op2)  /* Addition with CPU register. */
+{
+   self->reg[op1] = calculate(self, ADD, self->reg[op1], self->reg[op2]);
+}
+
+static void execute_sub(struct cpu_context* self, const uint8_t op1, const uint8_t op2)  /* Subtraction with CPU register. */
+{
+   self->reg[op1] = calculate(self, SUB, self->reg[op1], self->reg[op2]);
+}
+
+static void execute_inc(struct cpu_context* self, const uint8_t op1, const uint8_t op2)  /* Increments content of CPU register. */
+{
+   self->reg[op1] = calculate(self, ADD, self->reg[op1], 1);
+}
+
+static void execute_dec(struct cpu_context* self, const uint8_t op1, const uint8_t op2)  /* Decrements content of CPU register. */
+{
+   self->reg[op1] = calculate(self, SUB, self->reg[op1], 1);
+}
+
+static void execute_cpi(struct cpu_context* self, const uint8_t op1, const uint8_t op2)  /* Compares CPU register with a constant. */
+{
+   (void)calculate(self, SUB, self->reg[op1], op2); /* Return value is not stored. */
+}
+
+static void execute_cp(struct cpu_context* self, const uint8_t op1, const uint8_t op2)   /* Compares content between CPU registers. */
+{
+   (void)calculate(self, SUB, self->reg[op1], self->reg[op2]); /* Return value is not stored. */
+}
+
+static void execute_jmp(struct cpu_context* self, const uint8_t op1, const uint8_t op2)  /* Jumps to specified address. */
+{
+   self->pc = program_memory_jump_address(op1, op2);
+}
+
+static void execute_breq(struct cpu_context* self, const uint8_t op1, const uint8_t op2) /* Branches if Z flag is set. */
+{
+   update_status_flags(self);
+   if (read(self->sr, Z)) self->pc = program_memory_jump_address(op1, op2);
+}
+
+static void execute_brne(struct cpu_context* self, const uint8_t op1, const uint8_t op2) /* Branches if Z flag is cleared. */
+{
+   update_status_flags(self);
+   if (!read(self->sr, Z)) self->pc = program_memory_jump_address(op1, op2);
+}
+
+static void execute_brge(struct cpu_context* self, const uint8_t op1, const uint8_t op2) /* Branches if S flag is cleared. */
+{
+   update_status_flags(self);
+   if (!read(self->sr, S)) self->pc = program_memory_jump_address(op1, op2);
+}
+
+static void execute_brgt(struct cpu_context* self, const uint8_t op1, const uint8_t op2) /* Branches if S and Z flags are cleared. */
+{
+   update_status_flags(self);
+   if (!read(self->sr, S) && !read(self->sr, Z)) self->pc = program_memory_jump_address(op1, op2);
+}
+
+static void execute_brle(struct cpu_context* self, const uint8_t op1, const uint8_t op2) /* Branches if S or Z flag is set. */
+{
+   update_status_flags(self);
+   if (read(self->sr, S) || read(self->sr, Z)) self->pc = program_memory_jump_address(op1, op2);
+}
+
+static void execute_brlt(struct cpu_context* self, const uint8_t op1, const uint8_t op2) /* Branches if S flag is set. */
+{
+   update_status_flags(self);
+   if (read(self->sr, S)) self->pc = program_memory_jump_address(op1, op2);
+}
+
+static void execute_call(struct cpu_context* self, const uint8_t op1, const uint8_t op2) /* Stores return address and jumps. */
+{
+   const uint16_t address = program_memory_jump_address(op1, op2);
+   if (stack_push_address_ctx(self, self->pc)) self->events |= CONTROL_UNIT_STOP_ON_STACK_ERROR;
+   if (self->profiler) profiler_call(self->profiler, self->mar, address);
+   self->pc = address;
+}
+
+static void execute_ret(struct cpu_context* self, const uint8_t op1, const uint8_t op2)  /* Jumps to return address on the stack. */
+{
+   if (stack_pop_address_ctx(self, &self->pc)) self->events |= CONTROL_UNIT_STOP_ON_STACK_ERROR;
+   if (self->profiler) profiler_return(self->profiler);
+}
+
+static void execute_reti(struct cpu_context* self, const uint8_t op1, const uint8_t op2) /* Returns and sets the global interrupt flag. */
+{
+   if (stack_pop_address_ctx(self, &self->pc)) self->events |= CONTROL_UNIT_STOP_ON_STACK_ERROR;
+   set(self->sr, I);
+   if (self->profiler) profiler_return(self->profiler);
+}
+
+static void execute_push(struct cpu_context* self, const uint8_t op1, const uint8_t op2) /* Stores CPU register on the stack. */
+{
+   if (stack_push_ctx(self, self->reg[op1])) self->events |= CONTROL_UNIT_STOP_ON_STACK_ERROR;
+}
+
+static void execute_pop(struct cpu_context* self, const uint8_t op1, const uint8_t op2)  /* Loads value from the stack. */
+{
+   if (stack_is_empty_ctx(self)) self->events |= CONTROL_UNIT_STOP_ON_STACK_ERROR;
+   self->reg[op1] = stack_pop_ctx(self);
+}
+
+static void execute_lsl(struct cpu_context* self, const uint8_t op1, const uint8_t op2)  /* Shifts CPU register one step left. */
+{
+   self->reg[op1] = self->reg[op1] << 1;
+}
+
+static void execute_lsr(struct cpu_context* self, const uint8_t op1, const uint8_t op2)  /* Shifts CPU register one step right. */
+{
+   self->reg[op1] = self->reg[op1] >> 1;
+}
+
+static void execute_sei(struct cpu_context* self, const uint8_t op1, const uint8_t op2)  /* Sets the global interrupt flag. */
+{
+   set(self->sr, I);
+}
+
+static void execute_cli(struct cpu_context* self, const uint8_t op1, const uint8_t op2)  /* Clears the global interrupt flag. */
+{
+   clr(self->sr, I);
+}
+
+static void execute_stio(struct cpu_context* self, const uint8_t op1, const uint8_t op2) /* Stores to referenced I/O location. */
+{
+   const uint16_t address = self->reg[op1] | (self->reg[op1 + 1] << 8);
+   perf_counters_count_write(&self->counters, address);
+   data_memory_write_ctx(self, address, self->reg[op2]);
+}
+
+static void execute_ldio(struct cpu_context* self, const uint8_t op1, const uint8_t op2) /* Loads from referenced I/O location. */
+{
+   const uint16_t address = self->reg[op2] | (self->reg[op2 + 1] << 8);
+   perf_counters_count_read(&self->counters, address);
+   self->reg[op1] = data_memory_read_ctx(self, address);
+}
+
+static void execute_st(struct cpu_context* self, const uint8_t op1, const uint8_t op2)   /* Stores to referenced data location (offset = 256). */
+{
+   const uint32_t address = (self->reg[op1] | (self->reg[op1 + 1] << 8)) + DATA_MEMORY_DATA_OFFSET;
+
+   if (address >= DATA_MEMORY_ADDRESS_WIDTH)
+   {
+      self->events |= CONTROL_UNIT_STOP_ON_MEMORY_ERROR; /* Beyond the address space, nothing is stored. */
+      return;
+   }
+
+   perf_counters_count_write(&self->counters, (uint16_t)address);
+   data_memory_write_ctx(self, (uint16_t)address, self->reg[op2]);
+}
+
+static void execute_ld(struct cpu_context* self, const uint8_t op1, const uint8_t op2)   /* Loads from referenced data location (offset = 256). */
+{
+   const uint32_t address = (self->reg[op2] | (self->reg[op2 + 1] << 8)) + DATA_MEMORY_DATA_OFFSET;
+
+   if (address >= DATA_MEMORY_ADDRESS_WIDTH)
+   {
+      self->events |= CONTROL_UNIT_STOP_ON_MEMORY_ERROR; /* Beyond the address space, 0x00 is loaded. */
+      self->reg[op1] = 0x00;
+      return;
+   }
+
+   perf_counters_count_read(&self->counters, (uint16_t)address);
+   self->reg[op1] = data_memory_read_ctx(self, (uint16_t)address);
+}
+
+static void execute_invalid(struct cpu_context* self, const uint8_t op1, const uint8_t op2) /* System reset if error occurs. */
+{
+   control_unit_reset_ctx(self);
+   self->events |= CONTROL_UNIT_STOP_ON_INVALID_OP_CODE;
+}
+
+/********************************************************************************
+* decode_program: Decodes the entire program memory into the pre-decoded
+*                 program. Each instruction is split into OP code and operands
+*                 and given the handler used to execute it. Instructions with
+*                 unknown OP codes or invalid operands are given a handler that
+*                 resets the system, just as if the error had been detected
+*                 during the execute state.
+********************************************************************************/
+static void decode_program(struct cpu_context* self)
+{
+   static void (*const handlers[])(struct cpu_context*, const uint8_t, const uint8_t) =
+   {
+      execute_nop,  execute_ldi,  execute_mov,  execute_out,
+      execute_in,   execute_sts,  execute_lds,  execute_clr,
+      execute_ori,  execute_andi, execute_xori, execute_or,
+      execute_and,  execute_xor,  execute_addi, execute_subi,
+      execute_add,  execute_sub,  execute_inc,  execute_dec,
+      execute_cpi,  execute_cp,   execute_jmp,  execute_breq,
+      execute_brne, execute_brge, execute_brgt, execute_brle,
+      execute_brlt, execute_call, execute_ret,  execute_reti,
+      execute_push, execute_pop,  execute_lsl,  execute_lsr,
+      execute_sei,  execute_cli,  execute_stio, execute_ldio,
+      execute_st,   execute_ld
+   };
+
+   for (uint32_t i = 0; i < PROGRAM_MEMORY_ADDRESS_WIDTH; ++i)
+   {
+      struct decoded_instruction* instruction = &self->decoded_program[i];
+      instruction->ir = program_memory_read_ctx(self, (uint16_t)i);
+      instruction->op_code = instruction->ir >> 16;
+      instruction->op1 = instruction->ir >> 8;
+      instruction->op2 = instruction->ir;
+
+      instruction->valid = instruction->op_code <= LD && 
+         operands_valid(instruction->op_code, instruction->op1, instruction->op2);
+
+      if (instruction->valid)
+      {
+         instruction->execute = handlers[instruction->op_code];
+      }
+      else
+      {
+         instruction->execute = execute_invalid;
+      }
+   }
+
+   find_idle_loops(self);
+   fuse_instructions(self);
+   self->threaded_program_valid = false;
+   if (self->jit) jit_flush(self->jit);
+   return;
+}
+
+/********************************************************************************
+* operands_valid: Indicates if the operands of specified instruction are valid,
+*                 i.e. that all operands used as CPU registers refer to one of
+*                 the registers R0 - R31. For pointer operands, the high
+*                 register (for instance XH for X) must be valid too.
+*
+*                 - op_code: OP code of the instruction.
+*                 - op1    : First operand of the instruction.
+*                 - op2    : Second operand of the instruction.
+********************************************************************************/
+static bool operands_valid(const uint8_t op_code,
+                           const uint8_t op1,
+                           const uint8_t op2)
+{
+   switch (op_code)
+   {
+      case LDI: case IN: case LDS: case CLR: case ORI: case ANDI: case XORI:
+      case ADDI: case SUBI: case INC: case DEC: case CPI: case PUSH: case POP:
+      case LSL: case LSR:
+      {
+         return op1 < CPU_REGISTER_ADDRESS_WIDTH;
+      }
+      case MOV: case OR: case AND: case XOR: case ADD: case SUB: case CP:
+      {
+         return op1 < CPU_REGISTER_ADDRESS_WIDTH && op2 < CPU_REGISTER_ADDRESS_WIDTH;
+      }
+      case OUT: case STS:
+      {
+         return op2 < CPU_REGISTER_ADDRESS_WIDTH;
+      }
+      case STIO: case ST:
+      {
+         return op1 < CPU_REGISTER_ADDRESS_WIDTH - 1 && op2 < CPU_REGISTER_ADDRESS_WIDTH;
+      }
+      case LDIO: case LD:
+      {
+         return op1 < CPU_REGISTER_ADDRESS_WIDTH && op2 < CPU_REGISTER_ADDRESS_WIDTH - 1;
+      }
+      default:
+      {
+         return true;
+      }
+   }
+}
+
+/********************************************************************************
+* find_idle_loops: Finds the idle loops of the pre-decoded program and stores
+*                  the length of each loop at its first instruction. An idle
+*                  loop is at most CONTROL_UNIT_MAX_IDLE_LOOP instructions
+*                  long and ends with a jump or branch back to its first
+*                  instruction. It may only contain instructions giving the
+*                  same result when repeated with the same inputs, see
+*                  idle_loop_instruction, for instance a loop polling PINB
+*                  or main_loop in the built-in program. Whether the loop
+*                  actually leaves the state unchanged is checked when it's
+*                  run, see run_idle_loop.
+********************************************************************************/
+static void find_idle_loops(struct cpu_context* self)
+{
+   for (uint32_t start = 0; start < PROGRAM_MEMORY_ADDRESS_WIDTH; ++start)
+   {
+      uint8_t length = 0;
+
+      for (uint32_t i = start; i < PROGRAM_MEMORY_ADDRESS_WIDTH && i - start < CONTROL_UNIT_MAX_IDLE_LOOP; ++i)
+      {
+         const struct decoded_instruction* instruction = &self->decoded_program[i];
+         if (!instruction->valid || !idle_loop_instruction(instruction->op_code)) break;
+
+         if ((instruction->op_code == JMP || (instruction->op_code >= BREQ && instruction->op_code <= BRLT)) &&
+             program_memory_jump_address(instruction->op1, instruction->op2) == start)
+         {
+            length = (uint8_t)(i - start + 1);
+         }
+         if (instruction->op_code == JMP) break;
+      }
+      self->decoded_program[start].idle_length = CONTROL_UNIT_IDLE_LOOP_SKIP ? length : 0;
+   }
+   return;
+}
+
+/********************************************************************************
+* idle_loop_instruction: Indicates if instructions with specified OP code may
+*                        be part of an idle loop, i.e. if they don't write to
+*                        memory, the stack or the I flag and give the same
+*                        result each time they're repeated with unchanged
+*                        registers and inputs. Jumps and branches are allowed,
+*                        since the branch taken only depends on the flags.
+*
+*                        - op_code: OP code of the instruction.
+********************************************************************************/
+static bool idle_loop_instruction(const uint8_t op_code)
+{
+   switch (op_code)
+   {
+      case NOP: case LDI: case MOV: case IN: case LDS: case CLR: case ORI:
+      case ANDI: case OR: case AND: case CPI: case CP: case JMP: case BREQ:
+      case BRNE: case BRGE: case BRGT: case BRLE: case BRLT:
+      {
+         return true;
+      }
+      default:
+      {
+         return false;
+      }
+   }
+}
+
+/********************************************************************************
+* fuse_instructions: Marks the start of each instruction sequence of the
+*                    pre-decoded program which is run as a superinstruction
+*                    by the interpreter, see control_unit_fusion. Only the
+*                    first instruction is marked, so a jump or a return from
+*                    an interrupt to the middle of a sequence runs the rest
+*                    of it instruction by instruction. A branch closing an
+*                    idle loop isn't fused, since the loop is detected when
+*                    the branch is dispatched, see run_idle_loop.
+********************************************************************************/
+static void fuse_instructions(struct cpu_context* self)
+{
+   for (uint32_t i = 0; i < PROGRAM_MEMORY_ADDRESS_WIDTH; ++i)
+   {
+      struct decoded_instruction* first = &self->decoded_program[i];
+      first->fusion = CONTROL_UNIT_FUSION_NONE;
+      first->fused_length = 0;
+
+      if (!CONTROL_UNIT_FUSION || i + 1 >= PROGRAM_MEMORY_ADDRESS_WIDTH || !first->valid || !first[1].valid) continue;
+      const struct decoded_instruction* second = &first[1];
+
+      if (first->op_code == IN && i + 2 < PROGRAM_MEMORY_ADDRESS_WIDTH && first[2].valid &&
+          (second->op_code == ANDI || second->op_code == ORI) && second->op1 == first->op1 &&
+          first[2].op_code == OUT && first[2].op1 == first->op2 && first[2].op2 == first->op1)
+      {
+         first->fusion = CONTROL_UNIT_FUSION_IO_UPDATE;
+         first->fused_length = 3;
+      }
+      else if (first->op_code == CPI && second->op_code >= BREQ && second->op_code <= BRLT)
+      {
+         const uint16_t address = program_memory_jump_address(second->op1, second->op2);
+         const struct decoded_instruction* target = &self->decoded_program[address];
+         if (target->idle_length && (uint32_t)address + target->idle_length - 1 == i + 1) continue;
+         first->fusion = CONTROL_UNIT_FUSION_COMPARE_BRANCH;
+         first->fused_length = 2;
+      }
+      else if (first->op_code == LDI && second->op_code == LDI &&
+               (first->op1 == XL || first->op1 == YL) && second->op1 == first->op1 + 1)
+      {
+         first->fusion = CONTROL_UNIT_FUSION_LOAD_POINTER;
+         first->fused_length = 2;
+      }
+   }
+   return;
+}
+
+/********************************************************************************
+* run_decoded_instruction: Runs a complete instruction cycle straight from the
+*                          pre-decoded program. The architectural state after
+*                          the call is the same as after running the fetch,
+*                          decode and execute states one by one.
+********************************************************************************/
+static inline void run_decoded_instruction(struct cpu_context* self)
+{
+   const struct decoded_instruction* instruction = &self->decoded_program[self->pc];
+
+   self->ir = instruction->ir;
+   self->mar = self->pc;
+   self->pc++;
+   self->op_code = instruction->op_code;
+   self->op1 = instruction->op1;
+   self->op2 = instruction->op2;
+
+   perf_counters_retire(&self->counters, instruction->op_code, 1);
+   instruction->execute(self, self->op1, self->op2);
+   self->state = CPU_STATE_FETCH;
+   check_for_irq(self);
+   monitor_interrupts(self);
+   return;
+}
+
+/********************************************************************************
+* fusion_allowed: Indicates if the superinstruction starting with specified
+*                 decoded instruction may be run as one, i.e. if all of its
+*                 instructions fit within the remaining number of
+*                 instructions, no stop address or breakpoint is located
+*                 within it, no watchpoint is armed, since an access in the
+*                 first instruction must stop the run right after it, and no
+*                 interrupt is pending, since it
+*                 would be generated right after the first instruction.
+*                 Since the instructions before the last one can't write
+*                 memory or affect the interrupt logic, checking for
+*                 interrupt requests and stop conditions after the last
+*                 instruction then gives the same result as checking after
+*                 each instruction.
+*
+*                 - first           : Reference to the first instruction.
+*                 - address         : Address of the first instruction.
+*                 - num_instructions: Remaining number of instructions to run.
+*                 - config          : Reference to the configuration of the run.
+********************************************************************************/
+static inline bool fusion_allowed(struct cpu_context* self,
+                                  const struct decoded_instruction* first,
+                                  const uint16_t address,
+                                  const uint64_t num_instructions,
+                                  const struct control_unit_run_config* config)
+{
+   if (first->fused_length > num_instructions || irq_pending(self)) return false;
+   if (config->stop_conditions & CONTROL_UNIT_STOP_ON_WATCHPOINT) return false;
+   return !stop_address_within(self, config, (uint16_t)(address + 1), first->fused_length - 1);
+}
+
+/********************************************************************************
+* execute_fused: Executes the superinstruction starting with specified decoded
+*                instruction, which has just been fetched. The instructions
+*                are executed by their usual handlers without dispatch in
+*                between, so the results and the flags are the same as when
+*                they're run one by one. Afterwards, the registers hold the
+*                last instruction of the sequence, just as if it had been
+*                fetched and executed by itself.
+*
+*                - first: Reference to the first instruction.
+********************************************************************************/
+static inline void execute_fused(struct cpu_context* self,
+                                 const struct decoded_instruction* first)
+{
+   const uint16_t address = self->mar;
+   const uint8_t length = first->fused_length;
+   const struct decoded_instruction* last = &first[length - 1];
+   self->pc = address + length; /* Overwritten by a taken branch. */
+
+   switch (first->fusion)
+   {
+      case CONTROL_UNIT_FUSION_IO_UPDATE:
+      {
+         execute_in(self, first[0].op1, first[0].op2);
+         if (first[1].op_code == ANDI) execute_andi(self, first[1].op1, first[1].op2);
+         else                          execute_ori(self, first[1].op1, first[1].op2);
+         execute_out(self, first[2].op1, first[2].op2);
+         break;
+      }
+      case CONTROL_UNIT_FUSION_COMPARE_BRANCH:
+      {
+         execute_cpi(self, first[0].op1, first[0].op2);
+
+         switch (first[1].op_code)
+         {
+            case BREQ: execute_breq(self, first[1].op1, first[1].op2); break;
+            case BRNE: execute_brne(self, first[1].op1, first[1].op2); break;
+            case BRGE: execute_brge(self, first[1].op1, first[1].op2); break;
+            case BRGT: execute_brgt(self, first[1].op1, first[1].op2); break;
+            case BRLE: execute_brle(self, first[1].op1, first[1].op2); break;
+            default:   execute_brlt(self, first[1].op1, first[1].op2); break;
+         }
+         break;
+      }
+      case CONTROL_UNIT_FUSION_LOAD_POINTER:
+      {
+         execute_ldi(self, first[0].op1, first[0].op2);
+         execute_ldi(self, first[1].op1, first[1].op2);
+         break;
+      }
+      default:
+      {
+         break;
+      }
+   }
+
+   for (uint8_t i = 1; i < length; ++i)
+   {
+      perf_counters_retire(&self->counters, first[i].op_code, 1);
+   }
+
+   self->ir = last->ir;
+   self->mar = address + length - 1;
+   self->op_code = last->op_code;
+   self->op1 = last->op1;
+   self->op2 = last->op2;
+   return;
+}
+
+#if !CONTROL_UNIT_THREADED_DISPATCH
+/********************************************************************************
+* run_fused_instruction: Runs a complete instruction cycle of the
+*                        superinstruction at the current address, see
+*                        execute_fused.
+********************************************************************************/
+static inline void run_fused_instruction(struct cpu_context* self)
+{
+   const struct decoded_instruction* instruction = &self->decoded_program[self->pc];
+
+   self->ir = instruction->ir;
+   self->mar = self->pc;
+   self->pc++;
+   self->op_code = instruction->op_code;
+   self->op1 = instruction->op1;
+   self->op2 = instruction->op2;
+
+   perf_counters_retire(&self->counters, instruction->op_code, 1);
+   execute_fused(self, instruction);
+   self->state = CPU_STATE_FETCH;
+   check_for_irq(self);
+   monitor_interrupts(self);
+   return;
+}
+#endif /* !CONTROL_UNIT_THREADED_DISPATCH */
+
+/********************************************************************************
+* check_stop_conditions: Returns the reason to stop the current run if any of
+*                        the specified stop conditions has occured during the
+*                        last instruction, otherwise CONTROL_UNIT_STOP_LIMIT_REACHED.
+*
+*                        - config        : Reference to the configuration of the run.
+*                        - portb_previous: Reference to the content of PORTB after
+*                                          the previous instruction.
+********************************************************************************/
+static inline enum control_unit_stop_reason check_stop_conditions(struct cpu_context* self,
+                                                                  const struct control_unit_run_config* config,
+                                                                  uint8_t* portb_previous)
+{
+   const uint8_t stop_conditions = config->stop_conditions;
+   if (!stop_conditions) return CONTROL_UNIT_STOP_LIMIT_REACHED;
+
+   if (self->events & stop_conditions)
+   {
+      if (self->events & stop_conditions & CONTROL_UNIT_STOP_ON_INVALID_OP_CODE) return CONTROL_UNIT_STOP_INVALID_OP_CODE;
+      if (self->events & stop_conditions & CONTROL_UNIT_STOP_ON_STACK_ERROR)     return CONTROL_UNIT_STOP_STACK_ERROR;
+      if (self->events & stop_conditions & CONTROL_UNIT_STOP_ON_MEMORY_ERROR)    return CONTROL_UNIT_STOP_MEMORY_ERROR;
+      if (self->events & stop_conditions & CONTROL_UNIT_STOP_ON_WATCHPOINT)      return CONTROL_UNIT_STOP_WATCHPOINT;
+      if (self->events & stop_conditions & CONTROL_UNIT_STOP_ON_INTERRUPT)       return CONTROL_UNIT_STOP_INTERRUPT;
+   }
+
+   if (stop_conditions & CONTROL_UNIT_STOP_ON_PORTB_CHANGE)
+   {
+      const uint8_t portb = data_memory_peek_ctx(self, PORTB);
+
+      if (portb != *portb_previous)
+      {
+         *portb_previous = portb;
+         return CONTROL_UNIT_STOP_PORTB_CHANGED;
+      }
+   }
+
+   if ((stop_conditions & CONTROL_UNIT_STOP_ON_PC) && self->pc == config->stop_pc)
+   {
+      return CONTROL_UNIT_STOP_PC_REACHED;
+   }
+
+   if ((stop_conditions & CONTROL_UNIT_STOP_ON_BREAKPOINT) && (self->breakpoints->pc[self->pc / 64] >> (self->pc % 64) & 1))
+   {
+      return CONTROL_UNIT_STOP_BREAKPOINT;
+   }
+   return CONTROL_UNIT_STOP_LIMIT_REACHED;
+}
+
+/********************************************************************************
+* stop_address: Indicates if the current run is stopped when the program
+*               counter reaches specified address, i.e. if the address is
+*               the stop address or has an armed breakpoint.
+*
+*               - config : Reference to the configuration of the run.
+*               - address: The address to check.
+********************************************************************************/
+static inline bool stop_address(const struct cpu_context* self,
+                                const struct control_unit_run_config* config,
+                                const uint16_t address)
+{
+   if ((config->stop_conditions & CONTROL_UNIT_STOP_ON_PC) && address == config->stop_pc) return true;
+   return (config->stop_conditions & CONTROL_UNIT_STOP_ON_BREAKPOINT) &&
+      (self->breakpoints->pc[address / 64] >> (address % 64) & 1);
+}
+
+/********************************************************************************
+* stop_address_within: Indicates if the current run is stopped at any of
+*                      specified number of addresses starting at specified
+*                      address, see stop_address. Used to keep instruction
+*                      sequences run as a whole, such as superinstructions,
+*                      idle loops and JIT compiled blocks, from running past
+*                      a stop.
+*
+*                      - config: Reference to the configuration of the run.
+*                      - first : The first address to check.
+*                      - length: The number of addresses to check.
+********************************************************************************/
+static inline bool stop_address_within(const struct cpu_context* self,
+                                       const struct control_unit_run_config* config,
+                                       const uint16_t first,
+                                       const uint8_t length)
+{
+   if (!(config->stop_conditions & (CONTROL_UNIT_STOP_ON_PC | CONTROL_UNIT_STOP_ON_BREAKPOINT))) return false;
+
+   for (uint8_t i = 0; i < length; ++i)
+   {
+      if (stop_address(self, config, (uint16_t)(first + i))) return true;
+   }
+   return false;
+}
+
+#if !CONTROL_UNIT_THREADED_DISPATCH
+/********************************************************************************
+* run_decoded_instruction_loop: Runs specified number of instructions from the
+*                               pre-decoded program by calling the handler of
+*                               each instruction. Superinstructions are run
+*                               with a single call and idle loops are
+*                               fast-forwarded, see execute_fused and
+*                               run_idle_loop. The number of executed
+*                               instructions is returned. The run is stopped
+*                               early if any of the stop conditions occurs.
+*
+*                               - num_instructions: The number of instructions
+*                                                   to run.
+*                               - config          : Reference to the configuration
+*                                                   of the run.
+*                               - stop_reason     : Reference to variable storing
+*                                                   the reason for stopping early.
+********************************************************************************/
+static uint64_t run_decoded_instruction_loop(struct cpu_context* self,
+                                             uint64_t num_instructions,
+                                             const struct control_unit_run_config* config,
+                                             enum control_unit_stop_reason* stop_reason)
+{
+   uint8_t portb_previous = data_memory_peek_ctx(self, PORTB);
+   uint64_t executed = 0;
+
+   while (executed < num_instructions)
+   {
+      uint64_t count = 0;
+
+      if (self->decoded_program[self->pc].idle_length)
+      {
+         count = run_idle_loop(self, num_instructions - executed, config, &portb_previous, stop_reason);
+      }
+
+      if (count == 0)
+      {
+         const struct decoded_instruction* instruction = &self->decoded_program[self->pc];
+
+         if (instruction->fused_length &&
+             fusion_allowed(self, instruction, self->pc, num_instructions - executed, config))
+         {
+            run_fused_instruction(self);
+            count = instruction->fused_length;
+         }
+         else
+         {
+            run_decoded_instruction(self);
+            count = 1;
+         }
+         *stop_reason = check_stop_conditions(self, config, &portb_previous);
+      }
+
+      executed += count;
+      if (*stop_reason != CONTROL_UNIT_STOP_LIMIT_REACHED) return executed;
+   }
+   return executed;
+}
+#endif /* !CONTROL_UNIT_THREADED_DISPATCH */
+
+#if CONTROL_UNIT_THREADED_DISPATCH
+/********************************************************************************
+* run_threaded_instructions: Runs specified number of instructions from the
+*                            pre-decoded program by direct-threaded dispatch.
+*                            Each decoded instruction holds the address of the
+*                            label implementing it, and every implementation
+*                            jumps straight to the label of the next
+*                            instruction instead of returning to a common
+*                            dispatch point. The architectural state after
+*                            each instruction is the same as after running
+*                            run_decoded_instruction. The first instruction
+*                            of a superinstruction is linked to a label which
+*                            runs the entire sequence, see execute_fused, and
+*                            the jump or branch closing an idle loop is linked
+*                            to a label which fast-forwards through the loop,
+*                            see run_idle_loop.
+*
+*                            The number of executed instructions is returned.
+*                            The run is stopped early if any of the stop
+*                            conditions occurs.
+*
+*                            - num_instructions: The number of instructions
+*                                                to run.
+*                            - config          : Reference to the configuration
+*                                                of the run.
+*                            - stop_reason     : Reference to variable storing
+*                                                the reason for stopping early.
+********************************************************************************/
+static uint64_t run_threaded_instructions(struct cpu_context* self,
+                                          uint64_t num_instructions,
+                                          const struct control_unit_run_config* config,
+                                          enum control_unit_stop_reason* stop_reason)
+{
+   static const void* const labels[] =
+   {
+      &&op_nop,  &&op_ldi,  &&op_mov,  &&op_out,
+      &&op_in,   &&op_sts,  &&op_lds,  &&op_clr,
+      &&op_ori,  &&op_andi, &&op_xori, &&op_or,
+      &&op_and,  &&op_xor,  &&op_addi, &&op_subi,
+      &&op_add,  &&op_sub,  &&op_inc,  &&op_dec,
+      &&op_cpi,  &&op_cp,   &&op_jmp,  &&op_breq,
+      &&op_brne, &&op_brge, &&op_brgt, &&op_brle,
+      &&op_brlt, &&op_call, &&op_ret,  &&op_reti,
+      &&op_push, &&op_pop,  &&op_lsl,  &&op_lsr,
+      &&op_sei,  &&op_cli,  &&op_stio, &&op_ldio,
+      &&op_st,   &&op_ld
+   };
+
+   const struct decoded_instruction* instruction = 0;
+   uint64_t executed = 0;
+   uint8_t portb_previous = data_memory_peek_ctx(self, PORTB);
+
+/* Fetches next decoded instruction and jumps to its label. */
+#define DISPATCH()                                                        \
+   instruction = &self->decoded_program[self->pc];                        \
+   self->ir = instruction->ir;                                            \
+   self->mar = self->pc;                                                  \
+   self->pc++;                                                            \
+   self->op_code = instruction->op_code;                                  \
+   self->op1 = instruction->op1;                                          \
+   self->op2 = instruction->op2;                                          \
+   perf_counters_retire(&self->counters, instruction->op_code, 1);        \
+   goto *instruction->thread
+
+/* Finishes the current instruction and dispatches the next one, if any. */
+#define NEXT()                                                            \
+   self->state = CPU_STATE_FETCH;                                         \
+   check_for_irq(self);                                                   \
+   monitor_interrupts(self);                                              \
+   *stop_reason = check_stop_conditions(self, config, &portb_previous);   \
+   if (++executed == num_instructions ||                                  \
+       *stop_reason != CONTROL_UNIT_STOP_LIMIT_REACHED) return executed;  \
+   if (!self->threaded_program_valid) goto link;                          \
+   DISPATCH()
+
+   if (num_instructions == 0) return 0;
+   if (self->threaded_program_valid) { DISPATCH(); }
+
+link: /* Links each decoded instruction to its label after the program has been decoded. */
+   for (uint32_t i = 0; i < PROGRAM_MEMORY_ADDRESS_WIDTH; ++i)
+   {
+      struct decoded_instruction* decoded = &self->decoded_program[i];
+      decoded->thread = decoded->execute == execute_invalid ? &&op_invalid : labels[decoded->op_code];
+      if (decoded->fused_length) decoded->thread = &&op_fused;
+   }
+
+   for (uint32_t i = 0; i < PROGRAM_MEMORY_ADDRESS_WIDTH; ++i)
+   {
+      const uint8_t length = self->decoded_program[i].idle_length;
+      if (length) self->decoded_program[i + length - 1].thread = &&op_idle;
+   }
+   self->threaded_program_valid = true;
+   DISPATCH();
+
+op_nop:     NEXT();
+op_ldi:     execute_ldi(self, self->op1, self->op2);         NEXT();
+op_mov:     execute_mov(self, self->op1, self->op2);         NEXT();
+op_out:     execute_out(self, self->op1, self->op2);         NEXT();
+op_in:      execute_in(self, self->op1, self->op2);          NEXT();
+op_sts:     execute_sts(self, self->op1, self->op2);         NEXT();
+op_lds:     execute_lds(self, self->op1, self->op2);         NEXT();
+op_clr:     execute_clr(self, self->op1, self->op2);         NEXT();
+op_ori:     execute_ori(self, self->op1, self->op2);         NEXT();
+op_andi:    execute_andi(self, self->op1, self->op2);        NEXT();
+op_xori:    execute_xori(self, self->op1, self->op2);        NEXT();
+op_or:      execute_or(self, self->op1, self->op2);          NEXT();
+op_and:     execute_and(self, self->op1, self->op2);         NEXT();
+op_xor:     execute_xor(self, self->op1, self->op2);         NEXT();
+op_addi:    execute_addi(self, self->op1, self->op2);        NEXT();
+op_subi:    execute_subi(self, self->op1, self->op2);        NEXT();
+op_add:     execute_add(self, self->op1, self->op2);         NEXT();
+op_sub:     execute_sub(self, self->op1, self->op2);         NEXT();
+op_inc:     execute_inc(self, self->op1, self->op2);         NEXT();
+op_dec:     execute_dec(self, self->op1, self->op2);         NEXT();
+op_cpi:     execute_cpi(self, self->op1, self->op2);         NEXT();
+op_cp:      execute_cp(self, self->op1, self->op2);          NEXT();
+op_jmp:     execute_jmp(self, self->op1, self->op2);         NEXT();
+op_breq:    execute_breq(self, self->op1, self->op2);        NEXT();
+op_brne:    execute_brne(self, self->op1, self->op2);        NEXT();
+op_brge:    execute_brge(self, self->op1, self->op2);        NEXT();
+op_brgt:    execute_brgt(self, self->op1, self->op2);        NEXT();
+op_brle:    execute_brle(self, self->op1, self->op2);        NEXT();
+op_brlt:    execute_brlt(self, self->op1, self->op2);        NEXT();
+op_call:    execute_call(self, self->op1, self->op2);        NEXT();
+op_ret:     execute_ret(self, self->op1, self->op2);         NEXT();
+op_reti:    execute_reti(self, self->op1, self->op2);        NEXT();
+op_push:    execute_push(self, self->op1, self->op2);        NEXT();
+op_pop:     execute_pop(self, self->op1, self->op2);         NEXT();
+op_lsl:     execute_lsl(self, self->op1, self->op2);         NEXT();
+op_lsr:     execute_lsr(self, self->op1, self->op2);         NEXT();
+op_sei:     execute_sei(self, self->op1, self->op2);         NEXT();
+op_cli:     execute_cli(self, self->op1, self->op2);         NEXT();
+op_stio:    execute_stio(self, self->op1, self->op2);        NEXT();
+op_ldio:    execute_ldio(self, self->op1, self->op2);        NEXT();
+op_st:      execute_st(self, self->op1, self->op2);          NEXT();
+op_ld:      execute_ld(self, self->op1, self->op2);          NEXT();
+op_invalid: execute_invalid(self, self->op1, self->op2);     NEXT();
+
+op_fused: /* First instruction of a superinstruction, run by itself if not allowed. */
+   if (!fusion_allowed(self, instruction, self->mar, num_instructions - executed, config)) goto *labels[instruction->op_code];
+   execute_fused(self, instruction);
+   executed += instruction->fused_length - 1;
+   NEXT();
+
+op_idle: /* Jump or branch closing an idle loop, fast-forwards if taken. */
+   instruction->execute(self, self->op1, self->op2);
+   self->state = CPU_STATE_FETCH;
+   check_for_irq(self);
+   monitor_interrupts(self);
+   *stop_reason = check_stop_conditions(self, config, &portb_previous);
+   if (++executed == num_instructions ||
+       *stop_reason != CONTROL_UNIT_STOP_LIMIT_REACHED) return executed;
+
+   if (self->pc == program_memory_jump_address(instruction->op1, instruction->op2))
+   {
+      executed += run_idle_loop(self, num_instructions - executed, config, &portb_previous, stop_reason);
+      if (executed == num_instructions ||
+          *stop_reason != CONTROL_UNIT_STOP_LIMIT_REACHED) return executed;
+   }
+   if (!self->threaded_program_valid) goto link;
+   DISPATCH();
+
+#undef DISPATCH
+#undef NEXT
+}
+#endif /* CONTROL_UNIT_THREADED_DISPATCH */
+
+/********************************************************************************
+* irq_pending: Indicates if an interrupt will be generated at the next check
+*              for interrupt requests, i.e. if the I flag is set and any
+*              interrupt flag in PCIFR is set along with its enable bit in PCICR.
+********************************************************************************/
+static inline bool irq_pending(struct cpu_context* self)
+{
+   return self->irq_requests && read(self->sr, I);
+}
+
+/********************************************************************************
+* run_idle_loop: Runs one iteration of the idle loop starting at the current
+*                address and fast-forwards through the remaining number of
+*                instructions if the iteration returned to the start of the
+*                loop with the CPU registers and the status register
+*                unchanged. Since the loop doesn't write to memory and no
+*                interrupt is pending, every later iteration does exactly the
+*                same until an input changes, which can only happen between
+*                runs. Only whole iterations are skipped. The skipped
+*                instructions and their reads are counted as retired by the
+*                performance counters and the clock cycles are accounted by
+*                the caller as usual.
+*
+*                The number of executed instructions, including the skipped
+*                ones, is returned, or 0 if nothing was run because the loop
+*                can't be fast-forwarded, for instance when reading an I/O page
+*                mapped by a peripheral or when the PC stop address or a
+*                breakpoint is located within the loop. The run is stopped early
+*                if any of the stop conditions occurs.
+*
+*                - num_instructions: Max number of instructions to run.
+*                - config          : Reference to the configuration of the run.
+*                - portb_previous  : Reference to the content of PORTB after
+*                                    the previous instruction.
+*                - stop_reason     : Reference to variable storing the reason
+*                                    for stopping early.
+********************************************************************************/
+static uint64_t run_idle_loop(struct cpu_context* self,
+                              const uint64_t num_instructions,
+                              const struct control_unit_run_config* config,
+                              uint8_t* portb_previous,
+                              enum control_unit_stop_reason* stop_reason)
+{
+   const uint16_t start = self->pc;
+   const uint8_t length = self->decoded_program[start].idle_length;
+   uint16_t path[CONTROL_UNIT_MAX_IDLE_LOOP]; /* Addresses of the instructions run in the iteration. */
+   uint8_t reg[CPU_REGISTER_ADDRESS_WIDTH];
+   uint8_t executed = 0;
+
+   if (num_instructions < 2 * (uint64_t)length || irq_pending(self)) return 0;
+   if (stop_address_within(self, config, start, length)) return 0;
+
+   for (uint8_t i = 0; i < length; ++i)
+   {
+      const struct decoded_instruction* instruction = &self->decoded_program[start + i];
+
+      if (instruction->op_code == IN || instruction->op_code == LDS)
+      {
+         const uint16_t address = instruction->op_code == IN ? instruction->op2 :
+            instruction->op2 + DATA_MEMORY_DATA_OFFSET;
+         const struct data_memory_page* page = &self->pages[address >> 8];
+         if (!page->memory && page->read_handler && page->read_handler != data_memory_io_read_ctx) return 0;
+      }
+   }
+
+   update_status_flags(self);
+   const uint8_t sr = self->sr;
+   memcpy(reg, self->reg, sizeof(reg));
+
+   do
+   {
+      path[executed++] = self->pc;
+      run_decoded_instruction(self);
+      *stop_reason = check_stop_conditions(self, config, portb_previous);
+      if (*stop_reason != CONTROL_UNIT_STOP_LIMIT_REACHED) return executed;
+   } while (executed < length && self->pc != start && (uint16_t)(self->pc - start) < length);
+
+   update_status_flags(self);
+   if (self->pc != start || self->sr != sr || memcmp(reg, self->reg, sizeof(reg))) return executed;
+
+   const uint64_t iterations = (num_instructions - executed) / executed;
+
+   for (uint8_t i = 0; i < executed; ++i)
+   {
+      const struct decoded_instruction* instruction = &self->decoded_program[path[i]];
+      perf_counters_retire(&self->counters, instruction->op_code, iterations);
+
+      if (instruction->op_code == IN)
+      {
+         perf_counters_count_reads(&self->counters, instruction->op2, iterations);
+      }
+      else if (instruction->op_code == LDS)
+      {
+         perf_counters_count_reads(&self->counters, instruction->op2 + DATA_MEMORY_DATA_OFFSET, iterations);
+      }
+   }
+   return executed + iterations * executed;
+}
+
+/********************************************************************************
+* run_jit_instructions: Runs specified number of instructions by executing
+*                       JIT compiled blocks. A block is only run if no
+*                       interrupt request is pending, if the entire block fits
+*                       within the remaining number of instructions, if the
+*                       PC stop address or a breakpoint isn't located within
+*                       the block and if the run isn't stopped at memory
+*                       errors while the block holds LD, since the error
+*                       would only be noticed at the end of the block.
+*                       Otherwise a single instruction is interpreted.
+*                       Since no instruction within a block can affect the
+*                       interrupt logic, checking for interrupt requests and
+*                       stop conditions after the block gives the same result
+*                       as checking after each instruction. Idle loops are
+*                       fast-forwarded instead, see run_idle_loop.
+*
+*                       The number of executed instructions is returned.
+*                       The run is stopped early if any of the stop
+*                       conditions occurs.
+*
+*                       - num_instructions: The number of instructions to run.
+*                       - config          : Reference to the configuration
+*                                           of the run.
+*                       - stop_reason     : Reference to variable storing
+*                                           the reason for stopping early.
+********************************************************************************/
+static uint64_t run_jit_instructions(struct cpu_context* self,
+                                     uint64_t num_instructions,
+                                     const struct control_unit_run_config* config,
+                                     enum control_unit_stop_reason* stop_reason)
+{
+   uint8_t portb_previous = data_memory_peek_ctx(self, PORTB);
+   uint64_t executed = 0;
+
+   while (executed < num_instructions)
+   {
+      if (self->decoded_program[self->pc].idle_length)
+      {
+         const uint64_t count = run_idle_loop(self, num_instructions - executed, config, &portb_previous, stop_reason);
+         executed += count;
+         if (*stop_reason != CONTROL_UNIT_STOP_LIMIT_REACHED) return executed;
+         if (count) continue;
+      }
+
+      const uint64_t remaining = num_instructions - executed;
+      const uint16_t start = self->pc;
+      const struct jit_block* block = irq_pending(self) ? 0 : jit_block_get(self->jit, self, start);
+
+      const uint8_t length = block ? block->length : 0; /* Copied, since the block may be flushed when run. */
+
+      const bool faults = block && block->loads && (config->stop_conditions & CONTROL_UNIT_STOP_ON_MEMORY_ERROR);
+
+      if (block && !faults && length <= remaining && !stop_address_within(self, config, (uint16_t)(start + 1), length - 1))
+      {
+         const struct decoded_instruction* last = &self->decoded_program[start + length - 1];
+         const uint64_t max_iterations = stop_address(self, config, start) ? 1 : remaining / length;
+
+         update_status_flags(self); /* The compiled code reads and updates the status register. */
+         self->ir = last->ir;       /* The registers hold the last instruction of the block. */
+         self->mar = start + length - 1;
+         self->op_code = last->op_code;
+         self->op1 = last->op1;
+         self->op2 = last->op2;
+
+         const uint64_t iterations = block->run(self, max_iterations);
+         executed += iterations * length;
+
+         for (uint8_t i = 0; i < length; ++i)
+         {
+            perf_counters_retire(&self->counters, self->decoded_program[start + i].op_code, iterations);
+         }
+
+         self->state = CPU_STATE_FETCH;
+         check_for_irq(self);
+         monitor_interrupts(self);
+      }
+      else
+      {
+         run_decoded_instruction(self);
+         executed++;
+      }
+
+      *stop_reason = check_stop_conditions(self, config, &portb_previous);
+      if (*stop_reason != CONTROL_UNIT_STOP_LIMIT_REACHED) return executed;
+   }
+   return executed;
+}
+
+/********************************************************************************
+* run_instructions: Runs specified number of instructions by JIT compiled
+*                   blocks if JIT compilation is enabled, otherwise by the
+*                   interpreter. The number of executed instructions is
+*                   returned. The run is stopped early if any of the stop
+*                   conditions occurs.
+*
+*                   - num_instructions: The number of instructions to run.
+*                   - config          : Reference to the configuration of
+*                                       the run.
+*                   - stop_reason     : Reference to variable storing the
+*                                       reason for stopping early.
+********************************************************************************/
+static uint64_t run_instructions(struct cpu_context* self,
+                                 uint64_t num_instructions,
+                                 const struct control_unit_run_config* config,
+                                 enum control_unit_stop_reason* stop_reason)
+{
+   if (self->trace || self->vcd)
+   {
+      return run_traced_instructions(self, num_instructions, config, stop_reason);
+   }
+   else if (self->jit && !(config->stop_conditions & CONTROL_UNIT_STOP_ON_WATCHPOINT))
+   {
+      return run_jit_instructions(self, num_instructions, config, stop_reason);
+   }
+#if CONTROL_UNIT_THREADED_DISPATCH
+   return run_threaded_instructions(self, num_instructions, config, stop_reason);
+#else
+   return run_decoded_instruction_loop(self, num_instructions, config, stop_reason);
+#endif
+}
+
+/********************************************************************************
+* execute_traced: Executes the current instruction and adds a record of it to
+*                 the trace, holding the CPU register and the data memory
+*                 location written by the instruction, if any, and the
+*                 status register afterwards. The written location is
+*                 calculated before execution, since the instruction may
+*                 change the registers of a pointer.
+********************************************************************************/
+static void execute_traced(struct cpu_context* self)
+{
+   const struct decoded_instruction* instruction = &self->decoded_program[self->mar];
+   struct trace_record record = { instruction->ir, 0, self->mar, 0, 0, 0, 0, TRACE_RECORD_INSTRUCTION };
+   uint32_t address = 0;
+
+   if (instruction->valid)
+   {
+      switch (instruction->op_code)
+      {
+         case OUT:  address = self->op1; break;
+         case STS:  address = self->op1 + DATA_MEMORY_DATA_OFFSET; break;
+         case STIO: address = self->reg[self->op1] | (self->reg[self->op1 + 1] << 8); break;
+         case ST:   address = (self->reg[self->op1] | (self->reg[self->op1 + 1] << 8)) + DATA_MEMORY_DATA_OFFSET; break;
+         case LDI:  case MOV:  case IN:   case LDS:  case CLR:  case ORI:  case ANDI:
+         case XORI: case OR:   case AND:  case XOR:  case ADDI: case SUBI: case ADD:
+         case SUB:  case INC:  case DEC:  case POP:  case LSL:  case LSR:  case LDIO: case LD:
+         {
+            record.flags |= TRACE_RECORD_REGISTER;
+            record.reg = self->op1;
+            break;
+         }
+         default: break;
+      }
+
+      if ((instruction->op_code == OUT || instruction->op_code == STS ||
+           instruction->op_code == STIO || instruction->op_code == ST) &&
+          address < DATA_MEMORY_ADDRESS_WIDTH) /* ST beyond the address space stores nothing. */
+      {
+         record.flags |= TRACE_RECORD_MEMORY;
+         record.address = (uint16_t)address;
+         record.value = self->reg[self->op2];
+      }
+   }
+
+   instruction->execute(self, self->op1, self->op2);
+   update_status_flags(self);
+   record.sr = self->sr;
+   if (record.flags & TRACE_RECORD_REGISTER) record.reg_value = self->reg[record.reg];
+   trace_write(self->trace, &record);
+   return;
+}
+
+/********************************************************************************
+* run_traced_instructions: Runs specified number of instructions from the
+*                          pre-decoded program like run_decoded_instruction,
+*                          while adding a record of each instruction to the
+*                          trace and sampling the waveform after each
+*                          instruction, if enabled. The number of executed
+*                          instructions is returned. The run is stopped early
+*                          if any of the stop conditions occurs.
+*
+*                          - num_instructions: The number of instructions
+*                                              to run.
+*                          - config          : Reference to the configuration
+*                                              of the run.
+*                          - stop_reason     : Reference to variable storing
+*                                              the reason for stopping early.
+********************************************************************************/
+static uint64_t run_traced_instructions(struct cpu_context* self,
+                                        uint64_t num_instructions,
+                                        const struct control_unit_run_config* config,
+                                        enum control_unit_stop_reason* stop_reason)
+{
+   uint8_t portb_previous = data_memory_peek_ctx(self, PORTB);
+   if (self->vcd) vcd_sample(self->vcd, self, 0);
+
+   for (uint64_t i = 0; i < num_instructions; ++i)
+   {
+      const struct decoded_instruction* instruction = &self->decoded_program[self->pc];
+
+      self->ir = instruction->ir;
+      self->mar = self->pc;
+      self->pc++;
+      self->op_code = instruction->op_code;
+      self->op1 = instruction->op1;
+      self->op2 = instruction->op2;
+
+      perf_counters_retire(&self->counters, instruction->op_code, 1);
+
+      if (self->trace)
+      {
+         execute_traced(self);
+      }
+      else
+      {
+         instruction->execute(self, self->op1, self->op2);
+      }
+
+      self->state = CPU_STATE_FETCH;
+      check_for_irq(self);
+      monitor_interrupts(self);
+      if (self->vcd) vcd_sample(self->vcd, self, 3);
+
+      *stop_reason = check_stop_conditions(self, config, &portb_previous);
+      if (*stop_reason != CONTROL_UNIT_STOP_LIMIT_REACHED) return i + 1;
+   }
+   return num_instructions;
+}
+
+/********************************************************************************
+* calculate: Performs calculation with specified operands via the ALU and
+*            returns the result. If lazy flags are enabled, the status flags
+*            are updated when needed by calling update_status_flags, otherwise
+*            they are updated immediately.
+*
+*            - operation: The operation to perform (OR, AND, XOR, ADD or SUB).
+*            - a        : First operand.
+*            - b        : Second operand.
+********************************************************************************/
+static inline uint8_t calculate(struct cpu_context* self,
+                                const uint8_t operation,
+                                const uint8_t a,
+                                const uint8_t b)
+{
+#if CONTROL_UNIT_LAZY_FLAGS
+   return alu_lazy(operation, a, b, &self->flags);
+#else
+   return alu(operation, a, b, &self->sr);
+#endif
+}
+
+/********************************************************************************
+* update_status_flags: Updates the status flags SNZVC in accordance with the
+*                      last calculation, if lazy flags are enabled.
+********************************************************************************/
+static inline void update_status_flags(struct cpu_context* self)
+{
+#if CONTROL_UNIT_LAZY_FLAGS
+   alu_flags_update(&self->flags, &self->sr);
+#endif
+   return;
+}
\ No newline at end of file
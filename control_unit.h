@@ -1,39 +1,213 @@
-/********************************************************************************
-* control_unit.h: Contains function declarations for implementation of an
-*                 8-bit control unit.
-********************************************************************************/
-#ifndef CONTROL_UNIT_H_
-#define CONTROL_UNIT_H_
-
-/* Include directives: */
-#include "cpu.h"
-#include "program_memory.h"
-#include "data_memory.h"
-#include "stack.h"
-#include "alu.h"
-
-/********************************************************************************
-* control_unit_reset: Resets control unit and corresponding program.
-********************************************************************************/
-void control_unit_reset(void);
-
-/********************************************************************************
-* control_unit_run_next_state: Runs next state in the CPU instruction cycle.
-********************************************************************************/
-void control_unit_run_next_state(void);
-
-/********************************************************************************
-* control_unit_run_next_state: Runs next CPU instruction cycle, i.e. fetches
-*                              a new instruction from program memory, decodes
-*                              and executes it.
-********************************************************************************/
-void control_unit_run_next_instruction_cycle(void);
-
-/********************************************************************************
-* control_unit_print: Prints information about the processor, for instance
-*                     current subroutine, instruction, state, content in
-*                     CPU-registers and I/O registers DDRB, PORTB and PINB.
-********************************************************************************/
-void control_unit_print(void);
-
+/********************************************************************************
+* control_unit.h: Contains function declarations for implementation of an
+*                 8-bit control unit.
+********************************************************************************/
+#ifndef CONTROL_UNIT_H_
+#define CONTROL_UNIT_H_
+
+/* Include directives: */
+#include "cpu.h"
+#include "cpu_context.h"
+#include "program_memory.h"
+#include "data_memory.h"
+#include "stack.h"
+#include "alu.h"
+#include "cpu_snapshot.h"
+
+/* Macro definitions: */
+#define CONTROL_UNIT_STOP_ON_PC              (1 << 0) /* Stop when PC reaches specified address. */
+#define CONTROL_UNIT_STOP_ON_PORTB_CHANGE    (1 << 1) /* Stop when the content of PORTB changes. */
+#define CONTROL_UNIT_STOP_ON_INTERRUPT       (1 << 2) /* Stop when an interrupt is generated. */
+#define CONTROL_UNIT_STOP_ON_STACK_ERROR     (1 << 3) /* Stop at stack overflow or underflow. */
+#define CONTROL_UNIT_STOP_ON_INVALID_OP_CODE (1 << 4) /* Stop at system reset due to invalid OP code. */
+#define CONTROL_UNIT_STOP_ON_BREAKPOINT      (1 << 5) /* Stop when PC reaches an armed breakpoint. */
+#define CONTROL_UNIT_STOP_ON_WATCHPOINT      (1 << 6) /* Stop after an access to a watched address. */
+#define CONTROL_UNIT_STOP_ON_MEMORY_ERROR    (1 << 7) /* Stop when ST or LD addresses data beyond 0xFFFF. */
+
+/********************************************************************************
+* control_unit_stop_reason: Enumeration for the reasons a batch run returns.
+********************************************************************************/
+enum control_unit_stop_reason
+{
+   CONTROL_UNIT_STOP_LIMIT_REACHED,    /* Specified number of instructions or cycles run. */
+   CONTROL_UNIT_STOP_PC_REACHED,       /* Program counter reached specified address. */
+   CONTROL_UNIT_STOP_PORTB_CHANGED,    /* Content of PORTB changed. */
+   CONTROL_UNIT_STOP_INTERRUPT,        /* An interrupt was generated. */
+   CONTROL_UNIT_STOP_STACK_ERROR,      /* Stack overflow or underflow occured. */
+   CONTROL_UNIT_STOP_INVALID_OP_CODE,  /* System reset due to invalid instruction. */
+   CONTROL_UNIT_STOP_BREAKPOINT,       /* Program counter reached an armed breakpoint. */
+   CONTROL_UNIT_STOP_WATCHPOINT,       /* A watched address was accessed, see breakpoints.h. */
+   CONTROL_UNIT_STOP_MEMORY_ERROR      /* ST or LD addressed data beyond the 16-bit address space. */
+};
+
+/********************************************************************************
+* control_unit_run_config: Configuration of a batch run. A limit set to 0 is
+*                          ignored, but at least one of the limits must be set
+*                          for any instructions to be run. The stop conditions
+*                          are checked after each executed instruction. The
+*                          conditions CONTROL_UNIT_STOP_ON_BREAKPOINT and
+*                          CONTROL_UNIT_STOP_ON_WATCHPOINT are set by the run
+*                          itself while any breakpoint or watchpoint is armed,
+*                          see breakpoints.h.
+********************************************************************************/
+struct control_unit_run_config
+{
+   uint64_t max_instructions; /* Max number of instructions to run (0 = no limit). */
+   uint64_t max_cycles;       /* Max number of clock cycles to run (0 = no limit). */
+   uint8_t stop_conditions;   /* Conditions to stop at, see CONTROL_UNIT_STOP_ON_*. */
+   uint16_t stop_pc;          /* Address to stop at if CONTROL_UNIT_STOP_ON_PC is set. */
+};
+
+/********************************************************************************
+* control_unit_result: Result of a batch run.
+********************************************************************************/
+struct control_unit_result
+{
+   enum control_unit_stop_reason stop_reason; /* The reason the run returned. */
+   uint64_t num_instructions;                 /* Number of completed instructions. */
+   uint64_t num_cycles;                       /* Number of clock cycles run. */
+};
+
+/********************************************************************************
+* control_unit_reset_ctx: Resets control unit and corresponding program of
+*                         specified CPU context.
+*
+*                         - self: Reference to the CPU context.
+********************************************************************************/
+void control_unit_reset_ctx(struct cpu_context* self);
+
+/********************************************************************************
+* control_unit_run_next_state_ctx: Runs next state in the CPU instruction cycle
+*                                  of specified CPU context.
+*
+*                                  - self: Reference to the CPU context.
+********************************************************************************/
+void control_unit_run_next_state_ctx(struct cpu_context* self);
+
+/********************************************************************************
+* control_unit_run_next_instruction_cycle_ctx: Runs next CPU instruction cycle
+*                                              of specified CPU context, i.e.
+*                                              fetches a new instruction from
+*                                              program memory, decodes and
+*                                              executes it.
+*
+*                                              - self: Reference to the CPU context.
+********************************************************************************/
+void control_unit_run_next_instruction_cycle_ctx(struct cpu_context* self);
+
+/********************************************************************************
+* control_unit_run_ctx: Runs instructions of specified CPU context from the
+*                       pre-decoded program in a tight loop until the specified
+*                       number of instructions or clock cycles has been run, or
+*                       until one of the specified stop conditions occurs.
+*                       Nothing is printed, instead a result containing the
+*                       stop reason and the number of instructions and cycles
+*                       run is returned. If the CPU is in the middle of an
+*                       instruction cycle, the current instruction is completed
+*                       first. If the cycle limit ends in the middle of an
+*                       instruction, the remaining states are run one by one.
+*
+*                       - self  : Reference to the CPU context.
+*                       - config: Reference to the configuration of the run.
+********************************************************************************/
+struct control_unit_result control_unit_run_ctx(struct cpu_context* self,
+                                                const struct control_unit_run_config* config);
+
+/********************************************************************************
+* control_unit_print_ctx: Prints information about the processor of specified
+*                         CPU context, for instance current subroutine,
+*                         instruction, state, content in CPU-registers and
+*                         I/O registers DDRB, PORTB and PINB.
+*
+*                         - self: Reference to the CPU context.
+********************************************************************************/
+void control_unit_print_ctx(struct cpu_context* self);
+
+/********************************************************************************
+* control_unit_reset: Resets control unit and corresponding program.
+********************************************************************************/
+void control_unit_reset(void);
+
+/********************************************************************************
+* control_unit_run_next_state: Runs next state in the CPU instruction cycle.
+********************************************************************************/
+void control_unit_run_next_state(void);
+
+/********************************************************************************
+* control_unit_run_next_state: Runs next CPU instruction cycle, i.e. fetches
+*                              a new instruction from program memory, decodes
+*                              and executes it.
+********************************************************************************/
+void control_unit_run_next_instruction_cycle(void);
+
+/********************************************************************************
+* control_unit_run_decoded_instructions: Runs specified number of instructions
+*                                        straight from the pre-decoded program,
+*                                        i.e. without stepping through the
+*                                        fetch and decode states. If the CPU
+*                                        is in the middle of an instruction
+*                                        cycle, the current instruction is
+*                                        completed first and counted as one
+*                                        of the executed instructions.
+*
+*                                        - num_instructions: The number of
+*                                                            instructions to run.
+********************************************************************************/
+void control_unit_run_decoded_instructions(const uint32_t num_instructions);
+
+/********************************************************************************
+* control_unit_run: Runs instructions of the default CPU context in a tight
+*                   loop until the specified number of instructions or clock
+*                   cycles has been run, or until one of the specified stop
+*                   conditions occurs, see control_unit_run_ctx.
+*
+*                   - config: Reference to the configuration of the run.
+********************************************************************************/
+struct control_unit_result control_unit_run(const struct control_unit_run_config* config);
+
+/********************************************************************************
+* control_unit_enable_jit_ctx: Enables or disables JIT compilation of the
+*                              program of specified CPU context. While enabled,
+*                              batch runs execute compiled basic blocks where
+*                              possible and fall back to the interpreter
+*                              otherwise. Success code 0 is returned on
+*                              success, otherwise error code 1 is returned if
+*                              JIT compilation isn't supported on this platform
+*                              or the executable buffer couldn't be allocated.
+*
+*                              - self   : Reference to the CPU context.
+*                              - enabled: Indicates if JIT compilation is enabled.
+********************************************************************************/
+int control_unit_enable_jit_ctx(struct cpu_context* self,
+                                const bool enabled);
+
+/********************************************************************************
+* control_unit_enable_jit: Enables or disables JIT compilation of the program
+*                          of the default CPU context, see
+*                          control_unit_enable_jit_ctx.
+*
+*                          - enabled: Indicates if JIT compilation is enabled.
+********************************************************************************/
+int control_unit_enable_jit(const bool enabled);
+
+/********************************************************************************
+* control_unit_jit_enabled: Indicates if JIT compilation is enabled for the
+*                           default CPU context.
+********************************************************************************/
+bool control_unit_jit_enabled(void);
+
+/********************************************************************************
+* control_unit_stop_reason_name: Returns the name of specified stop reason.
+*
+*                                - stop_reason: The specified stop reason.
+********************************************************************************/
+const char* control_unit_stop_reason_name(const enum control_unit_stop_reason stop_reason);
+
+/********************************************************************************
+* control_unit_print: Prints information about the processor, for instance
+*                     current subroutine, instruction, state, content in
+*                     CPU-registers and I/O registers DDRB, PORTB and PINB.
+********************************************************************************/
+void control_unit_print(void);
+
 #endif /* CONTROL_UNIT_H_ */
\ No newline at end of file
@@ -0,0 +1,59 @@
+/********************************************************************************
+* cpu_context.c: Contains function definitions for creating and deleting
+*                CPU contexts, each holding the state of one emulated
+*                microcontroller.
+********************************************************************************/
+#include "cpu_context.h"
+#include "control_unit.h"
+
+/* Static variables: */
+static struct cpu_context default_context; /* CPU context used by the global API. */
+
+/********************************************************************************
+* cpu_context_new: Returns a new heap allocated CPU context, reset and loaded
+*                  with the program. If the allocation fails, a null pointer
+*                  is returned.
+********************************************************************************/
+struct cpu_context* cpu_context_new(void)
+{
+   struct cpu_context* self = (struct cpu_context*)calloc(1, sizeof(struct cpu_context));
+   if (!self) return 0;
+   control_unit_reset_ctx(self);
+   return self;
+}
+
+/********************************************************************************
+* cpu_context_delete: Deletes specified heap allocated CPU context and sets
+*                     the referenced pointer to null.
+*
+*                     - self: Reference to pointer to the CPU context.
+********************************************************************************/
+void cpu_context_delete(struct cpu_context** self)
+{
+   if (!*self) return;
+   jit_delete(&(*self)->jit);
+   free((*self)->profiler);
+   trace_close(&(*self)->trace);
+   vcd_close(&(*self)->vcd);
+   free((*self)->breakpoints);
+   cpu_snapshot_delete(&(*self)->power_on);
+
+   for (uint16_t i = 0; i < DATA_MEMORY_NUM_PAGES; ++i)
+   {
+      free((*self)->data_pages[i]);
+   }
+
+   free((*self)->data_initial);
+   free((*self)->labels);
+   free(*self);
+   *self = 0;
+   return;
+}
+
+/********************************************************************************
+* cpu_context_default: Returns the default CPU context used by the global API.
+********************************************************************************/
+struct cpu_context* cpu_context_default(void)
+{
+   return &default_context;
+}
@@ -0,0 +1,222 @@
+/********************************************************************************
+* cpu_context.h: Contains the definition of a CPU context, which holds the
+*                entire state of one emulated microcontroller, i.e. the
+*                control unit registers, the data memory, the stack and the
+*                program memory. Several CPU contexts can be used side by side
+*                in the same process, for instance to emulate many boards.
+*
+*                The global API of the control unit, data memory, stack and
+*                program memory operates on a default CPU context, while the
+*                functions ending with _ctx operate on a specified context.
+********************************************************************************/
+#ifndef CPU_CONTEXT_H_
+#define CPU_CONTEXT_H_
+
+/* Include directives: */
+#include "cpu.h"
+#include "program_memory.h"
+#include "data_memory.h"
+#include "stack.h"
+#include "alu.h"
+#include "jit.h"
+#include "perf_counters.h"
+#include "profiler.h"
+#include "trace.h"
+#include "vcd.h"
+#include "breakpoints.h"
+
+#include <stddef.h>
+
+/* Forward declarations: */
+struct cpu_context;
+struct cpu_snapshot;
+
+/********************************************************************************
+* CONTROL_UNIT_THREADED_DISPATCH: Set to 1 on compilers supporting labels as
+*                                 values (GCC and Clang), where the decoded
+*                                 instructions are run by direct-threaded
+*                                 dispatch. Other compilers call the handler
+*                                 of each decoded instruction in a loop.
+********************************************************************************/
+#if defined(__GNUC__) || defined(__clang__)
+#define CONTROL_UNIT_THREADED_DISPATCH 1
+#else
+#define CONTROL_UNIT_THREADED_DISPATCH 0
+#endif
+
+/********************************************************************************
+* CONTROL_UNIT_LAZY_FLAGS: Set to 1 to evaluate the status flags SNZVC lazily,
+*                          i.e. only when read by a branch instruction, the
+*                          JIT compiler or the printout, see alu_flags. The
+*                          status register is always up to date when a call
+*                          to the control unit returns.
+********************************************************************************/
+#ifndef CONTROL_UNIT_LAZY_FLAGS
+#define CONTROL_UNIT_LAZY_FLAGS 1
+#endif
+
+/********************************************************************************
+* CONTROL_UNIT_IDLE_LOOP_SKIP: Set to 1 to fast-forward through idle loops in
+*                              batch runs, i.e. short loops that only read
+*                              registers and inputs and leave the state
+*                              unchanged while waiting for an interrupt, for
+*                              instance main_loop in the built-in program.
+*                              Loops of at most CONTROL_UNIT_MAX_IDLE_LOOP
+*                              instructions are detected.
+********************************************************************************/
+#ifndef CONTROL_UNIT_IDLE_LOOP_SKIP
+#define CONTROL_UNIT_IDLE_LOOP_SKIP 1
+#endif
+
+#define CONTROL_UNIT_MAX_IDLE_LOOP 8 /* Max number of instructions in an idle loop. */
+
+/********************************************************************************
+* CONTROL_UNIT_FUSION: Set to 1 to let the decoder fuse common instruction
+*                      sequences into superinstructions, which the
+*                      interpreter runs with a single dispatch, see
+*                      control_unit_fusion.
+********************************************************************************/
+#ifndef CONTROL_UNIT_FUSION
+#define CONTROL_UNIT_FUSION 1
+#endif
+
+/********************************************************************************
+* control_unit_fusion: Instruction sequences fused into superinstructions.
+********************************************************************************/
+enum control_unit_fusion
+{
+   CONTROL_UNIT_FUSION_NONE,           /* Not the start of a superinstruction. */
+   CONTROL_UNIT_FUSION_IO_UPDATE,      /* IN Rd, A / ANDI or ORI Rd, K / OUT A, Rd. */
+   CONTROL_UNIT_FUSION_COMPARE_BRANCH, /* CPI Rd, K / BREQ, BRNE, BRGE, BRGT, BRLE or BRLT. */
+   CONTROL_UNIT_FUSION_LOAD_POINTER    /* LDI XL, K / LDI XH, K (or YL / YH). */
+};
+
+/********************************************************************************
+* decoded_instruction: Pre-decoded instruction, split into OP code and operands
+*                      once after the program has been written to the program
+*                      memory. The operands are validated at decode time and
+*                      the handler used to execute the instruction is stored
+*                      along with it, so that no decoding is needed during
+*                      execution. Invalid instructions are given a handler
+*                      which resets the system.
+********************************************************************************/
+struct decoded_instruction
+{
+   uint32_t ir;          /* The raw 24-bit instruction. */
+   uint8_t op_code;      /* OP code of the instruction. */
+   uint8_t op1;          /* First operand of the instruction. */
+   uint8_t op2;          /* Second operand of the instruction. */
+   bool valid;           /* Indicates if the OP code and the operands are valid. */
+   uint8_t idle_length;  /* Number of instructions in the idle loop starting here (0 = none). */
+   uint8_t fusion;       /* Superinstruction starting here, see control_unit_fusion. */
+   uint8_t fused_length; /* Number of instructions in the superinstruction (0 = none). */
+   void (*execute)(struct cpu_context* self, const uint8_t op1, const uint8_t op2); /* Handler. */
+#if CONTROL_UNIT_THREADED_DISPATCH
+   const void* thread; /* Label of the handler in the threaded interpreter core. */
+#endif
+};
+
+/********************************************************************************
+* cpu_context: State of one emulated microcontroller. The architectural state,
+*              i.e. the control unit registers, the I/O pages of the data
+*              memory and the stack, is stored first, so that it can be saved
+*              and restored as one contiguous block, see cpu_snapshot.h. It's
+*              followed by the configuration of the machine, which is kept at
+*              reset. The RAM pages of the data memory are allocated on the
+*              first write and saved page by page.
+********************************************************************************/
+struct cpu_context
+{
+   /* Control unit: */
+   uint32_t ir;                                /* Instruction register, stores next instruction to execute. */
+   uint16_t pc;                                /* Program counter, stores address to next instruction to fetch. */
+   uint16_t mar;                               /* Memory address register, stores address for current instruction. */
+   uint8_t sr;                                 /* Status register, stores status bits ISNZVC. */
+   struct alu_flags flags;                     /* Last calculation, for lazy evaluation of SNZVC. */
+   uint8_t op_code;                            /* Stores OP-code, for example LDI, OUT, JMP etc. */
+   uint8_t op1;                                /* Stores first operand, most often a destination. */
+   uint8_t op2;                                /* Stores second operand, most often a value or read address. */
+   enum cpu_state state;                       /* Stores current state. */
+   uint8_t reg[CPU_REGISTER_ADDRESS_WIDTH];    /* CPU-registers R0 - R31. */
+   uint8_t pinb_previous;                      /* Stores previous input values of PINB (for monitoring). */
+   uint8_t pinc_previous;                      /* Stores previous input values of PINC (for monitoring). */
+   uint8_t pind_previous;                      /* Stores previous input values of PIND (for monitoring). */
+   uint8_t pcint_dirty;                        /* Ports whose PIN or PCMSK register has been written, see PCIFx. */
+   uint8_t irq_requests;                       /* Enabled interrupt requests, i.e. PCIFR & PCICR. */
+
+   /* Data memory: */
+   uint8_t data[DATA_MEMORY_IO_SIZE];          /* I/O pages of the data memory, see data_pages for the rest. */
+
+   /* Stack: */
+   uint8_t stack[STACK_ADDRESS_WIDTH];         /* 1 kB stack. */
+   uint16_t sp;                                /* Stack pointer, points to last added value. */
+   bool stack_empty;                           /* Indicates if the stack is empty. */
+
+   /* End of the architectural state, see CPU_CONTEXT_SNAPSHOT_SIZE. */
+   uint8_t events;                             /* Events occured during current run, see CONTROL_UNIT_STOP_ON_*. */
+
+   /* Dirty page tracking, see cpu_snapshot_mark_ctx: */
+   uint64_t data_dirty[DATA_MEMORY_DIRTY_WORDS]; /* Data memory pages written since the marker. */
+   uint64_t stack_dirty[STACK_DIRTY_WORDS];      /* Stack pages written since the marker. */
+
+   /* Data memory configuration: */
+   struct data_memory_page pages[DATA_MEMORY_NUM_PAGES]; /* Page table decoding data memory addresses. */
+   bool pages_initialized;                     /* Indicates if the page table has been set up. */
+   uint8_t* data_pages[DATA_MEMORY_NUM_PAGES]; /* RAM pages above the I/O pages, null until first written. */
+   uint8_t* data_initial;                      /* Initial content written at reset, null if not used. */
+   uint16_t data_initial_address;              /* Start address of the initial content. */
+   uint32_t data_initial_size;                 /* Number of bytes in the initial content. */
+
+   /* Program memory: */
+   uint32_t program[PROGRAM_MEMORY_ADDRESS_WIDTH]; /* Program memory with capacity for 65 536 instructions. */
+   bool program_initialized;                       /* Indicates if the program has been written. */
+   uint16_t entry_point;                           /* Address the program is started from at reset. */
+   struct program_memory_label* labels;            /* Labels of a loaded program, sorted by address. */
+   uint32_t num_labels;                            /* Number of labels set. */
+   uint32_t labels_capacity;                       /* Number of labels the table has room for. */
+   struct decoded_instruction decoded_program[PROGRAM_MEMORY_ADDRESS_WIDTH]; /* Pre-decoded program. */
+   bool threaded_program_valid;                    /* Indicates if the threaded labels are up to date. */
+   struct jit* jit;                                /* JIT compiler, only set while JIT compilation is enabled. */
+   struct profiler* profiler;                      /* Call-stack profiler, only set while profiling is enabled. */
+   struct trace* trace;                            /* Execution trace, only set while tracing is enabled. */
+   struct vcd* vcd;                                /* Waveform, only set while recording is enabled. */
+   struct breakpoints* breakpoints;                /* Breakpoints and watchpoints, only set while any is armed. */
+
+   /* Power-on snapshot: */
+   struct cpu_snapshot* power_on;                  /* State right after reset, restored at later resets. */
+   bool power_on_valid;                            /* Indicates if the power-on snapshot is up to date. */
+
+   /* Performance counters: */
+   struct perf_counters counters;                  /* Kept at reset, see perf_counters.h. */
+};
+
+/********************************************************************************
+* CPU_CONTEXT_SNAPSHOT_SIZE: Size of the architectural state at the start of
+*                            the CPU context, from the instruction register up
+*                            to and including the stack. The data memory pages
+*                            above the I/O pages are stored separately, see
+*                            data_pages.
+********************************************************************************/
+#define CPU_CONTEXT_SNAPSHOT_SIZE offsetof(struct cpu_context, events)
+
+/********************************************************************************
+* cpu_context_new: Returns a new heap allocated CPU context, reset and loaded
+*                  with the program. If the allocation fails, a null pointer
+*                  is returned.
+********************************************************************************/
+struct cpu_context* cpu_context_new(void);
+
+/********************************************************************************
+* cpu_context_delete: Deletes specified heap allocated CPU context and sets
+*                     the referenced pointer to null.
+*
+*                     - self: Reference to pointer to the CPU context.
+********************************************************************************/
+void cpu_context_delete(struct cpu_context** self);
+
+/********************************************************************************
+* cpu_context_default: Returns the default CPU context used by the global API.
+********************************************************************************/
+struct cpu_context* cpu_context_default(void);
+
+#endif /* CPU_CONTEXT_H_ */
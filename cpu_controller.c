@@ -1,145 +1,463 @@
-/********************************************************************************
-* cpu_controller.c: Contains functionality for control of the program flow
-*                   by input from the keyboard.
-********************************************************************************/
-#include "cpu_controller.h"
-
-/* Static functions: */
-static inline void print_information_at_start(void);
-static inline void print_menu(void);
-static int execute_selection(void);
-static uint8_t get_selection(void);
-static void readline(char* s,
-                     const int size);
-static inline uint8_t get_byte(void);
-
-/********************************************************************************
-* cpu_controller_run_by_input: Controls the program flow and input to the PINB
-*                              register by input from the keyboard.
-********************************************************************************/
-void cpu_controller_run_by_input(void)
-{
-   control_unit_reset();
-   print_information_at_start(); 
-
-   while (1)
-   {
-      control_unit_print();
-      print_menu();
-      if (execute_selection()) return;
-   }
-}
-
-/********************************************************************************
-* print_information_at_start: Prints information about connected devices.
-********************************************************************************/
-static inline void print_information_at_start(void)
-{
-   printf("A led is connected to pin 8 (PORTB0).\n");
-   printf("Press the button connected to pin 13 (PORTB5) to toggle the led.\n");
-   printf("To press the button, set the fifth bit of the PINB register, ");
-   printf("for instance by entering the value 32!\n\n");
-   return;
-}
-
-/********************************************************************************
-* print_menu: Prints menu for user control of program flow and input.
-********************************************************************************/
-static inline void print_menu(void)
-{
-   printf("Please select between the following alternatives:\n");
-   printf("1. Execute next instruction cycle\n");
-   printf("2. Run next clock cycle\n");
-   printf("3. Reset system\n");
-   printf("4. Enter new input for pin input register PINB\n");
-   printf("5. Finish execution\n\n");
-   return;
-}
-
-/********************************************************************************
-* execute_selection: Reads and executes user selection entered from keyboard.
-********************************************************************************/
-static int execute_selection(void)
-{
-   const uint8_t selection = get_selection();
-
-   if (selection == 1)
-   {
-      control_unit_run_next_instruction_cycle();
-   }
-   else if (selection == 2)
-   {
-      control_unit_run_next_state();
-   }
-   else if (selection == 3)
-   {
-      control_unit_reset();
-      printf("System reset!\n");
-   }
-   else if (selection == 4)
-   {
-      printf("Enter new data for pin input register PINB:\n");
-      const uint8_t input = get_byte();
-      data_memory_write(PINB, input);
-      printf("Wrote %s to pin input register PINB!\n\n", get_binary(input, 8));
-   }
-   else if (selection == 5)
-   {
-      printf("System exit!\n\n");
-      return 1;
-   }
-   return 0;
-}
-
-/********************************************************************************
-* get_selection: Retunrs user selection from keyboard after correct input.
-********************************************************************************/
-static uint8_t get_selection(void)
-{
-   while (1)
-   {
-      const uint8_t selection = get_byte();
-
-      if (selection >= 0 && selection <= 5)
-      {
-         return selection;
-      }
-      else
-      {
-         printf("Invalid input, try again!\n\n");
-      }
-   }
-}
-
-/********************************************************************************
-* readline: Reads text entered from keyboard into referenced string. 
-* 
-*           - s   : Reference to the string which stores entered content.
-*           - size: The capacity of the string.
-********************************************************************************/
-static void readline(char* s,
-                     const int size)
-{
-   fgets(s, size, stdin);
-   printf("\n");
-
-   for (char* i = s; *i; ++i)
-   {
-      if (*i == '\n')
-      {
-         *i = '\0';
-      }
-   }
-   return;
-}
-
-/********************************************************************************
-* get_byte: Returns an unsigned integer entered from the terminal.
-********************************************************************************/
-static inline uint8_t get_byte(void)
-{
-   char s[20] = { '\0' };
-   readline(s, sizeof(s));
-   return (uint8_t)atoi(s);
-}
-
+/********************************************************************************
+* cpu_controller.c: Contains functionality for control of the program flow
+*                   by input from the keyboard.
+********************************************************************************/
+#include "cpu_controller.h"
+
+/* Macro definitions: */
+#define PROFILE_PATH "profile.folded" /* File the collapsed call stacks are written to. */
+#define TRACE_PATH   "trace.bin"      /* File the execution trace is written to. */
+#define VCD_PATH     "waveform.vcd"   /* File the waveform is written to. */
+
+/* Static functions: */
+static inline void print_information_at_start(void);
+static inline void print_menu(void);
+static int execute_selection(void);
+static void toggle_profiler(void);
+static void toggle_trace(void);
+static void toggle_vcd(void);
+static uint8_t get_selection(void);
+static void readline(char* s,
+                     const int size);
+static inline uint8_t get_byte(void);
+
+/********************************************************************************
+* cpu_controller_run_by_input: Controls the program flow and input to the PINB
+*                              register by input from the keyboard.
+********************************************************************************/
+void cpu_controller_run_by_input(void)
+{
+   control_unit_reset();
+   print_information_at_start(); 
+
+   while (1)
+   {
+      control_unit_print();
+      print_menu();
+      if (execute_selection()) return;
+   }
+}
+
+/********************************************************************************
+* cpu_controller_load_program: Loads the program at specified path into the
+*                              program memory in place of the built-in program.
+*                              Program images are loaded as is, while other
+*                              files are assembled first, in which case the
+*                              symbol table is printed. Success code 0 is
+*                              returned on success, otherwise error code 1 is
+*                              returned.
+*
+*                              - path: Path to the program image or assembly
+*                                      source file.
+********************************************************************************/
+int cpu_controller_load_program(const char* path)
+{
+   if (program_image_detect(path))
+   {
+      if (program_image_load_ctx(cpu_context_default(), path))
+      {
+         printf("Failed to load program image %s!\n\n", path);
+         return 1;
+      }
+
+      printf("Loaded program image %s!\n\n", path);
+      return 0;
+   }
+
+   struct assembler_program* program = (struct assembler_program*)malloc(sizeof(struct assembler_program));
+   if (!program) return 1;
+
+   if (assembler_assemble_file(program, path))
+   {
+      printf("Failed to assemble %s: %s\n\n", path, program->error);
+      free(program);
+      return 1;
+   }
+
+   printf("Assembled %s!\n", path);
+   assembler_print_symbols(program, stdout);
+   assembler_load_ctx(cpu_context_default(), program);
+   free(program);
+   return 0;
+}
+
+/********************************************************************************
+* cpu_controller_build_image: Assembles the source file at specified path and
+*                             writes the result as a program image. An
+*                             existing file at the image path is only
+*                             overwritten if it's a program image, so that a
+*                             source file passed by mistake isn't lost.
+*                             Success code 0 is returned on success, otherwise
+*                             error code 1 is returned.
+*
+*                             - source_path: Path to the assembly source file.
+*                             - image_path : Path to the image file to write.
+********************************************************************************/
+int cpu_controller_build_image(const char* source_path,
+                               const char* image_path)
+{
+   struct assembler_program* program = (struct assembler_program*)malloc(sizeof(struct assembler_program));
+   int result = 1;
+   if (!program) return 1;
+
+   FILE* existing = fopen(image_path, "rb");
+   const bool overwritable = !existing || program_image_detect(image_path);
+   if (existing) fclose(existing);
+
+   if (!overwritable)
+   {
+      printf("Refusing to overwrite %s, which isn't a program image!\n", image_path);
+   }
+   else if (assembler_assemble_file(program, source_path))
+   {
+      printf("Failed to assemble %s: %s\n", source_path, program->error);
+   }
+   else if (program_image_write(program, RESET_vect, image_path))
+   {
+      printf("Failed to write program image %s!\n", image_path);
+   }
+   else
+   {
+      printf("Wrote program image %s (%u instructions)!\n", image_path, (unsigned)program->code_size);
+      result = 0;
+   }
+
+   free(program);
+   return result;
+}
+
+/********************************************************************************
+* cpu_controller_run_stimulus: Runs the loaded program without keyboard input
+*                              while the pin input registers are driven by
+*                              the stimulus file at specified path. The run
+*                              starts from reset and continues until the
+*                              last write has been applied or, if set, the
+*                              specified number of clock cycles has been run.
+*                              A summary of the run is printed. Success code
+*                              0 is returned on success, otherwise error code
+*                              1 is returned.
+*
+*                              - path      : Path to the stimulus file.
+*                              - max_cycles: Number of clock cycles to run
+*                                            (0 = until the last write).
+*                              - vcd_path  : Path to a VCD file to record the
+*                                            waveform to (0 = none).
+********************************************************************************/
+int cpu_controller_run_stimulus(const char* path,
+                                const uint64_t max_cycles,
+                                const char* vcd_path)
+{
+   const struct control_unit_run_config config = { 0, max_cycles, 0, 0 };
+   struct stimulus* stimulus = stimulus_open(path);
+
+   if (!stimulus)
+   {
+      printf("Failed to open stimulus file %s!\n", path);
+      return 1;
+   }
+
+   control_unit_reset();
+
+   if (vcd_path && vcd_enable(true, vcd_path))
+   {
+      printf("Failed to create %s!\n", vcd_path);
+      stimulus_close(&stimulus);
+      return 1;
+   }
+
+   const struct control_unit_result result = stimulus_run(stimulus, &config);
+   const char* error = stimulus_error(stimulus);
+   const bool vcd_failed = vcd_path && vcd_enable(false, 0);
+
+   printf("Ran stimulus %s: %llu instructions, %llu cycles, %llu writes applied (%s)\n\n",
+          path, (unsigned long long)result.num_instructions, (unsigned long long)result.num_cycles,
+          (unsigned long long)stimulus_num_applied(stimulus), control_unit_stop_reason_name(result.stop_reason));
+   if (error) printf("Invalid stimulus file %s: %s\n\n", path, error);
+   if (vcd_failed) printf("Failed to write %s!\n\n", vcd_path);
+   control_unit_print();
+
+   stimulus_close(&stimulus);
+   return error || vcd_failed ? 1 : 0;
+}
+
+/********************************************************************************
+* cpu_controller_run_gdb: Runs the loaded program from reset under control of
+*                         a debugger connecting to specified address, see
+*                         gdb_stub_serve_ctx, until the debugger detaches or
+*                         disconnects. Success code 0 is returned on success,
+*                         otherwise error code 1 is returned.
+*
+*                         - address: Loopback TCP port or Unix socket path
+*                                    to listen to.
+********************************************************************************/
+int cpu_controller_run_gdb(const char* address)
+{
+   control_unit_reset();
+   printf("Waiting for a debugger to connect to %s...\n", address);
+   fflush(stdout);
+
+   if (gdb_stub_serve(address))
+   {
+      printf("Failed to serve a debugger at %s!\n", address);
+      return 1;
+   }
+
+   printf("Debugger session ended!\n\n");
+   control_unit_print();
+   return 0;
+}
+
+/********************************************************************************
+* print_information_at_start: Prints information about connected devices.
+********************************************************************************/
+static inline void print_information_at_start(void)
+{
+   printf("A led is connected to pin 8 (PORTB0).\n");
+   printf("Press the button connected to pin 13 (PORTB5) to toggle the led.\n");
+   printf("To press the button, set the fifth bit of the PINB register, ");
+   printf("for instance by entering the value 32!\n\n");
+   return;
+}
+
+/********************************************************************************
+* print_menu: Prints menu for user control of program flow and input.
+********************************************************************************/
+static inline void print_menu(void)
+{
+   printf("Please select between the following alternatives:\n");
+   printf("1. Execute next instruction cycle\n");
+   printf("2. Run next clock cycle\n");
+   printf("3. Reset system\n");
+   printf("4. Enter new input for pin input register PINB\n");
+   printf("5. Run until PORTB changes or an interrupt occurs\n");
+   printf("6. Toggle JIT compilation (currently %s)\n", control_unit_jit_enabled() ? "enabled" : "disabled");
+   printf("7. Print performance counters\n");
+   printf("8. Toggle call-stack profiler (currently %s)\n", profiler_enabled() ? "enabled" : "disabled");
+   printf("9. Toggle execution trace (currently %s)\n", trace_enabled() ? "enabled" : "disabled");
+   printf("10. Toggle waveform recording (currently %s)\n", vcd_enabled() ? "enabled" : "disabled");
+   printf("11. Finish execution\n\n");
+   return;
+}
+
+/********************************************************************************
+* execute_selection: Reads and executes user selection entered from keyboard.
+********************************************************************************/
+static int execute_selection(void)
+{
+   const uint8_t selection = get_selection();
+
+   if (selection == 1)
+   {
+      control_unit_run_next_instruction_cycle();
+   }
+   else if (selection == 2)
+   {
+      control_unit_run_next_state();
+   }
+   else if (selection == 3)
+   {
+      control_unit_reset();
+      printf("System reset!\n");
+   }
+   else if (selection == 4)
+   {
+      printf("Enter new data for pin input register PINB:\n");
+      const uint8_t input = get_byte();
+      data_memory_write(PINB, input);
+      printf("Wrote %s to pin input register PINB!\n\n", get_binary(input, 8));
+   }
+   else if (selection == 5)
+   {
+      const struct control_unit_run_config config = 
+      { 
+         1000000, 0, CONTROL_UNIT_STOP_ON_PORTB_CHANGE | CONTROL_UNIT_STOP_ON_INTERRUPT |
+         CONTROL_UNIT_STOP_ON_STACK_ERROR | CONTROL_UNIT_STOP_ON_INVALID_OP_CODE |
+         CONTROL_UNIT_STOP_ON_MEMORY_ERROR, 0 
+      };
+      const struct control_unit_result result = control_unit_run(&config);
+      printf("Ran %llu instructions (%llu clock cycles), stop reason: %s!\n\n", 
+             (unsigned long long)result.num_instructions, (unsigned long long)result.num_cycles,
+             control_unit_stop_reason_name(result.stop_reason));
+   }
+   else if (selection == 6)
+   {
+      if (control_unit_enable_jit(!control_unit_jit_enabled()))
+      {
+         printf("JIT compilation is not supported on this platform!\n\n");
+      }
+      else
+      {
+         printf("JIT compilation %s!\n\n", control_unit_jit_enabled() ? "enabled" : "disabled");
+      }
+   }
+   else if (selection == 7)
+   {
+      perf_counters_print(stdout);
+   }
+   else if (selection == 8)
+   {
+      toggle_profiler();
+   }
+   else if (selection == 9)
+   {
+      toggle_trace();
+   }
+   else if (selection == 10)
+   {
+      toggle_vcd();
+   }
+   else if (selection == 11)
+   {
+      printf("System exit!\n\n");
+      return 1;
+   }
+   return 0;
+}
+
+/********************************************************************************
+* toggle_profiler: Enables or disables the call-stack profiler. When disabled,
+*                  the collapsed stacks are written to PROFILE_PATH first, so
+*                  that a flame graph can be drawn, for instance by running
+*                  flamegraph.pl profile.folded > profile.svg.
+********************************************************************************/
+static void toggle_profiler(void)
+{
+   if (!profiler_enabled())
+   {
+      if (profiler_enable(true, PROFILER_DEFAULT_INTERVAL))
+      {
+         printf("Failed to enable the profiler!\n\n");
+      }
+      else
+      {
+         printf("Profiler enabled, sampling every %u clock cycles!\n\n", PROFILER_DEFAULT_INTERVAL);
+      }
+      return;
+   }
+
+   FILE* file = fopen(PROFILE_PATH, "w");
+
+   if (!file || profiler_write_collapsed(file))
+   {
+      printf("Failed to write %s!\n", PROFILE_PATH);
+   }
+   else
+   {
+      printf("Wrote collapsed call stacks to %s!\n", PROFILE_PATH);
+   }
+
+   if (file) fclose(file);
+   profiler_enable(false, 0);
+   printf("Profiler disabled!\n\n");
+   return;
+}
+
+/********************************************************************************
+* toggle_trace: Starts or stops writing an execution trace to TRACE_PATH. The
+*               trace is turned into text by passing the trace file as
+*               argument to the program.
+********************************************************************************/
+static void toggle_trace(void)
+{
+   if (!trace_enabled())
+   {
+      if (trace_enable(true, TRACE_PATH))
+      {
+         printf("Failed to create %s!\n\n", TRACE_PATH);
+      }
+      else
+      {
+         printf("Writing execution trace to %s!\n\n", TRACE_PATH);
+      }
+   }
+   else if (trace_enable(false, 0))
+   {
+      printf("Failed to write %s!\n\n", TRACE_PATH);
+   }
+   else
+   {
+      printf("Wrote execution trace to %s!\n\n", TRACE_PATH);
+   }
+   return;
+}
+
+/********************************************************************************
+* toggle_vcd: Starts or stops recording a waveform of the I/O registers to
+*             VCD_PATH, which can be opened in a waveform viewer.
+********************************************************************************/
+static void toggle_vcd(void)
+{
+   if (!vcd_enabled())
+   {
+      if (vcd_enable(true, VCD_PATH))
+      {
+         printf("Failed to create %s!\n\n", VCD_PATH);
+      }
+      else
+      {
+         printf("Writing waveform to %s!\n\n", VCD_PATH);
+      }
+   }
+   else if (vcd_enable(false, 0))
+   {
+      printf("Failed to write %s!\n\n", VCD_PATH);
+   }
+   else
+   {
+      printf("Wrote waveform to %s!\n\n", VCD_PATH);
+   }
+   return;
+}
+
+/********************************************************************************
+* get_selection: Retunrs user selection from keyboard after correct input.
+********************************************************************************/
+static uint8_t get_selection(void)
+{
+   while (1)
+   {
+      const uint8_t selection = get_byte();
+
+      if (selection <= 11)
+      {
+         return selection;
+      }
+      else
+      {
+         printf("Invalid input, try again!\n\n");
+      }
+   }
+}
+
+/********************************************************************************
+* readline: Reads text entered from keyboard into referenced string. 
+* 
+*           - s   : Reference to the string which stores entered content.
+*           - size: The capacity of the string.
+********************************************************************************/
+static void readline(char* s,
+                     const int size)
+{
+   fgets(s, size, stdin);
+   printf("\n");
+
+   for (char* i = s; *i; ++i)
+   {
+      if (*i == '\n')
+      {
+         *i = '\0';
+      }
+   }
+   return;
+}
+
+/********************************************************************************
+* get_byte: Returns an unsigned integer entered from the terminal.
+********************************************************************************/
+static inline uint8_t get_byte(void)
+{
+   char s[20] = { '\0' };
+   readline(s, sizeof(s));
+   return (uint8_t)atoi(s);
+}
+
@@ -1,18 +1,88 @@
-/********************************************************************************
-* cpu_controller.h: Contains functionality for control of the program flow 
-*                   by input from the keyboard.
-********************************************************************************/
-#ifndef CPU_CONTROLLER_H_
-#define CPU_CONTROLLER_H_
-
-/* Include directives: */
-#include "cpu.h"
-#include "control_unit.h"
-
-/********************************************************************************
-* cpu_controller_run_by_input: Controls the program flow and input to the PINB
-*                              register by input from the keyboard.
-********************************************************************************/
-void cpu_controller_run_by_input(void);
-
+/********************************************************************************
+* cpu_controller.h: Contains functionality for control of the program flow 
+*                   by input from the keyboard.
+********************************************************************************/
+#ifndef CPU_CONTROLLER_H_
+#define CPU_CONTROLLER_H_
+
+/* Include directives: */
+#include "cpu.h"
+#include "control_unit.h"
+#include "assembler.h"
+#include "program_image.h"
+#include "perf_counters.h"
+#include "profiler.h"
+#include "trace.h"
+#include "stimulus.h"
+#include "vcd.h"
+#include "gdb_stub.h"
+
+/********************************************************************************
+* cpu_controller_run_by_input: Controls the program flow and input to the PINB
+*                              register by input from the keyboard.
+********************************************************************************/
+void cpu_controller_run_by_input(void);
+
+/********************************************************************************
+* cpu_controller_load_program: Loads the program at specified path into the
+*                              program memory in place of the built-in program.
+*                              Program images are loaded as is, while other
+*                              files are assembled first, in which case the
+*                              symbol table is printed. Success code 0 is
+*                              returned on success, otherwise error code 1 is
+*                              returned.
+*
+*                              - path: Path to the program image or assembly
+*                                      source file.
+********************************************************************************/
+int cpu_controller_load_program(const char* path);
+
+/********************************************************************************
+* cpu_controller_build_image: Assembles the source file at specified path and
+*                             writes the result as a program image. An
+*                             existing file at the image path is only
+*                             overwritten if it's a program image, so that a
+*                             source file passed by mistake isn't lost.
+*                             Success code 0 is returned on success, otherwise
+*                             error code 1 is returned.
+*
+*                             - source_path: Path to the assembly source file.
+*                             - image_path : Path to the image file to write.
+********************************************************************************/
+int cpu_controller_build_image(const char* source_path,
+                               const char* image_path);
+
+/********************************************************************************
+* cpu_controller_run_stimulus: Runs the loaded program without keyboard input
+*                              while the pin input registers are driven by
+*                              the stimulus file at specified path. The run
+*                              starts from reset and continues until the
+*                              last write has been applied or, if set, the
+*                              specified number of clock cycles has been run.
+*                              A summary of the run is printed. Success code
+*                              0 is returned on success, otherwise error code
+*                              1 is returned.
+*
+*                              - path      : Path to the stimulus file.
+*                              - max_cycles: Number of clock cycles to run
+*                                            (0 = until the last write).
+*                              - vcd_path  : Path to a VCD file to record the
+*                                            waveform to (0 = none).
+********************************************************************************/
+int cpu_controller_run_stimulus(const char* path,
+                                const uint64_t max_cycles,
+                                const char* vcd_path);
+
+/********************************************************************************
+* cpu_controller_run_gdb: Runs the loaded program from reset under control of
+*                         a debugger connecting to specified address, see
+*                         gdb_stub_serve_ctx, until the debugger detaches or
+*                         disconnects. Success code 0 is returned on success,
+*                         otherwise error code 1 is returned.
+*
+*                         - address: Loopback TCP port or Unix socket path
+*                                    to listen to.
+********************************************************************************/
+int cpu_controller_run_gdb(const char* address);
+
 #endif /* CPU_CONTROLLER_H_ */
\ No newline at end of file
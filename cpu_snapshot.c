@@ -0,0 +1,445 @@
+/********************************************************************************
+* cpu_snapshot.c: Contains function definitions for saving and restoring the
+*                 architectural state of a CPU context as one memcpy, followed
+*                 by the allocated RAM pages of the data memory.
+********************************************************************************/
+#include "cpu_snapshot.h"
+
+#include <string.h>
+
+/* Static functions: */
+static int save_page(const struct cpu_context* self,
+                     struct cpu_snapshot* snapshot,
+                     const uint16_t page);
+static int restore_page(struct cpu_context* self,
+                        const struct cpu_snapshot* snapshot,
+                        const uint16_t page);
+static void copy_written(uint8_t* destination,
+                         const uint8_t* source,
+                         const struct cpu_context* self);
+static void copy_pages(uint8_t* destination,
+                       const uint8_t* source,
+                       const uint64_t* bitmap,
+                       const uint16_t num_words,
+                       const uint16_t page_size,
+                       const uint16_t memory_size);
+static inline bool page_written(const uint64_t* bitmap,
+                                const uint16_t page);
+static inline bool data_page_written(const uint64_t* bitmap,
+                                     const uint16_t page);
+static inline uint8_t data_content(const uint8_t* io,
+                                   uint8_t* const* pages,
+                                   const uint16_t address);
+
+/********************************************************************************
+* cpu_snapshot_new: Returns a new heap allocated snapshot. The content is
+*                   undefined until the snapshot is saved. If the allocation
+*                   fails, a null pointer is returned.
+********************************************************************************/
+struct cpu_snapshot* cpu_snapshot_new(void)
+{
+   return (struct cpu_snapshot*)calloc(1, sizeof(struct cpu_snapshot));
+}
+
+/********************************************************************************
+* cpu_snapshot_delete: Deletes specified heap allocated snapshot along with
+*                      its saved pages and sets the referenced pointer to null.
+*
+*                      - self: Reference to pointer to the snapshot.
+********************************************************************************/
+void cpu_snapshot_delete(struct cpu_snapshot** self)
+{
+   if (!*self) return;
+
+   for (uint16_t page = 0; page < DATA_MEMORY_NUM_PAGES; ++page)
+   {
+      free((*self)->pages[page]);
+   }
+
+   free(*self);
+   *self = 0;
+   return;
+}
+
+/********************************************************************************
+* cpu_snapshot_save_ctx: Saves the architectural state of specified CPU
+*                        context in referenced snapshot. Success code 0 is
+*                        returned on success, otherwise error code 1 is
+*                        returned if memory for a page can't be allocated.
+*
+*                        - self    : Reference to the CPU context.
+*                        - snapshot: Reference to the snapshot.
+********************************************************************************/
+int cpu_snapshot_save_ctx(const struct cpu_context* self,
+                          struct cpu_snapshot* snapshot)
+{
+   int result = 0;
+   memcpy(snapshot->state, self, CPU_CONTEXT_SNAPSHOT_SIZE);
+
+   for (uint16_t page = DATA_MEMORY_NUM_IO_PAGES; page < DATA_MEMORY_NUM_PAGES; ++page)
+   {
+      if (save_page(self, snapshot, page)) result = 1;
+   }
+   return result;
+}
+
+/********************************************************************************
+* cpu_snapshot_restore_ctx: Restores the architectural state of specified CPU
+*                           context from referenced snapshot. The shadow call
+*                           stack of the profiler, if any, is cleared. Success
+*                           code 0 is returned on success, otherwise error
+*                           code 1 is returned if memory for a page can't be
+*                           allocated.
+*
+*                           - self    : Reference to the CPU context.
+*                           - snapshot: Reference to the snapshot.
+********************************************************************************/
+int cpu_snapshot_restore_ctx(struct cpu_context* self,
+                             const struct cpu_snapshot* snapshot)
+{
+   int result = 0;
+   memcpy(self, snapshot->state, CPU_CONTEXT_SNAPSHOT_SIZE);
+
+   for (uint16_t page = DATA_MEMORY_NUM_IO_PAGES; page < DATA_MEMORY_NUM_PAGES; ++page)
+   {
+      if (restore_page(self, snapshot, page)) result = 1;
+   }
+
+   memset(self->data_dirty, 0xFF, sizeof(self->data_dirty));
+   memset(self->stack_dirty, 0xFF, sizeof(self->stack_dirty));
+   if (self->profiler) profiler_reset_stack(self->profiler);
+   return result;
+}
+
+/********************************************************************************
+* cpu_snapshot_mark_ctx: Sets the marker of specified CPU context, i.e. clears
+*                        the dirty bitmaps of the data memory and the stack.
+*
+*                        - self: Reference to the CPU context.
+********************************************************************************/
+void cpu_snapshot_mark_ctx(struct cpu_context* self)
+{
+   memset(self->data_dirty, 0, sizeof(self->data_dirty));
+   memset(self->stack_dirty, 0, sizeof(self->stack_dirty));
+   return;
+}
+
+/********************************************************************************
+* cpu_snapshot_save_incremental_ctx: Updates referenced snapshot, which must
+*                                    hold the state of specified CPU context
+*                                    when the marker was set, to the current
+*                                    state by copying the registers and the
+*                                    pages written since. The marker is then
+*                                    set at the current state. Success code 0
+*                                    is returned on success, otherwise error
+*                                    code 1 is returned if memory for a page
+*                                    can't be allocated.
+*
+*                                    - self    : Reference to the CPU context.
+*                                    - snapshot: Reference to the snapshot.
+********************************************************************************/
+int cpu_snapshot_save_incremental_ctx(struct cpu_context* self,
+                                      struct cpu_snapshot* snapshot)
+{
+   int result = 0;
+   copy_written(snapshot->state, (const uint8_t*)self, self);
+
+   for (uint16_t page = DATA_MEMORY_NUM_IO_PAGES; page < DATA_MEMORY_NUM_PAGES; ++page)
+   {
+      if (data_page_written(self->data_dirty, page) && save_page(self, snapshot, page)) result = 1;
+   }
+
+   cpu_snapshot_mark_ctx(self);
+   return result;
+}
+
+/********************************************************************************
+* cpu_snapshot_restore_incremental_ctx: Restores specified CPU context to the
+*                                       state when the marker was set, held
+*                                       by referenced snapshot, by copying
+*                                       the registers and the pages written
+*                                       since. The marker is kept, so the
+*                                       snapshot can be restored again.
+*                                       Success code 0 is returned on
+*                                       success, otherwise error code 1 is
+*                                       returned if memory for a page can't
+*                                       be allocated.
+*
+*                                       - self    : Reference to the CPU context.
+*                                       - snapshot: Reference to the snapshot.
+********************************************************************************/
+int cpu_snapshot_restore_incremental_ctx(struct cpu_context* self,
+                                         const struct cpu_snapshot* snapshot)
+{
+   int result = 0;
+   copy_written((uint8_t*)self, snapshot->state, self);
+
+   for (uint16_t page = DATA_MEMORY_NUM_IO_PAGES; page < DATA_MEMORY_NUM_PAGES; ++page)
+   {
+      if (data_page_written(self->data_dirty, page) && restore_page(self, snapshot, page)) result = 1;
+   }
+
+   cpu_snapshot_mark_ctx(self);
+   if (self->profiler) profiler_reset_stack(self->profiler);
+   return result;
+}
+
+/********************************************************************************
+* cpu_snapshot_diff_ctx: Lists the data memory and stack addresses of specified
+*                        CPU context whose content differs from referenced
+*                        snapshot, which must hold the state when the marker
+*                        was set. Only pages written since are compared. The
+*                        total number of changed addresses is returned, while
+*                        at most the specified number of changes are stored,
+*                        in address order with the data memory first.
+*
+*                        - self       : Reference to the CPU context.
+*                        - snapshot   : Reference to the snapshot.
+*                        - changes    : Reference to array storing the changes.
+*                        - max_changes: Capacity of the array.
+********************************************************************************/
+uint32_t cpu_snapshot_diff_ctx(const struct cpu_context* self,
+                               const struct cpu_snapshot* snapshot,
+                               struct cpu_snapshot_change* changes,
+                               const uint32_t max_changes)
+{
+   const uint8_t* data = snapshot->state + offsetof(struct cpu_context, data);
+   const uint8_t* stack = snapshot->state + offsetof(struct cpu_context, stack);
+   uint32_t num_changes = 0;
+
+   for (uint32_t address = 0; address < DATA_MEMORY_ADDRESS_WIDTH; ++address)
+   {
+      if (!page_written(self->data_dirty, address / DATA_MEMORY_DIRTY_PAGE_SIZE))
+      {
+         address |= DATA_MEMORY_DIRTY_PAGE_SIZE - 1; /* Skips the rest of the page. */
+         continue;
+      }
+
+      const uint8_t before = data_content(data, snapshot->pages, (uint16_t)address);
+      const uint8_t after = data_content(self->data, self->data_pages, (uint16_t)address);
+
+      if (before != after)
+      {
+         if (num_changes < max_changes)
+         {
+            const struct cpu_snapshot_change change = { CPU_SNAPSHOT_REGION_DATA, (uint16_t)address, before, after };
+            changes[num_changes] = change;
+         }
+         num_changes++;
+      }
+   }
+
+   for (uint16_t address = 0; address < STACK_ADDRESS_WIDTH; ++address)
+   {
+      if (!page_written(self->stack_dirty, address / STACK_DIRTY_PAGE_SIZE))
+      {
+         address |= STACK_DIRTY_PAGE_SIZE - 1;
+      }
+      else if (stack[address] != self->stack[address])
+      {
+         if (num_changes < max_changes)
+         {
+            const struct cpu_snapshot_change change = { CPU_SNAPSHOT_REGION_STACK, address, stack[address], self->stack[address] };
+            changes[num_changes] = change;
+         }
+         num_changes++;
+      }
+   }
+   return num_changes;
+}
+
+/********************************************************************************
+* cpu_snapshot_save: Saves the architectural state of the default CPU context
+*                    in referenced snapshot, see cpu_snapshot_save_ctx.
+*
+*                    - snapshot: Reference to the snapshot.
+********************************************************************************/
+int cpu_snapshot_save(struct cpu_snapshot* snapshot)
+{
+   return cpu_snapshot_save_ctx(cpu_context_default(), snapshot);
+}
+
+/********************************************************************************
+* cpu_snapshot_restore: Restores the architectural state of the default CPU
+*                       context from referenced snapshot, see
+*                       cpu_snapshot_restore_ctx.
+*
+*                       - snapshot: Reference to the snapshot.
+********************************************************************************/
+int cpu_snapshot_restore(const struct cpu_snapshot* snapshot)
+{
+   return cpu_snapshot_restore_ctx(cpu_context_default(), snapshot);
+}
+
+/********************************************************************************
+* save_page: Saves specified RAM page of the data memory of specified CPU
+*            context in referenced snapshot. A page the context hasn't
+*            allocated holds zeros only, which is saved by clearing the copy,
+*            if any. Error code 1 is returned if the copy can't be allocated.
+*
+*            - self    : Reference to the CPU context.
+*            - snapshot: Reference to the snapshot.
+*            - page    : The page to save.
+********************************************************************************/
+static int save_page(const struct cpu_context* self,
+                     struct cpu_snapshot* snapshot,
+                     const uint16_t page)
+{
+   if (!self->data_pages[page])
+   {
+      if (snapshot->pages[page]) memset(snapshot->pages[page], 0, DATA_MEMORY_PAGE_SIZE);
+      return 0;
+   }
+
+   if (!snapshot->pages[page])
+   {
+      snapshot->pages[page] = (uint8_t*)malloc(DATA_MEMORY_PAGE_SIZE);
+      if (!snapshot->pages[page]) return 1;
+   }
+
+   memcpy(snapshot->pages[page], self->data_pages[page], DATA_MEMORY_PAGE_SIZE);
+   return 0;
+}
+
+/********************************************************************************
+* restore_page: Restores specified RAM page of the data memory of specified
+*               CPU context from referenced snapshot. The page is allocated
+*               if the snapshot holds a copy of it, otherwise an allocated
+*               page is cleared. Error code 1 is returned if the page can't
+*               be allocated.
+*
+*               - self    : Reference to the CPU context.
+*               - snapshot: Reference to the snapshot.
+*               - page    : The page to restore.
+********************************************************************************/
+static int restore_page(struct cpu_context* self,
+                        const struct cpu_snapshot* snapshot,
+                        const uint16_t page)
+{
+   if (!snapshot->pages[page])
+   {
+      if (self->data_pages[page]) memset(self->data_pages[page], 0, DATA_MEMORY_PAGE_SIZE);
+      return 0;
+   }
+
+   uint8_t* memory = data_memory_page_data_ctx(self, (uint8_t)page, true);
+   if (!memory) return 1;
+   memcpy(memory, snapshot->pages[page], DATA_MEMORY_PAGE_SIZE);
+   return 0;
+}
+
+/********************************************************************************
+* copy_written: Copies the registers and the data memory and stack pages
+*               written since the marker of specified CPU context between two
+*               copies of the architectural state. The RAM pages of the data
+*               memory aren't part of the copies, see save_page. The copies
+*               are laid out as the start of a CPU context, see
+*               CPU_CONTEXT_SNAPSHOT_SIZE.
+*
+*               - destination: Reference to the state to copy to.
+*               - source     : Reference to the state to copy from.
+*               - self       : Reference to the CPU context holding the bitmaps.
+********************************************************************************/
+static void copy_written(uint8_t* destination,
+                         const uint8_t* source,
+                         const struct cpu_context* self)
+{
+   const size_t data = offsetof(struct cpu_context, data);
+   const size_t stack = offsetof(struct cpu_context, stack);
+   const size_t stack_end = offsetof(struct cpu_context, sp);
+
+   /* The control unit registers are stored before the data memory, the stack pointer after the stack. */
+   memcpy(destination, source, data);
+   memcpy(destination + stack_end, source + stack_end, CPU_CONTEXT_SNAPSHOT_SIZE - stack_end);
+
+   copy_pages(destination + data, source + data, self->data_dirty, DATA_MEMORY_DIRTY_WORDS,
+              DATA_MEMORY_DIRTY_PAGE_SIZE, DATA_MEMORY_IO_SIZE);
+   copy_pages(destination + stack, source + stack, self->stack_dirty, STACK_DIRTY_WORDS,
+              STACK_DIRTY_PAGE_SIZE, STACK_ADDRESS_WIDTH);
+   return;
+}
+
+/********************************************************************************
+* copy_pages: Copies the pages marked as written in referenced dirty bitmap
+*             from one memory to another. Each word of the bitmap is shifted
+*             until no marked pages remain, so unwritten memory at the end of
+*             each word is skipped without being checked.
+*
+*             - destination: Reference to the memory to copy to.
+*             - source     : Reference to the memory to copy from.
+*             - bitmap     : Reference to the dirty bitmap.
+*             - num_words  : Number of 64-bit words in the bitmap.
+*             - page_size  : Number of bytes per page.
+*             - memory_size: Number of bytes in the memory.
+********************************************************************************/
+static void copy_pages(uint8_t* destination,
+                       const uint8_t* source,
+                       const uint64_t* bitmap,
+                       const uint16_t num_words,
+                       const uint16_t page_size,
+                       const uint16_t memory_size)
+{
+   for (uint16_t word = 0; word < num_words; ++word)
+   {
+      uint32_t start = (uint32_t)word * 64 * page_size;
+
+      for (uint64_t pages = bitmap[word]; pages && start < memory_size; pages >>= 1, start += page_size)
+      {
+         if (pages & 1)
+         {
+            memcpy(destination + start, source + start, start + page_size <= memory_size ? page_size : memory_size - start);
+         }
+      }
+   }
+   return;
+}
+
+/********************************************************************************
+* page_written: Indicates if specified page is marked as written in referenced
+*               dirty bitmap.
+*
+*               - bitmap: Reference to the dirty bitmap.
+*               - page  : The page to check.
+********************************************************************************/
+static inline bool page_written(const uint64_t* bitmap,
+                                const uint16_t page)
+{
+   return (bitmap[page / 64] >> (page % 64)) & 1;
+}
+
+/********************************************************************************
+* data_page_written: Indicates if any part of specified data memory page is
+*                    marked as written in referenced dirty bitmap.
+*
+*                    - bitmap: Reference to the dirty bitmap.
+*                    - page  : The data memory page to check.
+********************************************************************************/
+static inline bool data_page_written(const uint64_t* bitmap,
+                                     const uint16_t page)
+{
+   const uint16_t parts = DATA_MEMORY_PAGE_SIZE / DATA_MEMORY_DIRTY_PAGE_SIZE;
+
+   for (uint16_t i = 0; i < parts; ++i)
+   {
+      if (page_written(bitmap, page * parts + i)) return true;
+   }
+   return false;
+}
+
+/********************************************************************************
+* data_content: Returns the content of specified data memory address, stored
+*               as I/O pages followed by RAM pages, where a missing page holds
+*               zeros only.
+*
+*               - io     : Reference to the I/O pages.
+*               - pages  : Reference to the RAM pages.
+*               - address: The address to read.
+********************************************************************************/
+static inline uint8_t data_content(const uint8_t* io,
+                                   uint8_t* const* pages,
+                                   const uint16_t address)
+{
+   if (address < DATA_MEMORY_IO_SIZE) return io[address];
+   const uint8_t* page = pages[address / DATA_MEMORY_PAGE_SIZE];
+   return page ? page[address % DATA_MEMORY_PAGE_SIZE] : 0x00;
+}
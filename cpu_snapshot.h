@@ -0,0 +1,191 @@
+/********************************************************************************
+* cpu_snapshot.h: Contains function declarations for saving and restoring the
+*                 architectural state of a CPU context, i.e. the control unit
+*                 registers (including the program counter, the status
+*                 register and the instruction cycle state), the data memory
+*                 and the stack. The registers, the I/O pages of the data
+*                 memory and the stack are stored as one contiguous block,
+*                 while the RAM pages of the data memory are stored page by
+*                 page, only for the pages allocated by the CPU context.
+*
+*                 The configuration of the CPU context, such as the program,
+*                 the initial data memory content and the memory mapped I/O,
+*                 isn't part of the snapshot, so a snapshot should only be
+*                 restored into a context running the same program. The
+*                 performance counters aren't part of the snapshot either.
+*
+*                 System reset restores a power-on snapshot taken at the first
+*                 reset after the program or the initial data memory content
+*                 has been changed, see control_unit_reset_ctx.
+*
+*                 Writes to the data memory and the stack are tracked per page
+*                 of 64 bytes in dirty bitmaps, which are cleared by setting a
+*                 marker. A snapshot saved when the marker was set can then be
+*                 updated or restored by copying the registers and the written
+*                 pages only, and the changes since the marker can be listed.
+*                 For instance, to explore several paths from the same state:
+*
+*                 cpu_snapshot_save_ctx(cpu, &start);
+*                 cpu_snapshot_mark_ctx(cpu);
+*                 run path 1, then cpu_snapshot_restore_incremental_ctx(cpu, &start);
+*                 run path 2, then cpu_snapshot_restore_incremental_ctx(cpu, &start);
+*
+*                 Full restores (and thereby resets) mark all pages as written.
+********************************************************************************/
+#ifndef CPU_SNAPSHOT_H_
+#define CPU_SNAPSHOT_H_
+
+/* Include directives: */
+#include "cpu.h"
+#include "cpu_context.h"
+
+/********************************************************************************
+* cpu_snapshot: Architectural state of a CPU context.
+********************************************************************************/
+struct cpu_snapshot
+{
+   uint8_t state[CPU_CONTEXT_SNAPSHOT_SIZE]; /* Copy of the start of the CPU context. */
+   uint8_t* pages[DATA_MEMORY_NUM_PAGES];    /* Copies of the RAM pages, null for pages holding zeros only. */
+};
+
+/********************************************************************************
+* cpu_snapshot_region: Memory holding a changed address.
+********************************************************************************/
+enum cpu_snapshot_region
+{
+   CPU_SNAPSHOT_REGION_DATA,  /* Data memory. */
+   CPU_SNAPSHOT_REGION_STACK  /* Stack. */
+};
+
+/********************************************************************************
+* cpu_snapshot_change: Address changed since the marker, see cpu_snapshot_diff_ctx.
+********************************************************************************/
+struct cpu_snapshot_change
+{
+   enum cpu_snapshot_region region; /* Memory holding the address. */
+   uint16_t address;                /* The changed address. */
+   uint8_t before;                  /* Content in the snapshot. */
+   uint8_t after;                   /* Current content. */
+};
+
+/********************************************************************************
+* cpu_snapshot_new: Returns a new heap allocated snapshot. The content is
+*                   undefined until the snapshot is saved. If the allocation
+*                   fails, a null pointer is returned.
+********************************************************************************/
+struct cpu_snapshot* cpu_snapshot_new(void);
+
+/********************************************************************************
+* cpu_snapshot_delete: Deletes specified heap allocated snapshot along with
+*                      its saved pages and sets the referenced pointer to null.
+*
+*                      - self: Reference to pointer to the snapshot.
+********************************************************************************/
+void cpu_snapshot_delete(struct cpu_snapshot** self);
+
+/********************************************************************************
+* cpu_snapshot_save_ctx: Saves the architectural state of specified CPU
+*                        context in referenced snapshot. Success code 0 is
+*                        returned on success, otherwise error code 1 is
+*                        returned if memory for a page can't be allocated.
+*
+*                        - self    : Reference to the CPU context.
+*                        - snapshot: Reference to the snapshot.
+********************************************************************************/
+int cpu_snapshot_save_ctx(const struct cpu_context* self,
+                           struct cpu_snapshot* snapshot);
+
+/********************************************************************************
+* cpu_snapshot_restore_ctx: Restores the architectural state of specified CPU
+*                           context from referenced snapshot. The shadow call
+*                           stack of the profiler, if any, is cleared. Success
+*                           code 0 is returned on success, otherwise error
+*                           code 1 is returned if memory for a page can't be
+*                           allocated.
+*
+*                           - self    : Reference to the CPU context.
+*                           - snapshot: Reference to the snapshot.
+********************************************************************************/
+int cpu_snapshot_restore_ctx(struct cpu_context* self,
+                              const struct cpu_snapshot* snapshot);
+
+/********************************************************************************
+* cpu_snapshot_mark_ctx: Sets the marker of specified CPU context, i.e. clears
+*                        the dirty bitmaps of the data memory and the stack.
+*
+*                        - self: Reference to the CPU context.
+********************************************************************************/
+void cpu_snapshot_mark_ctx(struct cpu_context* self);
+
+/********************************************************************************
+* cpu_snapshot_save_incremental_ctx: Updates referenced snapshot, which must
+*                                    hold the state of specified CPU context
+*                                    when the marker was set, to the current
+*                                    state by copying the registers and the
+*                                    pages written since. The marker is then
+*                                    set at the current state. Success code 0
+*                                    is returned on success, otherwise error
+*                                    code 1 is returned if memory for a page
+*                                    can't be allocated.
+*
+*                                    - self    : Reference to the CPU context.
+*                                    - snapshot: Reference to the snapshot.
+********************************************************************************/
+int cpu_snapshot_save_incremental_ctx(struct cpu_context* self,
+                                       struct cpu_snapshot* snapshot);
+
+/********************************************************************************
+* cpu_snapshot_restore_incremental_ctx: Restores specified CPU context to the
+*                                       state when the marker was set, held
+*                                       by referenced snapshot, by copying
+*                                       the registers and the pages written
+*                                       since. The marker is kept, so the
+*                                       snapshot can be restored again.
+*                                       Success code 0 is returned on
+*                                       success, otherwise error code 1 is
+*                                       returned if memory for a page can't
+*                                       be allocated.
+*
+*                                       - self    : Reference to the CPU context.
+*                                       - snapshot: Reference to the snapshot.
+********************************************************************************/
+int cpu_snapshot_restore_incremental_ctx(struct cpu_context* self,
+                                          const struct cpu_snapshot* snapshot);
+
+/********************************************************************************
+* cpu_snapshot_diff_ctx: Lists the data memory and stack addresses of specified
+*                        CPU context whose content differs from referenced
+*                        snapshot, which must hold the state when the marker
+*                        was set. Only pages written since are compared. The
+*                        total number of changed addresses is returned, while
+*                        at most the specified number of changes are stored,
+*                        in address order with the data memory first.
+*
+*                        - self       : Reference to the CPU context.
+*                        - snapshot   : Reference to the snapshot.
+*                        - changes    : Reference to array storing the changes.
+*                        - max_changes: Capacity of the array.
+********************************************************************************/
+uint32_t cpu_snapshot_diff_ctx(const struct cpu_context* self,
+                               const struct cpu_snapshot* snapshot,
+                               struct cpu_snapshot_change* changes,
+                               const uint32_t max_changes);
+
+/********************************************************************************
+* cpu_snapshot_save: Saves the architectural state of the default CPU context
+*                    in referenced snapshot, see cpu_snapshot_save_ctx.
+*
+*                    - snapshot: Reference to the snapshot.
+********************************************************************************/
+int cpu_snapshot_save(struct cpu_snapshot* snapshot);
+
+/********************************************************************************
+* cpu_snapshot_restore: Restores the architectural state of the default CPU
+*                       context from referenced snapshot, see
+*                       cpu_snapshot_restore_ctx.
+*
+*                       - snapshot: Reference to the snapshot.
+********************************************************************************/
+int cpu_snapshot_restore(const struct cpu_snapshot* snapshot);
+
+#endif /* CPU_SNAPSHOT_H_ */
@@ -1,63 +1,457 @@
-/********************************************************************************
-* data_memory.c: Contains function definitions for implementation of a 
-*                2 kB memory.
-********************************************************************************/
-#include "data_memory.h"
-
-/********************************************************************************
-* data: Data memory with storage capacity for 2000 bytes.
-********************************************************************************/
-static uint8_t data[DATA_MEMORY_ADDRESS_WIDTH]; 
-
-/********************************************************************************
-* data_memory_reset: Clears entire data memory.
-********************************************************************************/
-void data_memory_reset(void)
-{
-   for (uint16_t i = 0; i < DATA_MEMORY_ADDRESS_WIDTH; ++i)
-   {
-      data[i] = 0x00;
-   }
-   return;
-}
-
-/********************************************************************************
-* data_memory_write: Writes an 8-bit value to specified address in data memory.
-*                    The value 0 is returned after successful write. Otherwise
-*                    if invalid address is specified, no write is done and
-*                    error code 1 is returned.
-*
-*                    - address: Write location in data memory.
-*                    - value  : The 8-bit value to write to data memory.
-********************************************************************************/
-int data_memory_write(const uint16_t address,
-                      const uint8_t value)
-{
-   if (address < DATA_MEMORY_ADDRESS_WIDTH)
-   {
-      data[address] = value;
-      return 0;
-   }
-   else
-   {
-      return 1;
-   }
-}
-
-/********************************************************************************
-* data_memory_read: Returns content from specified read location in data memory.
-*                   If an invalid address is specified, the value 0 is returned.
-*
-*                   - address: Read location in data memory.
-********************************************************************************/
-uint8_t data_memory_read(const uint16_t address)
-{
-   if (address < DATA_MEMORY_ADDRESS_WIDTH)
-   {
-      return data[address];
-   }
-   else
-   {
-      return 0x00;
-   }
+/********************************************************************************
+* data_memory.c: Contains function definitions for implementation of a 
+*                64 kB memory. The I/O pages are stored in a CPU context,
+*                the other pages are allocated on the first write.
+*
+*                Page 0 and 1 contain the I/O registers and are mapped as I/O
+*                pages. The other pages are mapped as I/O pages using the
+*                default handlers until they're allocated, after which they're
+*                mapped as plain RAM pages.
+********************************************************************************/
+#include "data_memory.h"
+#include "cpu_context.h"
+
+#include <string.h>
+
+/* Static functions: */
+static void map_default_pages(struct cpu_context* self);
+static uint8_t* allocate_page(struct cpu_context* self,
+                              const uint8_t page);
+static inline void mark_dirty(struct cpu_context* self,
+                              const uint16_t address);
+static inline void track_interrupt_registers(struct cpu_context* self,
+                                             const uint16_t address);
+
+/********************************************************************************
+* data_memory_reset_ctx: Clears entire data memory of specified CPU context.
+*                        If an initial content has been set, it's written
+*                        to the data memory instead. The page table is set
+*                        up the first time the function is called, so I/O
+*                        handlers mapped by peripherals are kept at reset.
+*
+*                        - self: Reference to the CPU context.
+********************************************************************************/
+void data_memory_reset_ctx(struct cpu_context* self)
+{
+   memset(self->data, 0, DATA_MEMORY_IO_SIZE);
+
+   for (uint16_t i = DATA_MEMORY_NUM_IO_PAGES; i < DATA_MEMORY_NUM_PAGES; ++i)
+   {
+      if (self->data_pages[i]) memset(self->data_pages[i], 0, DATA_MEMORY_PAGE_SIZE);
+   }
+
+   if (!self->pages_initialized) map_default_pages(self);
+
+   for (uint32_t i = 0; i < self->data_initial_size; ++i)
+   {
+      const uint16_t address = self->data_initial_address + i;
+      uint8_t* memory = data_memory_page_data_ctx(self, address >> 8, true);
+      if (memory) memory[address & 0xFF] = self->data_initial[i];
+   }
+
+   memset(self->data_dirty, 0xFF, sizeof(self->data_dirty));
+   self->pcint_dirty = 0x00;
+   self->irq_requests = 0x00;
+   return;
+}
+
+/********************************************************************************
+* data_memory_set_initial_ctx: Sets the initial content of the data memory of
+*                              specified CPU context, which is written at each
+*                              reset. All other addresses are cleared at reset.
+*                              A size of 0 removes the initial content. Success
+*                              code 0 is returned on success, otherwise error
+*                              code 1 is returned if the content doesn't fit
+*                              in the data memory.
+*
+*                              - self   : Reference to the CPU context.
+*                              - address: Start address of the content.
+*                              - content: Reference to the content.
+*                              - size   : Number of bytes in the content.
+********************************************************************************/
+int data_memory_set_initial_ctx(struct cpu_context* self,
+                                const uint16_t address,
+                                const uint8_t* content,
+                                const uint32_t size)
+{
+   if ((uint32_t)address + size > DATA_MEMORY_ADDRESS_WIDTH) return 1;
+   uint8_t* initial = 0;
+
+   if (size)
+   {
+      initial = (uint8_t*)malloc(size);
+      if (!initial) return 1;
+      memcpy(initial, content, size);
+   }
+
+   free(self->data_initial);
+   self->data_initial = initial;
+   self->data_initial_address = address;
+   self->data_initial_size = size;
+   self->power_on_valid = false;
+   return 0;
+}
+
+/********************************************************************************
+* data_memory_write_ctx: Writes an 8-bit value to specified address in data
+*                        memory of specified CPU context. The value 0 is
+*                        returned after successful write. Otherwise if invalid
+*                        address is specified, no write is done and error
+*                        code 1 is returned.
+*
+*                        - self   : Reference to the CPU context.
+*                        - address: Write location in data memory.
+*                        - value  : The 8-bit value to write to data memory.
+********************************************************************************/
+int data_memory_write_ctx(struct cpu_context* self,
+                          const uint16_t address,
+                          const uint8_t value)
+{
+   const struct data_memory_page* page = &self->pages[address >> 8];
+
+   if (page->memory)
+   {
+      page->memory[address & 0xFF] = value;
+      mark_dirty(self, address);
+      return 0;
+   }
+   else if (page->write_handler)
+   {
+      return page->write_handler(self, address, value);
+   }
+   else
+   {
+      return 1;
+   }
+}
+
+/********************************************************************************
+* data_memory_read_ctx: Returns content from specified read location in data
+*                       memory of specified CPU context. If an invalid address
+*                       is specified, the value 0 is returned.
+*
+*                       - self   : Reference to the CPU context.
+*                       - address: Read location in data memory.
+********************************************************************************/
+uint8_t data_memory_read_ctx(struct cpu_context* self,
+                             const uint16_t address)
+{
+   const struct data_memory_page* page = &self->pages[address >> 8];
+
+   if (page->memory)
+   {
+      return page->memory[address & 0xFF];
+   }
+   else if (page->read_handler)
+   {
+      return page->read_handler(self, address);
+   }
+   else
+   {
+      return 0x00;
+   }
+}
+
+/********************************************************************************
+* data_memory_peek_ctx: Returns content from specified read location in data
+*                       memory of specified CPU context, just like
+*                       data_memory_read_ctx, but without triggering read
+*                       watchpoints, see breakpoints.h. Used for reads made by
+*                       the hardware rather than by the program, for instance
+*                       when monitoring the pin change interrupts.
+*
+*                       - self   : Reference to the CPU context.
+*                       - address: Read location in data memory.
+********************************************************************************/
+uint8_t data_memory_peek_ctx(struct cpu_context* self,
+                             const uint16_t address)
+{
+   const struct data_memory_page* page = &self->pages[address >> 8];
+   if (!page->memory && self->breakpoints) page = &self->breakpoints->pages[address >> 8];
+
+   if (page->memory)
+   {
+      return page->memory[address & 0xFF];
+   }
+   else if (page->read_handler)
+   {
+      return page->read_handler(self, address);
+   }
+   else
+   {
+      return 0x00;
+   }
+}
+
+/********************************************************************************
+* data_memory_map_io_ctx: Maps specified page of the data memory of specified
+*                         CPU context as an I/O page, where all accesses are
+*                         made through the specified handlers. Success code 0
+*                         is returned, otherwise error code 1 is returned if
+*                         the page is located outside the data memory.
+*
+*                         - self         : Reference to the CPU context.
+*                         - page         : The page to map (address / 256).
+*                         - read_handler : Handler called for reads from the page.
+*                         - write_handler: Handler called for writes to the page.
+********************************************************************************/
+int data_memory_map_io_ctx(struct cpu_context* self,
+                           const uint8_t page,
+                           uint8_t (*read_handler)(struct cpu_context* self, const uint16_t address),
+                           int (*write_handler)(struct cpu_context* self, const uint16_t address, const uint8_t value))
+{
+   if ((uint32_t)page * DATA_MEMORY_PAGE_SIZE >= DATA_MEMORY_ADDRESS_WIDTH) return 1;
+   if (!self->pages_initialized) map_default_pages(self);
+
+   /* While watchpoints are armed, a watched page keeps its watch handlers, see breakpoints.h. */
+   struct data_memory_page* entry = self->breakpoints ? &self->breakpoints->pages[page] : &self->pages[page];
+   entry->memory = 0;
+   entry->read_handler = read_handler;
+   entry->write_handler = write_handler;
+   if (self->breakpoints && !self->breakpoints->page_watchpoints[page]) self->pages[page] = *entry;
+   return 0;
+}
+
+/********************************************************************************
+* data_memory_page_data_ctx: Returns the memory of specified page of the data
+*                            memory of specified CPU context. Pages above the
+*                            I/O pages are allocated on the first write, so a
+*                            null pointer is returned for an untouched page,
+*                            unless allocation is requested. An allocated page
+*                            is cleared and, unless a peripheral has mapped it
+*                            as an I/O page, mapped as a plain RAM page. A null
+*                            pointer is also returned if memory can't be
+*                            allocated.
+*
+*                            - self    : Reference to the CPU context.
+*                            - page    : The page (address / 256).
+*                            - allocate: Indicates if an untouched page is allocated.
+********************************************************************************/
+uint8_t* data_memory_page_data_ctx(struct cpu_context* self,
+                                   const uint8_t page,
+                                   const bool allocate)
+{
+   if (page < DATA_MEMORY_NUM_IO_PAGES)
+   {
+      return &self->data[page * DATA_MEMORY_PAGE_SIZE];
+   }
+   else if (!self->data_pages[page] && allocate)
+   {
+      return allocate_page(self, page);
+   }
+   else
+   {
+      return self->data_pages[page];
+   }
+}
+
+/********************************************************************************
+* data_memory_io_read_ctx: Default read handler for I/O pages. Returns the
+*                          content at specified address, or 0 if the page
+*                          hasn't been written yet.
+*
+*                          - self   : Reference to the CPU context.
+*                          - address: Read location in data memory.
+********************************************************************************/
+uint8_t data_memory_io_read_ctx(struct cpu_context* self,
+                                const uint16_t address)
+{
+   if (address < DATA_MEMORY_IO_SIZE)
+   {
+      return self->data[address];
+   }
+   else if (self->data_pages[address >> 8])
+   {
+      return self->data_pages[address >> 8][address & 0xFF];
+   }
+   else
+   {
+      return 0x00;
+   }
+}
+
+/********************************************************************************
+* data_memory_io_write_ctx: Default write handler for I/O pages. Writes the
+*                           value to specified address and tracks writes to
+*                           the registers used by the pin change interrupts.
+*                           An untouched page is allocated first. Success code
+*                           0 is returned, otherwise error code 1 is returned
+*                           if the page can't be allocated.
+*
+*                           - self   : Reference to the CPU context.
+*                           - address: Write location in data memory.
+*                           - value  : The 8-bit value to write.
+********************************************************************************/
+int data_memory_io_write_ctx(struct cpu_context* self,
+                             const uint16_t address,
+                             const uint8_t value)
+{
+   if (address < DATA_MEMORY_IO_SIZE)
+   {
+      self->data[address] = value;
+      mark_dirty(self, address);
+      if (address <= DATA_MEMORY_PCMSK2) track_interrupt_registers(self, address);
+      return 0;
+   }
+
+   uint8_t* memory = data_memory_page_data_ctx(self, address >> 8, true);
+   if (!memory) return 1;
+   memory[address & 0xFF] = value;
+   mark_dirty(self, address);
+   return 0;
+}
+
+/********************************************************************************
+* data_memory_reset: Clears entire data memory.
+********************************************************************************/
+void data_memory_reset(void)
+{
+   data_memory_reset_ctx(cpu_context_default());
+   return;
+}
+
+/********************************************************************************
+* data_memory_write: Writes an 8-bit value to specified address in data memory.
+*                    The value 0 is returned after successful write. Otherwise
+*                    if invalid address is specified, no write is done and
+*                    error code 1 is returned.
+*
+*                    - address: Write location in data memory.
+*                    - value  : The 8-bit value to write to data memory.
+********************************************************************************/
+int data_memory_write(const uint16_t address,
+                      const uint8_t value)
+{
+   return data_memory_write_ctx(cpu_context_default(), address, value);
+}
+
+/********************************************************************************
+* data_memory_read: Returns content from specified read location in data memory.
+*                   If an invalid address is specified, the value 0 is returned.
+*
+*                   - address: Read location in data memory.
+********************************************************************************/
+uint8_t data_memory_read(const uint16_t address)
+{
+   return data_memory_read_ctx(cpu_context_default(), address);
+}
+
+/********************************************************************************
+* mark_dirty: Marks the page containing specified address as written in the
+*             dirty bitmap of the data memory.
+*
+*             - self   : Reference to the CPU context.
+*             - address: The written address in data memory.
+********************************************************************************/
+static inline void mark_dirty(struct cpu_context* self,
+                              const uint16_t address)
+{
+   const uint16_t page = address / DATA_MEMORY_DIRTY_PAGE_SIZE;
+   self->data_dirty[page / 64] |= (uint64_t)1 << (page % 64);
+   return;
+}
+
+/********************************************************************************
+* track_interrupt_registers: Marks the corresponding port for pin change
+*                            monitoring after a write to a pin input register
+*                            or a pin change mask register, and updates the
+*                            enabled interrupt requests after a write to
+*                            PCIFR or PCICR.
+*
+*                            - self   : Reference to the CPU context.
+*                            - address: The written address in data memory.
+********************************************************************************/
+static inline void track_interrupt_registers(struct cpu_context* self,
+                                             const uint16_t address)
+{
+   switch (address)
+   {
+      case PINB: case DATA_MEMORY_PCMSK0:
+      {
+         set(self->pcint_dirty, PCIF0);
+         break;
+      }
+      case PINC: case DATA_MEMORY_PCMSK1:
+      {
+         set(self->pcint_dirty, PCIF1);
+         break;
+      }
+      case PIND: case DATA_MEMORY_PCMSK2:
+      {
+         set(self->pcint_dirty, PCIF2);
+         break;
+      }
+      case DATA_MEMORY_PCIFR: case DATA_MEMORY_PCICR:
+      {
+         self->irq_requests = self->data[DATA_MEMORY_PCIFR] & self->data[DATA_MEMORY_PCICR] &
+            ((1 << PCIF0) | (1 << PCIF1) | (1 << PCIF2));
+         break;
+      }
+   }
+   return;
+}
+
+/********************************************************************************
+* map_default_pages: Sets up the page table of specified CPU context. Pages
+*                    already allocated are mapped as plain RAM, while the I/O
+*                    register pages 0 and 1 and the untouched pages are mapped
+*                    as I/O pages using the default handlers.
+*
+*                    - self: Reference to the CPU context.
+********************************************************************************/
+static void map_default_pages(struct cpu_context* self)
+{
+   for (uint16_t i = 0; i < DATA_MEMORY_NUM_PAGES; ++i)
+   {
+      struct data_memory_page* page = &self->pages[i];
+      page->memory = 0;
+      page->read_handler = 0;
+      page->write_handler = 0;
+
+      if (i >= DATA_MEMORY_NUM_IO_PAGES && self->data_pages[i])
+      {
+         page->memory = self->data_pages[i];
+      }
+      else
+      {
+         page->read_handler = data_memory_io_read_ctx;
+         page->write_handler = data_memory_io_write_ctx;
+      }
+   }
+
+   self->pages_initialized = true;
+   return;
+}
+
+/********************************************************************************
+* allocate_page: Allocates specified untouched page of the data memory of
+*                specified CPU context and returns its cleared memory. If the
+*                page is still accessed through the default I/O handlers, it's
+*                mapped as a plain RAM page from now on. While watchpoints are
+*                armed, the page table without the watch handlers is updated,
+*                as in data_memory_map_io_ctx. A null pointer is returned if
+*                memory can't be allocated.
+*
+*                - self: Reference to the CPU context.
+*                - page: The page to allocate.
+********************************************************************************/
+static uint8_t* allocate_page(struct cpu_context* self,
+                              const uint8_t page)
+{
+   uint8_t* memory = (uint8_t*)calloc(1, DATA_MEMORY_PAGE_SIZE);
+   if (!memory) return 0;
+   self->data_pages[page] = memory;
+   if (!self->pages_initialized) map_default_pages(self);
+
+   struct data_memory_page* entry = self->breakpoints ? &self->breakpoints->pages[page] : &self->pages[page];
+
+   if (!entry->memory && entry->read_handler == data_memory_io_read_ctx &&
+       entry->write_handler == data_memory_io_write_ctx)
+   {
+      entry->memory = memory;
+      entry->read_handler = 0;
+      entry->write_handler = 0;
+      if (self->breakpoints && !self->breakpoints->page_watchpoints[page]) self->pages[page] = *entry;
+   }
+   return memory;
 }
\ No newline at end of file
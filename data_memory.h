@@ -1,72 +1,294 @@
-/********************************************************************************
-* data_memory.h: Contains function declarations and macro definitions for
-*                implementation of a 2 kB data memory (2000 x 1 byte).
-********************************************************************************/
-#ifndef DATA_MEMORY_H_
-#define DATA_MEMORY_H_
-
-/* Include directives: */
-#include "cpu.h"
-
-/* Macro definitions: */
-#define DATA_MEMORY_ADDRESS_WIDTH 2000 /* 2000 unique addresses in data memory. */
-#define DATA_MEMORY_DATA_WIDTH    8    /* 8 bits storage capacity per address. */
-
-/********************************************************************************
-* data_memory_reset: Clears entire data memory.
-********************************************************************************/
-void data_memory_reset(void);
-
-/********************************************************************************
-* data_memory_write: Writes an 8-bit value to specified address in data memory.
-*                    The value 0 is returned after successful write. Otherwise
-*                    if invalid address is specified, no write is done and
-*                    error code 1 is returned.
-* 
-*                    - address: Write location in data memory.
-*                    - value  : The 8-bit value to write to data memory.
-********************************************************************************/
-int data_memory_write(const uint16_t address,
-                      const uint8_t value);
-
-/********************************************************************************
-* data_memory_read: Returns content from specified read location in data memory.
-*                   If an invalid address is specified, the value 0 is returned.
-* 
-*                   - address: Read location in data memory.
-********************************************************************************/
-uint8_t data_memory_read(const uint16_t address);
-
-/********************************************************************************
-* data_memory_set_bit: Sets bit in specified data memory register. The value 0 
-*                      is returned after successful write. Otherwise if an 
-*                      invalid address is specified, no write is done and 
-*                      error code 1 is returned.
-*
-*                     - address: Write location in data memory.
-*                     - bit    : Bit to set in data memory register.
-********************************************************************************/
-static inline int data_memory_set_bit(const uint16_t address, 
-                                      const uint8_t bit)
-{
-   const uint8_t data = data_memory_read(address); 
-   return data_memory_write(address, data | (1 << bit)); 
-}
-
-/********************************************************************************
-* data_memory_clear_bit: Clears bit in specified data memory register. The value
-*                        0 is returned after successful write. Otherwise if 
-*                        an invalid address is specified, no write is done and 
-*                        error code 1 is returned.
-*
-*                        - address: Write location in data memory.
-*                        - bit    : Bit to clear in data memory register.
-********************************************************************************/
-static inline int data_memory_clear_bit(const uint16_t address,
-                                        const uint8_t bit)
-{
-   const uint8_t data = data_memory_read(address);
-   return data_memory_write(address, data & ~(1 << bit));
-}
-
+/********************************************************************************
+* data_memory.h: Contains function declarations and macro definitions for
+*                implementation of a 64 kB data memory (65 536 x 1 byte),
+*                covering the entire 16-bit address space.
+*
+*                Addresses are decoded by a page table with one entry per
+*                256-byte page of the 16-bit address space. Plain RAM pages
+*                hold a pointer to the memory, so that an access is a single
+*                indexed load or store. I/O pages hold read and write handlers
+*                instead, which peripherals can replace to hook accesses to
+*                their registers. Unmapped pages read as 0 and ignore writes.
+*
+*                The memory is sparse: only the I/O pages 0 and 1 are stored
+*                in the CPU context. Every other page is allocated on the
+*                first write, so untouched pages cost nothing. Until then the
+*                page is accessed through the default I/O handlers, which read
+*                it as 0, and afterwards it's mapped as a plain RAM page.
+********************************************************************************/
+#ifndef DATA_MEMORY_H_
+#define DATA_MEMORY_H_
+
+/* Include directives: */
+#include "cpu.h"
+
+/* Macro definitions: */
+#define DATA_MEMORY_ADDRESS_WIDTH 65536 /* 65 536 unique addresses in data memory. */
+#define DATA_MEMORY_DATA_WIDTH    8     /* 8 bits storage capacity per address. */
+
+#define DATA_MEMORY_PAGE_SIZE    256 /* Number of addresses per page. */
+#define DATA_MEMORY_NUM_PAGES    256 /* Number of pages covering the 16-bit address space. */
+#define DATA_MEMORY_DATA_OFFSET  256 /* Address offset used by instructions STS, LDS, ST and LD. */
+#define DATA_MEMORY_IO_SIZE      512 /* Addresses of the I/O pages stored in the CPU context. */
+#define DATA_MEMORY_NUM_IO_PAGES (DATA_MEMORY_IO_SIZE / DATA_MEMORY_PAGE_SIZE) /* Number of I/O pages. */
+
+#define DATA_MEMORY_DIRTY_PAGE_SIZE 64 /* Number of addresses per page in the dirty bitmap. */
+#define DATA_MEMORY_NUM_DIRTY_PAGES \
+   ((DATA_MEMORY_ADDRESS_WIDTH + DATA_MEMORY_DIRTY_PAGE_SIZE - 1) / DATA_MEMORY_DIRTY_PAGE_SIZE)
+#define DATA_MEMORY_DIRTY_WORDS ((DATA_MEMORY_NUM_DIRTY_PAGES + 63) / 64) /* 64-bit words in the bitmap. */
+
+#define DATA_MEMORY_PCICR  (PCICR + DATA_MEMORY_DATA_OFFSET)  /* Address of PCICR in data memory. */
+#define DATA_MEMORY_PCIFR  (PCIFR + DATA_MEMORY_DATA_OFFSET)  /* Address of PCIFR in data memory. */
+#define DATA_MEMORY_PCMSK0 (PCMSK0 + DATA_MEMORY_DATA_OFFSET) /* Address of PCMSK0 in data memory. */
+#define DATA_MEMORY_PCMSK1 (PCMSK1 + DATA_MEMORY_DATA_OFFSET) /* Address of PCMSK1 in data memory. */
+#define DATA_MEMORY_PCMSK2 (PCMSK2 + DATA_MEMORY_DATA_OFFSET) /* Address of PCMSK2 in data memory. */
+
+/* Forward declarations: */
+struct cpu_context;
+
+/********************************************************************************
+* data_memory_page: Entry in the page table of the data memory. For plain RAM
+*                   pages, the memory pointer refers to the first byte of the
+*                   page. For I/O pages, the memory pointer is null and the
+*                   read and write handlers are called with the full address.
+*                   If no handlers are set either, the page is unmapped.
+********************************************************************************/
+struct data_memory_page
+{
+   uint8_t* memory; /* Pointer to RAM page, or null for I/O and unmapped pages. */
+   uint8_t (*read_handler)(struct cpu_context* self, const uint16_t address);                   /* Read handler. */
+   int (*write_handler)(struct cpu_context* self, const uint16_t address, const uint8_t value); /* Write handler. */
+};
+
+/********************************************************************************
+* data_memory_reset_ctx: Clears entire data memory of specified CPU context.
+*                        If an initial content has been set, it's written
+*                        to the data memory instead.
+*
+*                        - self: Reference to the CPU context.
+********************************************************************************/
+void data_memory_reset_ctx(struct cpu_context* self);
+
+/********************************************************************************
+* data_memory_set_initial_ctx: Sets the initial content of the data memory of
+*                              specified CPU context, which is written at each
+*                              reset. All other addresses are cleared at reset.
+*                              A size of 0 removes the initial content. Success
+*                              code 0 is returned on success, otherwise error
+*                              code 1 is returned if the content doesn't fit
+*                              in the data memory or memory can't be allocated.
+*
+*                              - self   : Reference to the CPU context.
+*                              - address: Start address of the content.
+*                              - content: Reference to the content.
+*                              - size   : Number of bytes in the content.
+********************************************************************************/
+int data_memory_set_initial_ctx(struct cpu_context* self,
+                                const uint16_t address,
+                                const uint8_t* content,
+                                const uint32_t size);
+
+/********************************************************************************
+* data_memory_write_ctx: Writes an 8-bit value to specified address in data
+*                        memory of specified CPU context. The value 0 is
+*                        returned after successful write. Otherwise if invalid
+*                        address is specified, no write is done and error
+*                        code 1 is returned.
+*
+*                        - self   : Reference to the CPU context.
+*                        - address: Write location in data memory.
+*                        - value  : The 8-bit value to write to data memory.
+********************************************************************************/
+int data_memory_write_ctx(struct cpu_context* self,
+                          const uint16_t address,
+                          const uint8_t value);
+
+/********************************************************************************
+* data_memory_read_ctx: Returns content from specified read location in data
+*                       memory of specified CPU context. If an invalid address
+*                       is specified, the value 0 is returned.
+*
+*                       - self   : Reference to the CPU context.
+*                       - address: Read location in data memory.
+********************************************************************************/
+uint8_t data_memory_read_ctx(struct cpu_context* self,
+                             const uint16_t address);
+
+/********************************************************************************
+* data_memory_peek_ctx: Returns content from specified read location in data
+*                       memory of specified CPU context, just like
+*                       data_memory_read_ctx, but without triggering read
+*                       watchpoints, see breakpoints.h. Used for reads made by
+*                       the hardware rather than by the program, for instance
+*                       when monitoring the pin change interrupts.
+*
+*                       - self   : Reference to the CPU context.
+*                       - address: Read location in data memory.
+********************************************************************************/
+uint8_t data_memory_peek_ctx(struct cpu_context* self,
+                             const uint16_t address);
+
+/********************************************************************************
+* data_memory_map_io_ctx: Maps specified page of the data memory of specified
+*                         CPU context as an I/O page, where all accesses are
+*                         made through the specified handlers. A peripheral
+*                         can call data_memory_io_read_ctx and
+*                         data_memory_io_write_ctx from its handlers for
+*                         addresses it doesn't handle itself. Success code 0
+*                         is returned, otherwise error code 1 is returned if
+*                         the page is located outside the data memory.
+*
+*                         - self         : Reference to the CPU context.
+*                         - page         : The page to map (address / 256).
+*                         - read_handler : Handler called for reads from the page.
+*                         - write_handler: Handler called for writes to the page.
+********************************************************************************/
+int data_memory_map_io_ctx(struct cpu_context* self,
+                           const uint8_t page,
+                           uint8_t (*read_handler)(struct cpu_context* self, const uint16_t address),
+                           int (*write_handler)(struct cpu_context* self, const uint16_t address, const uint8_t value));
+
+/********************************************************************************
+* data_memory_page_data_ctx: Returns the memory of specified page of the data
+*                            memory of specified CPU context. Pages above the
+*                            I/O pages are allocated on the first write, so a
+*                            null pointer is returned for an untouched page,
+*                            unless allocation is requested. An allocated page
+*                            is cleared and, unless a peripheral has mapped it
+*                            as an I/O page, mapped as a plain RAM page. A null
+*                            pointer is also returned if memory can't be
+*                            allocated.
+*
+*                            - self    : Reference to the CPU context.
+*                            - page    : The page (address / 256).
+*                            - allocate: Indicates if an untouched page is allocated.
+********************************************************************************/
+uint8_t* data_memory_page_data_ctx(struct cpu_context* self,
+                                   const uint8_t page,
+                                   const bool allocate);
+
+/********************************************************************************
+* data_memory_io_read_ctx: Default read handler for I/O pages. Returns the
+*                          content at specified address, or 0 if the page
+*                          hasn't been written yet.
+*
+*                          - self   : Reference to the CPU context.
+*                          - address: Read location in data memory.
+********************************************************************************/
+uint8_t data_memory_io_read_ctx(struct cpu_context* self,
+                                const uint16_t address);
+
+/********************************************************************************
+* data_memory_io_write_ctx: Default write handler for I/O pages. Writes the
+*                           value to specified address and tracks writes to
+*                           the registers used by the pin change interrupts,
+*                           so that the control unit only monitors interrupts
+*                           after changes. An untouched page is allocated, see
+*                           data_memory_page_data_ctx. Success code 0 is
+*                           returned, otherwise error code 1 is returned if
+*                           the page can't be allocated.
+*
+*                           - self   : Reference to the CPU context.
+*                           - address: Write location in data memory.
+*                           - value  : The 8-bit value to write.
+********************************************************************************/
+int data_memory_io_write_ctx(struct cpu_context* self,
+                             const uint16_t address,
+                             const uint8_t value);
+
+/********************************************************************************
+* data_memory_reset: Clears entire data memory.
+********************************************************************************/
+void data_memory_reset(void);
+
+/********************************************************************************
+* data_memory_write: Writes an 8-bit value to specified address in data memory.
+*                    The value 0 is returned after successful write. Otherwise
+*                    if invalid address is specified, no write is done and
+*                    error code 1 is returned.
+* 
+*                    - address: Write location in data memory.
+*                    - value  : The 8-bit value to write to data memory.
+********************************************************************************/
+int data_memory_write(const uint16_t address,
+                      const uint8_t value);
+
+/********************************************************************************
+* data_memory_read: Returns content from specified read location in data memory.
+*                   If an invalid address is specified, the value 0 is returned.
+* 
+*                   - address: Read location in data memory.
+********************************************************************************/
+uint8_t data_memory_read(const uint16_t address);
+
+/********************************************************************************
+* data_memory_set_bit_ctx: Sets bit in specified data memory register of
+*                          specified CPU context. The value 0 is returned after
+*                          successful write. Otherwise if an invalid address is
+*                          specified, no write is done and error code 1 is
+*                          returned.
+*
+*                          - self   : Reference to the CPU context.
+*                          - address: Write location in data memory.
+*                          - bit    : Bit to set in data memory register.
+********************************************************************************/
+static inline int data_memory_set_bit_ctx(struct cpu_context* self,
+                                          const uint16_t address,
+                                          const uint8_t bit)
+{
+   const uint8_t data = data_memory_peek_ctx(self, address);
+   return data_memory_write_ctx(self, address, data | (1 << bit));
+}
+
+/********************************************************************************
+* data_memory_clear_bit_ctx: Clears bit in specified data memory register of
+*                            specified CPU context. The value 0 is returned
+*                            after successful write. Otherwise if an invalid
+*                            address is specified, no write is done and error
+*                            code 1 is returned.
+*
+*                            - self   : Reference to the CPU context.
+*                            - address: Write location in data memory.
+*                            - bit    : Bit to clear in data memory register.
+********************************************************************************/
+static inline int data_memory_clear_bit_ctx(struct cpu_context* self,
+                                            const uint16_t address,
+                                            const uint8_t bit)
+{
+   const uint8_t data = data_memory_peek_ctx(self, address);
+   return data_memory_write_ctx(self, address, data & ~(1 << bit));
+}
+
+/********************************************************************************
+* data_memory_set_bit: Sets bit in specified data memory register. The value 0 
+*                      is returned after successful write. Otherwise if an 
+*                      invalid address is specified, no write is done and 
+*                      error code 1 is returned.
+*
+*                     - address: Write location in data memory.
+*                     - bit    : Bit to set in data memory register.
+********************************************************************************/
+static inline int data_memory_set_bit(const uint16_t address, 
+                                      const uint8_t bit)
+{
+   const uint8_t data = data_memory_read(address); 
+   return data_memory_write(address, data | (1 << bit)); 
+}
+
+/********************************************************************************
+* data_memory_clear_bit: Clears bit in specified data memory register. The value
+*                        0 is returned after successful write. Otherwise if 
+*                        an invalid address is specified, no write is done and 
+*                        error code 1 is returned.
+*
+*                        - address: Write location in data memory.
+*                        - bit    : Bit to clear in data memory register.
+********************************************************************************/
+static inline int data_memory_clear_bit(const uint16_t address,
+                                        const uint8_t bit)
+{
+   const uint8_t data = data_memory_read(address);
+   return data_memory_write(address, data & ~(1 << bit));
+}
+
 #endif /* DATA_MEMORY_H_ */
\ No newline at end of file
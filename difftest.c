@@ -0,0 +1,591 @@
+/********************************************************************************
+* difftest.c: Differential test of the execution engines on Linux. Random
+*             programs are run with the state machine (one state at a time),
+*             the interpreter (batch runs) and the JIT compiler side by side.
+*             Before each batch the same random values are written to the pin
+*             change registers of all three CPU contexts and a random run
+*             configuration is drawn, holding limits, stop conditions and a
+*             stop address. The state machine is then run for the number of
+*             clock cycles the interpreter reported, after which the
+*             architectural state of the three contexts must be identical.
+*             A directed test then changes PINB at every instruction of a
+*             loop holding superinstructions, so that the pin change
+*             interrupt lands right before each fused sequence.
+*
+*             Finally random programs are run by the lockstep engine with
+*             different writes to PINB and PCMSK0 per lane, so that the
+*             lanes diverge. After each batch the state of every lane must
+*             be identical to a CPU context of its own, run by the
+*             interpreter with the same writes.
+*
+*             Usage: difftest [programs] [seed]
+*
+*             The first mismatch is printed to stderr and the exit code is 1,
+*             otherwise the number of instructions run is printed and the
+*             exit code is 0.
+********************************************************************************/
+
+/* Include directives: */
+#include <string.h>
+
+#include "cpu_context.h"
+#include "control_unit.h"
+#include "data_memory.h"
+#include "program_memory.h"
+#include "assembler.h"
+#include "lockstep.h"
+
+/* Macro definitions: */
+#define DIFFTEST_PROGRAMS     200 /* Number of random programs run by default. */
+#define DIFFTEST_BATCHES      300 /* Number of batch runs per program. */
+#define DIFFTEST_MAX_LENGTH   64  /* Max number of instructions per program. */
+#define DIFFTEST_NUM_OP_CODES 0x2B /* OP codes drawn, including one invalid. */
+#define DIFFTEST_MAX_DELAY    40  /* Max number of instructions run before the pin change. */
+#define DIFFTEST_LOCKSTEP_DIVISOR 8 /* The lockstep engine runs 1/N of the random programs. */
+#define DIFFTEST_LOCKSTEP_BATCHES 100 /* Number of batch runs per program of the lockstep engine. */
+
+/********************************************************************************
+* difftest_engine: Execution engines compared by the test.
+********************************************************************************/
+enum difftest_engine
+{
+   DIFFTEST_ENGINE_STEP,        /* One state at a time via the state machine. */
+   DIFFTEST_ENGINE_INTERPRETER, /* Batch runs via the interpreter. */
+   DIFFTEST_ENGINE_JIT,         /* Batch runs via the JIT compiler. */
+   DIFFTEST_NUM_ENGINES         /* Number of engines. */
+};
+
+/* Static variables: */
+static const char* engine_names[DIFFTEST_NUM_ENGINES] = { "step", "interpreter", "jit" };
+static uint32_t random_state = 1;
+
+/********************************************************************************
+* fused_sequences: Loop holding the superinstructions IN / ANDI / OUT and
+*                  CPI / BRNE, interrupted by a pin change interrupt each time
+*                  PINB is changed.
+********************************************************************************/
+static const char* fused_sequences =
+   ".ORG RESET_vect\n"
+   "   JMP main\n"
+   ".ORG PCINT0_vect\n"
+   "   JMP ISR_PCINT0\n"
+   ".ORG 0x08\n"
+   "main:\n"
+   "   LDI R16, (1 << PCIE0)\n"
+   "   STS PCICR, R16\n"
+   "   LDI R16, 0xFF\n"
+   "   STS PCMSK0, R16\n"
+   "   SEI\n"
+   "loop:\n"
+   "   IN R17, PORTB\n"
+   "   ANDI R17, 0x0F\n"
+   "   OUT PORTB, R17\n"
+   "   INC R18\n"
+   "   CPI R18, 0x03\n"
+   "   BRNE loop\n"
+   "   LDI R18, 0x00\n"
+   "   JMP loop\n"
+   "ISR_PCINT0:\n"
+   "   IN R19, PORTB\n"
+   "   INC R19\n"
+   "   OUT PORTB, R19\n"
+   "   MOV R20, R18\n"
+   "   RETI\n";
+
+/* Static functions: */
+static uint32_t random_next(void);
+static uint32_t random_instruction(const uint32_t length);
+static uint32_t random_program(uint32_t* program);
+static bool data_page_equal(struct cpu_context* a,
+                            struct cpu_context* b,
+                            const uint32_t page);
+static const char* state_difference(struct cpu_context* a,
+                                    struct cpu_context* b);
+static int run_batch(struct cpu_context* engines[DIFFTEST_NUM_ENGINES],
+                     const struct control_unit_run_config* config,
+                     const char* name,
+                     const uint32_t batch,
+                     uint64_t* num_instructions);
+static int run_program(struct cpu_context* engines[DIFFTEST_NUM_ENGINES],
+                       const uint32_t program_number,
+                       uint64_t* num_instructions);
+static int run_fused_sequences(struct cpu_context* engines[DIFFTEST_NUM_ENGINES],
+                               uint64_t* num_instructions);
+static int run_lockstep_program(struct cpu_context* contexts[LOCKSTEP_LANES],
+                                struct cpu_context* lane_state,
+                                const uint32_t program_number,
+                                uint64_t* num_instructions);
+
+/********************************************************************************
+* main: Runs the random programs and compares the engines after each batch.
+*
+*       - argc: Number of command line arguments.
+*       - argv: Command line arguments, optionally holding the number of
+*               programs and the seed of the random generator.
+********************************************************************************/
+int main(const int argc,
+         const char** argv)
+{
+   struct cpu_context* engines[DIFFTEST_NUM_ENGINES] = { 0 };
+   struct cpu_context* contexts[LOCKSTEP_LANES] = { 0 };
+   struct cpu_context* lane_state = 0;
+   uint64_t programs = DIFFTEST_PROGRAMS;
+   uint64_t seed = 1;
+   uint64_t num_instructions = 0;
+   int status = 0;
+
+   if ((argc > 1 && !parse_number(argv[1], UINT32_MAX, &programs)) ||
+       (argc > 2 && !parse_number(argv[2], UINT32_MAX, &seed)) || argc > 3)
+   {
+      fprintf(stderr, "Usage: %s [programs] [seed]\n", argv[0]);
+      return 1;
+   }
+
+   random_state = seed ? (uint32_t)seed : 1;
+
+   for (uint32_t i = 0; i < DIFFTEST_NUM_ENGINES; ++i)
+   {
+      engines[i] = cpu_context_new();
+      if (!engines[i]) status = 1;
+   }
+
+   if (!status && control_unit_enable_jit_ctx(engines[DIFFTEST_ENGINE_JIT], true))
+   {
+      fprintf(stderr, "JIT compilation isn't supported on this host.\n");
+      status = 1;
+   }
+
+   for (uint32_t i = 0; !status && i < programs; ++i)
+   {
+      status = run_program(engines, i, &num_instructions);
+   }
+
+   if (!status) status = run_fused_sequences(engines, &num_instructions);
+
+   for (uint32_t i = 0; i < DIFFTEST_NUM_ENGINES; ++i)
+   {
+      cpu_context_delete(&engines[i]);
+   }
+
+   for (uint32_t i = 0; !status && i < LOCKSTEP_LANES; ++i)
+   {
+      contexts[i] = cpu_context_new();
+      if (!contexts[i]) status = 1;
+   }
+
+   if (!status && !(lane_state = cpu_context_new())) status = 1;
+
+   for (uint32_t i = 0; !status && i < programs / DIFFTEST_LOCKSTEP_DIVISOR; ++i)
+   {
+      status = run_lockstep_program(contexts, lane_state, i, &num_instructions);
+   }
+
+   for (uint32_t i = 0; i < LOCKSTEP_LANES; ++i)
+   {
+      cpu_context_delete(&contexts[i]);
+   }
+
+   cpu_context_delete(&lane_state);
+
+   if (!status)
+   {
+      printf("ok %llu instructions\n", (unsigned long long)num_instructions);
+   }
+   return status;
+}
+
+/********************************************************************************
+* random_next: Returns the next number of the xorshift random generator.
+********************************************************************************/
+static uint32_t random_next(void)
+{
+   random_state ^= random_state << 13;
+   random_state ^= random_state >> 17;
+   random_state ^= random_state << 5;
+   return random_state;
+}
+
+/********************************************************************************
+* random_instruction: Returns a random instruction for a program of specified
+*                     length. Jumps stay inside the program and most accesses
+*                     go to the I/O registers, the pointer registers and the
+*                     start of the data memory, so that the interrupts and
+*                     the data memory are exercised.
+*
+*                     - length: Number of instructions in the program.
+********************************************************************************/
+static uint32_t random_instruction(const uint32_t length)
+{
+   const uint8_t op_code = random_next() % DIFFTEST_NUM_OP_CODES;
+   const uint8_t pointer = random_next() % 2 ? 28 : 30;
+   const uint8_t value = random_next();
+   uint8_t op1 = 16 + random_next() % 16;
+   uint8_t op2 = 16 + random_next() % 16;
+
+   if (random_next() % 200 == 0) op1 = random_next();
+
+   switch (op_code)
+   {
+      case JMP: case BREQ: case BRNE: case BRGE: case BRGT: case BRLE: case BRLT: case CALL:
+         op1 = random_next() % length;
+         op2 = 0;
+         break;
+      case OUT:
+         op1 = random_next() % 20;
+         break;
+      case IN:
+         op2 = random_next() % 20;
+         break;
+      case STS: case LDS:
+         if (op_code == STS) op1 = random_next() % 3 ? 9 + random_next() % 10 : value;
+         else op2 = random_next() % 3 ? 9 + random_next() % 10 : value;
+         break;
+      case STIO: case ST:
+         op1 = pointer;
+         break;
+      case LDIO: case LD:
+         op2 = pointer;
+         break;
+      default:
+         if (random_next() % 2) op2 = value;
+         break;
+   }
+
+   return ((uint32_t)op_code << 16) | ((uint32_t)op1 << 8) | op2;
+}
+
+/********************************************************************************
+* random_program: Fills referenced buffer with a random program of 8 up to
+*                 DIFFTEST_MAX_LENGTH instructions and returns its length.
+*
+*                 - program: Reference to the buffer, with room for
+*                            DIFFTEST_MAX_LENGTH instructions.
+********************************************************************************/
+static uint32_t random_program(uint32_t* program)
+{
+   const uint32_t length = 8 + random_next() % (DIFFTEST_MAX_LENGTH - 8);
+
+   for (uint32_t i = 0; i < length; ++i)
+   {
+      program[i] = random_instruction(length);
+   }
+   return length;
+}
+
+/********************************************************************************
+* data_page_equal: Indicates if specified page of the data memory holds the
+*                  same content in two CPU contexts. A page that hasn't been
+*                  allocated reads as zeros.
+*
+*                  - a   : Reference to the first CPU context.
+*                  - b   : Reference to the second CPU context.
+*                  - page: The page to compare.
+********************************************************************************/
+static bool data_page_equal(struct cpu_context* a,
+                            struct cpu_context* b,
+                            const uint32_t page)
+{
+   static const uint8_t zeros[DATA_MEMORY_PAGE_SIZE] = { 0 };
+   if (!a->data_pages[page] && !b->data_pages[page]) return true;
+   const uint8_t* data_a = a->data_pages[page] ? a->data_pages[page] : zeros;
+   const uint8_t* data_b = b->data_pages[page] ? b->data_pages[page] : zeros;
+   return !memcmp(data_a, data_b, DATA_MEMORY_PAGE_SIZE);
+}
+
+/********************************************************************************
+* state_difference: Returns the name of the first part of the architectural
+*                   state that differs between two CPU contexts, or a null
+*                   pointer if the states are identical.
+*
+*                   - a: Reference to the first CPU context.
+*                   - b: Reference to the second CPU context.
+********************************************************************************/
+static const char* state_difference(struct cpu_context* a,
+                                    struct cpu_context* b)
+{
+   if (a->pc != b->pc) return "pc";
+   if (a->ir != b->ir) return "ir";
+   if (a->mar != b->mar) return "mar";
+   if (a->sr != b->sr) return "sr";
+   if (a->state != b->state) return "state";
+   if (a->op_code != b->op_code || a->op1 != b->op1 || a->op2 != b->op2) return "operands";
+   if (memcmp(a->reg, b->reg, sizeof(a->reg))) return "registers";
+   if (a->pinb_previous != b->pinb_previous || a->pinc_previous != b->pinc_previous ||
+       a->pind_previous != b->pind_previous) return "previous pin values";
+   if (memcmp(a->data, b->data, sizeof(a->data))) return "I/O registers";
+   if (a->sp != b->sp || a->stack_empty != b->stack_empty) return "stack pointer";
+   if (memcmp(a->stack, b->stack, sizeof(a->stack))) return "stack";
+
+   for (uint32_t i = DATA_MEMORY_NUM_IO_PAGES; i < DATA_MEMORY_NUM_PAGES; ++i)
+   {
+      if (!data_page_equal(a, b, i)) return "data memory";
+   }
+   return 0;
+}
+
+/********************************************************************************
+* run_batch: Runs a batch with specified configuration. The interpreter and
+*            the JIT compiler run the batch and must report the same result,
+*            after which the state machine runs the same number of clock
+*            cycles. Success code 0 is returned if the engines agreed,
+*            otherwise error code 1 is returned after the mismatch has been
+*            printed.
+*
+*            - engines         : The CPU contexts of the engines.
+*            - config          : Reference to the configuration of the run.
+*            - name            : Name of the program, used for printing.
+*            - batch           : Number of the batch, used for printing.
+*            - num_instructions: Reference to the counter of instructions
+*                                run, incremented by the instructions run
+*                                by the interpreter.
+********************************************************************************/
+static int run_batch(struct cpu_context* engines[DIFFTEST_NUM_ENGINES],
+                     const struct control_unit_run_config* config,
+                     const char* name,
+                     const uint32_t batch,
+                     uint64_t* num_instructions)
+{
+   struct control_unit_result result[DIFFTEST_NUM_ENGINES];
+
+   result[DIFFTEST_ENGINE_INTERPRETER] = control_unit_run_ctx(engines[DIFFTEST_ENGINE_INTERPRETER], config);
+   result[DIFFTEST_ENGINE_JIT] = control_unit_run_ctx(engines[DIFFTEST_ENGINE_JIT], config);
+   result[DIFFTEST_ENGINE_STEP] = result[DIFFTEST_ENGINE_INTERPRETER];
+
+   for (uint64_t i = 0; i < result[DIFFTEST_ENGINE_INTERPRETER].num_cycles; ++i)
+   {
+      control_unit_run_next_state_ctx(engines[DIFFTEST_ENGINE_STEP]);
+   }
+
+   *num_instructions += result[DIFFTEST_ENGINE_INTERPRETER].num_instructions;
+
+   for (uint32_t i = DIFFTEST_ENGINE_INTERPRETER; i < DIFFTEST_NUM_ENGINES; ++i)
+   {
+      const struct control_unit_result* expected = &result[DIFFTEST_ENGINE_STEP];
+      const char* difference = state_difference(engines[DIFFTEST_ENGINE_STEP], engines[i]);
+
+      if (result[i].stop_reason != expected->stop_reason ||
+          result[i].num_instructions != expected->num_instructions ||
+          result[i].num_cycles != expected->num_cycles)
+      {
+         difference = "result";
+      }
+
+      if (difference)
+      {
+         fprintf(stderr, "Mismatch in %s, batch %u: %s differs between %s and %s "
+                 "(pc %u and %u).\n", name, (unsigned)batch, difference,
+                 engine_names[DIFFTEST_ENGINE_STEP], engine_names[i],
+                 (unsigned)engines[DIFFTEST_ENGINE_STEP]->pc, (unsigned)engines[i]->pc);
+         return 1;
+      }
+   }
+   return 0;
+}
+
+/********************************************************************************
+* run_program: Loads a random program into the CPU contexts of the engines and
+*              runs it batch by batch, see run_batch. Before each batch, random
+*              values are written to PINB and PCMSK0 of all contexts and a
+*              random configuration is drawn. Success code 0 is returned if
+*              the engines agreed, otherwise error code 1 is returned.
+*
+*              - engines         : The CPU contexts of the engines.
+*              - program_number  : Number of the program, used for printing.
+*              - num_instructions: Reference to the counter of instructions
+*                                  run, see run_batch.
+********************************************************************************/
+static int run_program(struct cpu_context* engines[DIFFTEST_NUM_ENGINES],
+                       const uint32_t program_number,
+                       uint64_t* num_instructions)
+{
+   uint32_t program[DIFFTEST_MAX_LENGTH];
+   const uint32_t length = random_program(program);
+   char name[32];
+
+   snprintf(name, sizeof(name), "program %u", (unsigned)program_number);
+
+   for (uint32_t i = 0; i < DIFFTEST_NUM_ENGINES; ++i)
+   {
+      program_memory_load_ctx(engines[i], program, length, 0);
+      control_unit_reset_ctx(engines[i]);
+   }
+
+   for (uint32_t batch = 0; batch < DIFFTEST_BATCHES; ++batch)
+   {
+      struct control_unit_run_config config;
+      const bool write_pinb = random_next() % 3 == 0;
+      const bool write_pcmsk0 = random_next() % 7 == 0;
+      const uint8_t pinb = random_next();
+      const uint8_t pcmsk0 = random_next();
+
+      config.max_instructions = random_next() % 500;
+      config.max_cycles = random_next() % 4 == 0 ? random_next() % 900 : 0;
+      config.stop_conditions = random_next();
+      config.stop_pc = random_next() % length;
+
+      for (uint32_t i = 0; i < DIFFTEST_NUM_ENGINES; ++i)
+      {
+         if (write_pinb) data_memory_write_ctx(engines[i], PINB, pinb);
+         if (write_pcmsk0) data_memory_write_ctx(engines[i], PCMSK0, pcmsk0);
+      }
+
+      if (run_batch(engines, &config, name, batch, num_instructions)) return 1;
+   }
+   return 0;
+}
+
+/********************************************************************************
+* run_fused_sequences: Runs the loop holding superinstructions, see
+*                      fused_sequences, once per delay from 0 up to
+*                      DIFFTEST_MAX_DELAY instructions. After the delay PINB
+*                      is changed in all CPU contexts, so that the pin change
+*                      interrupt is requested right before each instruction
+*                      of the loop, among them the first instruction of each
+*                      fused sequence, which must then be run unfused. A few
+*                      batches follow, see run_batch. Success code 0 is
+*                      returned if the engines agreed, otherwise error code 1
+*                      is returned.
+*
+*                      - engines         : The CPU contexts of the engines.
+*                      - num_instructions: Reference to the counter of
+*                                          instructions run, see run_batch.
+********************************************************************************/
+static int run_fused_sequences(struct cpu_context* engines[DIFFTEST_NUM_ENGINES],
+                               uint64_t* num_instructions)
+{
+   static struct assembler_program program;
+
+   if (assembler_assemble(&program, fused_sequences))
+   {
+      fprintf(stderr, "fused sequences: %s\n", program.error);
+      return 1;
+   }
+
+   for (uint32_t delay = 0; delay <= DIFFTEST_MAX_DELAY; ++delay)
+   {
+      const struct control_unit_run_config delay_config = { delay, 0, 0, 0 };
+      const struct control_unit_run_config run_config = { 7, 0, 0, 0 };
+      char name[48];
+
+      snprintf(name, sizeof(name), "fused sequences, delay %u", (unsigned)delay);
+
+      for (uint32_t i = 0; i < DIFFTEST_NUM_ENGINES; ++i)
+      {
+         assembler_load_ctx(engines[i], &program);
+         control_unit_reset_ctx(engines[i]);
+      }
+
+      if (run_batch(engines, &delay_config, name, 0, num_instructions)) return 1;
+
+      for (uint32_t batch = 1; batch <= 4; ++batch)
+      {
+         for (uint32_t i = 0; i < DIFFTEST_NUM_ENGINES; ++i)
+         {
+            data_memory_write_ctx(engines[i], PINB, (uint8_t)batch);
+         }
+
+         if (run_batch(engines, &run_config, name, batch, num_instructions)) return 1;
+      }
+   }
+   return 0;
+}
+
+/********************************************************************************
+* run_lockstep_program: Loads a random program into the CPU contexts and runs
+*                       it in a random number of lanes of the lockstep engine,
+*                       where lane i mirrors context i. Before each batch,
+*                       random values are written to PINB and PCMSK0 of
+*                       random lanes and their contexts, so that the lanes
+*                       diverge. The lanes and the contexts, run by the
+*                       interpreter, then run the same number of
+*                       instructions, after which the state of each lane,
+*                       copied into a CPU context of its own, must be
+*                       identical to its context. Success code 0 is
+*                       returned if they agreed, otherwise error code 1 is
+*                       returned after the mismatch has been printed.
+*
+*                       - contexts        : The CPU contexts mirroring the
+*                                           lanes.
+*                       - lane_state      : CPU context the state of a lane
+*                                           is copied into.
+*                       - program_number  : Number of the program, used for
+*                                           printing.
+*                       - num_instructions: Reference to the counter of
+*                                           instructions run, incremented by
+*                                           the instructions run by the lanes.
+********************************************************************************/
+static int run_lockstep_program(struct cpu_context* contexts[LOCKSTEP_LANES],
+                                struct cpu_context* lane_state,
+                                const uint32_t program_number,
+                                uint64_t* num_instructions)
+{
+   uint32_t program[DIFFTEST_MAX_LENGTH];
+   const uint32_t length = random_program(program);
+   const uint8_t num_lanes = (uint8_t)(1 + random_next() % LOCKSTEP_LANES);
+   int status = 0;
+
+   for (uint8_t i = 0; i < num_lanes; ++i)
+   {
+      program_memory_load_ctx(contexts[i], program, length, 0);
+      control_unit_reset_ctx(contexts[i]);
+   }
+
+   struct lockstep* lanes = lockstep_new(contexts[0], num_lanes);
+   if (!lanes) return 1;
+
+   for (uint32_t batch = 0; !status && batch < DIFFTEST_LOCKSTEP_BATCHES; ++batch)
+   {
+      const struct control_unit_run_config config = { random_next() % 500, 0, 0, 0 };
+      uint64_t expected = 0;
+
+      for (uint8_t i = 0; i < num_lanes; ++i)
+      {
+         const uint8_t pinb = random_next();
+         const uint8_t pcmsk0 = random_next();
+
+         if (random_next() % 3 == 0)
+         {
+            lockstep_write(lanes, i, PINB, pinb);
+            data_memory_write_ctx(contexts[i], PINB, pinb);
+         }
+
+         if (random_next() % 7 == 0)
+         {
+            lockstep_write(lanes, i, PCMSK0, pcmsk0);
+            data_memory_write_ctx(contexts[i], PCMSK0, pcmsk0);
+         }
+      }
+
+      const uint64_t executed = lockstep_run(lanes, config.max_instructions);
+      *num_instructions += executed;
+
+      for (uint8_t i = 0; !status && i < num_lanes; ++i)
+      {
+         const char* difference = 0;
+         expected += control_unit_run_ctx(contexts[i], &config).num_instructions;
+
+         if (lockstep_save_lane(lanes, i, lane_state)) difference = "saved lane";
+         else difference = state_difference(contexts[i], lane_state);
+
+         if (difference)
+         {
+            fprintf(stderr, "Mismatch in lockstep program %u (%s, %u lanes), batch %u, lane %u: "
+                    "%s differs between interpreter and lockstep (pc %u and %u).\n",
+                    (unsigned)program_number, lockstep_simd(), (unsigned)num_lanes, (unsigned)batch,
+                    (unsigned)i, difference, (unsigned)contexts[i]->pc, (unsigned)lane_state->pc);
+            status = 1;
+         }
+      }
+
+      if (!status && executed != expected)
+      {
+         fprintf(stderr, "Mismatch in lockstep program %u, batch %u: %llu instructions run by the "
+                 "lanes, %llu by the interpreter.\n", (unsigned)program_number, (unsigned)batch,
+                 (unsigned long long)executed, (unsigned long long)expected);
+         status = 1;
+      }
+   }
+
+   lockstep_delete(&lanes);
+   return status;
+}
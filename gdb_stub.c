@@ -0,0 +1,894 @@
+/********************************************************************************
+* gdb_stub.c: Contains function definitions for debugging the emulated
+*             microcontroller via the GDB remote serial protocol. One debugger
+*             is served at a time. The packets are received through a buffer,
+*             so that an interrupt from the debugger can be noticed with a
+*             single poll between the batch runs of a continue.
+********************************************************************************/
+#if defined(__unix__) || defined(__APPLE__)
+/* Included before cpu.h, since the POSIX headers use names cpu.h defines as macros. */
+#define _POSIX_C_SOURCE 200809L
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "gdb_stub.h"
+#include "control_unit.h"
+#include "cpu_context.h"
+
+#include <string.h>
+
+/* Macro definitions: */
+#define GDB_STUB_NUM_REGISTERS 35   /* R0 - R31, SREG, SP and PC. */
+#define GDB_STUB_REGISTER_SREG 32   /* Number of the status register. */
+#define GDB_STUB_REGISTER_SP   33   /* Number of the stack pointer. */
+#define GDB_STUB_REGISTER_PC   34   /* Number of the program counter. */
+#define GDB_STUB_INTERRUPT     0x03 /* Sent by the debugger to stop a running program. */
+
+#define GDB_STUB_SIGINT  0x02 /* Stopped by an interrupt from the debugger. */
+#define GDB_STUB_SIGILL  0x04 /* Stopped at system reset due to invalid OP code. */
+#define GDB_STUB_SIGTRAP 0x05 /* Stopped after a step or at a breakpoint. */
+#define GDB_STUB_SIGSEGV 0x0B /* Stopped at a stack or memory error. */
+
+#ifdef MSG_NOSIGNAL
+#define GDB_STUB_SEND_FLAGS MSG_NOSIGNAL /* A closed connection is reported as an error, not a signal. */
+#else
+#define GDB_STUB_SEND_FLAGS 0
+#endif
+
+#if GDB_STUB_SOCKETS
+/********************************************************************************
+* gdb_stub: Session with a connected debugger.
+********************************************************************************/
+struct gdb_stub
+{
+   struct cpu_context* context;                         /* The debugged CPU context. */
+   int socket;                                          /* Socket connected to the debugger. */
+   bool detached;                                       /* Indicates if the debugger has detached. */
+   bool watchpoint_hit;                                 /* Indicates if the last stop was at a watchpoint. */
+   char input[GDB_STUB_MAX_PACKET];                     /* Received bytes not handled yet. */
+   size_t input_begin;                                  /* Index of the first byte not handled. */
+   size_t input_end;                                    /* Index of the last received byte + 1. */
+   char packet[GDB_STUB_MAX_PACKET + 1];                /* Content of the last received packet. */
+   char reply[GDB_STUB_MAX_PACKET + 4];                 /* Reply to send, followed by room for the checksum. */
+};
+
+/* Static functions: */
+static int open_listener(const char* address,
+                         bool* unix_socket);
+static int serve(struct gdb_stub* self);
+static bool handle_packet(struct gdb_stub* self,
+                          const size_t length);
+static void read_registers(struct gdb_stub* self);
+static void write_registers(struct gdb_stub* self,
+                            const char* hex);
+static uint32_t read_register(struct gdb_stub* self,
+                              const unsigned number,
+                              size_t* size);
+static int write_register(struct gdb_stub* self,
+                          const unsigned number,
+                          const uint32_t value);
+static int read_memory(struct gdb_stub* self,
+                       const char* arguments);
+static int write_memory(struct gdb_stub* self,
+                        const char* arguments);
+static int set_breakpoint(struct gdb_stub* self,
+                          const char type,
+                          const char* arguments,
+                          const bool enabled);
+static void step(struct gdb_stub* self);
+static int resume(struct gdb_stub* self);
+static void stop_reply(struct gdb_stub* self,
+                       const int stop_signal);
+static int receive_packet(struct gdb_stub* self,
+                          size_t* length);
+static int receive_char(struct gdb_stub* self);
+static int send_reply(struct gdb_stub* self);
+static void put_hex(char* destination,
+                    uint32_t value,
+                    const size_t size);
+static uint32_t get_hex(const char** source,
+                        const size_t max_digits);
+static int hex_digit(const char c);
+#endif /* GDB_STUB_SOCKETS */
+
+/********************************************************************************
+* gdb_stub_serve_ctx: Waits for a debugger to connect to specified address and
+*                     lets it debug specified CPU context until it detaches,
+*                     kills the program or disconnects. The address is either
+*                     a TCP port on the loopback interface, written as "1234",
+*                     ":1234" or "localhost:1234", a TCP port on the interface
+*                     with given IPv4 address, written as "127.0.0.1:1234", or
+*                     the path of a Unix socket, which must contain "/" if it
+*                     contains ":". A stale socket file at the path is removed
+*                     first. The CPU context isn't reset, but an instruction
+*                     cycle in progress is completed before the debugger is
+*                     served. Success code 0 is returned when the session has
+*                     ended, otherwise error code 1 is returned if the address
+*                     is invalid, the socket can't be opened or the
+*                     connection fails.
+*
+*                     - self   : Reference to the CPU context.
+*                     - address: The address to listen to.
+********************************************************************************/
+int gdb_stub_serve_ctx(struct cpu_context* self,
+                       const char* address)
+{
+#if GDB_STUB_SOCKETS
+   bool unix_socket = false;
+   const int listener = open_listener(address, &unix_socket);
+   if (listener < 0) return 1;
+
+   const int connection = accept(listener, 0, 0);
+   close(listener);
+   if (unix_socket) unlink(address);
+   if (connection < 0) return 1;
+
+   struct gdb_stub* stub = (struct gdb_stub*)malloc(sizeof(struct gdb_stub));
+
+   if (!stub)
+   {
+      close(connection);
+      return 1;
+   }
+
+   memset(stub, 0, sizeof(struct gdb_stub));
+   stub->context = self;
+   stub->socket = connection;
+
+   while (self->state != CPU_STATE_FETCH)
+   {
+      control_unit_run_next_state_ctx(self);
+   }
+
+   const int result = serve(stub);
+   breakpoints_clear_ctx(self);
+   close(connection);
+   free(stub);
+   return result;
+#else
+   (void)self;
+   (void)address;
+   return 1;
+#endif /* GDB_STUB_SOCKETS */
+}
+
+/********************************************************************************
+* gdb_stub_serve: Lets a debugger connecting to specified address debug the
+*                 default CPU context, see gdb_stub_serve_ctx.
+*
+*                 - address: The address to listen to.
+********************************************************************************/
+int gdb_stub_serve(const char* address)
+{
+   return gdb_stub_serve_ctx(cpu_context_default(), address);
+}
+
+#if GDB_STUB_SOCKETS
+/********************************************************************************
+* open_listener: Returns a socket listening to specified address, or -1 if the
+*                address is invalid or the socket can't be opened. Addresses
+*                containing "/" are opened as Unix sockets. Other addresses
+*                holding a port number, written as "1234", ":1234",
+*                "localhost:1234" or "<IPv4 address>:1234", are opened as TCP
+*                sockets on the loopback interface or the given interface.
+*                Remaining addresses without ":" are opened as Unix sockets,
+*                while the rest are invalid. A socket file left behind at the
+*                path of a Unix socket, for instance by a killed process, is
+*                removed before the socket is opened.
+*
+*                - address    : The address to listen to.
+*                - unix_socket: Reference to variable set to indicate if a
+*                               Unix socket was opened.
+********************************************************************************/
+static int open_listener(const char* address,
+                         bool* unix_socket)
+{
+   const char* separator = strrchr(address, ':');
+   const char* port = separator ? separator + 1 : address;
+   struct in_addr host = { htonl(INADDR_LOOPBACK) };
+
+   size_t num_digits = 0;
+   while (port[num_digits] >= '0' && port[num_digits] <= '9') num_digits++;
+   const bool valid_port = num_digits && !port[num_digits] && num_digits <= 5 && atol(port) <= 65535;
+   *unix_socket = strchr(address, '/') || (!separator && !valid_port);
+
+   if (!*unix_socket && separator && separator != address)
+   {
+      char name[INET_ADDRSTRLEN];
+      const size_t length = (size_t)(separator - address);
+      if (length >= sizeof(name)) return -1;
+      memcpy(name, address, length);
+      name[length] = '\0';
+      if (strcmp(name, "localhost") && inet_pton(AF_INET, name, &host) != 1) return -1;
+   }
+
+   if (!*unix_socket && !valid_port) return -1;
+
+   int listener = -1;
+
+   if (*unix_socket)
+   {
+      struct sockaddr_un local = { 0 };
+      if (strlen(address) >= sizeof(local.sun_path)) return -1;
+      local.sun_family = AF_UNIX;
+      strcpy(local.sun_path, address);
+
+      struct stat status;
+      if (!lstat(address, &status) && S_ISSOCK(status.st_mode)) unlink(address);
+      listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+      if (listener >= 0 && bind(listener, (struct sockaddr*)&local, sizeof(local)))
+      {
+         close(listener);
+         return -1;
+      }
+   }
+   else
+   {
+      struct sockaddr_in local = { 0 };
+      const int reuse = 1;
+      local.sin_family = AF_INET;
+      local.sin_port = htons((uint16_t)atol(port));
+      local.sin_addr = host;
+      listener = socket(AF_INET, SOCK_STREAM, 0);
+      if (listener >= 0) setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+      if (listener >= 0 && bind(listener, (struct sockaddr*)&local, sizeof(local)))
+      {
+         close(listener);
+         return -1;
+      }
+   }
+
+   if (listener >= 0 && listen(listener, 1))
+   {
+      close(listener);
+      if (*unix_socket) unlink(address);
+      return -1;
+   }
+   return listener;
+}
+
+/********************************************************************************
+* serve: Handles packets from the debugger of specified session until it
+*        detaches, kills the program or disconnects. Success code 0 is
+*        returned when the session has ended, otherwise error code 1 is
+*        returned if the connection fails.
+*
+*        - self: Reference to the session.
+********************************************************************************/
+static int serve(struct gdb_stub* self)
+{
+   while (1)
+   {
+      size_t length = 0;
+      const int result = receive_packet(self, &length);
+      if (result) return result < 0 ? 0 : 1;
+      if (!handle_packet(self, length)) return 0;
+      if (send_reply(self)) return 1;
+      if (self->detached) return 0;
+   }
+}
+
+/********************************************************************************
+* handle_packet: Handles the last received packet of specified session and
+*                writes the reply. Unsupported packets get an empty reply,
+*                as the protocol requires. False is returned if the session
+*                is to be ended without a reply, otherwise true.
+*
+*                - self  : Reference to the session.
+*                - length: Length of the packet.
+********************************************************************************/
+static bool handle_packet(struct gdb_stub* self,
+                          const size_t length)
+{
+   const char* arguments = self->packet + 1;
+   char* reply = self->reply;
+   *reply = '\0';
+
+   switch (self->packet[0])
+   {
+      case '?':
+      {
+         stop_reply(self, GDB_STUB_SIGTRAP);
+         break;
+      }
+      case 'g':
+      {
+         read_registers(self);
+         break;
+      }
+      case 'G':
+      {
+         if (length - 1 < 2 * (GDB_STUB_NUM_REGISTERS + 4)) strcpy(reply, "E01");
+         else
+         {
+            write_registers(self, arguments);
+            strcpy(reply, "OK");
+         }
+         break;
+      }
+      case 'p':
+      {
+         size_t size = 0;
+         const uint32_t value = read_register(self, get_hex(&arguments, 8), &size);
+         if (size) put_hex(reply, value, size);
+         else strcpy(reply, "E01");
+         break;
+      }
+      case 'P':
+      {
+         const unsigned number = get_hex(&arguments, 8);
+         if (*arguments++ != '=') strcpy(reply, "E01");
+         else
+         {
+            const char* value = arguments;
+            const size_t num_digits = strlen(value);
+            uint32_t swapped = 0;
+
+            /* The value is sent in target byte order, i.e. little endian. */
+            for (size_t i = 0; i + 1 < num_digits && i < 8; i += 2)
+            {
+               const char* byte = value + i;
+               swapped |= get_hex(&byte, 2) << (4 * i);
+            }
+            strcpy(reply, write_register(self, number, swapped) ? "E01" : "OK");
+         }
+         break;
+      }
+      case 'm':
+      {
+         if (read_memory(self, arguments)) strcpy(reply, "E01");
+         break;
+      }
+      case 'M':
+      {
+         strcpy(reply, write_memory(self, arguments) ? "E01" : "OK");
+         break;
+      }
+      case 's':
+      case 'c':
+      {
+         if (*arguments)
+         {
+            const uint32_t address = get_hex(&arguments, 8);
+            write_register(self, GDB_STUB_REGISTER_PC, address);
+         }
+
+         if (self->packet[0] == 's')
+         {
+            step(self);
+            stop_reply(self, GDB_STUB_SIGTRAP);
+         }
+         else
+         {
+            const int stop_signal = resume(self);
+            if (stop_signal < 0) return false;
+            stop_reply(self, stop_signal);
+         }
+         break;
+      }
+      case 'Z':
+      case 'z':
+      {
+         if (arguments[0] != '1' && arguments[0] >= '0' && arguments[0] <= '4' && arguments[1] == ',')
+         {
+            strcpy(reply, set_breakpoint(self, arguments[0], arguments + 2, self->packet[0] == 'Z') ? "E01" : "OK");
+         }
+         break;
+      }
+      case 'H':
+      {
+         strcpy(reply, "OK");
+         break;
+      }
+      case 'q':
+      {
+         if (!strncmp(arguments, "Supported", 9)) sprintf(reply, "PacketSize=%x", GDB_STUB_MAX_PACKET);
+         else if (!strcmp(arguments, "Attached")) strcpy(reply, "1");
+         break;
+      }
+      case 'D':
+      {
+         strcpy(reply, "OK");
+         self->detached = true;
+         break;
+      }
+      case 'k':
+      {
+         return false;
+      }
+      default:
+      {
+         break;
+      }
+   }
+   return true;
+}
+
+/********************************************************************************
+* read_registers: Writes all registers of the debugged CPU context to the
+*                 reply of specified session, in the order of their numbers.
+*
+*                 - self: Reference to the session.
+********************************************************************************/
+static void read_registers(struct gdb_stub* self)
+{
+   char* destination = self->reply;
+
+   for (unsigned i = 0; i < GDB_STUB_NUM_REGISTERS; ++i)
+   {
+      size_t size = 0;
+      const uint32_t value = read_register(self, i, &size);
+      put_hex(destination, value, size);
+      destination += 2 * size;
+   }
+   return;
+}
+
+/********************************************************************************
+* write_registers: Writes all registers of the debugged CPU context from
+*                  specified hexadecimal digits, in the order of their
+*                  numbers. The stack pointer is skipped, since it can't be
+*                  written.
+*
+*                  - self: Reference to the session.
+*                  - hex : The registers as hexadecimal digits.
+********************************************************************************/
+static void write_registers(struct gdb_stub* self,
+                            const char* hex)
+{
+   for (unsigned i = 0; i < GDB_STUB_NUM_REGISTERS; ++i)
+   {
+      size_t size = 0;
+      uint32_t value = 0;
+      read_register(self, i, &size);
+
+      for (size_t j = 0; j < size; ++j)
+      {
+         value |= get_hex(&hex, 2) << (8 * j);
+      }
+      if (i != GDB_STUB_REGISTER_SP) write_register(self, i, value);
+   }
+   return;
+}
+
+/********************************************************************************
+* read_register: Returns the value of specified register of the debugged CPU
+*                context, see gdb_stub.h. The size of the register in bytes
+*                is stored, or 0 if there's no such register.
+*
+*                - self  : Reference to the session.
+*                - number: Number of the register.
+*                - size  : Reference to variable storing the size.
+********************************************************************************/
+static uint32_t read_register(struct gdb_stub* self,
+                              const unsigned number,
+                              size_t* size)
+{
+   struct cpu_context* context = self->context;
+   *size = 1;
+
+   if (number < CPU_REGISTER_ADDRESS_WIDTH) return context->reg[number];
+   if (number == GDB_STUB_REGISTER_SREG) return context->sr;
+
+   if (number == GDB_STUB_REGISTER_SP)
+   {
+      *size = 2;
+      return context->sp;
+   }
+
+   if (number == GDB_STUB_REGISTER_PC)
+   {
+      *size = 4;
+      return 2 * (uint32_t)context->pc;
+   }
+
+   *size = 0;
+   return 0;
+}
+
+/********************************************************************************
+* write_register: Writes a value to specified register of the debugged CPU
+*                 context. Success code 0 is returned on success, otherwise
+*                 error code 1 is returned if the register doesn't exist or
+*                 can't be written, or if the value is out of range.
+*
+*                 - self  : Reference to the session.
+*                 - number: Number of the register.
+*                 - value : The value to write.
+********************************************************************************/
+static int write_register(struct gdb_stub* self,
+                          const unsigned number,
+                          const uint32_t value)
+{
+   struct cpu_context* context = self->context;
+
+   if (number < CPU_REGISTER_ADDRESS_WIDTH)
+   {
+      context->reg[number] = (uint8_t)value;
+      return 0;
+   }
+
+   if (number == GDB_STUB_REGISTER_SREG)
+   {
+      context->sr = (uint8_t)value;
+      context->flags.pending = false; /* Keeps lazily evaluated flags from overwriting the value. */
+      return 0;
+   }
+
+   if (number == GDB_STUB_REGISTER_PC && value / 2 < PROGRAM_MEMORY_ADDRESS_WIDTH)
+   {
+      context->pc = (uint16_t)(value / 2);
+      return 0;
+   }
+   return 1;
+}
+
+/********************************************************************************
+* read_memory: Writes the content of the data memory requested by specified
+*              arguments of an 'm' packet, i.e. address and length, to the
+*              reply of specified session. Success code 0 is returned on
+*              success, otherwise error code 1 is returned if the arguments
+*              are invalid or the range is outside the data memory.
+*
+*              - self     : Reference to the session.
+*              - arguments: The arguments of the packet.
+********************************************************************************/
+static int read_memory(struct gdb_stub* self,
+                       const char* arguments)
+{
+   const uint32_t address = get_hex(&arguments, 8);
+   if (*arguments++ != ',') return 1;
+   const uint32_t length = get_hex(&arguments, 8);
+
+   if (address < GDB_STUB_DATA_OFFSET || address - GDB_STUB_DATA_OFFSET > DATA_MEMORY_ADDRESS_WIDTH ||
+       length > DATA_MEMORY_ADDRESS_WIDTH - (address - GDB_STUB_DATA_OFFSET) || 2 * length > GDB_STUB_MAX_PACKET)
+   {
+      return 1;
+   }
+
+   for (uint32_t i = 0; i < length; ++i)
+   {
+      const uint8_t value = data_memory_peek_ctx(self->context, (uint16_t)(address - GDB_STUB_DATA_OFFSET + i));
+      put_hex(self->reply + 2 * i, value, 1);
+   }
+   return 0;
+}
+
+/********************************************************************************
+* write_memory: Writes the data of specified arguments of an 'M' packet, i.e.
+*               address, length and data, to the data memory of the debugged
+*               CPU context. The data is written byte by byte just as by the
+*               program, so writes to the I/O registers take effect as usual.
+*               Success code 0 is returned on success, otherwise error code 1
+*               is returned if the arguments are invalid or the range is
+*               outside the data memory.
+*
+*               - self     : Reference to the session.
+*               - arguments: The arguments of the packet.
+********************************************************************************/
+static int write_memory(struct gdb_stub* self,
+                        const char* arguments)
+{
+   const uint32_t address = get_hex(&arguments, 8);
+   if (*arguments++ != ',') return 1;
+   const uint32_t length = get_hex(&arguments, 8);
+   if (*arguments++ != ':' || strlen(arguments) < 2 * (size_t)length) return 1;
+
+   if (address < GDB_STUB_DATA_OFFSET || address - GDB_STUB_DATA_OFFSET > DATA_MEMORY_ADDRESS_WIDTH ||
+       length > DATA_MEMORY_ADDRESS_WIDTH - (address - GDB_STUB_DATA_OFFSET))
+   {
+      return 1;
+   }
+
+   for (uint32_t i = 0; i < length; ++i)
+   {
+      const uint8_t value = (uint8_t)get_hex(&arguments, 2);
+      data_memory_write_ctx(self->context, (uint16_t)(address - GDB_STUB_DATA_OFFSET + i), value);
+   }
+   return 0;
+}
+
+/********************************************************************************
+* set_breakpoint: Sets or removes the software breakpoint (type '0') or the
+*                 write, read or access watchpoint (type '2', '3' or '4')
+*                 given by specified arguments of a 'Z' or 'z' packet, i.e.
+*                 address and kind, see breakpoints.h. The kind of a
+*                 watchpoint is the number of watched bytes. Success code 0
+*                 is returned on success, otherwise error code 1 is returned
+*                 if the address is outside the program or data memory.
+*
+*                 - self     : Reference to the session.
+*                 - type     : The type of the breakpoint.
+*                 - arguments: The arguments of the packet.
+*                 - enabled  : Indicates if the breakpoint is set or removed.
+********************************************************************************/
+static int set_breakpoint(struct gdb_stub* self,
+                          const char type,
+                          const char* arguments,
+                          const bool enabled)
+{
+   const uint32_t address = get_hex(&arguments, 8);
+   if (*arguments++ != ',') return 1;
+   const uint32_t length = get_hex(&arguments, 8);
+
+   if (type == '0')
+   {
+      if (address / 2 >= PROGRAM_MEMORY_ADDRESS_WIDTH) return 1;
+      return breakpoints_set_ctx(self->context, (uint16_t)(address / 2), enabled);
+   }
+
+   const uint8_t access = type == '2' ? BREAKPOINTS_WRITE : type == '3' ? BREAKPOINTS_READ :
+      BREAKPOINTS_READ | BREAKPOINTS_WRITE;
+
+   if (address < GDB_STUB_DATA_OFFSET || address - GDB_STUB_DATA_OFFSET > DATA_MEMORY_ADDRESS_WIDTH ||
+       length > DATA_MEMORY_ADDRESS_WIDTH - (address - GDB_STUB_DATA_OFFSET))
+   {
+      return 1;
+   }
+
+   for (uint32_t i = 0; i < length; ++i)
+   {
+      if (breakpoints_watch_ctx(self->context, (uint16_t)(address - GDB_STUB_DATA_OFFSET + i), access, enabled)) return 1;
+   }
+   return 0;
+}
+
+/********************************************************************************
+* step: Runs the next instruction of the debugged CPU context, see
+*       control_unit_run_next_instruction_cycle_ctx, along with the remaining
+*       states of its instruction cycle, so that the CPU stops at the fetch of
+*       the following instruction. A watchpoint hit by the instruction is
+*       noted for the stop reply.
+*
+*       - self: Reference to the session.
+********************************************************************************/
+static void step(struct gdb_stub* self)
+{
+   self->context->events = 0;
+   control_unit_run_next_instruction_cycle_ctx(self->context);
+
+   while (self->context->state != CPU_STATE_FETCH)
+   {
+      control_unit_run_next_state_ctx(self->context);
+   }
+
+   self->watchpoint_hit = (self->context->events & CONTROL_UNIT_STOP_ON_WATCHPOINT) != 0;
+   return;
+}
+
+/********************************************************************************
+* resume: Runs the debugged CPU context in batch runs until a breakpoint is
+*         reached, a watched address is accessed, the program hits an
+*         invalid OP code, a stack error or a memory error, or the debugger
+*         sends an interrupt, which is checked for between the batch runs.
+*         The signal to report is returned, or -1 if the debugger
+*         disconnected.
+*
+*         - self: Reference to the session.
+********************************************************************************/
+static int resume(struct gdb_stub* self)
+{
+   const struct control_unit_run_config config =
+   {
+      GDB_STUB_RUN_SLICE, 0,
+      CONTROL_UNIT_STOP_ON_INVALID_OP_CODE | CONTROL_UNIT_STOP_ON_STACK_ERROR | CONTROL_UNIT_STOP_ON_MEMORY_ERROR, 0
+   };
+
+   while (1)
+   {
+      const struct control_unit_result result = control_unit_run_ctx(self->context, &config);
+
+      if (result.stop_reason == CONTROL_UNIT_STOP_BREAKPOINT)     return GDB_STUB_SIGTRAP;
+      self->watchpoint_hit = result.stop_reason == CONTROL_UNIT_STOP_WATCHPOINT;
+      if (self->watchpoint_hit)                                   return GDB_STUB_SIGTRAP;
+      if (result.stop_reason == CONTROL_UNIT_STOP_INVALID_OP_CODE) return GDB_STUB_SIGILL;
+      if (result.stop_reason == CONTROL_UNIT_STOP_STACK_ERROR)     return GDB_STUB_SIGSEGV;
+      if (result.stop_reason == CONTROL_UNIT_STOP_MEMORY_ERROR)    return GDB_STUB_SIGSEGV;
+
+      struct pollfd input = { self->socket, POLLIN, 0 };
+
+      while (self->input_begin < self->input_end || poll(&input, 1, 0) > 0)
+      {
+         const int c = receive_char(self);
+         if (c < 0) return -1;
+         if (c == GDB_STUB_INTERRUPT) return GDB_STUB_SIGINT;
+      }
+   }
+}
+
+/********************************************************************************
+* stop_reply: Writes the reply reporting a stop with specified signal to
+*             specified session. A stop at a watchpoint is reported along with
+*             the accessed address, as the debugger requires.
+*
+*             - self       : Reference to the session.
+*             - stop_signal: The signal to report.
+********************************************************************************/
+static void stop_reply(struct gdb_stub* self,
+                       const int stop_signal)
+{
+   const struct cpu_context* context = self->context;
+
+   if (self->watchpoint_hit && context->breakpoints)
+   {
+      sprintf(self->reply, "T%02x%s:%x;", stop_signal,
+              context->breakpoints->hit_access == BREAKPOINTS_READ ? "rwatch" : "watch",
+              (unsigned)(GDB_STUB_DATA_OFFSET + context->breakpoints->hit_address));
+   }
+   else
+   {
+      sprintf(self->reply, "S%02x", stop_signal);
+   }
+
+   self->watchpoint_hit = false;
+   return;
+}
+
+/********************************************************************************
+* receive_packet: Receives the next packet from the debugger of specified
+*                 session into its packet buffer and acknowledges it. Bytes
+*                 outside packets, such as acknowledgements, are skipped and
+*                 packets with invalid checksums are requested again. The
+*                 length of the packet is stored. Success code 0 is returned
+*                 on success, -1 if the debugger disconnected, or error code 1
+*                 if the connection failed.
+*
+*                 - self  : Reference to the session.
+*                 - length: Reference to variable storing the length.
+********************************************************************************/
+static int receive_packet(struct gdb_stub* self,
+                          size_t* length)
+{
+   while (1)
+   {
+      int c = 0;
+      uint8_t checksum = 0;
+      *length = 0;
+
+      do
+      {
+         c = receive_char(self);
+         if (c < 0) return c == -1 ? -1 : 1;
+      } while (c != '$');
+
+      while ((c = receive_char(self)) != '#')
+      {
+         if (c < 0) return c == -1 ? -1 : 1;
+         checksum += (uint8_t)c;
+         if (*length < GDB_STUB_MAX_PACKET) self->packet[(*length)++] = (char)c;
+      }
+
+      char digits[3] = { 0 };
+
+      for (size_t i = 0; i < 2; ++i)
+      {
+         c = receive_char(self);
+         if (c < 0) return c == -1 ? -1 : 1;
+         digits[i] = (char)c;
+      }
+
+      const char* expected = digits;
+      const bool valid = hex_digit(digits[0]) >= 0 && hex_digit(digits[1]) >= 0 &&
+         get_hex(&expected, 2) == checksum && *length < GDB_STUB_MAX_PACKET;
+      self->packet[*length] = '\0';
+
+      if (send(self->socket, valid ? "+" : "-", 1, GDB_STUB_SEND_FLAGS) != 1) return 1;
+      if (valid) return 0;
+   }
+}
+
+/********************************************************************************
+* receive_char: Returns the next byte received from the debugger of specified
+*               session, -1 if the debugger disconnected or -2 if the
+*               connection failed.
+*
+*               - self: Reference to the session.
+********************************************************************************/
+static int receive_char(struct gdb_stub* self)
+{
+   if (self->input_begin == self->input_end)
+   {
+      const ssize_t received = recv(self->socket, self->input, sizeof(self->input), 0);
+      if (received <= 0) return received == 0 ? -1 : -2;
+      self->input_begin = 0;
+      self->input_end = (size_t)received;
+   }
+   return (uint8_t)self->input[self->input_begin++];
+}
+
+/********************************************************************************
+* send_reply: Sends the reply of specified session as a packet. Success code
+*             0 is returned on success, otherwise error code 1 is returned.
+*
+*             - self: Reference to the session.
+********************************************************************************/
+static int send_reply(struct gdb_stub* self)
+{
+   const size_t length = strlen(self->reply);
+   uint8_t checksum = 0;
+
+   for (size_t i = 0; i < length; ++i)
+   {
+      checksum += (uint8_t)self->reply[i];
+   }
+
+   char header = '$';
+   char trailer[4] = { '#' }; /* Followed by the checksum and the null terminator written by put_hex. */
+   put_hex(trailer + 1, checksum, 1);
+
+   if (send(self->socket, &header, 1, GDB_STUB_SEND_FLAGS) != 1 ||
+       send(self->socket, self->reply, length, GDB_STUB_SEND_FLAGS) != (ssize_t)length ||
+       send(self->socket, trailer, 3, GDB_STUB_SEND_FLAGS) != 3)
+   {
+      return 1;
+   }
+   return 0;
+}
+
+/********************************************************************************
+* put_hex: Writes specified value as hexadecimal digits in little endian byte
+*          order, as the registers and memory of the target are sent. The
+*          digits are null terminated.
+*
+*          - destination: Reference to the destination.
+*          - value      : The value to write.
+*          - size       : Size of the value in bytes.
+********************************************************************************/
+static void put_hex(char* destination,
+                    uint32_t value,
+                    const size_t size)
+{
+   static const char digits[] = "0123456789abcdef";
+
+   for (size_t i = 0; i < size; ++i)
+   {
+      *destination++ = digits[(value >> 4) & 0x0F];
+      *destination++ = digits[value & 0x0F];
+      value >>= 8;
+   }
+
+   *destination = '\0';
+   return;
+}
+
+/********************************************************************************
+* get_hex: Returns the value of up to specified number of hexadecimal digits
+*          read from referenced position, which is advanced past the digits.
+*
+*          - source    : Reference to the position to read from.
+*          - max_digits: Max number of digits to read.
+********************************************************************************/
+static uint32_t get_hex(const char** source,
+                        const size_t max_digits)
+{
+   uint32_t value = 0;
+
+   for (size_t i = 0; i < max_digits && hex_digit(**source) >= 0; ++i)
+   {
+      value = (value << 4) | (uint32_t)hex_digit(*(*source)++);
+   }
+   return value;
+}
+
+/********************************************************************************
+* hex_digit: Returns the value of specified hexadecimal digit, or -1 if the
+*            character isn't a hexadecimal digit.
+*
+*            - c: The character.
+********************************************************************************/
+static int hex_digit(const char c)
+{
+   if (c >= '0' && c <= '9') return c - '0';
+   if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+   if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+   return -1;
+}
+#endif /* GDB_STUB_SOCKETS */
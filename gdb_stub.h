@@ -0,0 +1,80 @@
+/********************************************************************************
+* gdb_stub.h: Contains function declarations and macro definitions for
+*             debugging the emulated microcontroller with a standard debugger
+*             client, such as avr-gdb, via the GDB remote serial protocol over
+*             a local socket.
+*
+*             The debugger can read and write the CPU registers, the status
+*             register, the program counter and the data memory, step single
+*             instructions, continue, and set software breakpoints and data
+*             watchpoints. Between stops the program is run in batch runs at
+*             full speed, with the breakpoints and watchpoints checked by the
+*             control unit, see breakpoints.h. All breakpoints and
+*             watchpoints are disarmed when the session ends. An interrupt
+*             from the debugger (Ctrl-C) is noticed between batch runs.
+*
+*             The registers are laid out as avr-gdb expects, i.e. R0 - R31,
+*             SREG, SP (2 bytes) and PC (4 bytes), little endian. Since avr-gdb
+*             counts program addresses in bytes of 16-bit words, the program
+*             counter and the breakpoints are given as twice the address of
+*             the instruction. The data memory is found at offset
+*             GDB_STUB_DATA_OFFSET, as on AVR, while the program memory can't
+*             be accessed as memory. SP holds the stack pointer of the stack,
+*             which is separate from the data memory, and can't be written.
+********************************************************************************/
+#ifndef GDB_STUB_H_
+#define GDB_STUB_H_
+
+/* Include directives: */
+#include "cpu.h"
+
+/* Macro definitions: */
+#define GDB_STUB_DATA_OFFSET   0x800000 /* Offset of the data memory in the address space of avr-gdb. */
+#define GDB_STUB_MAX_PACKET    4096     /* Max size of a packet in bytes. */
+#define GDB_STUB_RUN_SLICE     1000000  /* Instructions run between checks for an interrupt from the debugger. */
+
+/********************************************************************************
+* GDB_STUB_SOCKETS: Set to 1 on platforms with POSIX sockets, where the stub
+*                   is available. Elsewhere gdb_stub_serve_ctx returns an
+*                   error right away.
+********************************************************************************/
+#if defined(__unix__) || defined(__APPLE__)
+#define GDB_STUB_SOCKETS 1
+#else
+#define GDB_STUB_SOCKETS 0
+#endif
+
+/* Forward declarations: */
+struct cpu_context;
+
+/********************************************************************************
+* gdb_stub_serve_ctx: Waits for a debugger to connect to specified address and
+*                     lets it debug specified CPU context until it detaches,
+*                     kills the program or disconnects. The address is either
+*                     a TCP port on the loopback interface, written as "1234",
+*                     ":1234" or "localhost:1234", a TCP port on the interface
+*                     with given IPv4 address, written as "127.0.0.1:1234", or
+*                     the path of a Unix socket, which must contain "/" if it
+*                     contains ":". A stale socket file at the path is removed
+*                     first. The CPU context isn't reset, but an instruction
+*                     cycle in progress is completed before the debugger is
+*                     served. Success code 0 is returned when the session has
+*                     ended, otherwise error code 1 is returned if the address
+*                     is invalid, the socket can't be opened or the
+*                     connection fails.
+*
+*                     - self   : Reference to the CPU context.
+*                     - address: The address to listen to.
+********************************************************************************/
+int gdb_stub_serve_ctx(struct cpu_context* self,
+                       const char* address);
+
+/********************************************************************************
+* gdb_stub_serve: Lets a debugger connecting to specified address debug the
+*                 default CPU context, see gdb_stub_serve_ctx.
+*
+*                 - address: The address to listen to.
+********************************************************************************/
+int gdb_stub_serve(const char* address);
+
+#endif /* GDB_STUB_H_ */
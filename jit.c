@@ -0,0 +1,636 @@
+/********************************************************************************
+* jit.c: Contains function definitions for a JIT compiler translating basic
+*        blocks of the program memory into x86-64 machine code.
+*
+*        The generated code keeps a pointer to the CPU context in rbx, the max
+*        number of iterations in r12 and the number of started iterations in
+*        r13. Guest registers are loaded from and stored to the CPU context
+*        for each instruction. The status flags are calculated from the flags
+*        of the host CPU and are identical to the flags calculated by the ALU.
+*
+*        The executable buffer is kept write protected while code is run and
+*        execution protected while code is written (W^X).
+********************************************************************************/
+#if defined(__linux__) && defined(__x86_64__)
+#define _DEFAULT_SOURCE /* Enables MAP_ANONYMOUS. */
+#include <sys/mman.h>
+#endif
+
+#include <stddef.h>
+#include <string.h>
+#include "jit.h"
+#include "cpu_context.h"
+
+#if JIT_SUPPORTED
+
+/* Macro definitions: */
+#define JIT_MAX_INSTRUCTION_SIZE 128 /* Max number of bytes generated per instruction. */
+#define JIT_MAX_OVERHEAD_SIZE    64  /* Max number of bytes for prologue and epilogue. */
+
+#define REG(r)  (uint32_t)(offsetof(struct cpu_context, reg) + (r))  /* Offset of CPU register. */
+#define SR      (uint32_t)offsetof(struct cpu_context, sr)           /* Offset of status register. */
+#define PC      (uint32_t)offsetof(struct cpu_context, pc)           /* Offset of program counter. */
+
+/********************************************************************************
+* jit_emitter: Writes machine code to the executable buffer.
+********************************************************************************/
+struct jit_emitter
+{
+   uint8_t* code; /* Start of the generated code. */
+   size_t pos;    /* Write position relative to the start. */
+};
+
+/* Static functions: */
+static void emit(struct jit_emitter* self,
+                 const uint8_t* bytes,
+                 const size_t num_bytes);
+static void emit8(struct jit_emitter* self,
+                  const uint8_t byte);
+static void emit32(struct jit_emitter* self,
+                   const uint32_t value);
+static void emit_load_eax(struct jit_emitter* self,
+                          const uint32_t offset);
+static void emit_load_ecx(struct jit_emitter* self,
+                          const uint32_t offset);
+static void emit_store_al(struct jit_emitter* self,
+                          const uint32_t offset);
+static void emit_store_constant(struct jit_emitter* self,
+                                const uint32_t offset,
+                                const uint8_t value);
+static void emit_store_pc(struct jit_emitter* self,
+                          const uint16_t address);
+static void emit_alu(struct jit_emitter* self,
+                     const uint8_t operation,
+                     const uint8_t a,
+                     const int16_t b_reg,
+                     const uint8_t b_constant,
+                     const bool store_result);
+static void emit_call(struct jit_emitter* self,
+                      const struct decoded_instruction* instruction);
+static void emit_epilogue(struct jit_emitter* self);
+static void emit_branch(struct jit_emitter* self,
+                        const struct decoded_instruction* instruction,
+                        const uint16_t start,
+                        const uint16_t next,
+                        const size_t loop_start);
+static bool compile_native(struct jit_emitter* self,
+                           const struct decoded_instruction* instruction);
+static bool ends_block(const struct decoded_instruction* instruction);
+static bool is_branch(const uint8_t op_code);
+static int set_protection(struct jit* self,
+                          const bool writable);
+
+/********************************************************************************
+* jit_new: Returns a new JIT compiler with an empty executable buffer. If the
+*          allocation fails, a null pointer is returned.
+********************************************************************************/
+struct jit* jit_new(void)
+{
+   struct jit* self = (struct jit*)calloc(1, sizeof(struct jit));
+   if (!self) return 0;
+
+   void* buffer = mmap(0, JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+   if (buffer == MAP_FAILED)
+   {
+      free(self);
+      return 0;
+   }
+
+   self->buffer = (uint8_t*)buffer;
+   return self;
+}
+
+/********************************************************************************
+* jit_delete: Deletes specified JIT compiler and sets the referenced pointer
+*             to null.
+*
+*             - self: Reference to pointer to the JIT compiler.
+********************************************************************************/
+void jit_delete(struct jit** self)
+{
+   if (!*self) return;
+   munmap((*self)->buffer, JIT_BUFFER_SIZE);
+   free(*self);
+   *self = 0;
+   return;
+}
+
+/********************************************************************************
+* jit_flush: Discards all compiled blocks.
+*
+*            - self: Reference to the JIT compiler.
+********************************************************************************/
+void jit_flush(struct jit* self)
+{
+   memset(self->blocks, 0, sizeof(self->blocks));
+   self->used = 0;
+   return;
+}
+
+/********************************************************************************
+* jit_block_get: Returns the block starting at specified address, compiled
+*                from the pre-decoded program of specified CPU context if
+*                needed. If the executable buffer is full, all blocks are
+*                discarded before compiling. If the block can't be compiled,
+*                a null pointer is returned.
+*
+*                - self   : Reference to the JIT compiler.
+*                - cpu    : Reference to the CPU context holding the program.
+*                - address: Start address of the block.
+********************************************************************************/
+const struct jit_block* jit_block_get(struct jit* self,
+                                      const struct cpu_context* cpu,
+                                      const uint16_t address)
+{
+   struct jit_block* block = &self->blocks[address];
+   if (block->compiled) return block;
+
+   const size_t max_size = JIT_MAX_BLOCK_LENGTH * JIT_MAX_INSTRUCTION_SIZE + JIT_MAX_OVERHEAD_SIZE;
+   if (self->used + max_size > JIT_BUFFER_SIZE) jit_flush(self);
+   if (set_protection(self, true)) return 0;
+
+   struct jit_emitter e = { self->buffer + self->used, 0 };
+   static const uint8_t prologue[] =
+   {
+      0x53,             /* push rbx */
+      0x41, 0x54,       /* push r12 */
+      0x41, 0x55,       /* push r13 */
+      0x48, 0x89, 0xFB, /* mov rbx, rdi */
+      0x49, 0x89, 0xF4, /* mov r12, rsi */
+      0x45, 0x31, 0xED  /* xor r13d, r13d */
+   };
+   static const uint8_t increment_iterations[] = { 0x49, 0xFF, 0xC5 }; /* inc r13 */
+
+   emit(&e, prologue, sizeof(prologue));
+   const size_t loop_start = e.pos;
+   emit(&e, increment_iterations, sizeof(increment_iterations));
+
+   uint32_t i = address;
+   bool terminated = false;
+
+   while (i < PROGRAM_MEMORY_ADDRESS_WIDTH && i - address < JIT_MAX_BLOCK_LENGTH && !terminated)
+   {
+      const struct decoded_instruction* instruction = &cpu->decoded_program[i++];
+      if (instruction->valid && instruction->op_code == LD) block->loads = true;
+
+      if (instruction->valid && is_branch(instruction->op_code))
+      {
+         emit_branch(&e, instruction, address, (uint16_t)i, loop_start);
+         terminated = true;
+      }
+      else if (ends_block(instruction))
+      {
+         emit_store_pc(&e, (uint16_t)i); /* The handler may use or update the PC. */
+         emit_call(&e, instruction);
+         emit_epilogue(&e);
+         terminated = true;
+      }
+      else if (!compile_native(&e, instruction))
+      {
+         emit_call(&e, instruction);
+      }
+   }
+
+   if (!terminated)
+   {
+      emit_store_pc(&e, (uint16_t)i);
+      emit_epilogue(&e);
+   }
+
+   block->run = (uint64_t (*)(struct cpu_context*, const uint64_t))(void*)e.code;
+   block->length = (uint8_t)(i - address);
+   block->compiled = true;
+   self->used += (e.pos + 15) & ~(size_t)15;
+   return set_protection(self, false) ? 0 : block;
+}
+
+/********************************************************************************
+* emit: Writes specified bytes to the generated code.
+********************************************************************************/
+static void emit(struct jit_emitter* self,
+                 const uint8_t* bytes,
+                 const size_t num_bytes)
+{
+   memcpy(self->code + self->pos, bytes, num_bytes);
+   self->pos += num_bytes;
+   return;
+}
+
+/********************************************************************************
+* emit8: Writes one byte to the generated code.
+********************************************************************************/
+static void emit8(struct jit_emitter* self,
+                  const uint8_t byte)
+{
+   self->code[self->pos++] = byte;
+   return;
+}
+
+/********************************************************************************
+* emit32: Writes a 32-bit value in little endian byte order to the generated code.
+********************************************************************************/
+static void emit32(struct jit_emitter* self,
+                   const uint32_t value)
+{
+   for (uint8_t i = 0; i < 32; i += 8)
+   {
+      emit8(self, (uint8_t)(value >> i));
+   }
+   return;
+}
+
+/********************************************************************************
+* emit_load_eax: Loads byte at specified offset in the CPU context into eax.
+********************************************************************************/
+static void emit_load_eax(struct jit_emitter* self,
+                          const uint32_t offset)
+{
+   static const uint8_t code[] = { 0x0F, 0xB6, 0x83 }; /* movzx eax, byte [rbx + offset] */
+   emit(self, code, sizeof(code));
+   emit32(self, offset);
+   return;
+}
+
+/********************************************************************************
+* emit_load_ecx: Loads byte at specified offset in the CPU context into ecx.
+********************************************************************************/
+static void emit_load_ecx(struct jit_emitter* self,
+                          const uint32_t offset)
+{
+   static const uint8_t code[] = { 0x0F, 0xB6, 0x8B }; /* movzx ecx, byte [rbx + offset] */
+   emit(self, code, sizeof(code));
+   emit32(self, offset);
+   return;
+}
+
+/********************************************************************************
+* emit_store_al: Stores al to specified offset in the CPU context.
+********************************************************************************/
+static void emit_store_al(struct jit_emitter* self,
+                          const uint32_t offset)
+{
+   static const uint8_t code[] = { 0x88, 0x83 }; /* mov byte [rbx + offset], al */
+   emit(self, code, sizeof(code));
+   emit32(self, offset);
+   return;
+}
+
+/********************************************************************************
+* emit_store_constant: Stores specified value to specified offset in the
+*                      CPU context.
+********************************************************************************/
+static void emit_store_constant(struct jit_emitter* self,
+                                const uint32_t offset,
+                                const uint8_t value)
+{
+   static const uint8_t code[] = { 0xC6, 0x83 }; /* mov byte [rbx + offset], value */
+   emit(self, code, sizeof(code));
+   emit32(self, offset);
+   emit8(self, value);
+   return;
+}
+
+/********************************************************************************
+* emit_store_pc: Stores specified address to the program counter of the CPU
+*                context.
+********************************************************************************/
+static void emit_store_pc(struct jit_emitter* self,
+                          const uint16_t address)
+{
+   static const uint8_t code[] = { 0x66, 0xC7, 0x83 }; /* mov word [rbx + PC], address */
+   emit(self, code, sizeof(code));
+   emit32(self, PC);
+   emit8(self, (uint8_t)address);
+   emit8(self, (uint8_t)(address >> 8));
+   return;
+}
+
+/********************************************************************************
+* emit_alu: Generates code performing specified ALU operation and updating the
+*           status flags SNZVC exactly as the ALU does. The second operand is
+*           read from specified CPU register, or if b_reg is negative, the
+*           specified constant is used.
+*
+*           Subtraction is performed as addition with the two's complement of
+*           the second operand, so that the V flag is calculated as by the ALU.
+*           The carry flag of subtraction is set if a >= b, since the ALU
+*           calculates a + (256 - b).
+*
+*           - operation   : The operation to perform (OR, AND, XOR, ADD or SUB).
+*           - a           : First operand, also destination of the result.
+*           - b_reg       : CPU register holding the second operand (or -1).
+*           - b_constant  : Second operand if no CPU register is specified.
+*           - store_result: Indicates if the result is stored in register a.
+********************************************************************************/
+static void emit_alu(struct jit_emitter* self,
+                     const uint8_t operation,
+                     const uint8_t a,
+                     const int16_t b_reg,
+                     const uint8_t b_constant,
+                     const bool store_result)
+{
+   static const uint8_t subtract[] =
+   {
+      0x38, 0xC8,             /* cmp al, cl */
+      0x41, 0x0F, 0x93, 0xC0, /* setae r8b (C) */
+      0xF6, 0xD9,             /* neg cl */
+      0x00, 0xC8              /* add al, cl */
+   };
+   static const uint8_t flags[] =
+   {
+      0x41, 0x0F, 0x90, 0xC1, /* seto r9b (V) */
+      0x41, 0x0F, 0x94, 0xC2, /* setz r10b (Z) */
+      0x41, 0x0F, 0x98, 0xC3, /* sets r11b (N) */
+      0x0F, 0x9C, 0xC2        /* setl dl (S = N ^ V) */
+   };
+   static const uint8_t update_sr[] =
+   {
+      0x41, 0xD0, 0xE1,       /* shl r9b, 1 */
+      0x41, 0xC0, 0xE2, 0x02, /* shl r10b, 2 */
+      0x41, 0xC0, 0xE3, 0x03, /* shl r11b, 3 */
+      0xC0, 0xE2, 0x04,       /* shl dl, 4 */
+      0x44, 0x08, 0xC2,       /* or dl, r8b */
+      0x44, 0x08, 0xCA,       /* or dl, r9b */
+      0x44, 0x08, 0xD2,       /* or dl, r10b */
+      0x44, 0x08, 0xDA        /* or dl, r11b */
+   };
+   static const uint8_t merge_sr[] =
+   {
+      0x80, 0xE1, 0xE0,       /* and cl, ~SNZVC */
+      0x08, 0xD1,             /* or cl, dl */
+   };
+   static const uint8_t set_carry[] = { 0x41, 0x0F, 0x92, 0xC0 }; /* setc r8b (C) */
+
+   emit_load_eax(self, REG(a));
+
+   if (b_reg >= 0)
+   {
+      emit_load_ecx(self, REG(b_reg));
+   }
+   else
+   {
+      emit8(self, 0xB1); /* mov cl, b_constant */
+      emit8(self, b_constant);
+   }
+
+   if (operation == SUB)
+   {
+      emit(self, subtract, sizeof(subtract));
+   }
+   else
+   {
+      if (operation == ADD)      emit8(self, 0x00); /* add al, cl */
+      else if (operation == OR)  emit8(self, 0x08); /* or al, cl */
+      else if (operation == AND) emit8(self, 0x20); /* and al, cl */
+      else                       emit8(self, 0x30); /* xor al, cl */
+      emit8(self, 0xC8);
+      emit(self, set_carry, sizeof(set_carry));
+   }
+
+   emit(self, flags, sizeof(flags));
+   if (store_result) emit_store_al(self, REG(a));
+
+   emit(self, update_sr, sizeof(update_sr));
+   emit_load_ecx(self, SR);
+   emit(self, merge_sr, sizeof(merge_sr));
+   emit8(self, 0x88); /* mov byte [rbx + SR], cl */
+   emit8(self, 0x8B);
+   emit32(self, SR);
+   return;
+}
+
+/********************************************************************************
+* emit_call: Generates a call to the handler of specified instruction.
+********************************************************************************/
+static void emit_call(struct jit_emitter* self,
+                      const struct decoded_instruction* instruction)
+{
+   static const uint8_t move_context[] = { 0x48, 0x89, 0xDF }; /* mov rdi, rbx */
+   static const uint8_t call_rax[] = { 0xFF, 0xD0 };           /* call rax */
+   const uint64_t handler = (uint64_t)(uintptr_t)instruction->execute;
+
+   emit(self, move_context, sizeof(move_context));
+   emit8(self, 0xBE); /* mov esi, op1 */
+   emit32(self, instruction->op1);
+   emit8(self, 0xBA); /* mov edx, op2 */
+   emit32(self, instruction->op2);
+   emit8(self, 0x48); /* mov rax, handler */
+   emit8(self, 0xB8);
+   emit32(self, (uint32_t)handler);
+   emit32(self, (uint32_t)(handler >> 32));
+   emit(self, call_rax, sizeof(call_rax));
+   return;
+}
+
+/********************************************************************************
+* emit_epilogue: Generates code returning the number of started iterations.
+********************************************************************************/
+static void emit_epilogue(struct jit_emitter* self)
+{
+   static const uint8_t epilogue[] =
+   {
+      0x4C, 0x89, 0xE8, /* mov rax, r13 */
+      0x41, 0x5D,       /* pop r13 */
+      0x41, 0x5C,       /* pop r12 */
+      0x5B,             /* pop rbx */
+      0xC3              /* ret */
+   };
+   emit(self, epilogue, sizeof(epilogue));
+   return;
+}
+
+/********************************************************************************
+* emit_branch: Generates code for a jump or branch ending a block. If the
+*              destination is the start of the block, the block is run again
+*              as long as the max number of iterations isn't reached.
+*
+*              - instruction: The jump or branch instruction.
+*              - start      : Start address of the block.
+*              - next       : Address of the instruction after the branch.
+*              - loop_start : Position of the loop start in the generated code.
+********************************************************************************/
+static void emit_branch(struct jit_emitter* self,
+                        const struct decoded_instruction* instruction,
+                        const uint16_t start,
+                        const uint16_t next,
+                        const size_t loop_start)
+{
+   const uint8_t op_code = instruction->op_code;
+   const uint16_t target = program_memory_jump_address(instruction->op1, instruction->op2);
+   size_t not_taken = 0;
+
+   if (op_code != JMP)
+   {
+      const uint8_t zs = (1 << Z) | (1 << S);
+      const uint8_t mask = op_code == BREQ || op_code == BRNE ? (1 << Z) :
+                           op_code == BRGE || op_code == BRLT ? (1 << S) : zs;
+      const bool taken_if_set = op_code == BREQ || op_code == BRLE || op_code == BRLT;
+
+      emit_load_eax(self, SR);
+      emit8(self, 0xA8); /* test al, mask */
+      emit8(self, mask);
+      emit8(self, 0x0F); /* jz/jnz not_taken */
+      emit8(self, taken_if_set ? 0x84 : 0x85);
+      not_taken = self->pos;
+      emit32(self, 0);
+   }
+
+   if (target == start)
+   {
+      static const uint8_t compare_iterations[] = { 0x4D, 0x39, 0xE5 }; /* cmp r13, r12 */
+      emit(self, compare_iterations, sizeof(compare_iterations));
+      emit8(self, 0x0F); /* jb loop_start */
+      emit8(self, 0x82);
+      emit32(self, (uint32_t)(loop_start - (self->pos + 4)));
+   }
+
+   emit_store_pc(self, target);
+   emit_epilogue(self);
+
+   if (op_code != JMP)
+   {
+      const uint32_t distance = (uint32_t)(self->pos - (not_taken + 4));
+      memcpy(self->code + not_taken, &distance, sizeof(distance));
+      emit_store_pc(self, next);
+      emit_epilogue(self);
+   }
+   return;
+}
+
+/********************************************************************************
+* compile_native: Generates native code for specified instruction. If the
+*                 instruction isn't supported for native code, nothing is
+*                 generated and false is returned. Reads from the data memory
+*                 are not compiled, since they may be handled by I/O handlers.
+********************************************************************************/
+static bool compile_native(struct jit_emitter* self,
+                           const struct decoded_instruction* instruction)
+{
+   const uint8_t op1 = instruction->op1;
+   const uint8_t op2 = instruction->op2;
+
+   switch (instruction->op_code)
+   {
+      case NOP:  break;
+      case LDI:  emit_store_constant(self, REG(op1), op2); break;
+      case CLR:  emit_store_constant(self, REG(op1), 0x00); break;
+      case MOV:  emit_load_eax(self, REG(op2)); emit_store_al(self, REG(op1)); break;
+      case ORI:  emit_alu(self, OR, op1, -1, op2, true); break;
+      case ANDI: emit_alu(self, AND, op1, -1, op2, true); break;
+      case XORI: emit_alu(self, XOR, op1, -1, op2, true); break;
+      case ADDI: emit_alu(self, ADD, op1, -1, op2, true); break;
+      case SUBI: emit_alu(self, SUB, op1, -1, op2, true); break;
+      case OR:   emit_alu(self, OR, op1, op2, 0, true); break;
+      case AND:  emit_alu(self, AND, op1, op2, 0, true); break;
+      case XOR:  emit_alu(self, XOR, op1, op2, 0, true); break;
+      case ADD:  emit_alu(self, ADD, op1, op2, 0, true); break;
+      case SUB:  emit_alu(self, SUB, op1, op2, 0, true); break;
+      case INC:  emit_alu(self, ADD, op1, -1, 1, true); break;
+      case DEC:  emit_alu(self, SUB, op1, -1, 1, true); break;
+      case CPI:  emit_alu(self, SUB, op1, -1, op2, false); break;
+      case CP:   emit_alu(self, SUB, op1, op2, 0, false); break;
+      case LSL:
+      {
+         static const uint8_t shift_left[] = { 0xD0, 0xE0 }; /* shl al, 1 */
+         emit_load_eax(self, REG(op1));
+         emit(self, shift_left, sizeof(shift_left));
+         emit_store_al(self, REG(op1));
+         break;
+      }
+      case LSR:
+      {
+         static const uint8_t shift_right[] = { 0xD0, 0xE8 }; /* shr al, 1 */
+         emit_load_eax(self, REG(op1));
+         emit(self, shift_right, sizeof(shift_right));
+         emit_store_al(self, REG(op1));
+         break;
+      }
+      default:   return false;
+   }
+   return true;
+}
+
+/********************************************************************************
+* ends_block: Indicates if specified instruction must end a block, i.e. if
+*             it's invalid or may affect the data memory, the stack, the
+*             program counter or the I flag. Such instructions are executed
+*             by calling their handlers.
+********************************************************************************/
+static bool ends_block(const struct decoded_instruction* instruction)
+{
+   if (!instruction->valid) return true;
+
+   switch (instruction->op_code)
+   {
+      case OUT: case STS: case STIO: case ST: case CALL: case RET: case RETI:
+      case PUSH: case POP: case SEI: case CLI:
+      {
+         return true;
+      }
+      default:
+      {
+         return false;
+      }
+   }
+}
+
+/********************************************************************************
+* is_branch: Indicates if specified OP code is a jump or a branch.
+********************************************************************************/
+static bool is_branch(const uint8_t op_code)
+{
+   return op_code >= JMP && op_code <= BRLT;
+}
+
+/********************************************************************************
+* set_protection: Makes the executable buffer writable or executable. Success
+*                 code 0 is returned on success, otherwise error code 1.
+********************************************************************************/
+static int set_protection(struct jit* self,
+                          const bool writable)
+{
+   const int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC;
+   return mprotect(self->buffer, JIT_BUFFER_SIZE, protection) ? 1 : 0;
+}
+
+#else
+
+/********************************************************************************
+* jit_new: JIT compilation isn't supported on this platform, hence a null
+*          pointer is always returned.
+********************************************************************************/
+struct jit* jit_new(void)
+{
+   return 0;
+}
+
+/********************************************************************************
+* jit_delete: Sets the referenced pointer to null.
+********************************************************************************/
+void jit_delete(struct jit** self)
+{
+   *self = 0;
+   return;
+}
+
+/********************************************************************************
+* jit_flush: Does nothing, since no blocks can be compiled.
+********************************************************************************/
+void jit_flush(struct jit* self)
+{
+   return;
+}
+
+/********************************************************************************
+* jit_block_get: Returns a null pointer, since no blocks can be compiled.
+********************************************************************************/
+const struct jit_block* jit_block_get(struct jit* self,
+                                      const struct cpu_context* cpu,
+                                      const uint16_t address)
+{
+   return 0;
+}
+
+#endif /* JIT_SUPPORTED */
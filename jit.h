@@ -0,0 +1,101 @@
+/********************************************************************************
+* jit.h: Contains function declarations and macro definitions for a JIT
+*        compiler, which translates basic blocks of the program memory into
+*        x86-64 machine code stored in an executable buffer allocated by mmap.
+*        The guest CPU registers and the status register are kept in the
+*        CPU context, so that the interpreter can continue at any point.
+*
+*        A block consists of a sequence of instructions without side effects
+*        on the data memory, the stack or the I flag. The block ends with a
+*        jump or a branch compiled to native code, or with an instruction
+*        executed by calling its handler (for instance OUT, CALL or SEI),
+*        after which the control unit checks for interrupt requests just as
+*        after any instruction. Since nothing within the block can affect
+*        the interrupt logic, no checks are needed between its instructions.
+*
+*        The JIT compiler is only available on Linux for x86-64. On other
+*        platforms, jit_new returns a null pointer and the interpreter is used.
+********************************************************************************/
+#ifndef JIT_H_
+#define JIT_H_
+
+/* Include directives: */
+#include "cpu.h"
+#include "program_memory.h"
+
+/* Macro definitions: */
+#if defined(__linux__) && defined(__x86_64__)
+#define JIT_SUPPORTED 1 /* JIT compilation is supported on this platform. */
+#else
+#define JIT_SUPPORTED 0 /* JIT compilation is not supported on this platform. */
+#endif
+
+#define JIT_MAX_BLOCK_LENGTH 64          /* Max number of instructions per block. */
+#define JIT_BUFFER_SIZE      (1024 * 1024) /* Size of the executable buffer in bytes. */
+
+/* Forward declarations: */
+struct cpu_context;
+
+/********************************************************************************
+* jit_block: Compiled basic block starting at a given address in the program
+*            memory. If the block ends with a jump or branch back to its own
+*            start address, it's run in a loop for up to the specified number
+*            of iterations. The number of completed iterations is returned.
+********************************************************************************/
+struct jit_block
+{
+   uint64_t (*run)(struct cpu_context* cpu, const uint64_t max_iterations); /* Native code. */
+   uint8_t length; /* Number of instructions in the block. */
+   bool loads;     /* Indicates if the block holds LD, which may raise a memory error. */
+   bool compiled;  /* Indicates if the block has been compiled. */
+};
+
+/********************************************************************************
+* jit: JIT compiler holding the executable buffer and the compiled blocks,
+*      indexed by start address.
+********************************************************************************/
+struct jit
+{
+   uint8_t* buffer;                                      /* Executable buffer. */
+   size_t used;                                          /* Number of used bytes in the buffer. */
+   struct jit_block blocks[PROGRAM_MEMORY_ADDRESS_WIDTH]; /* Compiled blocks. */
+};
+
+/********************************************************************************
+* jit_new: Returns a new JIT compiler with an empty executable buffer. If JIT
+*          compilation isn't supported or the allocation fails, a null pointer
+*          is returned.
+********************************************************************************/
+struct jit* jit_new(void);
+
+/********************************************************************************
+* jit_delete: Deletes specified JIT compiler and sets the referenced pointer
+*             to null.
+*
+*             - self: Reference to pointer to the JIT compiler.
+********************************************************************************/
+void jit_delete(struct jit** self);
+
+/********************************************************************************
+* jit_flush: Discards all compiled blocks, for instance after the program has
+*            been decoded again.
+*
+*            - self: Reference to the JIT compiler.
+********************************************************************************/
+void jit_flush(struct jit* self);
+
+/********************************************************************************
+* jit_block_get: Returns the block starting at specified address, compiled
+*                from the pre-decoded program of specified CPU context if
+*                needed. If the block can't be compiled, a null pointer is
+*                returned.
+*
+*                - self   : Reference to the JIT compiler.
+*                - cpu    : Reference to the CPU context holding the program.
+*                - address: Start address of the block.
+********************************************************************************/
+const struct jit_block* jit_block_get(struct jit* self,
+                                      const struct cpu_context* cpu,
+                                      const uint16_t address);
+
+#endif /* JIT_H_ */
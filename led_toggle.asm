@@ -0,0 +1,113 @@
+;********************************************************************************
+; led_toggle.asm: Assembly source for the built-in program of the program
+;                 memory. A led connected to pin 8 (PORTB0) is toggled at
+;                 pressdown of a button connected to pin 13 (PORTB5), which
+;                 generates a pin change interrupt. The state of the led is
+;                 stored in the variable led1_enabled in the data segment.
+;
+;                 Run by passing the path to this file as argument to the
+;                 program, for instance: Ela22_embedded_computer_system led_toggle.asm
+;********************************************************************************
+
+;********************************************************************************
+; Macro definitions:
+;********************************************************************************
+.EQU LED1 = PORTB0    ; Led 1 connected to pin 8 (PORTB0).
+.EQU BUTTON1 = PORTB5 ; Button 1 connected to pin 13 (PORTB5).
+
+;********************************************************************************
+; .DSEG: Data segment, storage of static variables.
+;********************************************************************************
+.DSEG
+.ORG 1000
+led1_enabled: .BYTE 1 ; Stores the state of led 1.
+
+;********************************************************************************
+; .CSEG: Code segment, storage of the program code.
+;********************************************************************************
+.CSEG
+
+;********************************************************************************
+; RESET_vect: Reset vector and start address for the program. A jump is made
+;             to the main subroutine in order to start the program.
+;********************************************************************************
+.ORG RESET_vect
+   JMP main
+
+;********************************************************************************
+; PCINT0_vect: Interrupt vector for pin change interrupt on I/O-port B. A jump
+;              is made to the corresponding interrupt handler ISR_PCINT0 to
+;              handle the interrupt.
+;********************************************************************************
+.ORG PCINT0_vect
+   JMP ISR_PCINT0
+
+;********************************************************************************
+; main: Initiates the system at start. The program is kept running as long
+;       as voltage is supplied. The led connected to PORTB0 is toggled when
+;       the button connected to PORTB5 is pressed.
+;********************************************************************************
+.ORG 0x08
+main:
+   CALL setup
+main_loop:
+   JMP main_loop
+
+;********************************************************************************
+; led1_toggle: Toggles the led connected to PORTB0.
+;********************************************************************************
+led1_toggle:
+   LD R16, X
+   CPI R16, 0x00
+   BREQ led1_on
+
+;********************************************************************************
+; led1_off: Disables the led connected to PORTB0.
+;********************************************************************************
+led1_off:
+   IN R16, PORTB
+   ANDI R16, ~(1 << LED1)
+   OUT PORTB, R16
+   LDI R16, 0x00
+   ST X, R16
+   RET
+
+;********************************************************************************
+; led1_on: Enables the led connected to PORTB0.
+;********************************************************************************
+led1_on:
+   IN R16, PORTB
+   ORI R16, (1 << LED1)
+   OUT PORTB, R16
+   LDI R16, 0x01
+   ST X, R16
+   RET
+
+;********************************************************************************
+; setup: Sets the led pin to output and enables the internal pull-up resistor
+;        for the button pin. Pin change interrupt is enabled for the button.
+;********************************************************************************
+setup:
+   LDI R16, (1 << LED1)
+   OUT DDRB, R16
+   LDI R17, (1 << BUTTON1)
+   OUT PORTB, R17
+   SEI
+   STS PCICR, R16
+   STS PCMSK0, R17
+   LDI XL, low(led1_enabled)
+   LDI XH, high(led1_enabled)
+   RET
+
+;********************************************************************************
+; ISR_PCINT0: Interrupt handler for pin change interrupt at I/O-port B, which
+;             is generated at pressdown and release of BUTTON1 connected to
+;             PORTB5. At pressdown, the led connected to PORTB0 is toggled.
+;********************************************************************************
+ISR_PCINT0:
+   IN R16, PINB
+   ANDI R16, (1 << BUTTON1)
+   BREQ ISR_PCINT0_end
+   CALL led1_toggle
+ISR_PCINT0_end:
+   RETI
@@ -0,0 +1,1550 @@
+/********************************************************************************
+* lockstep.c: Contains function definitions for running many instances of the
+*             same program in SIMD lanes. The lane vectors at the top hold one
+*             byte per lane and are implemented with AVX2, SSE2 or plain C;
+*             the rest of the file is written in terms of them. Instructions
+*             with a separate address per lane, such as PUSH or ST with
+*             different pointers, are executed lane by lane. The pages of the
+*             data memory above the I/O pages are allocated for all lanes on
+*             the first write; if memory can't be allocated, the write is
+*             ignored.
+********************************************************************************/
+/* Included before cpu.h, since the intrinsics headers use names cpu.h defines as macros. */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LOCKSTEP_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LOCKSTEP_SSE2 1
+#endif
+
+#include "lockstep.h"
+#include "cpu_context.h"
+#include "control_unit.h"
+
+#include <string.h>
+
+/* Macro definitions: */
+#define LOCKSTEP_SNZVC ((1 << S) | (1 << N) | (1 << Z) | (1 << V) | (1 << C)) /* Flags set by the ALU. */
+#define LOCKSTEP_PCIF  ((1 << PCIF0) | (1 << PCIF1) | (1 << PCIF2))          /* Pin change interrupt flags. */
+
+/********************************************************************************
+* lane_vector: One byte per lane, i.e. one row of the structure of arrays.
+********************************************************************************/
+#if LOCKSTEP_AVX2
+typedef __m256i lane_vector;
+#elif LOCKSTEP_SSE2
+typedef struct { __m128i half[2]; } lane_vector;
+#else
+typedef struct { uint8_t lane[LOCKSTEP_LANES]; } lane_vector;
+#endif
+
+/********************************************************************************
+* lockstep_instruction: Pre-decoded instruction shared by all lanes.
+********************************************************************************/
+struct lockstep_instruction
+{
+   uint32_t ir;     /* The raw 24-bit instruction. */
+   uint8_t op_code; /* OP code of the instruction. */
+   uint8_t op1;     /* First operand of the instruction. */
+   uint8_t op2;     /* Second operand of the instruction. */
+   bool valid;      /* Indicates if the OP code and the operands are valid. */
+};
+
+/********************************************************************************
+* lockstep: Lanes running the same program. Each row holds one byte per lane.
+********************************************************************************/
+struct lockstep
+{
+   uint8_t reg[CPU_REGISTER_ADDRESS_WIDTH][LOCKSTEP_LANES];  /* CPU registers R0 - R31. */
+   uint8_t sr[LOCKSTEP_LANES];                               /* Status registers. */
+   uint8_t pc[2][LOCKSTEP_LANES];                            /* Program counters, low and high byte. */
+   uint8_t mar[2][LOCKSTEP_LANES];                           /* Address of the last executed instruction. */
+   uint8_t fresh[LOCKSTEP_LANES];                            /* 0xFF until the first instruction after reset. */
+   uint8_t running[LOCKSTEP_LANES];                          /* 0xFF for lanes running in the current run. */
+   uint8_t pin_previous[3][LOCKSTEP_LANES];                  /* Previous input values of PINB, PINC and PIND. */
+   uint8_t pcint_dirty[LOCKSTEP_LANES];                      /* Ports whose PIN or PCMSK register has been written. */
+   uint8_t irq_requests[LOCKSTEP_LANES];                     /* Enabled interrupt requests, i.e. PCIFR & PCICR. */
+   uint8_t data[DATA_MEMORY_IO_SIZE][LOCKSTEP_LANES];        /* I/O pages of the data memory. */
+   uint8_t (*pages[DATA_MEMORY_NUM_PAGES])[LOCKSTEP_LANES];  /* Other pages of the data memory, null until written. */
+   uint8_t stack[STACK_ADDRESS_WIDTH][LOCKSTEP_LANES];       /* Stacks. */
+   uint16_t sp[LOCKSTEP_LANES];                              /* Stack pointers. */
+   bool stack_empty[LOCKSTEP_LANES];                         /* Indicates if the stacks are empty. */
+   uint64_t stalled[LOCKSTEP_LANES];                         /* Instructions each lane has been masked out this run. */
+   uint32_t waiting[LOCKSTEP_LANES];                         /* Instructions each lane has been masked out in a row. */
+   uint8_t num_lanes;                                        /* Number of lanes in use. */
+   uint16_t entry_point;                                     /* Address the program is started from at reset. */
+   uint8_t data_reset[DATA_MEMORY_ADDRESS_WIDTH];            /* Content of the data memory at reset. */
+   struct lockstep_instruction program[PROGRAM_MEMORY_ADDRESS_WIDTH]; /* Pre-decoded program. */
+};
+
+/* Static functions: */
+static inline lane_vector lanes_load(const uint8_t* row);
+static inline void lanes_store(uint8_t* row,
+                               const lane_vector value);
+static inline lane_vector lanes_broadcast(const uint8_t value);
+static inline lane_vector lanes_add(const lane_vector a,
+                                    const lane_vector b);
+static inline lane_vector lanes_sub(const lane_vector a,
+                                    const lane_vector b);
+static inline lane_vector lanes_and(const lane_vector a,
+                                    const lane_vector b);
+static inline lane_vector lanes_or(const lane_vector a,
+                                   const lane_vector b);
+static inline lane_vector lanes_xor(const lane_vector a,
+                                    const lane_vector b);
+static inline lane_vector lanes_andnot(const lane_vector a,
+                                       const lane_vector b);
+static inline lane_vector lanes_equal(const lane_vector a,
+                                      const lane_vector b);
+static inline lane_vector lanes_max(const lane_vector a,
+                                    const lane_vector b);
+static inline lane_vector lanes_negative(const lane_vector a);
+static inline lane_vector lanes_shift_right(const lane_vector a);
+static inline uint32_t lanes_bits(const lane_vector a);
+
+static inline uint8_t lowest_lane(const uint32_t bits);
+static inline void store_masked(uint8_t* row,
+                                const lane_vector mask,
+                                const lane_vector value);
+static inline void store_address(uint8_t rows[2][LOCKSTEP_LANES],
+                                 const lane_vector mask,
+                                 const uint16_t address);
+static inline lane_vector lanes_at(const struct lockstep* self,
+                                   const uint16_t address);
+static inline uint16_t lane_pc(const struct lockstep* self,
+                               const uint8_t lane);
+static inline void set_lane_pc(struct lockstep* self,
+                               const uint8_t lane,
+                               const uint16_t address);
+static inline const uint8_t* load_row(const struct lockstep* self,
+                                      const uint16_t address);
+static inline uint8_t* writable_row(struct lockstep* self,
+                                    const uint16_t address);
+static inline void store_row(struct lockstep* self,
+                             const uint16_t address,
+                             const lane_vector mask,
+                             const lane_vector value);
+static inline lane_vector calculate(struct lockstep* self,
+                                    const uint8_t operation,
+                                    const lane_vector a,
+                                    const lane_vector b,
+                                    const lane_vector mask);
+static inline lane_vector branch_taken(const struct lockstep* self,
+                                       const uint8_t op_code,
+                                       const lane_vector mask);
+static void store_indirect(struct lockstep* self,
+                           const uint8_t pointer,
+                           const uint8_t source,
+                           const uint16_t offset,
+                           const lane_vector mask,
+                           const uint32_t bits);
+static void load_indirect(struct lockstep* self,
+                          const uint8_t destination,
+                          const uint8_t pointer,
+                          const uint16_t offset,
+                          const lane_vector mask,
+                          const uint32_t bits);
+static void execute(struct lockstep* self,
+                    const uint16_t address,
+                    const lane_vector mask,
+                    const uint32_t bits);
+static uint16_t schedule(const struct lockstep* self,
+                        const uint32_t running,
+                        int* leader,
+                        uint32_t* leader_steps);
+static uint64_t update_waiting(struct lockstep* self,
+                               const uint32_t running,
+                               const uint32_t executed,
+                               const uint64_t num_instructions);
+
+static void reset_lane(struct lockstep* self,
+                       const uint8_t lane);
+static inline uint8_t read_lane(const struct lockstep* self,
+                                const uint8_t lane,
+                                const uint32_t address);
+static inline void write_lane(struct lockstep* self,
+                              const uint8_t lane,
+                              const uint32_t address,
+                              const uint8_t value);
+static inline void push_lane(struct lockstep* self,
+                             const uint8_t lane,
+                             const uint8_t value);
+static inline uint8_t pop_lane(struct lockstep* self,
+                               const uint8_t lane);
+static void check_for_irq_lane(struct lockstep* self,
+                               const uint8_t lane);
+static void monitor_interrupts_lane(struct lockstep* self,
+                                    const uint8_t lane);
+
+/********************************************************************************
+* lockstep_new: Returns a new set of specified number of lanes running the
+*               program of specified CPU context. The CPU context is reset
+*               and each lane is started from the reset state. A null pointer
+*               is returned if the number of lanes is 0 or exceeds
+*               LOCKSTEP_LANES or if memory can't be allocated.
+*
+*               - prototype: Reference to the CPU context holding the program.
+*               - num_lanes: Number of lanes.
+********************************************************************************/
+struct lockstep* lockstep_new(struct cpu_context* prototype,
+                              const uint8_t num_lanes)
+{
+   if (num_lanes == 0 || num_lanes > LOCKSTEP_LANES) return 0;
+   struct lockstep* self = (struct lockstep*)malloc(sizeof(struct lockstep));
+   if (!self) return 0;
+
+   memset(self->pages, 0, sizeof(self->pages));
+   control_unit_reset_ctx(prototype);
+
+   for (uint32_t i = 0; i < PROGRAM_MEMORY_ADDRESS_WIDTH; ++i)
+   {
+      const struct decoded_instruction* decoded = &prototype->decoded_program[i];
+      struct lockstep_instruction* instruction = &self->program[i];
+      instruction->ir = decoded->ir;
+      instruction->op_code = decoded->op_code;
+      instruction->op1 = decoded->op1;
+      instruction->op2 = decoded->op2;
+      instruction->valid = decoded->valid;
+   }
+
+   memset(self->data_reset, 0, sizeof(self->data_reset));
+   memcpy(self->data_reset, prototype->data, DATA_MEMORY_IO_SIZE);
+
+   for (uint16_t i = DATA_MEMORY_NUM_IO_PAGES; i < DATA_MEMORY_NUM_PAGES; ++i)
+   {
+      if (!prototype->data_pages[i]) continue;
+      memcpy(&self->data_reset[i * DATA_MEMORY_PAGE_SIZE], prototype->data_pages[i], DATA_MEMORY_PAGE_SIZE);
+
+      if (!writable_row(self, (uint16_t)(i * DATA_MEMORY_PAGE_SIZE)))
+      {
+         lockstep_delete(&self);
+         return 0;
+      }
+   }
+
+   self->entry_point = prototype->pc;
+   self->num_lanes = num_lanes;
+   memset(self->running, 0, sizeof(self->running));
+   lockstep_reset(self);
+   return self;
+}
+
+/********************************************************************************
+* lockstep_delete: Deletes specified set of lanes. The referenced pointer is
+*                  set to null.
+*
+*                  - self: Reference to pointer to the lanes.
+********************************************************************************/
+void lockstep_delete(struct lockstep** self)
+{
+   if (!*self) return;
+
+   for (uint16_t i = 0; i < DATA_MEMORY_NUM_PAGES; ++i)
+   {
+      free((*self)->pages[i]);
+   }
+
+   free(*self);
+   *self = 0;
+   return;
+}
+
+/********************************************************************************
+* lockstep_reset: Resets all lanes of specified set to the reset state of the
+*                 program.
+*
+*                 - self: Reference to the lanes.
+********************************************************************************/
+void lockstep_reset(struct lockstep* self)
+{
+   for (uint8_t lane = 0; lane < LOCKSTEP_LANES; ++lane)
+   {
+      reset_lane(self, lane);
+   }
+   return;
+}
+
+/********************************************************************************
+* lockstep_run: Runs specified number of instructions in each lane of
+*               specified set, with the same result per lane as a batch run
+*               of a CPU context, see control_unit_run_ctx. The total number
+*               of instructions executed by all lanes is returned.
+*
+*               As long as all running lanes stand at the same address, each
+*               instruction is executed once for all of them. Otherwise the
+*               lanes to run are picked by schedule and the others are masked
+*               out, so a lane finishes its run later the more instructions
+*               it has been masked out, see update_waiting.
+*
+*               - self            : Reference to the lanes.
+*               - num_instructions: Number of instructions to run per lane.
+********************************************************************************/
+uint64_t lockstep_run(struct lockstep* self,
+                      const uint64_t num_instructions)
+{
+   uint32_t running = self->num_lanes == 32 ? 0xFFFFFFFF : ((uint32_t)1 << self->num_lanes) - 1;
+   uint64_t step = 0;
+   uint64_t next_done = num_instructions;
+   int leader = -1;
+   uint32_t leader_steps = 0;
+   bool diverged = false;
+   if (num_instructions == 0) return 0;
+
+   for (uint8_t lane = 0; lane < self->num_lanes; ++lane)
+   {
+      self->running[lane] = 0xFF;
+      self->stalled[lane] = 0;
+      self->waiting[lane] = 0;
+      monitor_interrupts_lane(self, lane); /* Detects input changes made since the last run. */
+   }
+
+   while (running)
+   {
+      const lane_vector zero = lanes_broadcast(0x00);
+      const lane_vector active = lanes_load(self->running);
+      uint16_t address = lane_pc(self, lowest_lane(running));
+      lane_vector mask = lanes_and(lanes_at(self, address), active);
+      uint32_t bits = lanes_bits(mask);
+
+      if (bits != running)
+      {
+         address = schedule(self, running, &leader, &leader_steps);
+         mask = lanes_and(lanes_at(self, address), active);
+         bits = lanes_bits(mask);
+         next_done = update_waiting(self, running, bits, num_instructions);
+         diverged = true;
+      }
+      else if (diverged)
+      {
+         memset(self->waiting, 0, sizeof(self->waiting));
+         leader = -1;
+         diverged = false;
+      }
+
+      execute(self, address, mask, bits);
+
+      /* Checks for interrupts and input changes in the lanes just run. */
+      const lane_vector requested = lanes_andnot(lanes_equal(lanes_load(self->irq_requests), zero), mask);
+      const lane_vector enabled = lanes_andnot(lanes_equal(lanes_and(lanes_load(self->sr),
+         lanes_broadcast(1 << I)), zero), requested);
+
+      for (uint32_t rest = lanes_bits(enabled); rest; rest &= rest - 1)
+      {
+         check_for_irq_lane(self, lowest_lane(rest));
+      }
+
+      for (uint32_t rest = lanes_bits(lanes_andnot(lanes_equal(lanes_load(self->pcint_dirty), zero), mask));
+           rest; rest &= rest - 1)
+      {
+         monitor_interrupts_lane(self, lowest_lane(rest));
+      }
+
+      if (++step == next_done)
+      {
+         next_done = UINT64_MAX;
+
+         for (uint32_t rest = running; rest; rest &= rest - 1)
+         {
+            const uint8_t lane = lowest_lane(rest);
+            const uint64_t done = num_instructions + self->stalled[lane];
+
+            if (done == step)
+            {
+               running &= ~((uint32_t)1 << lane);
+               self->running[lane] = 0x00;
+            }
+            else if (done < next_done)
+            {
+               next_done = done;
+            }
+         }
+      }
+   }
+   return num_instructions * self->num_lanes;
+}
+
+/********************************************************************************
+* lockstep_write: Writes an 8-bit value to specified address in the data
+*                 memory of specified lane, for instance an input to PINB.
+*                 Success code 0 is returned after successful write, otherwise
+*                 error code 1 is returned if the lane is invalid or if
+*                 memory for the page can't be allocated.
+*
+*                 - self   : Reference to the lanes.
+*                 - lane   : The lane to write to.
+*                 - address: Write location in data memory.
+*                 - value  : The 8-bit value to write.
+********************************************************************************/
+int lockstep_write(struct lockstep* self,
+                   const uint8_t lane,
+                   const uint16_t address,
+                   const uint8_t value)
+{
+   if (lane >= self->num_lanes || !writable_row(self, address)) return 1;
+   write_lane(self, lane, address, value);
+   return 0;
+}
+
+/********************************************************************************
+* lockstep_read: Returns the content of specified address in the data memory
+*                of specified lane. If the lane is invalid, the value 0 is
+*                returned.
+*
+*                - self   : Reference to the lanes.
+*                - lane   : The lane to read from.
+*                - address: Read location in data memory.
+********************************************************************************/
+uint8_t lockstep_read(const struct lockstep* self,
+                      const uint8_t lane,
+                      const uint16_t address)
+{
+   if (lane >= self->num_lanes) return 0x00;
+   return read_lane(self, lane, address);
+}
+
+/********************************************************************************
+* lockstep_save_lane: Copies the state of specified lane into specified CPU
+*                     context running the same program, for instance to
+*                     print or inspect it. Success code 0 is returned on
+*                     success, otherwise error code 1 is returned if the lane
+*                     is invalid or if memory for a data memory page can't be
+*                     allocated.
+*
+*                     - self   : Reference to the lanes.
+*                     - lane   : The lane to copy.
+*                     - context: Reference to the CPU context.
+********************************************************************************/
+int lockstep_save_lane(const struct lockstep* self,
+                       const uint8_t lane,
+                       struct cpu_context* context)
+{
+   if (lane >= self->num_lanes) return 1;
+   const uint16_t mar = (uint16_t)(self->mar[0][lane] | (self->mar[1][lane] << 8));
+   const struct lockstep_instruction* instruction = &self->program[mar];
+   const bool fresh = self->fresh[lane] != 0;
+
+   context->ir = fresh ? 0 : instruction->ir;
+   context->pc = lane_pc(self, lane);
+   context->mar = mar;
+   context->sr = self->sr[lane];
+   context->flags.pending = false;
+   context->op_code = fresh ? 0 : instruction->op_code;
+   context->op1 = fresh ? 0 : instruction->op1;
+   context->op2 = fresh ? 0 : instruction->op2;
+   context->state = CPU_STATE_FETCH;
+
+   for (uint8_t i = 0; i < CPU_REGISTER_ADDRESS_WIDTH; ++i)
+   {
+      context->reg[i] = self->reg[i][lane];
+   }
+
+   context->pinb_previous = self->pin_previous[0][lane];
+   context->pinc_previous = self->pin_previous[1][lane];
+   context->pind_previous = self->pin_previous[2][lane];
+   context->pcint_dirty = self->pcint_dirty[lane];
+   context->irq_requests = self->irq_requests[lane];
+
+   for (uint16_t i = 0; i < DATA_MEMORY_IO_SIZE; ++i)
+   {
+      context->data[i] = self->data[i][lane];
+   }
+
+   for (uint16_t i = DATA_MEMORY_NUM_IO_PAGES; i < DATA_MEMORY_NUM_PAGES; ++i)
+   {
+      if (self->pages[i])
+      {
+         uint8_t* memory = data_memory_page_data_ctx(context, (uint8_t)i, true);
+         if (!memory) return 1;
+
+         for (uint16_t j = 0; j < DATA_MEMORY_PAGE_SIZE; ++j)
+         {
+            memory[j] = self->pages[i][j][lane];
+         }
+      }
+      else if (context->data_pages[i])
+      {
+         memset(context->data_pages[i], 0, DATA_MEMORY_PAGE_SIZE);
+      }
+   }
+
+   for (uint16_t i = 0; i < STACK_ADDRESS_WIDTH; ++i)
+   {
+      context->stack[i] = self->stack[i][lane];
+   }
+
+   context->sp = self->sp[lane];
+   context->stack_empty = self->stack_empty[lane];
+   memset(context->data_dirty, 0xFF, sizeof(context->data_dirty));
+   memset(context->stack_dirty, 0xFF, sizeof(context->stack_dirty));
+   return 0;
+}
+
+/********************************************************************************
+* lockstep_simd: Returns the name of the instruction set used to run the
+*                lanes, i.e. "avx2", "sse2" or "scalar".
+********************************************************************************/
+const char* lockstep_simd(void)
+{
+#if LOCKSTEP_AVX2
+   return "avx2";
+#elif LOCKSTEP_SSE2
+   return "sse2";
+#else
+   return "scalar";
+#endif
+}
+
+#if LOCKSTEP_AVX2
+/********************************************************************************
+* Lane vectors, AVX2: One 256-bit register holds all 32 lanes.
+********************************************************************************/
+static inline lane_vector lanes_load(const uint8_t* row)
+{
+   return _mm256_loadu_si256((const __m256i*)row);
+}
+static inline void lanes_store(uint8_t* row, const lane_vector value)
+{
+   _mm256_storeu_si256((__m256i*)row, value);
+}
+static inline lane_vector lanes_broadcast(const uint8_t value)
+{
+   return _mm256_set1_epi8((char)value);
+}
+static inline lane_vector lanes_add(const lane_vector a, const lane_vector b)
+{
+   return _mm256_add_epi8(a, b);
+}
+static inline lane_vector lanes_sub(const lane_vector a, const lane_vector b)
+{
+   return _mm256_sub_epi8(a, b);
+}
+static inline lane_vector lanes_and(const lane_vector a, const lane_vector b)
+{
+   return _mm256_and_si256(a, b);
+}
+static inline lane_vector lanes_or(const lane_vector a, const lane_vector b)
+{
+   return _mm256_or_si256(a, b);
+}
+static inline lane_vector lanes_xor(const lane_vector a, const lane_vector b)
+{
+   return _mm256_xor_si256(a, b);
+}
+static inline lane_vector lanes_andnot(const lane_vector a, const lane_vector b)
+{
+   return _mm256_andnot_si256(a, b);
+}
+static inline lane_vector lanes_equal(const lane_vector a, const lane_vector b)
+{
+   return _mm256_cmpeq_epi8(a, b);
+}
+static inline lane_vector lanes_max(const lane_vector a, const lane_vector b)
+{
+   return _mm256_max_epu8(a, b);
+}
+static inline lane_vector lanes_negative(const lane_vector a)
+{
+   return _mm256_cmpgt_epi8(_mm256_setzero_si256(), a);
+}
+static inline uint32_t lanes_bits(const lane_vector a)
+{
+   return (uint32_t)_mm256_movemask_epi8(a);
+}
+
+static inline lane_vector lanes_shift_right(const lane_vector a)
+{
+   return _mm256_and_si256(_mm256_srli_epi16(a, 1), _mm256_set1_epi8(0x7F));
+}
+
+#elif LOCKSTEP_SSE2
+/********************************************************************************
+* Lane vectors, SSE2: Two 128-bit registers hold 16 lanes each.
+********************************************************************************/
+#define LANES_BINARY(name, intrinsic)                                  \
+static inline lane_vector name(const lane_vector a, const lane_vector b) \
+{                                                                       \
+   lane_vector result;                                                  \
+   result.half[0] = intrinsic(a.half[0], b.half[0]);                    \
+   result.half[1] = intrinsic(a.half[1], b.half[1]);                    \
+   return result;                                                       \
+}
+
+LANES_BINARY(lanes_add, _mm_add_epi8)
+LANES_BINARY(lanes_sub, _mm_sub_epi8)
+LANES_BINARY(lanes_and, _mm_and_si128)
+LANES_BINARY(lanes_or, _mm_or_si128)
+LANES_BINARY(lanes_xor, _mm_xor_si128)
+LANES_BINARY(lanes_andnot, _mm_andnot_si128)
+LANES_BINARY(lanes_equal, _mm_cmpeq_epi8)
+LANES_BINARY(lanes_max, _mm_max_epu8)
+
+static inline lane_vector lanes_load(const uint8_t* row)
+{
+   lane_vector result;
+   result.half[0] = _mm_loadu_si128((const __m128i*)row);
+   result.half[1] = _mm_loadu_si128((const __m128i*)(row + 16));
+   return result;
+}
+
+static inline void lanes_store(uint8_t* row, const lane_vector value)
+{
+   _mm_storeu_si128((__m128i*)row, value.half[0]);
+   _mm_storeu_si128((__m128i*)(row + 16), value.half[1]);
+   return;
+}
+
+static inline lane_vector lanes_broadcast(const uint8_t value)
+{
+   lane_vector result;
+   result.half[0] = result.half[1] = _mm_set1_epi8((char)value);
+   return result;
+}
+
+static inline lane_vector lanes_negative(const lane_vector a)
+{
+   lane_vector result;
+   result.half[0] = _mm_cmplt_epi8(a.half[0], _mm_setzero_si128());
+   result.half[1] = _mm_cmplt_epi8(a.half[1], _mm_setzero_si128());
+   return result;
+}
+
+static inline lane_vector lanes_shift_right(const lane_vector a)
+{
+   lane_vector result;
+   result.half[0] = _mm_and_si128(_mm_srli_epi16(a.half[0], 1), _mm_set1_epi8(0x7F));
+   result.half[1] = _mm_and_si128(_mm_srli_epi16(a.half[1], 1), _mm_set1_epi8(0x7F));
+   return result;
+}
+
+static inline uint32_t lanes_bits(const lane_vector a)
+{
+   return (uint32_t)_mm_movemask_epi8(a.half[0]) | ((uint32_t)_mm_movemask_epi8(a.half[1]) << 16);
+}
+
+#else
+/********************************************************************************
+* Lane vectors, plain C: One loop iteration per lane, which the compiler may
+*                        vectorize for other instruction sets.
+********************************************************************************/
+#define LANES_BINARY(name, expression)                                 \
+static inline lane_vector name(const lane_vector a, const lane_vector b) \
+{                                                                       \
+   lane_vector result;                                                  \
+   for (int i = 0; i < LOCKSTEP_LANES; ++i)                             \
+   {                                                                    \
+      const uint8_t x = a.lane[i];                                      \
+      const uint8_t y = b.lane[i];                                      \
+      result.lane[i] = (uint8_t)(expression);                           \
+   }                                                                    \
+   return result;                                                       \
+}
+
+LANES_BINARY(lanes_add, x + y)
+LANES_BINARY(lanes_sub, x - y)
+LANES_BINARY(lanes_and, x & y)
+LANES_BINARY(lanes_or, x | y)
+LANES_BINARY(lanes_xor, x ^ y)
+LANES_BINARY(lanes_andnot, ~x & y)
+LANES_BINARY(lanes_equal, x == y ? 0xFF : 0x00)
+LANES_BINARY(lanes_max, x > y ? x : y)
+
+static inline lane_vector lanes_load(const uint8_t* row)
+{
+   lane_vector result;
+   memcpy(result.lane, row, LOCKSTEP_LANES);
+   return result;
+}
+
+static inline void lanes_store(uint8_t* row, const lane_vector value)
+{
+   memcpy(row, value.lane, LOCKSTEP_LANES);
+   return;
+}
+
+static inline lane_vector lanes_broadcast(const uint8_t value)
+{
+   lane_vector result;
+   memset(result.lane, value, LOCKSTEP_LANES);
+   return result;
+}
+
+static inline lane_vector lanes_negative(const lane_vector a)
+{
+   return lanes_equal(lanes_and(a, lanes_broadcast(0x80)), lanes_broadcast(0x80));
+}
+
+static inline lane_vector lanes_shift_right(const lane_vector a)
+{
+   lane_vector result;
+   for (int i = 0; i < LOCKSTEP_LANES; ++i) result.lane[i] = a.lane[i] >> 1;
+   return result;
+}
+
+static inline uint32_t lanes_bits(const lane_vector a)
+{
+   uint32_t bits = 0;
+   for (int i = 0; i < LOCKSTEP_LANES; ++i) bits |= (uint32_t)(a.lane[i] >> 7) << i;
+   return bits;
+}
+#endif /* LOCKSTEP_AVX2 */
+
+/********************************************************************************
+* lowest_lane: Returns the index of the lowest set bit of specified lane bits.
+*
+*              - bits: Lane bits, at least one of which is set.
+********************************************************************************/
+static inline uint8_t lowest_lane(const uint32_t bits)
+{
+#if defined(__GNUC__)
+   return (uint8_t)__builtin_ctz(bits);
+#else
+   uint8_t lane = 0;
+   while (!(bits & ((uint32_t)1 << lane))) lane++;
+   return lane;
+#endif
+}
+
+/********************************************************************************
+* store_masked: Stores specified value into the lanes of specified row where
+*               the mask is set, leaving the other lanes as they are.
+*
+*               - row  : Reference to the row.
+*               - mask : 0xFF for each lane to store.
+*               - value: The value to store.
+********************************************************************************/
+static inline void store_masked(uint8_t* row,
+                                const lane_vector mask,
+                                const lane_vector value)
+{
+   const lane_vector previous = lanes_load(row);
+   lanes_store(row, lanes_or(lanes_and(mask, value), lanes_andnot(mask, previous)));
+   return;
+}
+
+/********************************************************************************
+* store_address: Stores specified 16-bit address into the lanes of specified
+*                pair of rows where the mask is set, the low byte in the first
+*                row and the high byte in the second.
+*
+*                - rows   : Reference to the rows, e.g. the program counters.
+*                - mask   : 0xFF for each lane to store.
+*                - address: The address to store.
+********************************************************************************/
+static inline void store_address(uint8_t rows[2][LOCKSTEP_LANES],
+                                 const lane_vector mask,
+                                 const uint16_t address)
+{
+   store_masked(rows[0], mask, lanes_broadcast((uint8_t)address));
+   store_masked(rows[1], mask, lanes_broadcast((uint8_t)(address >> 8)));
+   return;
+}
+
+/********************************************************************************
+* lanes_at: Returns 0xFF for each lane whose program counter holds specified
+*           address.
+*
+*           - address: The program address.
+********************************************************************************/
+static inline lane_vector lanes_at(const struct lockstep* self,
+                                   const uint16_t address)
+{
+   return lanes_and(lanes_equal(lanes_load(self->pc[0]), lanes_broadcast((uint8_t)address)),
+                    lanes_equal(lanes_load(self->pc[1]), lanes_broadcast((uint8_t)(address >> 8))));
+}
+
+/********************************************************************************
+* lane_pc: Returns the program counter of specified lane.
+*
+*          - lane: The lane.
+********************************************************************************/
+static inline uint16_t lane_pc(const struct lockstep* self,
+                               const uint8_t lane)
+{
+   return (uint16_t)(self->pc[0][lane] | (self->pc[1][lane] << 8));
+}
+
+/********************************************************************************
+* set_lane_pc: Sets the program counter of specified lane.
+*
+*              - lane   : The lane.
+*              - address: The new program address.
+********************************************************************************/
+static inline void set_lane_pc(struct lockstep* self,
+                               const uint8_t lane,
+                               const uint16_t address)
+{
+   self->pc[0][lane] = (uint8_t)address;
+   self->pc[1][lane] = (uint8_t)(address >> 8);
+   return;
+}
+
+/********************************************************************************
+* load_row: Returns the row of specified address in the data memory. A page
+*           that hasn't been written yet reads as 0 in all lanes.
+*
+*           - address: Read location in data memory.
+********************************************************************************/
+static inline const uint8_t* load_row(const struct lockstep* self,
+                                      const uint16_t address)
+{
+   static const uint8_t zero[LOCKSTEP_LANES] = { 0 };
+
+   if (address < DATA_MEMORY_IO_SIZE)
+   {
+      return self->data[address];
+   }
+   else if (self->pages[address >> 8])
+   {
+      return self->pages[address >> 8][address & 0xFF];
+   }
+   else
+   {
+      return zero;
+   }
+}
+
+/********************************************************************************
+* writable_row: Returns the row of specified address in the data memory. The
+*               page is allocated and cleared for all lanes on the first
+*               write. A null pointer is returned if memory can't be
+*               allocated.
+*
+*               - address: Write location in data memory.
+********************************************************************************/
+static inline uint8_t* writable_row(struct lockstep* self,
+                                    const uint16_t address)
+{
+   if (address < DATA_MEMORY_IO_SIZE) return self->data[address];
+
+   if (!self->pages[address >> 8])
+   {
+      self->pages[address >> 8] = (uint8_t(*)[LOCKSTEP_LANES])calloc(DATA_MEMORY_PAGE_SIZE, LOCKSTEP_LANES);
+      if (!self->pages[address >> 8]) return 0;
+   }
+   return self->pages[address >> 8][address & 0xFF];
+}
+
+/********************************************************************************
+* store_row: Stores specified value at specified valid address in the data
+*            memory of the masked lanes and updates the interrupt logic just
+*            like data_memory_write_ctx, see track_interrupt_registers. The
+*            store is ignored if the page can't be allocated.
+*
+*            - address: The written address in data memory.
+*            - mask   : 0xFF for each lane to store.
+*            - value  : The value to store.
+********************************************************************************/
+static inline void store_row(struct lockstep* self,
+                             const uint16_t address,
+                             const lane_vector mask,
+                             const lane_vector value)
+{
+   uint8_t* row = writable_row(self, address);
+   if (!row) return;
+   store_masked(row, mask, value);
+
+   switch (address)
+   {
+      case PINB: case DATA_MEMORY_PCMSK0:
+      {
+         store_masked(self->pcint_dirty, mask, lanes_or(lanes_load(self->pcint_dirty), lanes_broadcast(1 << PCIF0)));
+         break;
+      }
+      case PINC: case DATA_MEMORY_PCMSK1:
+      {
+         store_masked(self->pcint_dirty, mask, lanes_or(lanes_load(self->pcint_dirty), lanes_broadcast(1 << PCIF1)));
+         break;
+      }
+      case PIND: case DATA_MEMORY_PCMSK2:
+      {
+         store_masked(self->pcint_dirty, mask, lanes_or(lanes_load(self->pcint_dirty), lanes_broadcast(1 << PCIF2)));
+         break;
+      }
+      case DATA_MEMORY_PCIFR: case DATA_MEMORY_PCICR:
+      {
+         const lane_vector requests = lanes_and(lanes_load(self->data[DATA_MEMORY_PCIFR]),
+                                                lanes_load(self->data[DATA_MEMORY_PCICR]));
+         store_masked(self->irq_requests, mask, lanes_and(requests, lanes_broadcast(LOCKSTEP_PCIF)));
+         break;
+      }
+   }
+   return;
+}
+
+/********************************************************************************
+* calculate: Performs calculation with specified operands in all lanes and
+*            returns the result. The status flags SNZVC of the masked lanes
+*            are updated exactly like by the alu function, i.e. for
+*            subtraction the carry is set unless A < B and signed overflow
+*            is detected with the two's complement of B.
+*
+*            - operation: The operation to perform (OR, AND, XOR, ADD or SUB).
+*            - a        : First operand.
+*            - b        : Second operand.
+*            - mask     : 0xFF for each lane whose flags are updated.
+********************************************************************************/
+static inline lane_vector calculate(struct lockstep* self,
+                                    const uint8_t operation,
+                                    const lane_vector a,
+                                    const lane_vector b,
+                                    const lane_vector mask)
+{
+   const lane_vector zero = lanes_broadcast(0x00);
+   lane_vector result;
+   lane_vector carry = zero;
+   lane_vector overflow = zero;
+
+   switch (operation)
+   {
+      case OR:
+      {
+         result = lanes_or(a, b);
+         break;
+      }
+      case AND:
+      {
+         result = lanes_and(a, b);
+         break;
+      }
+      case XOR:
+      {
+         result = lanes_xor(a, b);
+         break;
+      }
+      case ADD:
+      {
+         result = lanes_add(a, b);
+         carry = lanes_andnot(lanes_equal(lanes_max(result, a), result), lanes_broadcast(0xFF));
+         overflow = lanes_negative(lanes_andnot(lanes_xor(a, b), lanes_xor(a, result)));
+         break;
+      }
+      default: /* SUB */
+      {
+         result = lanes_sub(a, b);
+         carry = lanes_equal(lanes_max(a, b), a);
+         overflow = lanes_negative(lanes_andnot(lanes_xor(a, lanes_sub(zero, b)), lanes_xor(a, result)));
+         break;
+      }
+   }
+
+   const lane_vector negative = lanes_negative(result);
+   const lane_vector flags = lanes_or(lanes_or(lanes_and(negative, lanes_broadcast(1 << N)),
+                                               lanes_and(lanes_equal(result, zero), lanes_broadcast(1 << Z))),
+                                      lanes_or(lanes_or(lanes_and(overflow, lanes_broadcast(1 << V)),
+                                                        lanes_and(carry, lanes_broadcast(1 << C))),
+                                               lanes_and(lanes_xor(negative, overflow), lanes_broadcast(1 << S))));
+   const lane_vector sr = lanes_or(lanes_andnot(lanes_broadcast(LOCKSTEP_SNZVC), lanes_load(self->sr)), flags);
+   store_masked(self->sr, mask, sr);
+   return result;
+}
+
+/********************************************************************************
+* branch_taken: Returns 0xFF for each masked lane where the condition of
+*               specified branch instruction holds.
+*
+*               - op_code: OP code of the branch instruction.
+*               - mask   : 0xFF for each lane executing the branch.
+********************************************************************************/
+static inline lane_vector branch_taken(const struct lockstep* self,
+                                       const uint8_t op_code,
+                                       const lane_vector mask)
+{
+   const lane_vector zero = lanes_broadcast(0x00);
+   const lane_vector sr = lanes_load(self->sr);
+   const lane_vector zero_clear = lanes_equal(lanes_and(sr, lanes_broadcast(1 << Z)), zero);
+   const lane_vector signed_clear = lanes_equal(lanes_and(sr, lanes_broadcast(1 << S)), zero);
+
+   switch (op_code)
+   {
+      case BREQ: return lanes_andnot(zero_clear, mask);
+      case BRNE: return lanes_and(zero_clear, mask);
+      case BRGE: return lanes_and(signed_clear, mask);
+      case BRGT: return lanes_and(lanes_and(signed_clear, zero_clear), mask);
+      case BRLE: return lanes_andnot(lanes_and(signed_clear, zero_clear), mask);
+      default:   return lanes_andnot(signed_clear, mask); /* BRLT */
+   }
+}
+
+/********************************************************************************
+* store_indirect: Stores the content of specified source register at the
+*                 address held by specified pointer register pair plus
+*                 specified offset (STIO and ST). If all masked lanes point
+*                 at the same address, the row is stored at once, otherwise
+*                 lane by lane.
+*
+*                 - pointer: The low register of the pointer.
+*                 - source : The register to store.
+*                 - offset : Offset added to the pointer.
+*                 - mask   : 0xFF for each lane executing the instruction.
+*                 - bits   : Bit for each lane executing the instruction.
+********************************************************************************/
+static void store_indirect(struct lockstep* self,
+                           const uint8_t pointer,
+                           const uint8_t source,
+                           const uint16_t offset,
+                           const lane_vector mask,
+                           const uint32_t bits)
+{
+   const uint8_t first = lowest_lane(bits);
+   const uint8_t pointer_low = self->reg[pointer][first];
+   const uint8_t pointer_high = self->reg[pointer + 1][first];
+   const lane_vector same = lanes_and(lanes_equal(lanes_load(self->reg[pointer]), lanes_broadcast(pointer_low)),
+                                      lanes_equal(lanes_load(self->reg[pointer + 1]), lanes_broadcast(pointer_high)));
+
+   if ((lanes_bits(same) & bits) == bits)
+   {
+      const uint32_t address = (uint32_t)(pointer_low | (pointer_high << 8)) + offset;
+      if (address < DATA_MEMORY_ADDRESS_WIDTH) store_row(self, (uint16_t)address, mask, lanes_load(self->reg[source]));
+      return;
+   }
+
+   for (uint32_t rest = bits; rest; rest &= rest - 1)
+   {
+      const uint8_t lane = lowest_lane(rest);
+      const uint32_t address = (uint32_t)(self->reg[pointer][lane] | (self->reg[pointer + 1][lane] << 8)) + offset;
+      write_lane(self, lane, address, self->reg[source][lane]);
+   }
+   return;
+}
+
+/********************************************************************************
+* load_indirect: Loads specified destination register from the address held
+*                by specified pointer register pair plus specified offset
+*                (LDIO and LD). If all masked lanes point at the same
+*                address, the row is loaded at once, otherwise lane by lane.
+*
+*                - destination: The register to load.
+*                - pointer    : The low register of the pointer.
+*                - offset     : Offset added to the pointer.
+*                - mask       : 0xFF for each lane executing the instruction.
+*                - bits       : Bit for each lane executing the instruction.
+********************************************************************************/
+static void load_indirect(struct lockstep* self,
+                          const uint8_t destination,
+                          const uint8_t pointer,
+                          const uint16_t offset,
+                          const lane_vector mask,
+                          const uint32_t bits)
+{
+   const uint8_t first = lowest_lane(bits);
+   const uint8_t pointer_low = self->reg[pointer][first];
+   const uint8_t pointer_high = self->reg[pointer + 1][first];
+   const lane_vector same = lanes_and(lanes_equal(lanes_load(self->reg[pointer]), lanes_broadcast(pointer_low)),
+                                      lanes_equal(lanes_load(self->reg[pointer + 1]), lanes_broadcast(pointer_high)));
+
+   if ((lanes_bits(same) & bits) == bits)
+   {
+      const uint32_t address = (uint32_t)(pointer_low | (pointer_high << 8)) + offset;
+      const lane_vector value = address < DATA_MEMORY_ADDRESS_WIDTH ?
+         lanes_load(load_row(self, (uint16_t)address)) : lanes_broadcast(0x00);
+      store_masked(self->reg[destination], mask, value);
+      return;
+   }
+
+   for (uint32_t rest = bits; rest; rest &= rest - 1)
+   {
+      const uint8_t lane = lowest_lane(rest);
+      const uint32_t address = (uint32_t)(self->reg[pointer][lane] | (self->reg[pointer + 1][lane] << 8)) + offset;
+      self->reg[destination][lane] = read_lane(self, lane, address);
+   }
+   return;
+}
+
+/********************************************************************************
+* execute: Executes the instruction at specified address in the masked lanes,
+*          which all stand at the address. The result in each lane is the
+*          same as for the corresponding instruction handler of the control
+*          unit.
+*
+*          - address: Address of the instruction.
+*          - mask   : 0xFF for each lane executing the instruction.
+*          - bits   : Bit for each lane executing the instruction.
+********************************************************************************/
+static void execute(struct lockstep* self,
+                    const uint16_t address,
+                    const lane_vector mask,
+                    const uint32_t bits)
+{
+   const struct lockstep_instruction* instruction = &self->program[address];
+   const uint8_t op1 = instruction->op1;
+   const uint8_t op2 = instruction->op2;
+
+   store_address(self->mar, mask, address);
+   store_address(self->pc, mask, (uint16_t)(address + 1));
+   store_masked(self->fresh, mask, lanes_broadcast(0x00));
+
+   if (!instruction->valid)
+   {
+      for (uint32_t rest = bits; rest; rest &= rest - 1) reset_lane(self, lowest_lane(rest));
+      return;
+   }
+
+   switch (instruction->op_code)
+   {
+      case NOP:
+      {
+         break;
+      }
+      case LDI:
+      {
+         store_masked(self->reg[op1], mask, lanes_broadcast(op2));
+         break;
+      }
+      case MOV:
+      {
+         store_masked(self->reg[op1], mask, lanes_load(self->reg[op2]));
+         break;
+      }
+      case OUT:
+      {
+         store_row(self, op1, mask, lanes_load(self->reg[op2]));
+         break;
+      }
+      case IN:
+      {
+         store_masked(self->reg[op1], mask, lanes_load(load_row(self, op2)));
+         break;
+      }
+      case STS:
+      {
+         store_row(self, op1 + DATA_MEMORY_DATA_OFFSET, mask, lanes_load(self->reg[op2]));
+         break;
+      }
+      case LDS:
+      {
+         store_masked(self->reg[op1], mask, lanes_load(load_row(self, op2 + DATA_MEMORY_DATA_OFFSET)));
+         break;
+      }
+      case CLR:
+      {
+         store_masked(self->reg[op1], mask, lanes_broadcast(0x00));
+         break;
+      }
+      case ORI: case ANDI: case XORI: case ADDI: case SUBI:
+      {
+         static const uint8_t operations[] = { OR, AND, XOR, 0, 0, 0, ADD, SUB };
+         const lane_vector result = calculate(self, operations[instruction->op_code - ORI],
+                                              lanes_load(self->reg[op1]), lanes_broadcast(op2), mask);
+         store_masked(self->reg[op1], mask, result);
+         break;
+      }
+      case OR: case AND: case XOR: case ADD: case SUB:
+      {
+         const lane_vector result = calculate(self, instruction->op_code, lanes_load(self->reg[op1]),
+                                              lanes_load(self->reg[op2]), mask);
+         store_masked(self->reg[op1], mask, result);
+         break;
+      }
+      case INC: case DEC:
+      {
+         const lane_vector result = calculate(self, instruction->op_code == INC ? ADD : SUB,
+                                              lanes_load(self->reg[op1]), lanes_broadcast(1), mask);
+         store_masked(self->reg[op1], mask, result);
+         break;
+      }
+      case CPI:
+      {
+         (void)calculate(self, SUB, lanes_load(self->reg[op1]), lanes_broadcast(op2), mask);
+         break;
+      }
+      case CP:
+      {
+         (void)calculate(self, SUB, lanes_load(self->reg[op1]), lanes_load(self->reg[op2]), mask);
+         break;
+      }
+      case JMP:
+      {
+         store_address(self->pc, mask, program_memory_jump_address(op1, op2));
+         break;
+      }
+      case BREQ: case BRNE: case BRGE: case BRGT: case BRLE: case BRLT:
+      {
+         store_address(self->pc, branch_taken(self, instruction->op_code, mask), program_memory_jump_address(op1, op2));
+         break;
+      }
+      case CALL:
+      {
+         for (uint32_t rest = bits; rest; rest &= rest - 1)
+         {
+            const uint8_t lane = lowest_lane(rest);
+            push_lane(self, lane, self->pc[0][lane]);
+            push_lane(self, lane, self->pc[1][lane]);
+         }
+         store_address(self->pc, mask, program_memory_jump_address(op1, op2));
+         break;
+      }
+      case RET: case RETI:
+      {
+         for (uint32_t rest = bits; rest; rest &= rest - 1)
+         {
+            const uint8_t lane = lowest_lane(rest);
+            const uint8_t high = pop_lane(self, lane);
+            set_lane_pc(self, lane, (uint16_t)(pop_lane(self, lane) | (high << 8)));
+         }
+         if (instruction->op_code == RETI) store_masked(self->sr, mask, lanes_or(lanes_load(self->sr), lanes_broadcast(1 << I)));
+         break;
+      }
+      case PUSH:
+      {
+         for (uint32_t rest = bits; rest; rest &= rest - 1)
+         {
+            const uint8_t lane = lowest_lane(rest);
+            push_lane(self, lane, self->reg[op1][lane]);
+         }
+         break;
+      }
+      case POP:
+      {
+         for (uint32_t rest = bits; rest; rest &= rest - 1)
+         {
+            const uint8_t lane = lowest_lane(rest);
+            self->reg[op1][lane] = pop_lane(self, lane);
+         }
+         break;
+      }
+      case LSL:
+      {
+         const lane_vector value = lanes_load(self->reg[op1]);
+         store_masked(self->reg[op1], mask, lanes_add(value, value));
+         break;
+      }
+      case LSR:
+      {
+         store_masked(self->reg[op1], mask, lanes_shift_right(lanes_load(self->reg[op1])));
+         break;
+      }
+      case SEI:
+      {
+         store_masked(self->sr, mask, lanes_or(lanes_load(self->sr), lanes_broadcast(1 << I)));
+         break;
+      }
+      case CLI:
+      {
+         store_masked(self->sr, mask, lanes_andnot(lanes_broadcast(1 << I), lanes_load(self->sr)));
+         break;
+      }
+      case STIO:
+      {
+         store_indirect(self, op1, op2, 0, mask, bits);
+         break;
+      }
+      case LDIO:
+      {
+         load_indirect(self, op1, op2, 0, mask, bits);
+         break;
+      }
+      case ST:
+      {
+         store_indirect(self, op1, op2, DATA_MEMORY_DATA_OFFSET, mask, bits);
+         break;
+      }
+      case LD:
+      {
+         load_indirect(self, op1, op2, DATA_MEMORY_DATA_OFFSET, mask, bits);
+         break;
+      }
+   }
+   return;
+}
+
+/********************************************************************************
+* schedule: Returns the address to run next when the running lanes stand at
+*           different addresses. Normally the lowest address is picked, so
+*           that lanes which have branched ahead wait for the others where
+*           the branches join. If a lane has been kept waiting for
+*           LOCKSTEP_MAX_WAIT instructions, it becomes the leader and its
+*           address is picked for the next LOCKSTEP_MAX_WAIT instructions,
+*           so that lanes looping at different addresses take turns.
+*
+*           - running     : Bit for each running lane.
+*           - leader      : Reference to the leading lane (-1 = none).
+*           - leader_steps: Reference to the number of instructions led.
+********************************************************************************/
+static uint16_t schedule(const struct lockstep* self,
+                         const uint32_t running,
+                         int* leader,
+                         uint32_t* leader_steps)
+{
+   if (*leader >= 0 && (running & ((uint32_t)1 << *leader)) && *leader_steps < LOCKSTEP_MAX_WAIT)
+   {
+      (*leader_steps)++;
+      return lane_pc(self, (uint8_t)*leader);
+   }
+
+   uint32_t lowest = PROGRAM_MEMORY_ADDRESS_WIDTH;
+   uint8_t oldest = lowest_lane(running);
+   *leader = -1;
+
+   for (uint32_t rest = running; rest; rest &= rest - 1)
+   {
+      const uint8_t lane = lowest_lane(rest);
+      if (lane_pc(self, lane) < lowest) lowest = lane_pc(self, lane);
+      if (self->waiting[lane] > self->waiting[oldest]) oldest = lane;
+   }
+
+   if (self->waiting[oldest] >= LOCKSTEP_MAX_WAIT)
+   {
+      *leader = oldest;
+      *leader_steps = 1;
+      return lane_pc(self, oldest);
+   }
+   return (uint16_t)lowest;
+}
+
+/********************************************************************************
+* update_waiting: Counts one more masked out instruction for each running
+*                 lane not executed and returns the step at which the first
+*                 running lane finishes its run, i.e. once it has executed
+*                 the specified number of instructions.
+*
+*                 - running         : Bit for each running lane.
+*                 - executed        : Bit for each lane executed this step.
+*                 - num_instructions: Number of instructions to run per lane.
+********************************************************************************/
+static uint64_t update_waiting(struct lockstep* self,
+                               const uint32_t running,
+                               const uint32_t executed,
+                               const uint64_t num_instructions)
+{
+   uint64_t next_done = UINT64_MAX;
+
+   for (uint32_t rest = running; rest; rest &= rest - 1)
+   {
+      const uint8_t lane = lowest_lane(rest);
+
+      if (executed & ((uint32_t)1 << lane))
+      {
+         self->waiting[lane] = 0;
+      }
+      else
+      {
+         self->waiting[lane]++;
+         self->stalled[lane]++;
+      }
+
+      if (num_instructions + self->stalled[lane] < next_done)
+      {
+         next_done = num_instructions + self->stalled[lane];
+      }
+   }
+   return next_done;
+}
+
+/********************************************************************************
+* reset_lane: Resets specified lane to the reset state of the program, just
+*             like control_unit_reset_ctx.
+*
+*             - lane: The lane to reset.
+********************************************************************************/
+static void reset_lane(struct lockstep* self,
+                       const uint8_t lane)
+{
+   for (uint8_t i = 0; i < CPU_REGISTER_ADDRESS_WIDTH; ++i)
+   {
+      self->reg[i][lane] = 0x00;
+   }
+
+   self->sr[lane] = 0x00;
+   set_lane_pc(self, lane, self->entry_point);
+   self->mar[0][lane] = 0x00;
+   self->mar[1][lane] = 0x00;
+   self->fresh[lane] = 0xFF;
+   self->pin_previous[0][lane] = 0x00;
+   self->pin_previous[1][lane] = 0x00;
+   self->pin_previous[2][lane] = 0x00;
+   self->pcint_dirty[lane] = 0x00;
+   self->irq_requests[lane] = 0x00;
+
+   for (uint16_t i = 0; i < DATA_MEMORY_IO_SIZE; ++i)
+   {
+      self->data[i][lane] = self->data_reset[i];
+   }
+
+   for (uint16_t i = DATA_MEMORY_NUM_IO_PAGES; i < DATA_MEMORY_NUM_PAGES; ++i)
+   {
+      if (!self->pages[i]) continue;
+
+      for (uint16_t j = 0; j < DATA_MEMORY_PAGE_SIZE; ++j)
+      {
+         self->pages[i][j][lane] = self->data_reset[i * DATA_MEMORY_PAGE_SIZE + j];
+      }
+   }
+
+   for (uint16_t i = 0; i < STACK_ADDRESS_WIDTH; ++i)
+   {
+      self->stack[i][lane] = 0x00;
+   }
+
+   self->sp[lane] = STACK_ADDRESS_WIDTH - 1;
+   self->stack_empty[lane] = true;
+   return;
+}
+
+/********************************************************************************
+* read_lane: Returns the content of specified address in the data memory of
+*            specified lane, or 0 if the address is invalid.
+*
+*            - lane   : The lane to read from.
+*            - address: Read location in data memory.
+********************************************************************************/
+static inline uint8_t read_lane(const struct lockstep* self,
+                                const uint8_t lane,
+                                const uint32_t address)
+{
+   return address < DATA_MEMORY_ADDRESS_WIDTH ? load_row(self, (uint16_t)address)[lane] : 0x00;
+}
+
+/********************************************************************************
+* write_lane: Writes specified value to specified address in the data memory
+*             of specified lane and updates the interrupt logic of the lane,
+*             see store_row. Writes to invalid addresses are ignored, just
+*             like writes to pages that can't be allocated.
+*
+*             - lane   : The lane to write to.
+*             - address: Write location in data memory.
+*             - value  : The 8-bit value to write.
+********************************************************************************/
+static inline void write_lane(struct lockstep* self,
+                              const uint8_t lane,
+                              const uint32_t address,
+                              const uint8_t value)
+{
+   uint8_t* row = address < DATA_MEMORY_ADDRESS_WIDTH ? writable_row(self, (uint16_t)address) : 0;
+   if (!row) return;
+   row[lane] = value;
+
+   switch (address)
+   {
+      case PINB: case DATA_MEMORY_PCMSK0:
+      {
+         set(self->pcint_dirty[lane], PCIF0);
+         break;
+      }
+      case PINC: case DATA_MEMORY_PCMSK1:
+      {
+         set(self->pcint_dirty[lane], PCIF1);
+         break;
+      }
+      case PIND: case DATA_MEMORY_PCMSK2:
+      {
+         set(self->pcint_dirty[lane], PCIF2);
+         break;
+      }
+      case DATA_MEMORY_PCIFR: case DATA_MEMORY_PCICR:
+      {
+         self->irq_requests[lane] = self->data[DATA_MEMORY_PCIFR][lane] &
+            self->data[DATA_MEMORY_PCICR][lane] & LOCKSTEP_PCIF;
+         break;
+      }
+   }
+   return;
+}
+
+/********************************************************************************
+* push_lane: Pushes specified value to the stack of specified lane, unless the
+*            stack is full, just like stack_push_ctx.
+*
+*            - lane : The lane to push to.
+*            - value: The value to push.
+********************************************************************************/
+static inline void push_lane(struct lockstep* self,
+                             const uint8_t lane,
+                             const uint8_t value)
+{
+   if (self->sp[lane] == 0) return;
+
+   if (self->stack_empty[lane])
+   {
+      self->stack[self->sp[lane]][lane] = value;
+      self->stack_empty[lane] = false;
+   }
+   else
+   {
+      self->stack[--self->sp[lane]][lane] = value;
+   }
+   return;
+}
+
+/********************************************************************************
+* pop_lane: Pops a value from the stack of specified lane, just like
+*           stack_pop_ctx. If the stack is empty, the value 0 is returned.
+*
+*           - lane: The lane to pop from.
+********************************************************************************/
+static inline uint8_t pop_lane(struct lockstep* self,
+                               const uint8_t lane)
+{
+   if (self->stack_empty[lane]) return 0x00;
+
+   if (self->sp[lane] < STACK_ADDRESS_WIDTH - 1)
+   {
+      return self->stack[self->sp[lane]++][lane];
+   }
+   else
+   {
+      self->stack_empty[lane] = true;
+      return self->stack[self->sp[lane]][lane];
+   }
+}
+
+/********************************************************************************
+* check_for_irq_lane: Generates an interrupt in specified lane for the first
+*                     enabled interrupt request, just like check_for_irq of
+*                     the control unit. Called for lanes with an enabled
+*                     request and the I flag set.
+*
+*                     - lane: The lane to check.
+********************************************************************************/
+static void check_for_irq_lane(struct lockstep* self,
+                               const uint8_t lane)
+{
+   static const uint8_t vectors[] = { PCINT0_vect, PCINT1_vect, PCINT2_vect };
+   const uint8_t pcifr = self->data[DATA_MEMORY_PCIFR][lane];
+   const uint8_t pcicr = self->data[DATA_MEMORY_PCICR][lane];
+
+   for (uint8_t flag = PCIF0; flag <= PCIF2; ++flag)
+   {
+      if (read(pcifr, flag) && read(pcicr, flag))
+      {
+         write_lane(self, lane, DATA_MEMORY_PCIFR, pcifr & ~(1 << flag));
+         push_lane(self, lane, self->pc[0][lane]);
+         push_lane(self, lane, self->pc[1][lane]);
+         clr(self->sr[lane], I);
+         set_lane_pc(self, lane, vectors[flag]);
+         return;
+      }
+   }
+   return;
+}
+
+/********************************************************************************
+* monitor_interrupts_lane: Monitors pin change interrupts on the ports of
+*                          specified lane whose PIN or PCMSK register has been
+*                          written, just like monitor_interrupts of the
+*                          control unit.
+*
+*                          - lane: The lane to monitor.
+********************************************************************************/
+static void monitor_interrupts_lane(struct lockstep* self,
+                                    const uint8_t lane)
+{
+   static const uint8_t pins[] = { PINB, PINC, PIND };
+   static const uint16_t masks[] = { DATA_MEMORY_PCMSK0, DATA_MEMORY_PCMSK1, DATA_MEMORY_PCMSK2 };
+
+   for (uint8_t port = 0; port < 3; ++port)
+   {
+      if (!read(self->pcint_dirty[lane], port)) continue;
+      const uint8_t current = self->data[pins[port]][lane];
+
+      if ((current ^ self->pin_previous[port][lane]) & self->data[masks[port]][lane])
+      {
+         write_lane(self, lane, DATA_MEMORY_PCIFR, self->data[DATA_MEMORY_PCIFR][lane] | (1 << port));
+      }
+
+      self->pin_previous[port][lane] = current;
+   }
+
+   self->pcint_dirty[lane] = 0x00;
+   return;
+}
@@ -0,0 +1,135 @@
+/********************************************************************************
+* lockstep.h: Contains function declarations and macro definitions for running
+*             many instances of the same program side by side, for instance
+*             one board per combination of PIN inputs. The CPU registers,
+*             status register, program counter, data memory and stack of
+*             all instances are stored as a structure of arrays, where each
+*             address holds one byte per instance (lane), so that an
+*             instruction is executed for all lanes at once with SIMD
+*             instructions: AVX2 when the compiler targets it, otherwise
+*             SSE2 on x86 and plain C on other platforms.
+*
+*             All lanes standing at the same address execute the next
+*             instruction together. When the lanes take different branches,
+*             for instance because of different PIN inputs, the lanes
+*             standing at the lowest address are run first, while the other
+*             lanes are masked out, so that the lanes meet again where the
+*             branches join. A lane kept waiting for LOCKSTEP_MAX_WAIT
+*             instructions is run for as long, so that lanes stuck in
+*             different loops still share the run fairly.
+*
+*             Each lane behaves exactly like a CPU context running the same
+*             program in batch runs of the same length. Peripherals mapped
+*             onto the data memory aren't emulated; all addresses are plain
+*             data memory. As in a CPU context, the pages of the data memory
+*             above the I/O pages are allocated on the first write, here for
+*             all lanes at once.
+********************************************************************************/
+#ifndef LOCKSTEP_H_
+#define LOCKSTEP_H_
+
+/* Include directives: */
+#include "cpu.h"
+
+/* Macro definitions: */
+#define LOCKSTEP_LANES    32 /* Max number of lanes, one SIMD register of 8-bit values with AVX2. */
+#define LOCKSTEP_MAX_WAIT 64 /* Max number of instructions a lane is kept waiting before it's run. */
+
+/* Forward declarations: */
+struct cpu_context;
+struct lockstep;
+
+/********************************************************************************
+* lockstep_new: Returns a new set of specified number of lanes running the
+*               program of specified CPU context. The CPU context is reset
+*               and each lane is started from the reset state. A null pointer
+*               is returned if the number of lanes is 0 or exceeds
+*               LOCKSTEP_LANES or if memory can't be allocated.
+*
+*               - prototype: Reference to the CPU context holding the program.
+*               - num_lanes: Number of lanes.
+********************************************************************************/
+struct lockstep* lockstep_new(struct cpu_context* prototype,
+                              const uint8_t num_lanes);
+
+/********************************************************************************
+* lockstep_delete: Deletes specified set of lanes. The referenced pointer is
+*                  set to null.
+*
+*                  - self: Reference to pointer to the lanes.
+********************************************************************************/
+void lockstep_delete(struct lockstep** self);
+
+/********************************************************************************
+* lockstep_reset: Resets all lanes of specified set to the reset state of the
+*                 program.
+*
+*                 - self: Reference to the lanes.
+********************************************************************************/
+void lockstep_reset(struct lockstep* self);
+
+/********************************************************************************
+* lockstep_run: Runs specified number of instructions in each lane of
+*               specified set, with the same result per lane as a batch run
+*               of a CPU context, see control_unit_run_ctx. The total number
+*               of instructions executed by all lanes is returned.
+*
+*               - self            : Reference to the lanes.
+*               - num_instructions: Number of instructions to run per lane.
+********************************************************************************/
+uint64_t lockstep_run(struct lockstep* self,
+                      const uint64_t num_instructions);
+
+/********************************************************************************
+* lockstep_write: Writes an 8-bit value to specified address in the data
+*                 memory of specified lane, for instance an input to PINB.
+*                 Success code 0 is returned after successful write, otherwise
+*                 error code 1 is returned if the lane is invalid or if
+*                 memory for the page can't be allocated.
+*
+*                 - self   : Reference to the lanes.
+*                 - lane   : The lane to write to.
+*                 - address: Write location in data memory.
+*                 - value  : The 8-bit value to write.
+********************************************************************************/
+int lockstep_write(struct lockstep* self,
+                   const uint8_t lane,
+                   const uint16_t address,
+                   const uint8_t value);
+
+/********************************************************************************
+* lockstep_read: Returns the content of specified address in the data memory
+*                of specified lane. If the lane is invalid, the value 0 is
+*                returned.
+*
+*                - self   : Reference to the lanes.
+*                - lane   : The lane to read from.
+*                - address: Read location in data memory.
+********************************************************************************/
+uint8_t lockstep_read(const struct lockstep* self,
+                      const uint8_t lane,
+                      const uint16_t address);
+
+/********************************************************************************
+* lockstep_save_lane: Copies the state of specified lane into specified CPU
+*                     context running the same program, for instance to
+*                     print or inspect it. Success code 0 is returned on
+*                     success, otherwise error code 1 is returned if the lane
+*                     is invalid or if memory for a data memory page can't be
+*                     allocated.
+*
+*                     - self   : Reference to the lanes.
+*                     - lane   : The lane to copy.
+*                     - context: Reference to the CPU context.
+********************************************************************************/
+int lockstep_save_lane(const struct lockstep* self,
+                       const uint8_t lane,
+                       struct cpu_context* context);
+
+/********************************************************************************
+* lockstep_simd: Returns the name of the instruction set used to run the
+*                lanes, i.e. "avx2", "sse2" or "scalar".
+********************************************************************************/
+const char* lockstep_simd(void);
+
+#endif /* LOCKSTEP_H_ */
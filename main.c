@@ -1,13 +1,59 @@
-/********************************************************************************
-* main.c: Demonstration of an 8-bit CPU in progress, based on AVR architecture.
-********************************************************************************/
-#include "cpu_controller.h"
-
-/********************************************************************************
-* main: Controls the program flow of an 8-bit processor by keyboard input.
-********************************************************************************/
-int main(void)
-{
-   cpu_controller_run_by_input();
-   return 0;
+/********************************************************************************
+* main.c: Demonstration of an 8-bit CPU in progress, based on AVR architecture.
+********************************************************************************/
+#include "cpu_controller.h"
+
+#include <string.h>
+
+/********************************************************************************
+* main: Controls the program flow of an 8-bit processor by keyboard input.
+*       If the path to a program image or an assembly source file is passed
+*       as argument, the program is run instead of the built-in program.
+*       If the option -o is passed after the source file along with the path
+*       to an image file, the source file is assembled into a program image,
+*       which is written to the file. An existing file is only overwritten if
+*       it's a program image itself. If the
+*       path to an execution trace is passed, the trace is printed as text.
+*       If the path to a stimulus file is passed, after the optional program,
+*       the program is run headless with the pin input registers driven by
+*       the stimulus, optionally for a given number of clock cycles and with
+*       the waveform of the I/O registers recorded to a given VCD file.
+*       If the option --gdb is passed along with a loopback TCP port or a
+*       Unix socket path, and optionally a program, the program is run under
+*       control of a debugger connecting to the address.
+*
+*       - argc: The number of arguments.
+*       - argv: The arguments, where argv[1] is an optional program, trace or
+*               stimulus file and argv[2] is an optional stimulus file or the
+*               option -o followed by the image file to write.
+********************************************************************************/
+int main(int argc, char** argv)
+{
+   if (argc > 2 && !strcmp(argv[1], "--gdb"))
+   {
+      if (argc > 3 && cpu_controller_load_program(argv[3])) return 1;
+      return cpu_controller_run_gdb(argv[2]);
+   }
+   if (argc > 1 && stimulus_detect(argv[1]))
+   {
+      return cpu_controller_run_stimulus(argv[1], argc > 2 ? strtoull(argv[2], 0, 0) : 0, argc > 3 ? argv[3] : 0);
+   }
+   if (argc > 2 && stimulus_detect(argv[2]))
+   {
+      if (cpu_controller_load_program(argv[1])) return 1;
+      return cpu_controller_run_stimulus(argv[2], argc > 3 ? strtoull(argv[3], 0, 0) : 0, argc > 4 ? argv[4] : 0);
+   }
+   if (argc == 4 && !strcmp(argv[2], "-o")) return cpu_controller_build_image(argv[1], argv[3]);
+   if (argc > 2)
+   {
+      printf("Usage: %s [program] [stimulus file [cycles [VCD file]]]\n", argv[0]);
+      printf("       %s <source file> -o <image file>\n", argv[0]);
+      printf("       %s <trace file>\n", argv[0]);
+      printf("       %s --gdb <address> [program]\n", argv[0]);
+      return 1;
+   }
+   if (argc > 1 && trace_detect(argv[1])) return trace_dump(argv[1], stdout);
+   if (argc > 1 && cpu_controller_load_program(argv[1])) return 1;
+   cpu_controller_run_by_input();
+   return 0;
 }
\ No newline at end of file
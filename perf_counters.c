@@ -0,0 +1,133 @@
+/********************************************************************************
+* perf_counters.c: Contains function definitions for reading, clearing and
+*                  printing the performance counters of a CPU context.
+********************************************************************************/
+#include "perf_counters.h"
+#include "cpu_context.h"
+
+#include <string.h>
+
+/********************************************************************************
+* perf_counters_reset_ctx: Clears all performance counters of specified CPU
+*                          context.
+*
+*                          - self: Reference to the CPU context.
+********************************************************************************/
+void perf_counters_reset_ctx(struct cpu_context* self)
+{
+   memset(&self->counters, 0, sizeof(self->counters));
+   return;
+}
+
+/********************************************************************************
+* perf_counters_get_ctx: Returns the performance counters of specified CPU
+*                        context.
+*
+*                        - self: Reference to the CPU context.
+********************************************************************************/
+const struct perf_counters* perf_counters_get_ctx(const struct cpu_context* self)
+{
+   return &self->counters;
+}
+
+/********************************************************************************
+* perf_counters_retired_total: Returns the total number of retired instructions.
+*
+*                              - self: Reference to the counters.
+********************************************************************************/
+uint64_t perf_counters_retired_total(const struct perf_counters* self)
+{
+   uint64_t total = 0;
+
+   for (uint16_t i = 0; i < PERF_COUNTERS_NUM_OP_CODES; ++i)
+   {
+      total += self->retired[i];
+   }
+   return total;
+}
+
+/********************************************************************************
+* perf_counters_print_ctx: Prints the performance counters of specified CPU
+*                          context. OP codes without retired instructions are
+*                          left out.
+*
+*                          - self   : Reference to the CPU context.
+*                          - ostream: Reference to the output stream.
+********************************************************************************/
+void perf_counters_print_ctx(const struct cpu_context* self,
+                             FILE* ostream)
+{
+   static const char* const vectors[PERF_COUNTERS_NUM_VECTORS] =
+   {
+      "RESET_vect", "PCINT0_vect", "PCINT1_vect", "PCINT2_vect"
+   };
+
+   const struct perf_counters* counters = &self->counters;
+
+   fprintf(ostream, "Performance counters:\n");
+   fprintf(ostream, "Instructions retired:\t\t\t\t%llu\n",
+           (unsigned long long)perf_counters_retired_total(counters));
+
+   for (uint16_t i = 0; i < PERF_COUNTERS_NUM_OP_CODES; ++i)
+   {
+      if (!counters->retired[i]) continue;
+      const char* name = cpu_instruction_name((uint8_t)i);
+
+      if (!strcmp(name, "Unknown"))
+      {
+         fprintf(ostream, "   Invalid (0x%02X)\t\t\t\t%llu\n", i, (unsigned long long)counters->retired[i]);
+      }
+      else
+      {
+         fprintf(ostream, "   %s\t\t\t\t\t\t%llu\n", name, (unsigned long long)counters->retired[i]);
+      }
+   }
+
+   fprintf(ostream, "Clock states:\t\t\t\t\t%llu\n", (unsigned long long)counters->states);
+
+   for (uint8_t i = 0; i < PERF_COUNTERS_NUM_VECTORS; ++i)
+   {
+      fprintf(ostream, "Interrupts taken (%s):\t\t\t%llu\n", vectors[i],
+              (unsigned long long)counters->interrupts[i]);
+   }
+
+   fprintf(ostream, "I/O reads / writes:\t\t\t\t%llu / %llu\n",
+           (unsigned long long)counters->io_reads, (unsigned long long)counters->io_writes);
+   fprintf(ostream, "RAM reads / writes:\t\t\t\t%llu / %llu\n",
+           (unsigned long long)counters->ram_reads, (unsigned long long)counters->ram_writes);
+   fprintf(ostream, "Stack high-water mark:\t\t\t\t%u bytes\n", counters->stack_high_water);
+   fprintf(ostream, "Stack overflows / underflows:\t\t\t%llu / %llu\n\n",
+           (unsigned long long)counters->stack_overflows, (unsigned long long)counters->stack_underflows);
+   return;
+}
+
+/********************************************************************************
+* perf_counters_reset: Clears all performance counters of the default CPU
+*                      context.
+********************************************************************************/
+void perf_counters_reset(void)
+{
+   perf_counters_reset_ctx(cpu_context_default());
+   return;
+}
+
+/********************************************************************************
+* perf_counters_get: Returns the performance counters of the default CPU
+*                    context.
+********************************************************************************/
+const struct perf_counters* perf_counters_get(void)
+{
+   return perf_counters_get_ctx(cpu_context_default());
+}
+
+/********************************************************************************
+* perf_counters_print: Prints the performance counters of the default CPU
+*                      context.
+*
+*                      - ostream: Reference to the output stream.
+********************************************************************************/
+void perf_counters_print(FILE* ostream)
+{
+   perf_counters_print_ctx(cpu_context_default(), ostream);
+   return;
+}
@@ -0,0 +1,202 @@
+/********************************************************************************
+* perf_counters.h: Contains function declarations and macro definitions for
+*                  performance counters of the emulated microcontroller, such
+*                  as the number of retired instructions per OP code, taken
+*                  interrupts per vector and data memory accesses per region.
+*
+*                  The counters are stored in the CPU context and updated by
+*                  plain increments, so they can be left enabled. They are
+*                  kept at system reset, including resets caused by invalid
+*                  instructions, and are only cleared by perf_counters_reset.
+*                  Data memory accesses are counted for instructions only,
+*                  not for accesses made by the emulator itself.
+********************************************************************************/
+#ifndef PERF_COUNTERS_H_
+#define PERF_COUNTERS_H_
+
+/* Include directives: */
+#include "cpu.h"
+#include "data_memory.h"
+
+/* Macro definitions: */
+#ifndef PERF_COUNTERS_ENABLED
+#define PERF_COUNTERS_ENABLED 1 /* Set to 0 to remove all counting at compile time. */
+#endif
+
+#define PERF_COUNTERS_NUM_OP_CODES 256 /* One counter per possible OP code. */
+#define PERF_COUNTERS_NUM_VECTORS  4   /* RESET_vect, PCINT0_vect, PCINT1_vect and PCINT2_vect. */
+
+/* Forward declarations: */
+struct cpu_context;
+
+/********************************************************************************
+* perf_counters: Performance counters of a CPU context.
+********************************************************************************/
+struct perf_counters
+{
+   uint64_t retired[PERF_COUNTERS_NUM_OP_CODES];   /* Retired instructions per OP code. */
+   uint64_t states;                                /* Number of clock states (cycles) run. */
+   uint64_t interrupts[PERF_COUNTERS_NUM_VECTORS]; /* Taken interrupts per vector (vector / 2). */
+   uint64_t io_reads;                              /* Reads from I/O locations (address 0 - 255). */
+   uint64_t io_writes;                             /* Writes to I/O locations (address 0 - 255). */
+   uint64_t ram_reads;                             /* Reads from data memory (address 256 - 65535). */
+   uint64_t ram_writes;                            /* Writes to data memory (address 256 - 65535). */
+   uint64_t stack_overflows;                       /* Pushes to a full stack. */
+   uint64_t stack_underflows;                      /* Pops from an empty stack. */
+   uint16_t stack_high_water;                      /* Max number of bytes stored on the stack. */
+};
+
+/********************************************************************************
+* perf_counters_retire: Counts specified number of retired instructions with
+*                       specified OP code.
+*
+*                       - self   : Reference to the counters.
+*                       - op_code: OP code of the retired instructions.
+*                       - count  : Number of retired instructions.
+********************************************************************************/
+static inline void perf_counters_retire(struct perf_counters* self,
+                                        const uint8_t op_code,
+                                        const uint64_t count)
+{
+#if PERF_COUNTERS_ENABLED
+   self->retired[op_code] += count;
+#endif
+   return;
+}
+
+/********************************************************************************
+* perf_counters_count_states: Counts specified number of clock states.
+*
+*                             - self : Reference to the counters.
+*                             - count: Number of clock states run.
+********************************************************************************/
+static inline void perf_counters_count_states(struct perf_counters* self,
+                                              const uint64_t count)
+{
+#if PERF_COUNTERS_ENABLED
+   self->states += count;
+#endif
+   return;
+}
+
+/********************************************************************************
+* perf_counters_count_interrupt: Counts an interrupt taken at specified vector.
+*
+*                                - self  : Reference to the counters.
+*                                - vector: The interrupt vector.
+********************************************************************************/
+static inline void perf_counters_count_interrupt(struct perf_counters* self,
+                                                 const uint8_t vector)
+{
+#if PERF_COUNTERS_ENABLED
+   if (vector / 2 < PERF_COUNTERS_NUM_VECTORS) self->interrupts[vector / 2]++;
+#endif
+   return;
+}
+
+/********************************************************************************
+* perf_counters_count_read: Counts a read from specified data memory address.
+*
+*                           - self   : Reference to the counters.
+*                           - address: The read location in data memory.
+********************************************************************************/
+static inline void perf_counters_count_read(struct perf_counters* self,
+                                            const uint16_t address)
+{
+#if PERF_COUNTERS_ENABLED
+   if (address < DATA_MEMORY_DATA_OFFSET) self->io_reads++;
+   else self->ram_reads++;
+#endif
+   return;
+}
+
+/********************************************************************************
+* perf_counters_count_reads: Counts specified number of reads from specified
+*                            data memory address.
+*
+*                            - self   : Reference to the counters.
+*                            - address: The read location in data memory.
+*                            - count  : Number of reads.
+********************************************************************************/
+static inline void perf_counters_count_reads(struct perf_counters* self,
+                                             const uint16_t address,
+                                             const uint64_t count)
+{
+#if PERF_COUNTERS_ENABLED
+   if (address < DATA_MEMORY_DATA_OFFSET) self->io_reads += count;
+   else self->ram_reads += count;
+#endif
+   return;
+}
+
+/********************************************************************************
+* perf_counters_count_write: Counts a write to specified data memory address.
+*
+*                            - self   : Reference to the counters.
+*                            - address: The write location in data memory.
+********************************************************************************/
+static inline void perf_counters_count_write(struct perf_counters* self,
+                                             const uint16_t address)
+{
+#if PERF_COUNTERS_ENABLED
+   if (address < DATA_MEMORY_DATA_OFFSET) self->io_writes++;
+   else self->ram_writes++;
+#endif
+   return;
+}
+
+/********************************************************************************
+* perf_counters_reset_ctx: Clears all performance counters of specified CPU
+*                          context.
+*
+*                          - self: Reference to the CPU context.
+********************************************************************************/
+void perf_counters_reset_ctx(struct cpu_context* self);
+
+/********************************************************************************
+* perf_counters_get_ctx: Returns the performance counters of specified CPU
+*                        context.
+*
+*                        - self: Reference to the CPU context.
+********************************************************************************/
+const struct perf_counters* perf_counters_get_ctx(const struct cpu_context* self);
+
+/********************************************************************************
+* perf_counters_retired_total: Returns the total number of retired instructions.
+*
+*                              - self: Reference to the counters.
+********************************************************************************/
+uint64_t perf_counters_retired_total(const struct perf_counters* self);
+
+/********************************************************************************
+* perf_counters_print_ctx: Prints the performance counters of specified CPU
+*                          context. OP codes without retired instructions are
+*                          left out.
+*
+*                          - self   : Reference to the CPU context.
+*                          - ostream: Reference to the output stream.
+********************************************************************************/
+void perf_counters_print_ctx(const struct cpu_context* self,
+                             FILE* ostream);
+
+/********************************************************************************
+* perf_counters_reset: Clears all performance counters of the default CPU
+*                      context.
+********************************************************************************/
+void perf_counters_reset(void);
+
+/********************************************************************************
+* perf_counters_get: Returns the performance counters of the default CPU
+*                    context.
+********************************************************************************/
+const struct perf_counters* perf_counters_get(void);
+
+/********************************************************************************
+* perf_counters_print: Prints the performance counters of the default CPU
+*                      context.
+*
+*                      - ostream: Reference to the output stream.
+********************************************************************************/
+void perf_counters_print(FILE* ostream);
+
+#endif /* PERF_COUNTERS_H_ */
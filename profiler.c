@@ -0,0 +1,341 @@
+/********************************************************************************
+* profiler.c: Contains function definitions for the call-stack sampling
+*             profiler. Samples are stored by address and only named when
+*             written, so that no strings are built during the run.
+********************************************************************************/
+#include "profiler.h"
+#include "cpu_context.h"
+
+#include <string.h>
+
+/********************************************************************************
+* collapsed_stack: Named call chain of an entry, used when writing the result.
+********************************************************************************/
+struct collapsed_stack
+{
+   char* frames;     /* Frame names separated by semicolons. */
+   uint64_t samples; /* Number of samples of the chain. */
+};
+
+/* Static functions: */
+static void take_sample(struct profiler* self,
+                        const struct cpu_context* cpu);
+static uint32_t chain_hash(const uint16_t* chain,
+                           const uint8_t length);
+static char* chain_name(const struct cpu_context* cpu,
+                        const struct profiler_entry* entry);
+static int compare_stacks(const void* a,
+                          const void* b);
+
+/********************************************************************************
+* profiler_enable_ctx: Enables or disables profiling of specified CPU context.
+*                      When enabled, a new profiler sampling every Nth cycle
+*                      is created, replacing any previous one. When disabled,
+*                      the profiler is deleted. Success code 0 is returned on
+*                      success, otherwise error code 1 is returned if the
+*                      profiler couldn't be allocated.
+*
+*                      - self    : Reference to the CPU context.
+*                      - enabled : Indicates if profiling is enabled.
+*                      - interval: Number of cycles between samples (0 = default).
+********************************************************************************/
+int profiler_enable_ctx(struct cpu_context* self,
+                        const bool enabled,
+                        const uint32_t interval)
+{
+   free(self->profiler);
+   self->profiler = 0;
+   if (!enabled) return 0;
+
+   self->profiler = (struct profiler*)calloc(1, sizeof(struct profiler));
+   if (!self->profiler) return 1;
+
+   self->profiler->interval = interval ? interval : PROFILER_DEFAULT_INTERVAL;
+   self->profiler->cycles_left = self->profiler->interval;
+   return 0;
+}
+
+/********************************************************************************
+* profiler_write_collapsed_ctx: Writes the samples of the profiler of specified
+*                               CPU context in collapsed stack format, sorted
+*                               by call chain. Success code 0 is returned on
+*                               success, otherwise error code 1 is returned if
+*                               profiling isn't enabled or memory couldn't be
+*                               allocated.
+*
+*                               - self   : Reference to the CPU context.
+*                               - ostream: Reference to the output stream.
+********************************************************************************/
+int profiler_write_collapsed_ctx(const struct cpu_context* self,
+                                 FILE* ostream)
+{
+   const struct profiler* profiler = self->profiler;
+   if (!profiler) return 1;
+
+   struct collapsed_stack* stacks = (struct collapsed_stack*)malloc(sizeof(struct collapsed_stack) * PROFILER_TABLE_SIZE);
+   uint16_t num_stacks = 0;
+   int result = 0;
+   if (!stacks) return 1;
+
+   for (uint16_t i = 0; i < PROFILER_TABLE_SIZE; ++i)
+   {
+      const struct profiler_entry* entry = &profiler->table[i];
+      if (!entry->samples) continue;
+
+      stacks[num_stacks].frames = chain_name(self, entry);
+      stacks[num_stacks].samples = entry->samples;
+
+      if (!stacks[num_stacks].frames)
+      {
+         result = 1;
+         break;
+      }
+      num_stacks++;
+   }
+
+   if (!result)
+   {
+      /* Chains of different addresses may get the same names, these are merged. */
+      qsort(stacks, num_stacks, sizeof(struct collapsed_stack), compare_stacks);
+
+      for (uint16_t i = 0; i < num_stacks; ++i)
+      {
+         uint64_t samples = stacks[i].samples;
+
+         while (i + 1 < num_stacks && !strcmp(stacks[i].frames, stacks[i + 1].frames))
+         {
+            samples += stacks[++i].samples;
+         }
+         fprintf(ostream, "%s %llu\n", stacks[i].frames, (unsigned long long)(samples * profiler->interval));
+      }
+
+      if (profiler->dropped)
+      {
+         fprintf(ostream, "[dropped] %llu\n", (unsigned long long)(profiler->dropped * profiler->interval));
+      }
+   }
+
+   for (uint16_t i = 0; i < num_stacks; ++i)
+   {
+      free(stacks[i].frames);
+   }
+
+   free(stacks);
+   return result;
+}
+
+/********************************************************************************
+* profiler_call: Pushes a frame to the shadow call stack at a call or an
+*                interrupt.
+*
+*                - self     : Reference to the profiler.
+*                - call_site: Address of the call or the interrupted instruction.
+*                - target   : Address of the called subroutine or interrupt vector.
+********************************************************************************/
+void profiler_call(struct profiler* self,
+                   const uint16_t call_site,
+                   const uint16_t target)
+{
+   if (self->depth < PROFILER_MAX_DEPTH)
+   {
+      self->frames[self->depth].call_site = call_site;
+      self->frames[self->depth].target = target;
+   }
+
+   if (self->depth < UINT16_MAX) self->depth++;
+   return;
+}
+
+/********************************************************************************
+* profiler_return: Pops a frame from the shadow call stack at a return. Returns
+*                  from an empty stack are ignored.
+*
+*                  - self: Reference to the profiler.
+********************************************************************************/
+void profiler_return(struct profiler* self)
+{
+   if (self->depth) self->depth--;
+   return;
+}
+
+/********************************************************************************
+* profiler_reset_stack: Clears the shadow call stack, for instance at system
+*                       reset. The samples are kept.
+*
+*                       - self: Reference to the profiler.
+********************************************************************************/
+void profiler_reset_stack(struct profiler* self)
+{
+   self->depth = 0;
+   return;
+}
+
+/********************************************************************************
+* profiler_run_cycles: Advances the profiler by specified number of cycles,
+*                      taking a sample of specified CPU context each time the
+*                      sampling interval elapses.
+*
+*                      - self  : Reference to the profiler.
+*                      - cpu   : Reference to the CPU context.
+*                      - cycles: Number of cycles run since the last call.
+********************************************************************************/
+void profiler_run_cycles(struct profiler* self,
+                         const struct cpu_context* cpu,
+                         uint64_t cycles)
+{
+   while (cycles >= self->cycles_left)
+   {
+      cycles -= self->cycles_left;
+      self->cycles_left = self->interval;
+      take_sample(self, cpu);
+   }
+
+   self->cycles_left -= cycles;
+   return;
+}
+
+/********************************************************************************
+* profiler_enable: Enables or disables profiling of the default CPU context,
+*                  see profiler_enable_ctx.
+*
+*                  - enabled : Indicates if profiling is enabled.
+*                  - interval: Number of cycles between samples (0 = default).
+********************************************************************************/
+int profiler_enable(const bool enabled,
+                    const uint32_t interval)
+{
+   return profiler_enable_ctx(cpu_context_default(), enabled, interval);
+}
+
+/********************************************************************************
+* profiler_enabled: Indicates if profiling is enabled for the default CPU
+*                   context.
+********************************************************************************/
+bool profiler_enabled(void)
+{
+   return cpu_context_default()->profiler != 0;
+}
+
+/********************************************************************************
+* profiler_write_collapsed: Writes the samples of the profiler of the default
+*                           CPU context in collapsed stack format, see
+*                           profiler_write_collapsed_ctx.
+*
+*                           - ostream: Reference to the output stream.
+********************************************************************************/
+int profiler_write_collapsed(FILE* ostream)
+{
+   return profiler_write_collapsed_ctx(cpu_context_default(), ostream);
+}
+
+/********************************************************************************
+* take_sample: Samples the current call chain of specified CPU context, i.e.
+*              the recorded frames followed by the current instruction. Between
+*              instruction cycles, the current instruction is the one the
+*              program counter points to, otherwise the one being run.
+*
+*              - self: Reference to the profiler.
+*              - cpu : Reference to the CPU context.
+********************************************************************************/
+static void take_sample(struct profiler* self,
+                        const struct cpu_context* cpu)
+{
+   uint16_t chain[PROFILER_MAX_CHAIN];
+   uint8_t length = 0;
+   const uint16_t depth = self->depth < PROFILER_MAX_DEPTH ? self->depth : PROFILER_MAX_DEPTH;
+
+   for (uint16_t i = 0; i < depth; ++i)
+   {
+      chain[length++] = self->frames[i].call_site;
+      chain[length++] = self->frames[i].target;
+   }
+
+   chain[length++] = cpu->state == CPU_STATE_FETCH ? cpu->pc : cpu->mar;
+
+   const uint32_t hash = chain_hash(chain, length);
+
+   for (uint16_t i = 0; i < PROFILER_TABLE_SIZE; ++i)
+   {
+      struct profiler_entry* entry = &self->table[(hash + i) & (PROFILER_TABLE_SIZE - 1)];
+
+      if (!entry->samples)
+      {
+         entry->samples = 1;
+         entry->hash = hash;
+         entry->length = length;
+         memcpy(entry->chain, chain, length * sizeof(chain[0]));
+         return;
+      }
+      else if (entry->hash == hash && entry->length == length && !memcmp(entry->chain, chain, length * sizeof(chain[0])))
+      {
+         entry->samples++;
+         return;
+      }
+   }
+
+   self->dropped++;
+   return;
+}
+
+/********************************************************************************
+* chain_hash: Returns the 32-bit FNV-1a hash of referenced call chain.
+*
+*             - chain : Reference to the addresses in the chain.
+*             - length: Number of addresses in the chain.
+********************************************************************************/
+static uint32_t chain_hash(const uint16_t* chain,
+                           const uint8_t length)
+{
+   uint32_t hash = 2166136261u;
+
+   for (uint8_t i = 0; i < length; ++i)
+   {
+      hash ^= (uint8_t)chain[i];
+      hash *= 16777619u;
+      hash ^= (uint8_t)(chain[i] >> 8);
+      hash *= 16777619u;
+   }
+   return hash;
+}
+
+/********************************************************************************
+* chain_name: Returns a heap allocated string holding the names of the frames
+*             of referenced entry separated by semicolons. Adjacent addresses
+*             within the same subroutine are named once, for instance a call
+*             site and the current instruction of the calling subroutine. If
+*             the allocation fails, a null pointer is returned.
+*
+*             - cpu  : Reference to the CPU context.
+*             - entry: Reference to the entry.
+********************************************************************************/
+static char* chain_name(const struct cpu_context* cpu,
+                        const struct profiler_entry* entry)
+{
+   char* frames = (char*)malloc(entry->length * PROGRAM_MEMORY_LABEL_SIZE + 1);
+   const char* previous = 0;
+   size_t size = 0;
+   if (!frames) return 0;
+
+   for (uint8_t i = 0; i < entry->length; ++i)
+   {
+      const char* name = program_memory_subroutine_name_ctx(cpu, entry->chain[i]);
+      if (previous && !strcmp(name, previous)) continue;
+      size += sprintf(frames + size, "%s%s", previous ? ";" : "", name);
+      previous = name;
+   }
+
+   frames[size] = '\0';
+   return frames;
+}
+
+/********************************************************************************
+* compare_stacks: Compares two collapsed stacks by name, used for sorting.
+*
+*                 - a: Reference to the first collapsed stack.
+*                 - b: Reference to the second collapsed stack.
+********************************************************************************/
+static int compare_stacks(const void* a,
+                          const void* b)
+{
+   return strcmp(((const struct collapsed_stack*)a)->frames, ((const struct collapsed_stack*)b)->frames);
+}
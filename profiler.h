@@ -0,0 +1,181 @@
+/********************************************************************************
+* profiler.h: Contains function declarations and macro definitions for a
+*             call-stack sampling profiler of the guest program.
+*
+*             The profiler follows CALL, RET, RETI and interrupt entry in a
+*             shadow call stack, where each frame holds the address of the
+*             call site and the address of the called subroutine (or the
+*             interrupt vector). Every Nth clock cycle, the current chain of
+*             frames and the current instruction is sampled. Samples with
+*             the same chain are aggregated in a hash table, so the memory
+*             usage doesn't grow with the length of the run.
+*
+*             The result is written in the collapsed stack format accepted
+*             by flame graph tools, one line per call chain with the frames
+*             separated by semicolons followed by the number of cycles,
+*             for instance "main;PCINT0_vect;ISR_PCINT0;led1_toggle;led1_on 300".
+*             Addresses are named by subroutine when the result is written,
+*             see program_memory_subroutine_name_ctx.
+********************************************************************************/
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+/* Include directives: */
+#include "cpu.h"
+
+/* Macro definitions: */
+#define PROFILER_MAX_DEPTH        32   /* Max number of recorded frames, deeper calls are left out. */
+#define PROFILER_MAX_CHAIN        (PROFILER_MAX_DEPTH * 2 + 1) /* Max number of addresses per chain. */
+#define PROFILER_TABLE_SIZE       4096 /* Capacity for unique call chains (power of 2). */
+#define PROFILER_DEFAULT_INTERVAL 97   /* Default number of cycles between samples. */
+
+/* Forward declarations: */
+struct cpu_context;
+
+/********************************************************************************
+* profiler_frame: Frame in the shadow call stack.
+********************************************************************************/
+struct profiler_frame
+{
+   uint16_t call_site; /* Address of the call or the interrupted instruction. */
+   uint16_t target;    /* Address of the called subroutine or interrupt vector. */
+};
+
+/********************************************************************************
+* profiler_entry: Aggregated samples of a unique call chain, consisting of the
+*                 call site and target of each frame followed by the address
+*                 of the current instruction.
+********************************************************************************/
+struct profiler_entry
+{
+   uint64_t samples;                    /* Number of samples of the chain (0 = unused entry). */
+   uint32_t hash;                       /* Hash of the chain. */
+   uint8_t length;                      /* Number of addresses in the chain. */
+   uint16_t chain[PROFILER_MAX_CHAIN];  /* Addresses in the chain. */
+};
+
+/********************************************************************************
+* profiler: Call-stack sampling profiler.
+********************************************************************************/
+struct profiler
+{
+   uint32_t interval;                                /* Number of cycles between samples. */
+   uint64_t cycles_left;                             /* Number of cycles until the next sample. */
+   uint16_t depth;                                   /* Current call depth, including unrecorded frames. */
+   struct profiler_frame frames[PROFILER_MAX_DEPTH]; /* Shadow call stack. */
+   uint64_t dropped;                                 /* Samples dropped due to a full table. */
+   struct profiler_entry table[PROFILER_TABLE_SIZE]; /* Aggregated samples per call chain. */
+};
+
+/********************************************************************************
+* profiler_instructions_until_sample: Returns the number of complete
+*                                     instructions (3 cycles each) needed to
+*                                     reach the next sample, so that batch
+*                                     runs can be split at the sample points
+*                                     without checking for samples in the
+*                                     run loop.
+*
+*                                     - self: Reference to the profiler.
+********************************************************************************/
+static inline uint64_t profiler_instructions_until_sample(const struct profiler* self)
+{
+   return (self->cycles_left + 2) / 3;
+}
+
+/********************************************************************************
+* profiler_enable_ctx: Enables or disables profiling of specified CPU context.
+*                      When enabled, a new profiler sampling every Nth cycle
+*                      is created, replacing any previous one. When disabled,
+*                      the profiler is deleted. Success code 0 is returned on
+*                      success, otherwise error code 1 is returned if the
+*                      profiler couldn't be allocated.
+*
+*                      - self    : Reference to the CPU context.
+*                      - enabled : Indicates if profiling is enabled.
+*                      - interval: Number of cycles between samples (0 = default).
+********************************************************************************/
+int profiler_enable_ctx(struct cpu_context* self,
+                        const bool enabled,
+                        const uint32_t interval);
+
+/********************************************************************************
+* profiler_write_collapsed_ctx: Writes the samples of the profiler of specified
+*                               CPU context in collapsed stack format, sorted
+*                               by call chain. Success code 0 is returned on
+*                               success, otherwise error code 1 is returned if
+*                               profiling isn't enabled or memory couldn't be
+*                               allocated.
+*
+*                               - self   : Reference to the CPU context.
+*                               - ostream: Reference to the output stream.
+********************************************************************************/
+int profiler_write_collapsed_ctx(const struct cpu_context* self,
+                                 FILE* ostream);
+
+/********************************************************************************
+* profiler_call: Pushes a frame to the shadow call stack at a call or an
+*                interrupt.
+*
+*                - self     : Reference to the profiler.
+*                - call_site: Address of the call or the interrupted instruction.
+*                - target   : Address of the called subroutine or interrupt vector.
+********************************************************************************/
+void profiler_call(struct profiler* self,
+                   const uint16_t call_site,
+                   const uint16_t target);
+
+/********************************************************************************
+* profiler_return: Pops a frame from the shadow call stack at a return. Returns
+*                  from an empty stack are ignored.
+*
+*                  - self: Reference to the profiler.
+********************************************************************************/
+void profiler_return(struct profiler* self);
+
+/********************************************************************************
+* profiler_reset_stack: Clears the shadow call stack, for instance at system
+*                       reset. The samples are kept.
+*
+*                       - self: Reference to the profiler.
+********************************************************************************/
+void profiler_reset_stack(struct profiler* self);
+
+/********************************************************************************
+* profiler_run_cycles: Advances the profiler by specified number of cycles,
+*                      taking a sample of specified CPU context each time the
+*                      sampling interval elapses.
+*
+*                      - self  : Reference to the profiler.
+*                      - cpu   : Reference to the CPU context.
+*                      - cycles: Number of cycles run since the last call.
+********************************************************************************/
+void profiler_run_cycles(struct profiler* self,
+                         const struct cpu_context* cpu,
+                         uint64_t cycles);
+
+/********************************************************************************
+* profiler_enable: Enables or disables profiling of the default CPU context,
+*                  see profiler_enable_ctx.
+*
+*                  - enabled : Indicates if profiling is enabled.
+*                  - interval: Number of cycles between samples (0 = default).
+********************************************************************************/
+int profiler_enable(const bool enabled,
+                    const uint32_t interval);
+
+/********************************************************************************
+* profiler_enabled: Indicates if profiling is enabled for the default CPU
+*                   context.
+********************************************************************************/
+bool profiler_enabled(void);
+
+/********************************************************************************
+* profiler_write_collapsed: Writes the samples of the profiler of the default
+*                           CPU context in collapsed stack format, see
+*                           profiler_write_collapsed_ctx.
+*
+*                           - ostream: Reference to the output stream.
+********************************************************************************/
+int profiler_write_collapsed(FILE* ostream);
+
+#endif /* PROFILER_H_ */
@@ -0,0 +1,468 @@
+/********************************************************************************
+* program_image.c: Contains function definitions for writing and loading
+*                  binary program images. The image is validated in full
+*                  before anything is written to the CPU context.
+********************************************************************************/
+#if defined(__unix__) || defined(__APPLE__)
+/* Included before cpu.h, since unistd.h declares read, which cpu.h defines as a macro. */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "program_image.h"
+#include "cpu_context.h"
+#include "control_unit.h"
+
+#include <string.h>
+
+/* Macro definitions: */
+#define PROGRAM_IMAGE_INSTRUCTION_SIZE 3 /* Number of bytes per packed instruction. */
+
+/* Static functions: */
+static const uint8_t* map_image(const char* path,
+                                size_t* size);
+static void unmap_image(const uint8_t* image,
+                        const size_t size);
+static bool image_valid(const uint8_t* image,
+                        const size_t size);
+static uint32_t checksum(const uint8_t* data,
+                         const size_t size);
+static inline uint32_t align4(const uint32_t offset);
+static void write_header(uint8_t* image,
+                         const struct program_image_header* header);
+static void read_header(const uint8_t* image,
+                        struct program_image_header* header);
+static void write_symbol(uint8_t* entry,
+                         const struct program_image_symbol* symbol);
+static void read_symbol(const uint8_t* entry,
+                        struct program_image_symbol* symbol);
+static inline void write16(uint8_t* destination,
+                           const uint16_t value);
+static inline void write32(uint8_t* destination,
+                           const uint32_t value);
+static inline uint16_t read16(const uint8_t* source);
+static inline uint32_t read32(const uint8_t* source);
+
+/********************************************************************************
+* program_image_write: Writes referenced assembled program as a program image
+*                      to the file at specified path. Success code 0 is
+*                      returned on success, otherwise error code 1 is returned.
+*
+*                      - program    : Reference to the assembled program.
+*                      - entry_point: Address to start the program from.
+*                      - path       : Path to the image file.
+********************************************************************************/
+int program_image_write(const struct assembler_program* program,
+                        const uint16_t entry_point,
+                        const char* path)
+{
+   struct program_image_header header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, PROGRAM_IMAGE_MAGIC, sizeof(header.magic));
+   header.version = PROGRAM_IMAGE_VERSION;
+   header.header_size = PROGRAM_IMAGE_HEADER_SIZE;
+   header.entry_point = entry_point;
+   header.num_instructions = program->code_size;
+   header.num_symbols = program->num_symbols;
+   header.data_address = program->data_start;
+   header.data_size = (uint16_t)(program->data_end - program->data_start);
+   header.code_offset = PROGRAM_IMAGE_HEADER_SIZE;
+   header.symbols_offset = align4(header.code_offset + header.num_instructions * PROGRAM_IMAGE_INSTRUCTION_SIZE);
+   header.data_offset = header.symbols_offset + header.num_symbols * PROGRAM_IMAGE_ENTRY_SIZE;
+   header.image_size = header.data_offset + header.data_size;
+
+   uint8_t* image = (uint8_t*)calloc(1, header.image_size);
+   if (!image) return 1;
+
+   for (uint32_t i = 0; i < program->code_size; ++i)
+   {
+      uint8_t* instruction = image + header.code_offset + i * PROGRAM_IMAGE_INSTRUCTION_SIZE;
+      instruction[0] = (uint8_t)(program->code[i] >> 16);
+      instruction[1] = (uint8_t)(program->code[i] >> 8);
+      instruction[2] = (uint8_t)(program->code[i]);
+   }
+
+   for (uint16_t i = 0; i < program->num_symbols; ++i)
+   {
+      struct program_image_symbol symbol;
+      memset(&symbol, 0, sizeof(symbol));
+      snprintf(symbol.name, PROGRAM_IMAGE_SYMBOL_SIZE, "%s", program->symbols[i].name);
+      symbol.value = program->symbols[i].value;
+      symbol.type = (uint8_t)program->symbols[i].type;
+      write_symbol(image + header.symbols_offset + i * PROGRAM_IMAGE_ENTRY_SIZE, &symbol);
+   }
+
+   memcpy(image + header.data_offset, program->data + program->data_start, header.data_size);
+   header.checksum = checksum(image + PROGRAM_IMAGE_HEADER_SIZE, header.image_size - PROGRAM_IMAGE_HEADER_SIZE);
+   write_header(image, &header);
+
+   FILE* file = fopen(path, "wb");
+   int result = 1;
+
+   if (file)
+   {
+      result = fwrite(image, 1, header.image_size, file) == header.image_size ? 0 : 1;
+      if (fclose(file)) result = 1;
+   }
+
+   free(image);
+   return result;
+}
+
+/********************************************************************************
+* program_image_detect: Indicates if the file at specified path starts with
+*                       the magic number of a program image.
+*
+*                       - path: Path to the file.
+********************************************************************************/
+bool program_image_detect(const char* path)
+{
+   char magic[4] = { '\0' };
+   FILE* file = fopen(path, "rb");
+   if (!file) return false;
+   const bool detected = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+                         !memcmp(magic, PROGRAM_IMAGE_MAGIC, sizeof(magic));
+   fclose(file);
+   return detected;
+}
+
+/********************************************************************************
+* program_image_load_ctx: Loads the program image at specified path into the
+*                         program memory of specified CPU context together with
+*                         its entry point, initial data memory content and code
+*                         labels. The CPU context is reset so that the program
+*                         is decoded and started. Success code 0 is returned on
+*                         success, otherwise error code 1 is returned if the
+*                         file can't be read or isn't a valid image or if
+*                         memory can't be allocated, in which case the CPU
+*                         context is left unchanged.
+*
+*                         - self: Reference to the CPU context.
+*                         - path: Path to the image file.
+********************************************************************************/
+int program_image_load_ctx(struct cpu_context* self,
+                           const char* path)
+{
+   size_t size = 0;
+   const uint8_t* image = map_image(path, &size);
+   if (!image) return 1;
+   uint32_t* code = image_valid(image, size) ? (uint32_t*)malloc(PROGRAM_MEMORY_ADDRESS_WIDTH * sizeof(uint32_t)) : 0;
+
+   if (!code)
+   {
+      unmap_image(image, size);
+      return 1;
+   }
+
+   struct program_image_header header;
+   read_header(image, &header);
+   const uint8_t* instruction = image + header.code_offset;
+
+   for (uint32_t i = 0; i < header.num_instructions; ++i, instruction += PROGRAM_IMAGE_INSTRUCTION_SIZE)
+   {
+      code[i] = ((uint32_t)instruction[0] << 16) | ((uint32_t)instruction[1] << 8) | instruction[2];
+   }
+
+   program_memory_load_ctx(self, code, header.num_instructions, header.entry_point);
+   free(code);
+   data_memory_set_initial_ctx(self, header.data_address, image + header.data_offset, header.data_size);
+
+   for (uint16_t i = 0; i < header.num_symbols; ++i)
+   {
+      struct program_image_symbol symbol;
+      read_symbol(image + header.symbols_offset + i * PROGRAM_IMAGE_ENTRY_SIZE, &symbol);
+
+      if (symbol.type == ASSEMBLER_SYMBOL_CODE_LABEL && symbol.value >= 0 &&
+          symbol.value < PROGRAM_MEMORY_ADDRESS_WIDTH && !program_memory_label_ctx(self, (uint16_t)symbol.value))
+      {
+         program_memory_set_label_ctx(self, (uint16_t)symbol.value, symbol.name);
+      }
+   }
+
+   if (!program_memory_label_ctx(self, RESET_vect))
+   {
+      program_memory_set_label_ctx(self, RESET_vect, "RESET_vect");
+   }
+
+   unmap_image(image, size);
+   control_unit_reset_ctx(self);
+   return 0;
+}
+
+/********************************************************************************
+* map_image: Maps the file at specified path into memory and returns a pointer
+*            to its content. If the file can't be read, a null pointer is
+*            returned.
+*
+*            - path: Path to the image file.
+*            - size: Reference to variable storing the size of the file.
+********************************************************************************/
+static const uint8_t* map_image(const char* path,
+                                size_t* size)
+{
+#if PROGRAM_IMAGE_MMAP
+   const int fd = open(path, O_RDONLY);
+   struct stat info;
+   void* image = MAP_FAILED;
+   if (fd < 0) return 0;
+
+   if (!fstat(fd, &info) && info.st_size > 0)
+   {
+      *size = (size_t)info.st_size;
+      image = mmap(0, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+   }
+
+   close(fd);
+   return image == MAP_FAILED ? 0 : (const uint8_t*)image;
+#else
+   FILE* file = fopen(path, "rb");
+   uint8_t* image = 0;
+   long file_size = 0;
+   if (!file) return 0;
+
+   if (!fseek(file, 0, SEEK_END) && (file_size = ftell(file)) > 0 && !fseek(file, 0, SEEK_SET))
+   {
+      *size = (size_t)file_size;
+      image = (uint8_t*)malloc(*size);
+
+      if (image && fread(image, 1, *size, file) != *size)
+      {
+         free(image);
+         image = 0;
+      }
+   }
+
+   fclose(file);
+   return image;
+#endif /* PROGRAM_IMAGE_MMAP */
+}
+
+/********************************************************************************
+* unmap_image: Releases an image returned by map_image.
+*
+*              - image: Reference to the image.
+*              - size : Size of the image in bytes.
+********************************************************************************/
+static void unmap_image(const uint8_t* image,
+                        const size_t size)
+{
+#if PROGRAM_IMAGE_MMAP
+   munmap((void*)image, size);
+#else
+   (void)size;
+   free((void*)image);
+#endif /* PROGRAM_IMAGE_MMAP */
+   return;
+}
+
+/********************************************************************************
+* image_valid: Indicates if referenced image is valid, i.e. if the header is
+*              correct, all sections are within the image, the content fits
+*              in the memories of the CPU and the checksum is correct.
+*
+*              - image: Reference to the image.
+*              - size : Size of the image in bytes.
+********************************************************************************/
+static bool image_valid(const uint8_t* image,
+                        const size_t size)
+{
+   struct program_image_header parsed;
+   const struct program_image_header* header = &parsed;
+   if (size < PROGRAM_IMAGE_HEADER_SIZE) return false;
+   read_header(image, &parsed);
+
+   const uint64_t code_end = (uint64_t)header->code_offset +
+                             (uint64_t)header->num_instructions * PROGRAM_IMAGE_INSTRUCTION_SIZE;
+   const uint64_t symbols_end = (uint64_t)header->symbols_offset +
+                                (uint64_t)header->num_symbols * PROGRAM_IMAGE_ENTRY_SIZE;
+   const uint64_t data_end = (uint64_t)header->data_offset + header->data_size;
+
+   if (memcmp(header->magic, PROGRAM_IMAGE_MAGIC, sizeof(header->magic)) ||
+       header->version != PROGRAM_IMAGE_VERSION || header->header_size != PROGRAM_IMAGE_HEADER_SIZE ||
+       header->image_size != size)
+   {
+      return false;
+   }
+   else if (header->code_offset < PROGRAM_IMAGE_HEADER_SIZE || code_end > size ||
+            header->symbols_offset < PROGRAM_IMAGE_HEADER_SIZE || header->symbols_offset % 4 || symbols_end > size ||
+            header->data_offset < PROGRAM_IMAGE_HEADER_SIZE || data_end > size)
+   {
+      return false;
+   }
+   else if (header->num_instructions > PROGRAM_MEMORY_ADDRESS_WIDTH ||
+            (uint32_t)header->data_address + header->data_size > DATA_MEMORY_ADDRESS_WIDTH)
+   {
+      return false;
+   }
+
+   for (uint16_t i = 0; i < header->num_symbols; ++i)
+   {
+      const uint8_t* entry = image + header->symbols_offset + i * PROGRAM_IMAGE_ENTRY_SIZE;
+      if (entry[PROGRAM_IMAGE_SYMBOL_SIZE - 1] != '\0') return false;
+   }
+
+   return checksum(image + PROGRAM_IMAGE_HEADER_SIZE, size - PROGRAM_IMAGE_HEADER_SIZE) == header->checksum;
+}
+
+/********************************************************************************
+* checksum: Returns the 32-bit FNV-1a checksum of referenced data.
+*
+*           - data: Reference to the data.
+*           - size: Number of bytes to include.
+********************************************************************************/
+static uint32_t checksum(const uint8_t* data,
+                         const size_t size)
+{
+   uint32_t hash = 2166136261u;
+
+   for (size_t i = 0; i < size; ++i)
+   {
+      hash ^= data[i];
+      hash *= 16777619u;
+   }
+   return hash;
+}
+
+/********************************************************************************
+* align4: Returns specified offset rounded up to the closest multiple of 4.
+*
+*         - offset: The offset to align.
+********************************************************************************/
+static inline uint32_t align4(const uint32_t offset)
+{
+   return (offset + 3) & ~(uint32_t)3;
+}
+
+/********************************************************************************
+* write_header: Stores referenced header at the start of an image, field by
+*               field in little endian byte order.
+*
+*               - image : Reference to the image.
+*               - header: Reference to the header.
+********************************************************************************/
+static void write_header(uint8_t* image,
+                         const struct program_image_header* header)
+{
+   memcpy(image, header->magic, sizeof(header->magic));
+   write16(image + 4, header->version);
+   write16(image + 6, header->header_size);
+   write32(image + 8, header->checksum);
+   write32(image + 12, header->image_size);
+   write16(image + 16, header->entry_point);
+   write16(image + 18, header->num_symbols);
+   write32(image + 20, header->num_instructions);
+   write16(image + 24, header->data_address);
+   write16(image + 26, header->data_size);
+   write32(image + 28, header->code_offset);
+   write32(image + 32, header->symbols_offset);
+   write32(image + 36, header->data_offset);
+   return;
+}
+
+/********************************************************************************
+* read_header: Reads the header at the start of an image, see write_header.
+*              The image must hold at least PROGRAM_IMAGE_HEADER_SIZE bytes.
+*
+*              - image : Reference to the image.
+*              - header: Reference to the header to fill.
+********************************************************************************/
+static void read_header(const uint8_t* image,
+                        struct program_image_header* header)
+{
+   memcpy(header->magic, image, sizeof(header->magic));
+   header->version = read16(image + 4);
+   header->header_size = read16(image + 6);
+   header->checksum = read32(image + 8);
+   header->image_size = read32(image + 12);
+   header->entry_point = read16(image + 16);
+   header->num_symbols = read16(image + 18);
+   header->num_instructions = read32(image + 20);
+   header->data_address = read16(image + 24);
+   header->data_size = read16(image + 26);
+   header->code_offset = read32(image + 28);
+   header->symbols_offset = read32(image + 32);
+   header->data_offset = read32(image + 36);
+   return;
+}
+
+/********************************************************************************
+* write_symbol: Stores referenced symbol in an entry of the symbol table.
+*
+*               - entry : Reference to the entry.
+*               - symbol: Reference to the symbol.
+********************************************************************************/
+static void write_symbol(uint8_t* entry,
+                         const struct program_image_symbol* symbol)
+{
+   memcpy(entry, symbol->name, PROGRAM_IMAGE_SYMBOL_SIZE);
+   write32(entry + PROGRAM_IMAGE_SYMBOL_SIZE, (uint32_t)symbol->value);
+   entry[PROGRAM_IMAGE_SYMBOL_SIZE + 4] = symbol->type;
+   memcpy(entry + PROGRAM_IMAGE_SYMBOL_SIZE + 5, symbol->reserved, sizeof(symbol->reserved));
+   return;
+}
+
+/********************************************************************************
+* read_symbol: Reads an entry of the symbol table, see write_symbol.
+*
+*              - entry : Reference to the entry.
+*              - symbol: Reference to the symbol to fill.
+********************************************************************************/
+static void read_symbol(const uint8_t* entry,
+                        struct program_image_symbol* symbol)
+{
+   memcpy(symbol->name, entry, PROGRAM_IMAGE_SYMBOL_SIZE);
+   symbol->value = (int32_t)read32(entry + PROGRAM_IMAGE_SYMBOL_SIZE);
+   symbol->type = entry[PROGRAM_IMAGE_SYMBOL_SIZE + 4];
+   memcpy(symbol->reserved, entry + PROGRAM_IMAGE_SYMBOL_SIZE + 5, sizeof(symbol->reserved));
+   return;
+}
+
+/********************************************************************************
+* write16: Stores a 16-bit value in little endian byte order.
+*
+*          - destination: Reference to the first byte to write.
+*          - value      : The value to store.
+********************************************************************************/
+static inline void write16(uint8_t* destination,
+                           const uint16_t value)
+{
+   destination[0] = (uint8_t)value;
+   destination[1] = (uint8_t)(value >> 8);
+   return;
+}
+
+/********************************************************************************
+* write32: Stores a 32-bit value in little endian byte order.
+*
+*          - destination: Reference to the first byte to write.
+*          - value      : The value to store.
+********************************************************************************/
+static inline void write32(uint8_t* destination,
+                           const uint32_t value)
+{
+   write16(destination, (uint16_t)value);
+   write16(destination + 2, (uint16_t)(value >> 16));
+   return;
+}
+
+/********************************************************************************
+* read16: Returns the 16-bit value stored in little endian byte order.
+*
+*         - source: Reference to the first byte to read.
+********************************************************************************/
+static inline uint16_t read16(const uint8_t* source)
+{
+   return (uint16_t)(source[0] | (source[1] << 8));
+}
+
+/********************************************************************************
+* read32: Returns the 32-bit value stored in little endian byte order.
+*
+*         - source: Reference to the first byte to read.
+********************************************************************************/
+static inline uint32_t read32(const uint8_t* source)
+{
+   return read16(source) | ((uint32_t)read16(source + 2) << 16);
+}
@@ -0,0 +1,111 @@
+/********************************************************************************
+* program_image.h: Contains function declarations and macro definitions for a
+*                  compact binary program image, which can be loaded without
+*                  assembling or parsing any source text.
+*
+*                  The image consists of a fixed header followed by sections
+*                  for the machine code, the symbol table and the initial data
+*                  memory content. The offset of each section is stored in
+*                  the header. Instructions are packed as 3 bytes each (OP
+*                  code, first operand and second operand). The header and
+*                  the symbol entries are stored field by field in the order
+*                  of their structs below, without padding, with all
+*                  multi-byte fields in little endian byte order, so that an
+*                  image can be loaded on any host. The checksum (32-bit
+*                  FNV-1a) covers all bytes after the header.
+*
+*                  On POSIX systems, the image is mapped into memory by mmap,
+*                  otherwise it's read into a temporary buffer.
+********************************************************************************/
+#ifndef PROGRAM_IMAGE_H_
+#define PROGRAM_IMAGE_H_
+
+/* Include directives: */
+#include "cpu.h"
+#include "assembler.h"
+
+/* Macro definitions: */
+#define PROGRAM_IMAGE_MAGIC       "E22P" /* Identifies a program image. */
+#define PROGRAM_IMAGE_VERSION     2      /* Current version of the image format (16-bit addresses). */
+#define PROGRAM_IMAGE_SYMBOL_SIZE 32     /* Max length of symbol names (including '\0'). */
+#define PROGRAM_IMAGE_HEADER_SIZE 40     /* Size of the stored header in bytes. */
+#define PROGRAM_IMAGE_ENTRY_SIZE  40     /* Size of a stored symbol entry in bytes. */
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PROGRAM_IMAGE_MMAP 1 /* Images are mapped into memory by mmap. */
+#else
+#define PROGRAM_IMAGE_MMAP 0 /* Images are read into a temporary buffer. */
+#endif
+
+/********************************************************************************
+* program_image_header: Header at the start of a program image, stored in
+*                       PROGRAM_IMAGE_HEADER_SIZE bytes.
+********************************************************************************/
+struct program_image_header
+{
+   char magic[4];             /* Set to PROGRAM_IMAGE_MAGIC. */
+   uint16_t version;          /* Version of the image format. */
+   uint16_t header_size;      /* Size of the header in bytes. */
+   uint32_t checksum;         /* Checksum of all bytes after the header. */
+   uint32_t image_size;       /* Total size of the image in bytes. */
+   uint16_t entry_point;      /* Address to start the program from. */
+   uint16_t num_symbols;      /* Number of entries in the symbol table. */
+   uint32_t num_instructions; /* Number of instructions in the code section. */
+   uint16_t data_address;     /* Start address of the initial data memory content. */
+   uint16_t data_size;        /* Number of bytes of initial data memory content. */
+   uint32_t code_offset;      /* Offset to the code section. */
+   uint32_t symbols_offset;   /* Offset to the symbol table. */
+   uint32_t data_offset;      /* Offset to the initial data memory content. */
+};
+
+/********************************************************************************
+* program_image_symbol: Entry in the symbol table of a program image, stored
+*                       in PROGRAM_IMAGE_ENTRY_SIZE bytes.
+********************************************************************************/
+struct program_image_symbol
+{
+   char name[PROGRAM_IMAGE_SYMBOL_SIZE]; /* Name of the symbol, null terminated. */
+   int32_t value;                        /* Value or address of the symbol. */
+   uint8_t type;                         /* Kind of symbol, see assembler_symbol_type. */
+   uint8_t reserved[3];                  /* Reserved, set to 0. */
+};
+
+/********************************************************************************
+* program_image_write: Writes referenced assembled program as a program image
+*                      to the file at specified path. Success code 0 is
+*                      returned on success, otherwise error code 1 is returned.
+*
+*                      - program    : Reference to the assembled program.
+*                      - entry_point: Address to start the program from.
+*                      - path       : Path to the image file.
+********************************************************************************/
+int program_image_write(const struct assembler_program* program,
+                        const uint16_t entry_point,
+                        const char* path);
+
+/********************************************************************************
+* program_image_detect: Indicates if the file at specified path starts with
+*                       the magic number of a program image.
+*
+*                       - path: Path to the file.
+********************************************************************************/
+bool program_image_detect(const char* path);
+
+/********************************************************************************
+* program_image_load_ctx: Loads the program image at specified path into the
+*                         program memory of specified CPU context together with
+*                         its entry point, initial data memory content and code
+*                         labels. The CPU context is reset so that the program
+*                         is decoded and started. Success code 0 is returned on
+*                         success, otherwise error code 1 is returned if the
+*                         file can't be read or isn't a valid image or if
+*                         memory can't be allocated, in which case the CPU
+*                         context is left unchanged.
+*
+*                         - self: Reference to the CPU context.
+*                         - path: Path to the image file.
+********************************************************************************/
+int program_image_load_ctx(struct cpu_context* self,
+                           const char* path);
+
+#endif /* PROGRAM_IMAGE_H_ */
@@ -1,181 +1,350 @@
-/********************************************************************************
-* program_memory.c: Contains function definitions and macro definitions for
-*                   implementation of a 6 kB program memory, capable of storing
-*                   up to 256 24-bit instructions. Since C doesn't support
-*                   unsigned 24-bit integers (without using structs or unions),
-*                   the program memory is set to 32 bits data width, but only
-*                   24 bits are used.
-********************************************************************************/
-#include "program_memory.h"
-
-/* Macro definitions: */
-#define main            8  /* Start address for subroutine main. */
-#define main_loop       9  /* Start address for loop in subroutine main. */
-#define led1_toggle     10 /* Start address for subroutine led1_toggle. */
-#define led1_off        13 /* Start address for subroutine led1_off. */
-#define led1_on         19 /* Start address for subroutine led1_on. */
-#define setup           25 /* Start address for subroutine setup. */
-#define ISR_PCINT0      35 /* Start address for PCINT0 interrupt handler. */
-#define ISR_PCINT0_end  39 /* End address for PCINT0 interrupt handler.*/
-#define end             40 /* End address for current program. */
-
-#define LED1 PORTB0         /* Led 1 connected to pin 8 (PORTB0). */
-#define BUTTON1 PORTB5      /* Button 1 connected to pin 13 (PORTB5). */
-#define led1_enabled 1000   /* Address for variable storing the state of led 1.  */
-
-/* Static functions: */
-static inline uint32_t assemble(const uint8_t op_code,
-                                const uint8_t op1,
-                                const uint8_t op2);
-
-/********************************************************************************
-* data: Program memory with capacity for storing 256 instructions.
-********************************************************************************/
-static uint32_t data[PROGRAM_MEMORY_ADDRESS_WIDTH];
-
-/********************************************************************************
-* program_memory_write: Writes machine code to the program memory. This function
-*                       should be called once when the program starts.
-********************************************************************************/
-void program_memory_write(void)
-{
-   static bool program_memory_initialized = false;
-   if (program_memory_initialized) return;
-
-   /********************************************************************************
-   * RESET_vect: Reset vector and start address for the program. A jump is made
-   *             to the main subroutine in order to start the program.
-   ********************************************************************************/
-   data[0] = assemble(JMP, main, 0x00);
-   data[1] = assemble(NOP, 0x00, 0x00);
-
-   /********************************************************************************
-   * PCINT0_vect: Interrupt vector for pin change interrupt on I/O-port B. A jump
-   *              is made to the corresponding interrupt handler ISR_PCINT0 to
-   *              handle the interrupt.
-   ********************************************************************************/
-   data[2] = assemble(JMP, ISR_PCINT0, 0x00);
-   data[3] = assemble(NOP, 0x00, 0x00);
-   data[4] = assemble(NOP, 0x00, 0x00);
-   data[5] = assemble(NOP, 0x00, 0x00);
-   data[6] = assemble(NOP, 0x00, 0x00);
-   data[7] = assemble(NOP, 0x00, 0x00);
-
-   /********************************************************************************
-   * main: Initiates the system at start. The program is kept running as long
-   *       as voltage is supplied. The led connected to PORTB0 is enabled when
-   *       the button connected to PORTB5 is pressed, otherwise it's disabled.
-   ********************************************************************************/
-   data[8] = assemble(CALL, setup, 0x00);
-   data[9] = assemble(JMP, main_loop, 0x00);
-
-   /********************************************************************************
-   * led1_toggle: Toggle the led connected to PORTB0.
-   ********************************************************************************/
-   data[10] = assemble(LD, R16, X);
-   data[11] = assemble(CPI, R16, 0x00);
-   data[12] = assemble(BREQ, led1_on, 0x00);
-
-   /********************************************************************************
-   * led1_off: Disables the led connected to PORTB0.
-   ********************************************************************************/
-   data[13] = assemble(IN, R16, PORTB);
-   data[14] = assemble(ANDI, R16, ~(1 << LED1));
-   data[15] = assemble(OUT, PORTB, R16);
-   data[16] = assemble(LDI, R16, 0x00);
-   data[17] = assemble(ST, X, R16);
-   data[18] = assemble(RET, 0x00, 0x00);
-
-   /********************************************************************************
-   * led1_on: Enables the led connected to PORTB0.
-   ********************************************************************************/
-   data[19] = assemble(IN, R16, PORTB);
-   data[20] = assemble(ORI, R16, (1 << LED1));
-   data[21] = assemble(OUT, PORTB, R16);
-   data[22] = assemble(LDI, R16, 0x01);
-   data[23] = assemble(ST, X, R16);
-   data[24] = assemble(RET, 0x00, 0x00);
-
-   /********************************************************************************
-   * setup: Sets the led pin to output and enables the internal pull-up resistor
-   *        for the button pin.
-   ********************************************************************************/
-   data[25] = assemble(LDI, R16, (1 << LED1));
-   data[26] = assemble(OUT, DDRB, R16);
-   data[27] = assemble(LDI, R17, (1 << BUTTON1));
-   data[28] = assemble(OUT, PORTB, R17);
-   data[29] = assemble(SEI, 0x00, 0x00);
-   data[30] = assemble(STS, PCICR, R16);
-   data[31] = assemble(STS, PCMSK0, R17);
-   data[32] = assemble(LDI, XL, low(led1_enabled));
-   data[33] = assemble(LDI, XH, high(led1_enabled));
-   data[34] = assemble(RET, 0x00, 0x00);
-
-   /********************************************************************************
-   * ISR_PCINT0: Interrupt handler for pin change interrupt at I/O-port B, which
-   *             is generated at pressdown and release of BUTTON1 connected to
-   *             PORTB5. At pressdown, the led connected to PORTB0 is toggled.
-   ********************************************************************************/
-   data[35] = assemble(IN, R16, PINB);
-   data[36] = assemble(ANDI, R16, (1 << BUTTON1));
-   data[37] = assemble(BREQ, ISR_PCINT0_end, 0x00);
-   data[38] = assemble(CALL, led1_toggle, 0x00);
-   data[39] = assemble(RETI, 0x00, 0x00);
-
-   program_memory_initialized = true;
-   return;
-}
-
-/********************************************************************************
-* program_memory_read: Returns the instruction at specified address. If an
-*                      invalid address is specified (should be impossible as
-*                      long as the program memory address width isn't increased)
-*                      no operation (0x00) is returned.
-*
-*                      - address: Address to instruction in program memory.
-********************************************************************************/
-uint32_t program_memory_read(const uint8_t address)
-{
-   if (address < PROGRAM_MEMORY_ADDRESS_WIDTH)
-   {
-      return data[address];
-   }
-   else
-   {
-      return 0x00;
-   }
-}
-
-/********************************************************************************
-* program_memory_subroutine_name: Returns the name of the subroutine at
-*                                 specified address.
-*
-*                                 - address: Address within the subroutine.
-********************************************************************************/
-const char* program_memory_subroutine_name(const uint8_t address)
-{
-   if (address >= RESET_vect && address < PCINT0_vect)    return "RESET_vect";
-   else if (address >= PCINT0_vect && address < main)     return "PCINT0_vect";
-   else if (address >= main && address < led1_toggle)     return "main";
-   else if (address >= led1_toggle && address < led1_off) return "led1_toggle";
-   else if (address >= led1_off && address < led1_on)     return "led1_off";
-   else if (address >= led1_on && address < setup)        return "led1_on";
-   else if (address >= setup && address < ISR_PCINT0)     return "setup";
-   else if (address >= ISR_PCINT0 && address < end)       return "ISR_PCINT0";
-   else                                                   return "Unknown";
-}
-
-/********************************************************************************
-* assemble: Returns instruction assembled to machine code.
-*
-*           - op_code: OP code of the instruction.
-*           - op1    : First operand (destination).
-*           - op2    : Second operand (constant or read location).
-********************************************************************************/
-static inline uint32_t assemble(const uint8_t op_code,
-                                const uint8_t op1,
-                                const uint8_t op2)
-{
-   const uint32_t instruction = (op_code << 16) | (op1 << 8) | op2;
-   return instruction;
+/********************************************************************************
+* program_memory.c: Contains function definitions and macro definitions for
+*                   implementation of a 192 kB program memory, capable of
+*                   storing up to 65 536 24-bit instructions. Since C doesn't
+*                   support unsigned 24-bit integers (without using structs or
+*                   unions), the program memory is set to 32 bits data width,
+*                   but only 24 bits are used. The content is stored in a CPU
+*                   context.
+********************************************************************************/
+#include "program_memory.h"
+#include "cpu_context.h"
+
+#include <string.h>
+
+/* Macro definitions: */
+#define main            8  /* Start address for subroutine main. */
+#define main_loop       9  /* Start address for loop in subroutine main. */
+#define led1_toggle     10 /* Start address for subroutine led1_toggle. */
+#define led1_off        13 /* Start address for subroutine led1_off. */
+#define led1_on         19 /* Start address for subroutine led1_on. */
+#define setup           25 /* Start address for subroutine setup. */
+#define ISR_PCINT0      35 /* Start address for PCINT0 interrupt handler. */
+#define ISR_PCINT0_end  39 /* End address for PCINT0 interrupt handler.*/
+#define end             40 /* End address for current program. */
+
+#define LED1 PORTB0         /* Led 1 connected to pin 8 (PORTB0). */
+#define BUTTON1 PORTB5      /* Button 1 connected to pin 13 (PORTB5). */
+#define led1_enabled 1000   /* Address for variable storing the state of led 1.  */
+
+#define PROGRAM_MEMORY_MIN_LABELS 16 /* Initial capacity of the label table. */
+
+/* Static functions: */
+static inline uint32_t assemble(const uint8_t op_code,
+                                const uint8_t op1,
+                                const uint8_t op2);
+static uint32_t find_label(const struct cpu_context* self,
+                           const uint16_t address);
+
+/********************************************************************************
+* program_memory_write_ctx: Writes machine code to the program memory of
+*                           specified CPU context. The program is only written
+*                           the first time the function is called.
+*
+*                           - self: Reference to the CPU context.
+********************************************************************************/
+void program_memory_write_ctx(struct cpu_context* self)
+{
+   uint32_t* data = self->program;
+   if (self->program_initialized) return;
+
+   /********************************************************************************
+   * RESET_vect: Reset vector and start address for the program. A jump is made
+   *             to the main subroutine in order to start the program.
+   ********************************************************************************/
+   data[0] = assemble(JMP, main, 0x00);
+   data[1] = assemble(NOP, 0x00, 0x00);
+
+   /********************************************************************************
+   * PCINT0_vect: Interrupt vector for pin change interrupt on I/O-port B. A jump
+   *              is made to the corresponding interrupt handler ISR_PCINT0 to
+   *              handle the interrupt.
+   ********************************************************************************/
+   data[2] = assemble(JMP, ISR_PCINT0, 0x00);
+   data[3] = assemble(NOP, 0x00, 0x00);
+   data[4] = assemble(NOP, 0x00, 0x00);
+   data[5] = assemble(NOP, 0x00, 0x00);
+   data[6] = assemble(NOP, 0x00, 0x00);
+   data[7] = assemble(NOP, 0x00, 0x00);
+
+   /********************************************************************************
+   * main: Initiates the system at start. The program is kept running as long
+   *       as voltage is supplied. The led connected to PORTB0 is enabled when
+   *       the button connected to PORTB5 is pressed, otherwise it's disabled.
+   ********************************************************************************/
+   data[8] = assemble(CALL, setup, 0x00);
+   data[9] = assemble(JMP, main_loop, 0x00);
+
+   /********************************************************************************
+   * led1_toggle: Toggle the led connected to PORTB0.
+   ********************************************************************************/
+   data[10] = assemble(LD, R16, X);
+   data[11] = assemble(CPI, R16, 0x00);
+   data[12] = assemble(BREQ, led1_on, 0x00);
+
+   /********************************************************************************
+   * led1_off: Disables the led connected to PORTB0.
+   ********************************************************************************/
+   data[13] = assemble(IN, R16, PORTB);
+   data[14] = assemble(ANDI, R16, ~(1 << LED1));
+   data[15] = assemble(OUT, PORTB, R16);
+   data[16] = assemble(LDI, R16, 0x00);
+   data[17] = assemble(ST, X, R16);
+   data[18] = assemble(RET, 0x00, 0x00);
+
+   /********************************************************************************
+   * led1_on: Enables the led connected to PORTB0.
+   ********************************************************************************/
+   data[19] = assemble(IN, R16, PORTB);
+   data[20] = assemble(ORI, R16, (1 << LED1));
+   data[21] = assemble(OUT, PORTB, R16);
+   data[22] = assemble(LDI, R16, 0x01);
+   data[23] = assemble(ST, X, R16);
+   data[24] = assemble(RET, 0x00, 0x00);
+
+   /********************************************************************************
+   * setup: Sets the led pin to output and enables the internal pull-up resistor
+   *        for the button pin.
+   ********************************************************************************/
+   data[25] = assemble(LDI, R16, (1 << LED1));
+   data[26] = assemble(OUT, DDRB, R16);
+   data[27] = assemble(LDI, R17, (1 << BUTTON1));
+   data[28] = assemble(OUT, PORTB, R17);
+   data[29] = assemble(SEI, 0x00, 0x00);
+   data[30] = assemble(STS, PCICR, R16);
+   data[31] = assemble(STS, PCMSK0, R17);
+   data[32] = assemble(LDI, XL, low(led1_enabled));
+   data[33] = assemble(LDI, XH, high(led1_enabled));
+   data[34] = assemble(RET, 0x00, 0x00);
+
+   /********************************************************************************
+   * ISR_PCINT0: Interrupt handler for pin change interrupt at I/O-port B, which
+   *             is generated at pressdown and release of BUTTON1 connected to
+   *             PORTB5. At pressdown, the led connected to PORTB0 is toggled.
+   ********************************************************************************/
+   data[35] = assemble(IN, R16, PINB);
+   data[36] = assemble(ANDI, R16, (1 << BUTTON1));
+   data[37] = assemble(BREQ, ISR_PCINT0_end, 0x00);
+   data[38] = assemble(CALL, led1_toggle, 0x00);
+   data[39] = assemble(RETI, 0x00, 0x00);
+
+   self->program_initialized = true;
+   return;
+}
+
+/********************************************************************************
+* program_memory_read_ctx: Returns the instruction at specified address in the
+*                          program memory of specified CPU context. Every
+*                          16-bit address is valid, since the program memory
+*                          covers the entire address space.
+*
+*                          - self   : Reference to the CPU context.
+*                          - address: Address to instruction in program memory.
+********************************************************************************/
+uint32_t program_memory_read_ctx(const struct cpu_context* self,
+                                 const uint16_t address)
+{
+   return self->program[address];
+}
+
+/********************************************************************************
+* program_memory_load_ctx: Loads specified machine code into the program memory
+*                          of specified CPU context, replacing the built-in
+*                          program. Unused addresses are filled with no
+*                          operation (0x00) and all labels are cleared. The new
+*                          program is decoded and started from specified entry
+*                          point at the next reset.
+*
+*                          - self       : Reference to the CPU context.
+*                          - code       : Reference to the machine code.
+*                          - size       : Number of instructions to load.
+*                          - entry_point: Address to start the program from.
+********************************************************************************/
+void program_memory_load_ctx(struct cpu_context* self,
+                             const uint32_t* code,
+                             const uint32_t size,
+                             const uint16_t entry_point)
+{
+   for (uint32_t i = 0; i < PROGRAM_MEMORY_ADDRESS_WIDTH; ++i)
+   {
+      self->program[i] = i < size ? code[i] : 0x00;
+   }
+
+   self->num_labels = 0;
+   self->entry_point = entry_point;
+   self->program_initialized = true;
+   self->power_on_valid = false;
+   return;
+}
+
+/********************************************************************************
+* program_memory_set_label_ctx: Sets the label at specified address in the
+*                               program memory of specified CPU context. Once
+*                               a label has been set, subroutine names are
+*                               taken from the labels instead of the layout
+*                               of the built-in program. Success code 0 is
+*                               returned on success, otherwise error code 1 is
+*                               returned if memory can't be allocated.
+*
+*                               - self   : Reference to the CPU context.
+*                               - address: Address of the label.
+*                               - name   : Name of the label.
+********************************************************************************/
+int program_memory_set_label_ctx(struct cpu_context* self,
+                                 const uint16_t address,
+                                 const char* name)
+{
+   const uint32_t index = find_label(self, address);
+
+   if (index == self->num_labels || self->labels[index].address != address)
+   {
+      if (self->num_labels == self->labels_capacity)
+      {
+         const uint32_t capacity = self->labels_capacity ? 2 * self->labels_capacity : PROGRAM_MEMORY_MIN_LABELS;
+         struct program_memory_label* labels =
+            (struct program_memory_label*)realloc(self->labels, capacity * sizeof(struct program_memory_label));
+         if (!labels) return 1;
+         self->labels = labels;
+         self->labels_capacity = capacity;
+      }
+
+      memmove(&self->labels[index + 1], &self->labels[index],
+              (self->num_labels - index) * sizeof(struct program_memory_label));
+      self->labels[index].address = address;
+      self->num_labels++;
+   }
+
+   snprintf(self->labels[index].name, PROGRAM_MEMORY_LABEL_SIZE, "%s", name);
+   return 0;
+}
+
+/********************************************************************************
+* program_memory_label_ctx: Returns the name of the label at specified address
+*                           in the program memory of specified CPU context, or
+*                           a null pointer if no label is set at the address.
+*
+*                           - self   : Reference to the CPU context.
+*                           - address: Address of the label.
+********************************************************************************/
+const char* program_memory_label_ctx(const struct cpu_context* self,
+                                     const uint16_t address)
+{
+   const uint32_t index = find_label(self, address);
+
+   if (index < self->num_labels && self->labels[index].address == address)
+   {
+      return self->labels[index].name;
+   }
+   else
+   {
+      return 0;
+   }
+}
+
+/********************************************************************************
+* program_memory_subroutine_name_ctx: Returns the name of the subroutine at
+*                                     specified address in the program memory
+*                                     of specified CPU context, i.e. the
+*                                     closest label at or before the address.
+*
+*                                     - self   : Reference to the CPU context.
+*                                     - address: Address within the subroutine.
+********************************************************************************/
+const char* program_memory_subroutine_name_ctx(const struct cpu_context* self,
+                                               const uint16_t address)
+{
+   if (!self->num_labels) return program_memory_subroutine_name(address);
+   const uint32_t index = find_label(self, address);
+
+   if (index < self->num_labels && self->labels[index].address == address)
+   {
+      return self->labels[index].name;
+   }
+   else if (index > 0)
+   {
+      return self->labels[index - 1].name;
+   }
+   else
+   {
+      return "Unknown";
+   }
+}
+
+/********************************************************************************
+* program_memory_write: Writes machine code to the program memory. This function
+*                       should be called once when the program starts.
+********************************************************************************/
+void program_memory_write(void)
+{
+   program_memory_write_ctx(cpu_context_default());
+   return;
+}
+
+/********************************************************************************
+* program_memory_read: Returns the instruction at specified address. Every
+*                      16-bit address is valid, since the program memory
+*                      covers the entire address space.
+*
+*                      - address: Address to instruction in program memory.
+********************************************************************************/
+uint32_t program_memory_read(const uint16_t address)
+{
+   return program_memory_read_ctx(cpu_context_default(), address);
+}
+
+/********************************************************************************
+* program_memory_subroutine_name: Returns the name of the subroutine at
+*                                 specified address.
+*
+*                                 - address: Address within the subroutine.
+********************************************************************************/
+const char* program_memory_subroutine_name(const uint16_t address)
+{
+   if (address < PCINT0_vect)      return "RESET_vect";
+   else if (address < main)        return "PCINT0_vect";
+   else if (address < led1_toggle) return "main";
+   else if (address < led1_off)    return "led1_toggle";
+   else if (address < led1_on)     return "led1_off";
+   else if (address < setup)       return "led1_on";
+   else if (address < ISR_PCINT0)  return "setup";
+   else if (address < end)         return "ISR_PCINT0";
+   else                            return "Unknown";
+}
+
+/********************************************************************************
+* assemble: Returns instruction assembled to machine code.
+*
+*           - op_code: OP code of the instruction.
+*           - op1    : First operand (destination).
+*           - op2    : Second operand (constant or read location).
+********************************************************************************/
+static inline uint32_t assemble(const uint8_t op_code,
+                                const uint8_t op1,
+                                const uint8_t op2)
+{
+   const uint32_t instruction = (op_code << 16) | (op1 << 8) | op2;
+   return instruction;
+}
+
+/********************************************************************************
+* find_label: Returns the index of the first label at or after specified
+*             address in the label table of specified CPU context, which is
+*             sorted by address. If all labels are located before the address,
+*             the number of labels is returned.
+*
+*             - address: The address to search for.
+********************************************************************************/
+static uint32_t find_label(const struct cpu_context* self,
+                           const uint16_t address)
+{
+   uint32_t low = 0;
+   uint32_t high = self->num_labels;
+
+   while (low < high)
+   {
+      const uint32_t middle = (low + high) / 2;
+      if (self->labels[middle].address < address) low = middle + 1;
+      else                                        high = middle;
+   }
+   return low;
 }
\ No newline at end of file
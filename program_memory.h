@@ -1,43 +1,157 @@
-/********************************************************************************
-* program_memory.h: Contains function declarations and macro definitions for
-*                   implementation of a 6 kB program memory, capable of storing
-*                   up to 256 24-bit instructions. Since C doesn't support
-*                   unsigned 24-bit integers (without using structs or unions),
-*                   the program memory is set to 32 bits data width, but only
-*                   24 bits are used.
-********************************************************************************/
-#ifndef PROGRAM_MEMORY_H_
-#define PROGRAM_MEMORY_H_
-
-/* Include directives: */
-#include "cpu.h"
-
-/* Macro definitions: */
-#define PROGRAM_MEMORY_DATA_WIDTH    24  /* 24 bits per instruction. */
-#define PROGRAM_MEMORY_ADDRESS_WIDTH 256 /* Capacity for storage of 256 instructions. */
-
-/********************************************************************************
-* program_memory_write: Writes machine code to the program memory. This function
-*                       should be called once when the program starts.
-********************************************************************************/
-void program_memory_write(void);
-
-/********************************************************************************
-* program_memory_read: Returns the instruction at specified address. If an
-*                      invalid address is specified (should be impossible as
-*                      long as the program memory address width isn't increased)
-*                      no operation (0x00) is returned.
-*
-*                      - address: Address to instruction in program memory.
-********************************************************************************/
-uint32_t program_memory_read(const uint8_t address);
-
-/********************************************************************************
-* program_memory_subroutine_name: Returns the name of the subroutine at
-*                                 specified address.
-*
-*                                 - address: Address within the subroutine.
-********************************************************************************/
-const char* program_memory_subroutine_name(const uint8_t address);
-
+/********************************************************************************
+* program_memory.h: Contains function declarations and macro definitions for
+*                   implementation of a 192 kB program memory, capable of
+*                   storing up to 65 536 24-bit instructions addressed by the
+*                   16-bit program counter. Since C doesn't support unsigned
+*                   24-bit integers (without using structs or unions), the
+*                   program memory is set to 32 bits data width, but only 24
+*                   bits are used.
+*
+*                   Jump, branch and call instructions hold the low byte of
+*                   the target address in the first operand and the high byte
+*                   in the second operand, so programs within the first 256
+*                   addresses leave the second operand 0 as before. Code
+*                   labels are stored in a table sorted by address, which only
+*                   grows with the number of labels set.
+********************************************************************************/
+#ifndef PROGRAM_MEMORY_H_
+#define PROGRAM_MEMORY_H_
+
+/* Include directives: */
+#include "cpu.h"
+
+/* Macro definitions: */
+#define PROGRAM_MEMORY_DATA_WIDTH    24  /* 24 bits per instruction. */
+#define PROGRAM_MEMORY_ADDRESS_WIDTH 65536 /* Capacity for storage of 65 536 instructions. */
+#define PROGRAM_MEMORY_LABEL_SIZE    32    /* Max length of subroutine labels (including '\0'). */
+
+/* Forward declarations: */
+struct cpu_context;
+
+/********************************************************************************
+* program_memory_label: Code label of a loaded program.
+********************************************************************************/
+struct program_memory_label
+{
+   uint16_t address;                     /* Address of the label. */
+   char name[PROGRAM_MEMORY_LABEL_SIZE]; /* Name of the label, null terminated. */
+};
+
+/********************************************************************************
+* program_memory_jump_address: Returns the target address of a jump, branch or
+*                              call instruction with specified operands, i.e.
+*                              the first operand as the low byte and the second
+*                              operand as the high byte.
+*
+*                              - op1: First operand of the instruction.
+*                              - op2: Second operand of the instruction.
+********************************************************************************/
+static inline uint16_t program_memory_jump_address(const uint8_t op1,
+                                                   const uint8_t op2)
+{
+   return (uint16_t)(op1 | (op2 << 8));
+}
+
+/********************************************************************************
+* program_memory_write_ctx: Writes machine code to the program memory of
+*                           specified CPU context. The program is only written
+*                           the first time the function is called.
+*
+*                           - self: Reference to the CPU context.
+********************************************************************************/
+void program_memory_write_ctx(struct cpu_context* self);
+
+/********************************************************************************
+* program_memory_read_ctx: Returns the instruction at specified address in the
+*                          program memory of specified CPU context. Every
+*                          16-bit address is valid, since the program memory
+*                          covers the entire address space.
+*
+*                          - self   : Reference to the CPU context.
+*                          - address: Address to instruction in program memory.
+********************************************************************************/
+uint32_t program_memory_read_ctx(const struct cpu_context* self,
+                                 const uint16_t address);
+
+/********************************************************************************
+* program_memory_load_ctx: Loads specified machine code into the program memory
+*                          of specified CPU context, replacing the built-in
+*                          program. Unused addresses are filled with no
+*                          operation (0x00) and all labels are cleared. The new
+*                          program is decoded and started from specified entry
+*                          point at the next reset.
+*
+*                          - self       : Reference to the CPU context.
+*                          - code       : Reference to the machine code.
+*                          - size       : Number of instructions to load.
+*                          - entry_point: Address to start the program from.
+********************************************************************************/
+void program_memory_load_ctx(struct cpu_context* self,
+                             const uint32_t* code,
+                             const uint32_t size,
+                             const uint16_t entry_point);
+
+/********************************************************************************
+* program_memory_set_label_ctx: Sets the label at specified address in the
+*                               program memory of specified CPU context. Once
+*                               a label has been set, subroutine names are
+*                               taken from the labels instead of the layout
+*                               of the built-in program. Success code 0 is
+*                               returned on success, otherwise error code 1 is
+*                               returned if memory can't be allocated.
+*
+*                               - self   : Reference to the CPU context.
+*                               - address: Address of the label.
+*                               - name   : Name of the label.
+********************************************************************************/
+int program_memory_set_label_ctx(struct cpu_context* self,
+                                 const uint16_t address,
+                                 const char* name);
+
+/********************************************************************************
+* program_memory_label_ctx: Returns the name of the label at specified address
+*                           in the program memory of specified CPU context, or
+*                           a null pointer if no label is set at the address.
+*
+*                           - self   : Reference to the CPU context.
+*                           - address: Address of the label.
+********************************************************************************/
+const char* program_memory_label_ctx(const struct cpu_context* self,
+                                     const uint16_t address);
+
+/********************************************************************************
+* program_memory_subroutine_name_ctx: Returns the name of the subroutine at
+*                                     specified address in the program memory
+*                                     of specified CPU context, i.e. the
+*                                     closest label at or before the address.
+*
+*                                     - self   : Reference to the CPU context.
+*                                     - address: Address within the subroutine.
+********************************************************************************/
+const char* program_memory_subroutine_name_ctx(const struct cpu_context* self,
+                                               const uint16_t address);
+
+/********************************************************************************
+* program_memory_write: Writes machine code to the program memory. This function
+*                       should be called once when the program starts.
+********************************************************************************/
+void program_memory_write(void);
+
+/********************************************************************************
+* program_memory_read: Returns the instruction at specified address. Every
+*                      16-bit address is valid, since the program memory
+*                      covers the entire address space.
+*
+*                      - address: Address to instruction in program memory.
+********************************************************************************/
+uint32_t program_memory_read(const uint16_t address);
+
+/********************************************************************************
+* program_memory_subroutine_name: Returns the name of the subroutine at
+*                                 specified address.
+*
+*                                 - address: Address within the subroutine.
+********************************************************************************/
+const char* program_memory_subroutine_name(const uint16_t address);
+
 #endif /* PROGRAM_MEMORY_H_ */
\ No newline at end of file
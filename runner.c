@@ -0,0 +1,73 @@
+/********************************************************************************
+* runner.c: Scenario runner for nightly test matrices on Linux. The scenarios
+*           of a scenario list, see scenario.h, are run on all host cores and
+*           a report holding the final PORT registers, the counters and the
+*           outcome of the assertions of each scenario is printed as JSON to
+*           stdout. A summary is printed to stderr.
+*
+*           Usage: runner <scenario list> [threads]
+*
+*           The exit code is 0 if all scenarios passed, otherwise 1.
+********************************************************************************/
+#define _POSIX_C_SOURCE 200809L /* For clock_gettime. */
+
+/* Include directives: */
+#include <time.h> /* Included before cpu.h, which defines short macro names. */
+
+#include "scenario.h"
+
+/* Static functions: */
+static double now(void);
+
+/********************************************************************************
+* main: Runs the scenarios of the scenario list passed as the first argument
+*       and prints the report.
+*
+*       - argc: Number of command line arguments.
+*       - argv: Command line arguments, holding the path to the scenario list
+*               and optionally the number of worker threads.
+********************************************************************************/
+int main(const int argc,
+         const char** argv)
+{
+   struct scenario_batch batch;
+   size_t num_passed = 0;
+
+   if (argc < 2)
+   {
+      fprintf(stderr, "Usage: %s <scenario list> [threads]\n", argv[0]);
+      return 1;
+   }
+
+   if (scenario_batch_load(&batch, argv[1]))
+   {
+      fprintf(stderr, "%s: %s\n", argv[1], batch.error);
+      return 1;
+   }
+
+   const double start = now();
+   scenario_batch_run(&batch, argc > 2 ? (unsigned)strtoul(argv[2], 0, 10) : 0);
+   const double seconds = now() - start;
+   scenario_batch_print(&batch, stdout);
+
+   for (size_t i = 0; i < batch.size; ++i)
+   {
+      if (batch.results[i].status == SCENARIO_PASSED) num_passed++;
+   }
+
+   fprintf(stderr, "Ran %zu scenarios on %u threads in %.3f seconds, %zu passed!\n",
+           batch.size, batch.num_threads, seconds, num_passed);
+   const int result = num_passed == batch.size ? 0 : 1;
+   scenario_batch_free(&batch);
+   return result;
+}
+
+/********************************************************************************
+* now: Returns the current time of the monotonic clock in seconds.
+********************************************************************************/
+static double now(void)
+{
+   struct timespec time;
+   clock_gettime(CLOCK_MONOTONIC, &time);
+   return time.tv_sec + time.tv_nsec * 1e-9;
+}
@@ -0,0 +1,712 @@
+/********************************************************************************
+* scenario.c: Contains function definitions for running batches of scenarios
+*             on a work-stealing pool of worker threads. The scenarios are
+*             independent, so the only shared state is the range of each
+*             worker, guarded by a mutex per worker. Since every scenario
+*             runs for thousands of clock cycles, the locks are rarely
+*             contended.
+********************************************************************************/
+#if defined(__unix__) || defined(__APPLE__)
+/* Included before cpu.h, since the POSIX headers use names cpu.h defines as macros. */
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "scenario.h"
+#include "cpu_context.h"
+#include "assembler.h"
+#include "program_image.h"
+#include "stimulus.h"
+
+#include <string.h>
+
+/* Macro definitions: */
+#define SCENARIO_LINE_SIZE  2048 /* Max length of a line in the scenario list. */
+#define SCENARIO_MAX_TOKENS (4 + SCENARIO_MAX_ASSERTIONS) /* Max number of tokens per line. */
+#define SCENARIO_MAX_THREADS 1024 /* Max number of worker threads. */
+
+#define IO_REGISTER(name) { #name, name }
+
+/********************************************************************************
+* io_register: Name and address of an I/O register that can be asserted.
+********************************************************************************/
+struct io_register
+{
+   const char* name; /* Name of the register. */
+   uint8_t address;  /* Address of the register. */
+};
+
+/********************************************************************************
+* scenario_range: Range of scenarios owned by a worker. The owner takes
+*                 scenarios from the front, while other workers steal from
+*                 the back.
+********************************************************************************/
+struct scenario_range
+{
+#if SCENARIO_THREADS
+   pthread_mutex_t lock; /* Guards the range. */
+#endif
+   size_t begin;         /* Index of the next scenario to run. */
+   size_t end;           /* Index of the last scenario of the range + 1. */
+};
+
+/********************************************************************************
+* scenario_worker: Worker running scenarios with its own CPU context, which is
+*                  reused as long as the scenarios run the same program.
+********************************************************************************/
+struct scenario_worker
+{
+   struct scenario_batch* batch;   /* The batch being run. */
+   struct scenario_range* ranges;  /* Ranges of all workers. */
+   unsigned num_workers;           /* Number of workers. */
+   unsigned index;                 /* Index of this worker. */
+   struct cpu_context* context;    /* CPU context of the worker, if created. */
+   const char* program;            /* Path to the program loaded into the context. */
+#if SCENARIO_THREADS
+   pthread_t thread;               /* Thread of the worker. */
+#endif
+};
+
+/* Static variables: */
+static const struct io_register io_registers[] =
+{
+   IO_REGISTER(DDRB),   IO_REGISTER(PORTB),  IO_REGISTER(PINB),
+   IO_REGISTER(DDRC),   IO_REGISTER(PORTC),  IO_REGISTER(PINC),
+   IO_REGISTER(DDRD),   IO_REGISTER(PORTD),  IO_REGISTER(PIND),
+   IO_REGISTER(PCICR),  IO_REGISTER(PCIFR),
+   IO_REGISTER(PCMSK0), IO_REGISTER(PCMSK1), IO_REGISTER(PCMSK2)
+};
+
+/* Static functions: */
+static int parse_scenario(struct scenario* self,
+                          char* line,
+                          char* message);
+static bool parse_assertion(struct scenario_assertion* self,
+                            const char* s);
+static const char* register_name(const uint8_t address);
+static void* worker_main(void* arg);
+static bool take_scenario(struct scenario_worker* self,
+                          size_t* index);
+static bool steal_scenarios(struct scenario_worker* self);
+static void run_scenario(struct scenario_worker* self,
+                         const size_t index);
+static int load_program(struct cpu_context* self,
+                        const char* path,
+                        char* message);
+static void print_string(const char* s,
+                         FILE* ostream);
+
+/********************************************************************************
+* scenario_batch_load: Reads the scenario list at specified path into
+*                      referenced batch. Success code 0 is returned on
+*                      success, otherwise error code 1 is returned and the
+*                      error message of the batch is set.
+*
+*                      - self: Reference to the batch.
+*                      - path: Path to the scenario list.
+********************************************************************************/
+int scenario_batch_load(struct scenario_batch* self,
+                        const char* path)
+{
+   char line[SCENARIO_LINE_SIZE];
+   size_t capacity = 0;
+   unsigned line_number = 0;
+   FILE* file = fopen(path, "r");
+   memset(self, 0, sizeof(*self));
+
+   if (!file)
+   {
+      snprintf(self->error, SCENARIO_MESSAGE_SIZE, "Failed to open %s", path);
+      return 1;
+   }
+
+   while (fgets(line, sizeof(line), file))
+   {
+      char message[SCENARIO_MESSAGE_SIZE];
+      line_number++;
+
+      if (self->size == capacity)
+      {
+         capacity = capacity ? capacity * 2 : 256;
+         struct scenario* scenarios = (struct scenario*)realloc(self->scenarios, capacity * sizeof(struct scenario));
+
+         if (!scenarios)
+         {
+            snprintf(self->error, SCENARIO_MESSAGE_SIZE, "Out of memory at line %u", line_number);
+            break;
+         }
+         self->scenarios = scenarios;
+      }
+
+      const int parsed = parse_scenario(&self->scenarios[self->size], line, message);
+
+      if (parsed < 0)
+      {
+         snprintf(self->error, SCENARIO_MESSAGE_SIZE, "Line %u: %.100s", line_number, message);
+         break;
+      }
+      else if (parsed > 0)
+      {
+         self->size++;
+      }
+   }
+
+   fclose(file);
+
+   if (!self->error[0])
+   {
+      self->results = (struct scenario_result*)calloc(self->size ? self->size : 1, sizeof(struct scenario_result));
+      if (!self->results) snprintf(self->error, SCENARIO_MESSAGE_SIZE, "Out of memory");
+   }
+
+   if (self->error[0])
+   {
+      char error[SCENARIO_MESSAGE_SIZE];
+      memcpy(error, self->error, sizeof(error));
+      scenario_batch_free(self);
+      memcpy(self->error, error, sizeof(error));
+      return 1;
+   }
+   return 0;
+}
+
+/********************************************************************************
+* scenario_batch_free: Frees the scenarios and results of referenced batch.
+*
+*                      - self: Reference to the batch.
+********************************************************************************/
+void scenario_batch_free(struct scenario_batch* self)
+{
+   free(self->scenarios);
+   free(self->results);
+   memset(self, 0, sizeof(*self));
+   return;
+}
+
+/********************************************************************************
+* scenario_batch_run: Runs all scenarios of referenced batch on a pool of
+*                     worker threads and stores their results. The
+*                     scenarios are split into equal ranges, one per worker,
+*                     before the workers are started.
+*
+*                     - self       : Reference to the batch.
+*                     - num_threads: Number of worker threads (0 = one per
+*                                    host core).
+********************************************************************************/
+void scenario_batch_run(struct scenario_batch* self,
+                        unsigned num_threads)
+{
+#if SCENARIO_THREADS
+   if (!num_threads)
+   {
+      const long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+      num_threads = num_cores > 0 ? (unsigned)num_cores : 1;
+   }
+   if (num_threads > SCENARIO_MAX_THREADS) num_threads = SCENARIO_MAX_THREADS;
+#else
+   num_threads = 1;
+#endif
+   if (self->size && num_threads > self->size) num_threads = (unsigned)self->size;
+   if (!num_threads) num_threads = 1;
+
+   struct scenario_range* ranges = (struct scenario_range*)calloc(num_threads, sizeof(struct scenario_range));
+   struct scenario_worker* workers = (struct scenario_worker*)calloc(num_threads, sizeof(struct scenario_worker));
+
+   if (!ranges || !workers)
+   {
+      /* Runs the scenarios on the calling thread if the pool can't be allocated. */
+      struct scenario_range range = { .begin = 0, .end = self->size };
+      struct scenario_worker worker = { .batch = self, .ranges = &range, .num_workers = 1 };
+#if SCENARIO_THREADS
+      pthread_mutex_init(&range.lock, 0);
+#endif
+      worker_main(&worker);
+#if SCENARIO_THREADS
+      pthread_mutex_destroy(&range.lock);
+#endif
+      free(ranges);
+      free(workers);
+      self->num_threads = 1;
+      return;
+   }
+
+   for (unsigned i = 0; i < num_threads; ++i)
+   {
+      ranges[i].begin = self->size * i / num_threads;
+      ranges[i].end = self->size * (i + 1) / num_threads;
+#if SCENARIO_THREADS
+      pthread_mutex_init(&ranges[i].lock, 0);
+#endif
+      workers[i].batch = self;
+      workers[i].ranges = ranges;
+      workers[i].num_workers = num_threads;
+      workers[i].index = i;
+   }
+
+#if SCENARIO_THREADS
+   /* Worker 0 runs on the calling thread, the others on new threads. */
+   unsigned num_started = 1;
+
+   while (num_started < num_threads && !pthread_create(&workers[num_started].thread, 0, worker_main, &workers[num_started]))
+   {
+      num_started++;
+   }
+
+   /* Ranges of workers that couldn't be started are stolen by the others. */
+   worker_main(&workers[0]);
+   for (unsigned i = 1; i < num_started; ++i) pthread_join(workers[i].thread, 0);
+   for (unsigned i = 0; i < num_threads; ++i) pthread_mutex_destroy(&ranges[i].lock);
+   self->num_threads = num_started;
+#else
+   worker_main(&workers[0]);
+   self->num_threads = 1;
+#endif
+
+   free(ranges);
+   free(workers);
+   return;
+}
+
+/********************************************************************************
+* scenario_batch_print: Prints a report of the results of referenced batch as
+*                       JSON, holding the number of passed, failed and
+*                       erroneous scenarios followed by the result of each
+*                       scenario.
+*
+*                       - self   : Reference to the batch.
+*                       - ostream: Reference to the output stream.
+********************************************************************************/
+void scenario_batch_print(const struct scenario_batch* self,
+                          FILE* ostream)
+{
+   size_t num_status[3] = { 0, 0, 0 };
+   static const char* status_names[3] = { "passed", "failed", "error" };
+
+   for (size_t i = 0; i < self->size; ++i)
+   {
+      num_status[self->results[i].status]++;
+   }
+
+   fprintf(ostream, "{\n");
+   fprintf(ostream, "  \"threads\": %u,\n", self->num_threads);
+   fprintf(ostream, "  \"scenarios\": %zu,\n", self->size);
+   fprintf(ostream, "  \"passed\": %zu,\n", num_status[SCENARIO_PASSED]);
+   fprintf(ostream, "  \"failed\": %zu,\n", num_status[SCENARIO_FAILED]);
+   fprintf(ostream, "  \"errors\": %zu,\n", num_status[SCENARIO_ERROR]);
+   fprintf(ostream, "  \"results\": [\n");
+
+   for (size_t i = 0; i < self->size; ++i)
+   {
+      const struct scenario_result* result = &self->results[i];
+      fprintf(ostream, "    {\"name\": ");
+      print_string(self->scenarios[i].name, ostream);
+      fprintf(ostream, ", \"status\": \"%s\", \"stop_reason\": \"%s\", \"instructions\": %llu, "
+              "\"cycles\": %llu, \"writes\": %llu, \"interrupts\": %llu, "
+              "\"portb\": \"0x%02X\", \"portc\": \"0x%02X\", \"portd\": \"0x%02X\"",
+              status_names[result->status], control_unit_stop_reason_name(result->stop_reason),
+              (unsigned long long)result->num_instructions, (unsigned long long)result->num_cycles,
+              (unsigned long long)result->num_writes, (unsigned long long)result->num_interrupts,
+              result->portb, result->portc, result->portd);
+
+      if (result->message[0])
+      {
+         fprintf(ostream, ", \"message\": ");
+         print_string(result->message, ostream);
+      }
+      fprintf(ostream, "}%s\n", i + 1 < self->size ? "," : "");
+   }
+
+   fprintf(ostream, "  ]\n");
+   fprintf(ostream, "}\n");
+   return;
+}
+
+/********************************************************************************
+* scenario_run_ctx: Runs referenced scenario in specified CPU context from
+*                   reset and stores the result. The program of the scenario
+*                   must already be loaded.
+*
+*                   - self    : Reference to the CPU context.
+*                   - scenario: Reference to the scenario.
+*                   - result  : Reference to variable storing the result.
+********************************************************************************/
+void scenario_run_ctx(struct cpu_context* self,
+                      const struct scenario* scenario,
+                      struct scenario_result* result)
+{
+   const struct control_unit_run_config config = { 0, scenario->max_cycles, 0, 0 };
+   struct control_unit_result run = { CONTROL_UNIT_STOP_LIMIT_REACHED, 0, 0 };
+   memset(result, 0, sizeof(*result));
+
+   control_unit_reset_ctx(self);
+   perf_counters_reset_ctx(self);
+
+   if (scenario->stimulus[0])
+   {
+      struct stimulus* stimulus = stimulus_open(scenario->stimulus);
+
+      if (!stimulus)
+      {
+         result->status = SCENARIO_ERROR;
+         snprintf(result->message, SCENARIO_MESSAGE_SIZE, "Failed to open stimulus file %.80s", scenario->stimulus);
+         return;
+      }
+
+      run = stimulus_run_ctx(self, stimulus, &config);
+      result->num_writes = stimulus_num_applied(stimulus);
+
+      if (stimulus_error(stimulus))
+      {
+         result->status = SCENARIO_ERROR;
+         snprintf(result->message, SCENARIO_MESSAGE_SIZE, "%s", stimulus_error(stimulus));
+      }
+      stimulus_close(&stimulus);
+   }
+   else
+   {
+      run = control_unit_run_ctx(self, &config);
+   }
+
+   const struct perf_counters* counters = perf_counters_get_ctx(self);
+   result->stop_reason = run.stop_reason;
+   result->num_instructions = run.num_instructions;
+   result->num_cycles = run.num_cycles;
+   for (int i = 0; i < PERF_COUNTERS_NUM_VECTORS; ++i) result->num_interrupts += counters->interrupts[i];
+   result->portb = data_memory_read_ctx(self, PORTB);
+   result->portc = data_memory_read_ctx(self, PORTC);
+   result->portd = data_memory_read_ctx(self, PORTD);
+   if (result->status == SCENARIO_ERROR) return;
+
+   for (uint8_t i = 0; i < scenario->num_assertions; ++i)
+   {
+      const struct scenario_assertion* assertion = &scenario->assertions[i];
+      const uint8_t value = data_memory_read_ctx(self, assertion->address);
+
+      if ((value & assertion->mask) != assertion->value)
+      {
+         result->status = SCENARIO_FAILED;
+         snprintf(result->message, SCENARIO_MESSAGE_SIZE, "%s&0x%02X is 0x%02X, expected 0x%02X",
+                  register_name(assertion->address), assertion->mask, value & assertion->mask,
+                  assertion->value);
+         return;
+      }
+   }
+
+   result->status = SCENARIO_PASSED;
+   return;
+}
+
+/********************************************************************************
+* parse_scenario: Parses a line of the scenario list into referenced
+*                 scenario. 1 is returned if the line holds a scenario, 0 if
+*                 it's empty or a comment and -1 if it's invalid, in which
+*                 case the error message is stored.
+*
+*                 - self   : Reference to the scenario.
+*                 - line   : The line to parse, which is split into tokens.
+*                 - message: Buffer of SCENARIO_MESSAGE_SIZE bytes for the
+*                            error message.
+********************************************************************************/
+static int parse_scenario(struct scenario* self,
+                          char* line,
+                          char* message)
+{
+   char* tokens[SCENARIO_MAX_TOKENS];
+   size_t num_tokens = 0;
+   char* comment = strchr(line, '#');
+   if (comment) *comment = '\0';
+
+   for (char* s = strtok(line, " \t\r\n"); s; s = strtok(0, " \t\r\n"))
+   {
+      if (num_tokens == SCENARIO_MAX_TOKENS)
+      {
+         snprintf(message, SCENARIO_MESSAGE_SIZE, "More than %d assertions", SCENARIO_MAX_ASSERTIONS);
+         return -1;
+      }
+      tokens[num_tokens++] = s;
+   }
+
+   if (num_tokens == 0) return 0;
+
+   if (num_tokens < 4 || strlen(tokens[0]) >= SCENARIO_NAME_SIZE ||
+       strlen(tokens[1]) >= SCENARIO_PATH_SIZE || strlen(tokens[2]) >= SCENARIO_PATH_SIZE ||
+       !parse_number(tokens[3], UINT64_MAX, &self->max_cycles))
+   {
+      snprintf(message, SCENARIO_MESSAGE_SIZE, "Expected <name> <program> <stimulus> <cycles> [<assertion> ...]");
+      return -1;
+   }
+
+   strcpy(self->name, tokens[0]);
+   strcpy(self->program, strcmp(tokens[1], "-") ? tokens[1] : "");
+   strcpy(self->stimulus, strcmp(tokens[2], "-") ? tokens[2] : "");
+   self->num_assertions = 0;
+
+   if (!self->stimulus[0] && !self->max_cycles)
+   {
+      snprintf(message, SCENARIO_MESSAGE_SIZE, "A cycle budget is required without stimulus");
+      return -1;
+   }
+
+   for (size_t i = 4; i < num_tokens; ++i)
+   {
+      if (!parse_assertion(&self->assertions[self->num_assertions++], tokens[i]))
+      {
+         snprintf(message, SCENARIO_MESSAGE_SIZE, "Invalid assertion %.60s", tokens[i]);
+         return -1;
+      }
+   }
+   return 1;
+}
+
+/********************************************************************************
+* parse_assertion: Parses an assertion written as <register>=<value> or
+*                  <register>&<mask>=<value>. True is returned if the
+*                  assertion is valid.
+*
+*                  - self: Reference to the assertion.
+*                  - s   : The assertion to parse, which is modified.
+********************************************************************************/
+static bool parse_assertion(struct scenario_assertion* self,
+                            const char* s)
+{
+   char text[SCENARIO_LINE_SIZE];
+   uint64_t mask = 0xFF, value;
+   strcpy(text, s);
+
+   char* equals = strchr(text, '=');
+   if (!equals) return false;
+   *equals = '\0';
+
+   char* ampersand = strchr(text, '&');
+
+   if (ampersand)
+   {
+      *ampersand = '\0';
+      if (!parse_number(ampersand + 1, UINT8_MAX, &mask)) return false;
+   }
+
+   if (!parse_number(equals + 1, UINT8_MAX, &value) || (value & ~mask)) return false;
+
+   for (size_t i = 0; i < sizeof(io_registers) / sizeof(io_registers[0]); ++i)
+   {
+      if (names_equal(text, io_registers[i].name))
+      {
+         self->address = io_registers[i].address;
+         self->mask = (uint8_t)mask;
+         self->value = (uint8_t)value;
+         return true;
+      }
+   }
+   return false;
+}
+
+/********************************************************************************
+* register_name: Returns the name of the I/O register at specified address.
+*
+*                - address: Address of the register.
+********************************************************************************/
+static const char* register_name(const uint8_t address)
+{
+   for (size_t i = 0; i < sizeof(io_registers) / sizeof(io_registers[0]); ++i)
+   {
+      if (io_registers[i].address == address) return io_registers[i].name;
+   }
+   return "?";
+}
+
+/********************************************************************************
+* worker_main: Runs scenarios of the own range until it's empty, then steals
+*              scenarios from the other workers until no scenarios are left.
+*              The CPU context of the worker is deleted at the end.
+*
+*              - arg: Reference to the worker.
+********************************************************************************/
+static void* worker_main(void* arg)
+{
+   struct scenario_worker* self = (struct scenario_worker*)arg;
+   size_t index;
+
+   while (take_scenario(self, &index) || (steal_scenarios(self) && take_scenario(self, &index)))
+   {
+      run_scenario(self, index);
+   }
+
+   cpu_context_delete(&self->context);
+   self->program = 0;
+   return 0;
+}
+
+/********************************************************************************
+* take_scenario: Takes the next scenario from the front of the own range of
+*                specified worker. True is returned if a scenario was taken.
+*
+*                - self : Reference to the worker.
+*                - index: Reference to variable storing the scenario index.
+********************************************************************************/
+static bool take_scenario(struct scenario_worker* self,
+                          size_t* index)
+{
+   struct scenario_range* range = &self->ranges[self->index];
+   bool taken = false;
+#if SCENARIO_THREADS
+   pthread_mutex_lock(&range->lock);
+#endif
+
+   if (range->begin < range->end)
+   {
+      *index = range->begin++;
+      taken = true;
+   }
+
+#if SCENARIO_THREADS
+   pthread_mutex_unlock(&range->lock);
+#endif
+   return taken;
+}
+
+/********************************************************************************
+* steal_scenarios: Moves the back half of the range of another worker to the
+*                  own range of specified worker, which must be empty. The
+*                  other workers are visited in turn, starting with the next
+*                  one. True is returned if any scenarios were stolen.
+*
+*                  - self: Reference to the worker.
+********************************************************************************/
+static bool steal_scenarios(struct scenario_worker* self)
+{
+#if SCENARIO_THREADS
+   for (unsigned i = 1; i < self->num_workers; ++i)
+   {
+      struct scenario_range* victim = &self->ranges[(self->index + i) % self->num_workers];
+      size_t begin = 0, end = 0;
+      pthread_mutex_lock(&victim->lock);
+
+      if (victim->begin < victim->end)
+      {
+         end = victim->end;
+         begin = victim->end - (victim->end - victim->begin + 1) / 2;
+         victim->end = begin;
+      }
+
+      pthread_mutex_unlock(&victim->lock);
+      if (begin == end) continue;
+
+      struct scenario_range* range = &self->ranges[self->index];
+      pthread_mutex_lock(&range->lock);
+      range->begin = begin;
+      range->end = end;
+      pthread_mutex_unlock(&range->lock);
+      return true;
+   }
+#else
+   (void)self;
+#endif
+   return false;
+}
+
+/********************************************************************************
+* run_scenario: Runs the scenario at specified index with the CPU context of
+*               specified worker. The program is only loaded if it differs
+*               from the program of the previous scenario, in which case a
+*               new CPU context is created, so that no configuration is left
+*               from the previous program.
+*
+*               - self : Reference to the worker.
+*               - index: Index of the scenario.
+********************************************************************************/
+static void run_scenario(struct scenario_worker* self,
+                         const size_t index)
+{
+   const struct scenario* scenario = &self->batch->scenarios[index];
+   struct scenario_result* result = &self->batch->results[index];
+
+   if (!self->context || strcmp(self->program, scenario->program))
+   {
+      cpu_context_delete(&self->context);
+      self->program = 0;
+      self->context = cpu_context_new();
+
+      if (!self->context)
+      {
+         memset(result, 0, sizeof(*result));
+         result->status = SCENARIO_ERROR;
+         snprintf(result->message, SCENARIO_MESSAGE_SIZE, "Out of memory");
+         return;
+      }
+
+      if (scenario->program[0] && load_program(self->context, scenario->program, result->message))
+      {
+         result->status = SCENARIO_ERROR;
+         cpu_context_delete(&self->context);
+         return;
+      }
+      self->program = scenario->program;
+   }
+
+   scenario_run_ctx(self->context, scenario, result);
+   return;
+}
+
+/********************************************************************************
+* load_program: Loads the program image or assembly source file at specified
+*               path into specified CPU context. Success code 0 is returned on
+*               success, otherwise error code 1 is returned and the error
+*               message is stored.
+*
+*               - self   : Reference to the CPU context.
+*               - path   : Path to the program image or assembly source file.
+*               - message: Buffer of SCENARIO_MESSAGE_SIZE bytes for the error
+*                          message.
+********************************************************************************/
+static int load_program(struct cpu_context* self,
+                        const char* path,
+                        char* message)
+{
+   if (program_image_detect(path))
+   {
+      if (!program_image_load_ctx(self, path)) return 0;
+      snprintf(message, SCENARIO_MESSAGE_SIZE, "Failed to load program image %.80s", path);
+      return 1;
+   }
+
+   struct assembler_program* program = (struct assembler_program*)malloc(sizeof(struct assembler_program));
+
+   if (!program)
+   {
+      snprintf(message, SCENARIO_MESSAGE_SIZE, "Out of memory");
+      return 1;
+   }
+
+   if (assembler_assemble_file(program, path))
+   {
+      snprintf(message, SCENARIO_MESSAGE_SIZE, "Failed to assemble %.40s: %.64s", path, program->error);
+      free(program);
+      return 1;
+   }
+
+   assembler_load_ctx(self, program);
+   free(program);
+   return 0;
+}
+
+/********************************************************************************
+* print_string: Prints specified string as a JSON string literal.
+*
+*               - s      : The string to print.
+*               - ostream: Reference to the output stream.
+********************************************************************************/
+static void print_string(const char* s,
+                         FILE* ostream)
+{
+   fputc('"', ostream);
+
+   for (; *s; ++s)
+   {
+      if (*s == '"' || *s == '\\') fputc('\\', ostream);
+      if ((unsigned char)*s >= ' ') fputc(*s, ostream);
+   }
+
+   fputc('"', ostream);
+   return;
+}
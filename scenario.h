@@ -0,0 +1,171 @@
+/********************************************************************************
+* scenario.h: Contains function declarations and macro definitions for running
+*             large batches of scenarios, each a program run with a stimulus
+*             for a budget of clock cycles and checked by assertions on the
+*             I/O registers afterwards.
+*
+*             A scenario list is a text file with one scenario per line:
+*
+*             <name> <program> <stimulus> <cycles> [<assertion> ...]
+*
+*             The program is a program image or an assembly source file and
+*             the stimulus a stimulus file, see stimulus.h, where - selects
+*             the built-in program or no stimulus respectively. Paths are
+*             relative to the working directory. The cycle budget 0 runs the
+*             scenario until the last write of the stimulus. An assertion is
+*             written as <register>=<value> or <register>&<mask>=<value>,
+*             for instance PORTB&0x01=1, and passes if the register holds
+*             the value after the run, counting only the bits of the mask.
+*             Text after # is ignored.
+*
+*             The scenarios are spread across a pool of worker threads, one
+*             per host core by default. Each worker owns a range of the
+*             scenarios and takes them from the front, while an idle worker
+*             steals the back half of the range of another worker, so that
+*             all cores are kept busy until the batch is done. Each worker
+*             reuses its CPU context between scenarios running the same
+*             program. On systems without POSIX threads, the scenarios are
+*             run one by one on the calling thread.
+********************************************************************************/
+#ifndef SCENARIO_H_
+#define SCENARIO_H_
+
+/* Include directives: */
+#include "cpu.h"
+#include "control_unit.h"
+
+/* Macro definitions: */
+#define SCENARIO_NAME_SIZE      64  /* Max length of a scenario name, including the terminator. */
+#define SCENARIO_PATH_SIZE      256 /* Max length of a path, including the terminator. */
+#define SCENARIO_MAX_ASSERTIONS 8   /* Max number of assertions per scenario. */
+#define SCENARIO_MESSAGE_SIZE   128 /* Size of error and failure messages. */
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SCENARIO_THREADS 1 /* Scenarios are run by a pool of POSIX threads. */
+#else
+#define SCENARIO_THREADS 0 /* Scenarios are run one by one on the calling thread. */
+#endif
+
+/* Forward declarations: */
+struct cpu_context;
+
+/********************************************************************************
+* scenario_assertion: Expected value of an I/O register after a scenario.
+********************************************************************************/
+struct scenario_assertion
+{
+   uint8_t address; /* Address of the I/O register. */
+   uint8_t mask;    /* Bits of the register that are checked. */
+   uint8_t value;   /* Expected value of the checked bits. */
+};
+
+/********************************************************************************
+* scenario: A program run with a stimulus for a budget of clock cycles.
+********************************************************************************/
+struct scenario
+{
+   char name[SCENARIO_NAME_SIZE];         /* Name of the scenario. */
+   char program[SCENARIO_PATH_SIZE];      /* Path to the program (empty = the built-in program). */
+   char stimulus[SCENARIO_PATH_SIZE];     /* Path to the stimulus file (empty = none). */
+   uint64_t max_cycles;                   /* Number of clock cycles to run (0 = until the last write). */
+   struct scenario_assertion assertions[SCENARIO_MAX_ASSERTIONS]; /* Assertions checked after the run. */
+   uint8_t num_assertions;                /* Number of assertions. */
+};
+
+/********************************************************************************
+* scenario_status: Outcome of a scenario.
+********************************************************************************/
+enum scenario_status
+{
+   SCENARIO_PASSED, /* All assertions passed. */
+   SCENARIO_FAILED, /* At least one assertion failed. */
+   SCENARIO_ERROR   /* The program or the stimulus couldn't be loaded. */
+};
+
+/********************************************************************************
+* scenario_result: Result of a scenario, holding the final PORT registers and
+*                  the performance counters of the run.
+********************************************************************************/
+struct scenario_result
+{
+   enum scenario_status status;                /* Outcome of the scenario. */
+   enum control_unit_stop_reason stop_reason;  /* Reason the run stopped. */
+   uint64_t num_instructions;                  /* Number of executed instructions. */
+   uint64_t num_cycles;                        /* Number of clock cycles run. */
+   uint64_t num_writes;                        /* Number of stimulus writes applied. */
+   uint64_t num_interrupts;                    /* Number of taken interrupts. */
+   uint8_t portb;                              /* Content of PORTB after the run. */
+   uint8_t portc;                              /* Content of PORTC after the run. */
+   uint8_t portd;                              /* Content of PORTD after the run. */
+   char message[SCENARIO_MESSAGE_SIZE];        /* The failed assertion or the error, if any. */
+};
+
+/********************************************************************************
+* scenario_batch: A batch of scenarios read from a scenario list, along with
+*                 their results once run.
+********************************************************************************/
+struct scenario_batch
+{
+   struct scenario* scenarios;        /* The scenarios, in the order of the list. */
+   struct scenario_result* results;   /* Result of each scenario. */
+   size_t size;                       /* Number of scenarios. */
+   unsigned num_threads;              /* Number of worker threads used by the last run. */
+   char error[SCENARIO_MESSAGE_SIZE]; /* Error message if the list is invalid. */
+};
+
+/********************************************************************************
+* scenario_batch_load: Reads the scenario list at specified path into
+*                      referenced batch. Success code 0 is returned on
+*                      success, otherwise error code 1 is returned and the
+*                      error message of the batch is set.
+*
+*                      - self: Reference to the batch.
+*                      - path: Path to the scenario list.
+********************************************************************************/
+int scenario_batch_load(struct scenario_batch* self,
+                        const char* path);
+
+/********************************************************************************
+* scenario_batch_free: Frees the scenarios and results of referenced batch.
+*
+*                      - self: Reference to the batch.
+********************************************************************************/
+void scenario_batch_free(struct scenario_batch* self);
+
+/********************************************************************************
+* scenario_batch_run: Runs all scenarios of referenced batch on a pool of
+*                     worker threads and stores their results.
+*
+*                     - self       : Reference to the batch.
+*                     - num_threads: Number of worker threads (0 = one per
+*                                    host core).
+********************************************************************************/
+void scenario_batch_run(struct scenario_batch* self,
+                        unsigned num_threads);
+
+/********************************************************************************
+* scenario_batch_print: Prints a report of the results of referenced batch as
+*                       JSON, holding the number of passed, failed and
+*                       erroneous scenarios followed by the result of each
+*                       scenario.
+*
+*                       - self   : Reference to the batch.
+*                       - ostream: Reference to the output stream.
+********************************************************************************/
+void scenario_batch_print(const struct scenario_batch* self,
+                          FILE* ostream);
+
+/********************************************************************************
+* scenario_run_ctx: Runs referenced scenario in specified CPU context from
+*                   reset and stores the result. The program of the scenario
+*                   must already be loaded.
+*
+*                   - self    : Reference to the CPU context.
+*                   - scenario: Reference to the scenario.
+*                   - result  : Reference to variable storing the result.
+********************************************************************************/
+void scenario_run_ctx(struct cpu_context* self,
+                      const struct scenario* scenario,
+                      struct scenario_result* result);
+
+#endif /* SCENARIO_H_ */
@@ -1,101 +1,276 @@
-/********************************************************************************
-* stack.c: Contains function definitions for implementation of 1 kB stack.
-********************************************************************************/
-#include "stack.h"
-
-/* Static variables: */
-static uint8_t stack[STACK_ADDRESS_WIDTH]; /* 1 kB stack. */
-static uint16_t sp;      /* Stack pointer, points to last added value. */
-static bool stack_empty; /* Indicates if the stack is empty. */
-
-/********************************************************************************
-* stack_reset: Clears content on the entire stack and sets the stack pointer
-*              to the top of the stack.
-********************************************************************************/
-void stack_reset(void)
-{
-   for (uint16_t i = 0; i < STACK_ADDRESS_WIDTH; ++i)
-   {
-      stack[i] = 0x00;
-   }
-
-   sp = STACK_ADDRESS_WIDTH - 1;
-   stack_empty = true;
-   return;
-}
-
-/********************************************************************************
-* stack_push: Pushes 8 bit value to the stack, unless the stack is full.
-*             Success code 0 is returned after successful push, otherwise
-*             error code 1 is returned if the stack is already full.
-*
-*             - value: 8 bit value to push to the stack.
-********************************************************************************/
-int stack_push(const uint8_t value)
-{
-   if (sp == 0)
-   {
-      return 1;
-   }
-   else
-   {
-      if (stack_empty)
-      {
-         stack[sp] = value;
-         stack_empty = false;
-      }
-      else
-      {
-         stack[--sp] = value;
-      }
-      return 0;
-   }
-}
-
-/********************************************************************************
-* stack_pop: Returns 8 bit value popped from the stack. If the stack is empty,
-*            the value 0x00 is returned.
-********************************************************************************/
-uint8_t stack_pop(void)
-{
-   if (stack_empty)
-   {
-      return 0x00;
-   }
-   else
-   {
-      if (sp < STACK_ADDRESS_WIDTH - 1)
-      {
-         return stack[sp++];
-      }
-      else
-      {
-         stack_empty = true;
-         return stack[sp];
-      }
-   }
-}
-
-/********************************************************************************
-* stack_pointer: Returns the 16 bit address of the stack pointer.
-********************************************************************************/
-uint16_t stack_pointer(void)
-{
-   return sp;
-}
-
-/********************************************************************************
-* stack_last_added_value: Returns the last added value to the stack. If the
-*                         stack is empty, the value 0x00 is returned.
-********************************************************************************/
-uint8_t stack_last_added_value(void)
-{
-   if (stack_empty)
-   {
-      return 0x00;
-   }
-   else
-   {
-      return stack[sp];
-   }
+/********************************************************************************
+* stack.c: Contains function definitions for implementation of 1 kB stack.
+*          The content and the stack pointer are stored in a CPU context.
+********************************************************************************/
+#include "stack.h"
+#include "cpu_context.h"
+
+#include <string.h>
+
+/* Static functions: */
+static inline void mark_dirty(struct cpu_context* self,
+                              const uint16_t address);
+
+/********************************************************************************
+* stack_reset_ctx: Clears content on the entire stack of specified CPU context
+*                  and sets the stack pointer to the top of the stack.
+*
+*                  - self: Reference to the CPU context.
+********************************************************************************/
+void stack_reset_ctx(struct cpu_context* self)
+{
+   for (uint16_t i = 0; i < STACK_ADDRESS_WIDTH; ++i)
+   {
+      self->stack[i] = 0x00;
+   }
+
+   self->sp = STACK_ADDRESS_WIDTH - 1;
+   self->stack_empty = true;
+   memset(self->stack_dirty, 0xFF, sizeof(self->stack_dirty));
+   return;
+}
+
+/********************************************************************************
+* stack_push_ctx: Pushes 8 bit value to the stack of specified CPU context,
+*                 unless the stack is full. Success code 0 is returned after
+*                 successful push, otherwise error code 1 is returned if the
+*                 stack is already full.
+*
+*                 - self : Reference to the CPU context.
+*                 - value: 8 bit value to push to the stack.
+********************************************************************************/
+int stack_push_ctx(struct cpu_context* self,
+                   const uint8_t value)
+{
+   if (self->sp == 0)
+   {
+#if PERF_COUNTERS_ENABLED
+      self->counters.stack_overflows++;
+#endif
+      return 1;
+   }
+   else
+   {
+      if (self->stack_empty)
+      {
+         self->stack[self->sp] = value;
+         self->stack_empty = false;
+      }
+      else
+      {
+         self->stack[--self->sp] = value;
+      }
+
+      mark_dirty(self, self->sp);
+
+#if PERF_COUNTERS_ENABLED
+      const uint16_t depth = STACK_ADDRESS_WIDTH - self->sp;
+      if (depth > self->counters.stack_high_water) self->counters.stack_high_water = depth;
+#endif
+      return 0;
+   }
+}
+
+/********************************************************************************
+* stack_pop_ctx: Returns 8 bit value popped from the stack of specified CPU
+*                context. If the stack is empty, the value 0x00 is returned.
+*
+*                - self: Reference to the CPU context.
+********************************************************************************/
+uint8_t stack_pop_ctx(struct cpu_context* self)
+{
+   if (self->stack_empty)
+   {
+#if PERF_COUNTERS_ENABLED
+      self->counters.stack_underflows++;
+#endif
+      return 0x00;
+   }
+   else
+   {
+      if (self->sp < STACK_ADDRESS_WIDTH - 1)
+      {
+         return self->stack[self->sp++];
+      }
+      else
+      {
+         self->stack_empty = true;
+         return self->stack[self->sp];
+      }
+   }
+}
+
+/********************************************************************************
+* stack_push_address_ctx: Pushes 16 bit program address to the stack of
+*                         specified CPU context, low byte first, for instance
+*                         the return address of a call. Success code 0 is
+*                         returned after successful push, otherwise error code
+*                         1 is returned if the stack is full.
+*
+*                         - self   : Reference to the CPU context.
+*                         - address: 16 bit address to push to the stack.
+********************************************************************************/
+int stack_push_address_ctx(struct cpu_context* self,
+                           const uint16_t address)
+{
+   if (stack_push_ctx(self, (uint8_t)address)) return 1;
+   return stack_push_ctx(self, (uint8_t)(address >> 8));
+}
+
+/********************************************************************************
+* stack_pop_address_ctx: Pops 16 bit program address pushed by
+*                        stack_push_address_ctx from the stack of specified
+*                        CPU context. Success code 0 is returned after
+*                        successful pop, otherwise error code 1 is returned if
+*                        the stack holds less than two bytes, in which case
+*                        missing bytes are read as 0x00.
+*
+*                        - self   : Reference to the CPU context.
+*                        - address: Reference to variable storing the address.
+********************************************************************************/
+int stack_pop_address_ctx(struct cpu_context* self,
+                          uint16_t* address)
+{
+   const int result = self->stack_empty || self->sp == STACK_ADDRESS_WIDTH - 1 ? 1 : 0;
+   const uint8_t high = stack_pop_ctx(self);
+   const uint8_t low = stack_pop_ctx(self);
+   *address = low | (high << 8);
+   return result;
+}
+
+/********************************************************************************
+* stack_pointer_ctx: Returns the 16 bit address of the stack pointer of
+*                    specified CPU context.
+*
+*                    - self: Reference to the CPU context.
+********************************************************************************/
+uint16_t stack_pointer_ctx(const struct cpu_context* self)
+{
+   return self->sp;
+}
+
+/********************************************************************************
+* stack_last_added_value_ctx: Returns the last added value to the stack of
+*                             specified CPU context. If the stack is empty,
+*                             the value 0x00 is returned.
+*
+*                             - self: Reference to the CPU context.
+********************************************************************************/
+uint8_t stack_last_added_value_ctx(const struct cpu_context* self)
+{
+   if (self->stack_empty)
+   {
+      return 0x00;
+   }
+   else
+   {
+      return self->stack[self->sp];
+   }
+}
+
+/********************************************************************************
+* stack_is_empty_ctx: Indicates if the stack of specified CPU context is empty,
+*                     for instance to detect stack underflow before popping.
+*
+*                     - self: Reference to the CPU context.
+********************************************************************************/
+bool stack_is_empty_ctx(const struct cpu_context* self)
+{
+   return self->stack_empty;
+}
+
+/********************************************************************************
+* stack_reset: Clears content on the entire stack and sets the stack pointer
+*              to the top of the stack.
+********************************************************************************/
+void stack_reset(void)
+{
+   stack_reset_ctx(cpu_context_default());
+   return;
+}
+
+/********************************************************************************
+* stack_push: Pushes 8 bit value to the stack, unless the stack is full.
+*             Success code 0 is returned after successful push, otherwise
+*             error code 1 is returned if the stack is already full.
+*
+*             - value: 8 bit value to push to the stack.
+********************************************************************************/
+int stack_push(const uint8_t value)
+{
+   return stack_push_ctx(cpu_context_default(), value);
+}
+
+/********************************************************************************
+* stack_pop: Returns 8 bit value popped from the stack. If the stack is empty,
+*            the value 0x00 is returned.
+********************************************************************************/
+uint8_t stack_pop(void)
+{
+   return stack_pop_ctx(cpu_context_default());
+}
+
+/********************************************************************************
+* stack_push_address: Pushes 16 bit program address to the stack, low byte
+*                     first. Success code 0 is returned after successful push,
+*                     otherwise error code 1 is returned if the stack is full.
+*
+*                     - address: 16 bit address to push to the stack.
+********************************************************************************/
+int stack_push_address(const uint16_t address)
+{
+   return stack_push_address_ctx(cpu_context_default(), address);
+}
+
+/********************************************************************************
+* stack_pop_address: Pops 16 bit program address from the stack. Success code
+*                    0 is returned after successful pop, otherwise error code
+*                    1 is returned if the stack holds less than two bytes.
+*
+*                    - address: Reference to variable storing the address.
+********************************************************************************/
+int stack_pop_address(uint16_t* address)
+{
+   return stack_pop_address_ctx(cpu_context_default(), address);
+}
+
+/********************************************************************************
+* stack_pointer: Returns the 16 bit address of the stack pointer.
+********************************************************************************/
+uint16_t stack_pointer(void)
+{
+   return stack_pointer_ctx(cpu_context_default());
+}
+
+/********************************************************************************
+* stack_last_added_value: Returns the last added value to the stack. If the
+*                         stack is empty, the value 0x00 is returned.
+********************************************************************************/
+uint8_t stack_last_added_value(void)
+{
+   return stack_last_added_value_ctx(cpu_context_default());
+}
+
+/********************************************************************************
+* stack_is_empty: Indicates if the stack is empty, for instance to detect
+*                 stack underflow before popping.
+********************************************************************************/
+bool stack_is_empty(void)
+{
+   return stack_is_empty_ctx(cpu_context_default());
+}
+
+/********************************************************************************
+* mark_dirty: Marks the page containing specified address as written in the
+*             dirty bitmap of the stack.
+*
+*             - self   : Reference to the CPU context.
+*             - address: The written address on the stack.
+********************************************************************************/
+static inline void mark_dirty(struct cpu_context* self,
+                              const uint16_t address)
+{
+   const uint16_t page = address / STACK_DIRTY_PAGE_SIZE;
+   self->stack_dirty[page / 64] |= (uint64_t)1 << (page % 64);
+   return;
 }
\ No newline at end of file
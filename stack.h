@@ -1,47 +1,158 @@
-/********************************************************************************
-* stack.h: Contains function declarations and macro definition for 
-*          implementation of 1 kB stack (1024 x 1 byte = 1024 byte).
-********************************************************************************/
-#ifndef STACK_H_
-#define STACK_H_
-
-/* Include directives: */
-#include "cpu.h"
-
-/* Macro definitions: */
-#define STACK_ADDRESS_WIDTH 1024 /* 1024 unique addresses on the stack. */
-#define STACK_DATA_WIDTH    8    /* 8 bit storage capacity per address. */
-
-/********************************************************************************
-* stack_reset: Clears content on the entire stack and sets the stack pointer
-*              to the top of the stack.
-********************************************************************************/
-void stack_reset(void);
-
-/********************************************************************************
-* stack_push: Pushes 8 bit value to the stack, unless the stack is full.
-*             Success code 0 is returned after successful push, otherwise
-*             error code 1 is returned if the stack is already full.
-* 
-*             - value: 8 bit value to push to the stack.
-********************************************************************************/
-int stack_push(const uint8_t value);
-
-/********************************************************************************
-* stack_pop: Returns 8 bit value popped from the stack. If the stack is empty, 
-*            the value 0x00 is returned.
-********************************************************************************/
-uint8_t stack_pop(void);
-
-/********************************************************************************
-* stack_pointer: Returns the 16 bit address of the stack pointer.
-********************************************************************************/
-uint16_t stack_pointer(void);
-
-/********************************************************************************
-* stack_last_added_value: Returns the last added value to the stack. If the
-*                         stack is empty, the value 0x00 is returned.
-********************************************************************************/
-uint8_t stack_last_added_value(void);
-
+/********************************************************************************
+* stack.h: Contains function declarations and macro definition for 
+*          implementation of 1 kB stack (1024 x 1 byte = 1024 byte).
+********************************************************************************/
+#ifndef STACK_H_
+#define STACK_H_
+
+/* Include directives: */
+#include "cpu.h"
+
+/* Macro definitions: */
+#define STACK_ADDRESS_WIDTH 1024 /* 1024 unique addresses on the stack. */
+#define STACK_DATA_WIDTH    8    /* 8 bit storage capacity per address. */
+
+#define STACK_DIRTY_PAGE_SIZE 64 /* Number of addresses per page in the dirty bitmap. */
+#define STACK_NUM_DIRTY_PAGES ((STACK_ADDRESS_WIDTH + STACK_DIRTY_PAGE_SIZE - 1) / STACK_DIRTY_PAGE_SIZE)
+#define STACK_DIRTY_WORDS     ((STACK_NUM_DIRTY_PAGES + 63) / 64) /* 64-bit words in the bitmap. */
+
+/* Forward declarations: */
+struct cpu_context;
+
+/********************************************************************************
+* stack_reset_ctx: Clears content on the entire stack of specified CPU context
+*                  and sets the stack pointer to the top of the stack.
+*
+*                  - self: Reference to the CPU context.
+********************************************************************************/
+void stack_reset_ctx(struct cpu_context* self);
+
+/********************************************************************************
+* stack_push_ctx: Pushes 8 bit value to the stack of specified CPU context,
+*                 unless the stack is full. Success code 0 is returned after
+*                 successful push, otherwise error code 1 is returned if the
+*                 stack is already full.
+*
+*                 - self : Reference to the CPU context.
+*                 - value: 8 bit value to push to the stack.
+********************************************************************************/
+int stack_push_ctx(struct cpu_context* self,
+                   const uint8_t value);
+
+/********************************************************************************
+* stack_pop_ctx: Returns 8 bit value popped from the stack of specified CPU
+*                context. If the stack is empty, the value 0x00 is returned.
+*
+*                - self: Reference to the CPU context.
+********************************************************************************/
+uint8_t stack_pop_ctx(struct cpu_context* self);
+
+/********************************************************************************
+* stack_push_address_ctx: Pushes 16 bit program address to the stack of
+*                         specified CPU context, low byte first, for instance
+*                         the return address of a call. Success code 0 is
+*                         returned after successful push, otherwise error code
+*                         1 is returned if the stack is full.
+*
+*                         - self   : Reference to the CPU context.
+*                         - address: 16 bit address to push to the stack.
+********************************************************************************/
+int stack_push_address_ctx(struct cpu_context* self,
+                           const uint16_t address);
+
+/********************************************************************************
+* stack_pop_address_ctx: Pops 16 bit program address pushed by
+*                        stack_push_address_ctx from the stack of specified
+*                        CPU context. Success code 0 is returned after
+*                        successful pop, otherwise error code 1 is returned if
+*                        the stack holds less than two bytes, in which case
+*                        missing bytes are read as 0x00.
+*
+*                        - self   : Reference to the CPU context.
+*                        - address: Reference to variable storing the address.
+********************************************************************************/
+int stack_pop_address_ctx(struct cpu_context* self,
+                          uint16_t* address);
+
+/********************************************************************************
+* stack_pointer_ctx: Returns the 16 bit address of the stack pointer of
+*                    specified CPU context.
+*
+*                    - self: Reference to the CPU context.
+********************************************************************************/
+uint16_t stack_pointer_ctx(const struct cpu_context* self);
+
+/********************************************************************************
+* stack_last_added_value_ctx: Returns the last added value to the stack of
+*                             specified CPU context. If the stack is empty,
+*                             the value 0x00 is returned.
+*
+*                             - self: Reference to the CPU context.
+********************************************************************************/
+uint8_t stack_last_added_value_ctx(const struct cpu_context* self);
+
+/********************************************************************************
+* stack_is_empty_ctx: Indicates if the stack of specified CPU context is empty,
+*                     for instance to detect stack underflow before popping.
+*
+*                     - self: Reference to the CPU context.
+********************************************************************************/
+bool stack_is_empty_ctx(const struct cpu_context* self);
+
+/********************************************************************************
+* stack_reset: Clears content on the entire stack and sets the stack pointer
+*              to the top of the stack.
+********************************************************************************/
+void stack_reset(void);
+
+/********************************************************************************
+* stack_push: Pushes 8 bit value to the stack, unless the stack is full.
+*             Success code 0 is returned after successful push, otherwise
+*             error code 1 is returned if the stack is already full.
+* 
+*             - value: 8 bit value to push to the stack.
+********************************************************************************/
+int stack_push(const uint8_t value);
+
+/********************************************************************************
+* stack_pop: Returns 8 bit value popped from the stack. If the stack is empty, 
+*            the value 0x00 is returned.
+********************************************************************************/
+uint8_t stack_pop(void);
+
+/********************************************************************************
+* stack_push_address: Pushes 16 bit program address to the stack, low byte
+*                     first. Success code 0 is returned after successful push,
+*                     otherwise error code 1 is returned if the stack is full.
+*
+*                     - address: 16 bit address to push to the stack.
+********************************************************************************/
+int stack_push_address(const uint16_t address);
+
+/********************************************************************************
+* stack_pop_address: Pops 16 bit program address from the stack. Success code
+*                    0 is returned after successful pop, otherwise error code
+*                    1 is returned if the stack holds less than two bytes.
+*
+*                    - address: Reference to variable storing the address.
+********************************************************************************/
+int stack_pop_address(uint16_t* address);
+
+/********************************************************************************
+* stack_pointer: Returns the 16 bit address of the stack pointer.
+********************************************************************************/
+uint16_t stack_pointer(void);
+
+/********************************************************************************
+* stack_last_added_value: Returns the last added value to the stack. If the
+*                         stack is empty, the value 0x00 is returned.
+********************************************************************************/
+uint8_t stack_last_added_value(void);
+
+/********************************************************************************
+* stack_is_empty: Indicates if the stack is empty, for instance to detect
+*                 stack underflow before popping.
+********************************************************************************/
+bool stack_is_empty(void);
+
 #endif /* STACK_H_ */
\ No newline at end of file
@@ -0,0 +1,521 @@
+/********************************************************************************
+* stimulus.c: Contains function definitions for reading stimulus files and
+*             applying their writes to the pin input registers while the CPU
+*             runs. Only the current line, the current ramp and the current
+*             repeat block are kept in memory.
+********************************************************************************/
+#include "stimulus.h"
+#include "cpu_context.h"
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <string.h>
+
+/* Macro definitions: */
+#define STIMULUS_LINE_SIZE   256           /* Max length of a line, including the terminator. */
+#define STIMULUS_MAX_TOKENS  6             /* Max number of tokens per line. */
+#define STIMULUS_ERROR_SIZE  128           /* Size of the error message buffer. */
+#define STIMULUS_FILE_BUFFER (1024 * 1024) /* Size of the buffer of the file stream. */
+
+/********************************************************************************
+* stimulus_line: Kinds of lines in a stimulus file.
+********************************************************************************/
+enum stimulus_line
+{
+   STIMULUS_LINE_EMPTY,     /* Empty line or comment. */
+   STIMULUS_LINE_WRITE,     /* A single write. */
+   STIMULUS_LINE_GENERATOR, /* A ramp or a repeat block, which generates writes. */
+   STIMULUS_LINE_ERROR      /* Invalid line or end of file within a repeat block. */
+};
+
+/********************************************************************************
+* stimulus: Stimulus file being read, along with the writes generated by the
+*           current ramp or repeat block, if any.
+********************************************************************************/
+struct stimulus
+{
+   FILE* file;                   /* The stimulus file. */
+   uint32_t line;                /* Number of the last line read. */
+   bool ended;                   /* Set at the end of the file or at an error. */
+   uint64_t last_cycle;          /* Cycle of the last write read, for checking the order. */
+   uint64_t cycle;               /* Number of clock cycles run through the stimulus. */
+   uint64_t num_applied;         /* Number of writes applied. */
+   bool pending;                 /* Indicates if the next write has been read but not applied. */
+   struct stimulus_event next;   /* The next write to apply. */
+
+   /* Current ramp: */
+   uint16_t ramp_left;           /* Number of writes left of the ramp. */
+   int8_t ramp_step;             /* Value added for each write (1 or -1). */
+   uint64_t ramp_interval;       /* Number of cycles between the writes. */
+   struct stimulus_event ramp;   /* The next write of the ramp. */
+
+   /* Current repeat block: */
+   uint64_t repeat_left;         /* Number of repetitions left, including the current one. */
+   uint64_t repeat_start;        /* Cycle of the current repetition. */
+   uint64_t repeat_period;       /* Number of cycles between the repetitions. */
+   uint16_t repeat_size;         /* Number of writes in the block. */
+   uint16_t repeat_index;        /* Index of the next write in the current repetition. */
+   struct stimulus_event repeat[STIMULUS_MAX_REPEAT]; /* Writes of the block, with offsets as cycles. */
+
+   char error[STIMULUS_ERROR_SIZE];  /* Error message if the file is invalid. */
+   char buffer[STIMULUS_FILE_BUFFER]; /* Buffer of the file stream, for big sequential reads. */
+};
+
+/* Static functions: */
+static size_t read_tokens(struct stimulus* self,
+                          char* line,
+                          char* tokens[]);
+static enum stimulus_line parse_line(struct stimulus* self,
+                                     struct stimulus_event* event);
+static enum stimulus_line parse_repeat(struct stimulus* self,
+                                       const uint64_t cycle,
+                                       char* tokens[],
+                                       const size_t num_tokens);
+static bool parse_register(const char* s,
+                           uint16_t* address);
+static void error(struct stimulus* self,
+                  const char* format, ...);
+
+/********************************************************************************
+* stimulus_open: Returns a new stimulus read from the file at specified path.
+*                If the file can't be opened or memory can't be allocated, a
+*                null pointer is returned.
+*
+*                - path: Path to the stimulus file.
+********************************************************************************/
+struct stimulus* stimulus_open(const char* path)
+{
+   struct stimulus* self = (struct stimulus*)malloc(sizeof(struct stimulus));
+   if (!self) return 0;
+
+   self->file = fopen(path, "r");
+
+   if (!self->file)
+   {
+      free(self);
+      return 0;
+   }
+
+   setvbuf(self->file, self->buffer, _IOFBF, STIMULUS_FILE_BUFFER);
+   self->line = 0;
+   self->ended = false;
+   self->last_cycle = 0;
+   self->cycle = 0;
+   self->num_applied = 0;
+   self->pending = false;
+   self->ramp_left = 0;
+   self->repeat_left = 0;
+   self->error[0] = '\0';
+   return self;
+}
+
+/********************************************************************************
+* stimulus_close: Closes the file of specified stimulus and deletes it. The
+*                 referenced pointer is set to null.
+*
+*                 - self: Reference to pointer to the stimulus.
+********************************************************************************/
+void stimulus_close(struct stimulus** self)
+{
+   if (!*self) return;
+   fclose((*self)->file);
+   free(*self);
+   *self = 0;
+   return;
+}
+
+/********************************************************************************
+* stimulus_next: Reads the next write of specified stimulus. Success code 0 is
+*                returned on success, otherwise error code 1 is returned at
+*                the end of the file or if the file is invalid, in which case
+*                an error message is available, see stimulus_error.
+*
+*                - self : Reference to the stimulus.
+*                - event: Reference to variable storing the write.
+********************************************************************************/
+int stimulus_next(struct stimulus* self,
+                  struct stimulus_event* event)
+{
+   while (!self->ended)
+   {
+      if (self->ramp_left)
+      {
+         *event = self->ramp;
+         self->ramp.value += self->ramp_step;
+         self->ramp.cycle += self->ramp_interval;
+         self->ramp_left--;
+      }
+      else if (self->repeat_left)
+      {
+         *event = self->repeat[self->repeat_index];
+         event->cycle += self->repeat_start;
+
+         if (++self->repeat_index == self->repeat_size)
+         {
+            self->repeat_index = 0;
+            self->repeat_start += self->repeat_period;
+            self->repeat_left--;
+         }
+      }
+      else
+      {
+         const enum stimulus_line line = parse_line(self, event);
+         if (line != STIMULUS_LINE_WRITE) continue;
+      }
+
+      if (event->cycle < self->last_cycle)
+      {
+         error(self, "Write at cycle %llu is earlier than the previous write",
+               (unsigned long long)event->cycle);
+         return 1;
+      }
+
+      self->last_cycle = event->cycle;
+      return 0;
+   }
+   return 1;
+}
+
+/********************************************************************************
+* stimulus_error: Returns the error message of specified stimulus if the file
+*                 is invalid, otherwise a null pointer.
+*
+*                 - self: Reference to the stimulus.
+********************************************************************************/
+const char* stimulus_error(const struct stimulus* self)
+{
+   return self->error[0] ? self->error : 0;
+}
+
+/********************************************************************************
+* stimulus_cycle: Returns the number of clock cycles run through specified
+*                 stimulus.
+*
+*                 - self: Reference to the stimulus.
+********************************************************************************/
+uint64_t stimulus_cycle(const struct stimulus* self)
+{
+   return self->cycle;
+}
+
+/********************************************************************************
+* stimulus_num_applied: Returns the number of writes of specified stimulus
+*                       applied so far.
+*
+*                       - self: Reference to the stimulus.
+********************************************************************************/
+uint64_t stimulus_num_applied(const struct stimulus* self)
+{
+   return self->num_applied;
+}
+
+/********************************************************************************
+* stimulus_run_ctx: Runs specified CPU context while applying the writes of
+*                   specified stimulus at their clock cycles. The run is split
+*                   into batch runs ending at the cycle of each write, see
+*                   control_unit_run_ctx, so the CPU runs at full speed
+*                   between the writes. The run continues until the limits of
+*                   the configuration have been reached or one of its stop
+*                   conditions occurs. If no limits are set, the run continues
+*                   until the last write has been applied. A later call
+*                   continues where the previous one stopped. The result of
+*                   the entire run is returned.
+*
+*                   - self    : Reference to the CPU context.
+*                   - stimulus: Reference to the stimulus.
+*                   - config  : Reference to the configuration of the run.
+********************************************************************************/
+struct control_unit_result stimulus_run_ctx(struct cpu_context* self,
+                                            struct stimulus* stimulus,
+                                            const struct control_unit_run_config* config)
+{
+   struct control_unit_result result = { CONTROL_UNIT_STOP_LIMIT_REACHED, 0, 0 };
+   const bool limited = config->max_instructions || config->max_cycles;
+   const uint64_t max_instructions = config->max_instructions ? config->max_instructions : UINT64_MAX;
+   const uint64_t max_cycles = config->max_cycles ? config->max_cycles : UINT64_MAX;
+
+   if (!stimulus->pending) stimulus->pending = !stimulus_next(stimulus, &stimulus->next);
+
+   while (true)
+   {
+      /* Applies all writes due at the current cycle. */
+      while (stimulus->pending && stimulus->next.cycle <= stimulus->cycle)
+      {
+         data_memory_write_ctx(self, stimulus->next.address, stimulus->next.value);
+         stimulus->num_applied++;
+         stimulus->pending = !stimulus_next(stimulus, &stimulus->next);
+      }
+
+      if (!limited && !stimulus->pending) return result;
+      if (result.num_instructions >= max_instructions || result.num_cycles >= max_cycles) return result;
+
+      /* Runs until the next write or the end of the run, whichever comes first. */
+      struct control_unit_run_config chunk = *config;
+      chunk.max_instructions = config->max_instructions ? max_instructions - result.num_instructions : 0;
+      chunk.max_cycles = config->max_cycles ? max_cycles - result.num_cycles : 0;
+
+      if (stimulus->pending && (!chunk.max_cycles || stimulus->next.cycle - stimulus->cycle < chunk.max_cycles))
+      {
+         chunk.max_cycles = stimulus->next.cycle - stimulus->cycle;
+      }
+
+      const struct control_unit_result run = control_unit_run_ctx(self, &chunk);
+      result.num_instructions += run.num_instructions;
+      result.num_cycles += run.num_cycles;
+      stimulus->cycle += run.num_cycles;
+
+      if (run.stop_reason != CONTROL_UNIT_STOP_LIMIT_REACHED)
+      {
+         result.stop_reason = run.stop_reason;
+         return result;
+      }
+   }
+}
+
+/********************************************************************************
+* stimulus_detect: Indicates if the file at specified path is a stimulus file,
+*                  i.e. if its first line that isn't empty or a comment
+*                  starts with a timestamp.
+*
+*                  - path: Path to the file.
+********************************************************************************/
+bool stimulus_detect(const char* path)
+{
+   char line[STIMULUS_LINE_SIZE];
+   FILE* file = fopen(path, "r");
+   bool detected = false;
+   if (!file) return false;
+
+   while (fgets(line, sizeof(line), file))
+   {
+      const char* s = line;
+      while (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n') s++;
+      if (!*s || *s == '#') continue;
+      detected = isdigit((unsigned char)*s);
+      break;
+   }
+
+   fclose(file);
+   return detected;
+}
+
+/********************************************************************************
+* stimulus_run: Runs the default CPU context while applying the writes of
+*               specified stimulus, see stimulus_run_ctx.
+*
+*               - stimulus: Reference to the stimulus.
+*               - config  : Reference to the configuration of the run.
+********************************************************************************/
+struct control_unit_result stimulus_run(struct stimulus* stimulus,
+                                        const struct control_unit_run_config* config)
+{
+   return stimulus_run_ctx(cpu_context_default(), stimulus, config);
+}
+
+/********************************************************************************
+* read_tokens: Reads the next line of specified stimulus into the line buffer
+*              and splits it into whitespace separated tokens, leaving out
+*              comments. The number of tokens is returned. At the end of the
+*              file, the stimulus is marked as ended and 0 is returned.
+*
+*              - line  : Buffer of STIMULUS_LINE_SIZE bytes for the line.
+*              - tokens: Array of STIMULUS_MAX_TOKENS pointers to the tokens.
+********************************************************************************/
+static size_t read_tokens(struct stimulus* self,
+                          char* line,
+                          char* tokens[])
+{
+   size_t num_tokens = 0;
+
+   if (!fgets(line, STIMULUS_LINE_SIZE, self->file))
+   {
+      self->ended = true;
+      return 0;
+   }
+
+   self->line++;
+   char* comment = strchr(line, '#');
+   if (comment) *comment = '\0';
+
+   for (char* s = strtok(line, " \t\r\n"); s; s = strtok(0, " \t\r\n"))
+   {
+      if (num_tokens == STIMULUS_MAX_TOKENS)
+      {
+         error(self, "Too many fields");
+         return 0;
+      }
+      tokens[num_tokens++] = s;
+   }
+   return num_tokens;
+}
+
+/********************************************************************************
+* parse_line: Reads and parses the next line of specified stimulus. For a
+*             single write, the write is stored in referenced event. For a
+*             ramp or a repeat block, the generator is set up, so that the
+*             writes are returned by the following calls to stimulus_next.
+*             The kind of line is returned.
+*
+*             - event: Reference to variable storing a single write.
+********************************************************************************/
+static enum stimulus_line parse_line(struct stimulus* self,
+                                     struct stimulus_event* event)
+{
+   char line[STIMULUS_LINE_SIZE];
+   char* tokens[STIMULUS_MAX_TOKENS];
+   const size_t num_tokens = read_tokens(self, line, tokens);
+   uint64_t cycle, first, last, interval;
+   if (num_tokens == 0) return self->ended ? STIMULUS_LINE_ERROR : STIMULUS_LINE_EMPTY;
+
+   if (!parse_number(tokens[0], UINT64_MAX, &cycle))
+   {
+      error(self, "Invalid timestamp %s", tokens[0]);
+      return STIMULUS_LINE_ERROR;
+   }
+
+   if (num_tokens >= 2 && names_equal(tokens[1], "repeat"))
+   {
+      return parse_repeat(self, cycle, tokens, num_tokens);
+   }
+   else if (num_tokens >= 2 && names_equal(tokens[1], "ramp"))
+   {
+      if (num_tokens != 6 || !parse_register(tokens[2], &self->ramp.address) ||
+          !parse_number(tokens[3], UINT8_MAX, &first) || !parse_number(tokens[4], UINT8_MAX, &last) ||
+          !parse_number(tokens[5], UINT64_MAX, &interval))
+      {
+         error(self, "Expected <cycle> ramp <register> <first> <last> <interval>");
+         return STIMULUS_LINE_ERROR;
+      }
+
+      self->ramp.cycle = cycle;
+      self->ramp.value = (uint8_t)first;
+      self->ramp_step = last >= first ? 1 : -1;
+      self->ramp_interval = interval;
+      self->ramp_left = (uint16_t)(last >= first ? last - first + 1 : first - last + 1);
+      return STIMULUS_LINE_GENERATOR;
+   }
+   else
+   {
+      if (num_tokens != 3 || !parse_register(tokens[1], &event->address) ||
+          !parse_number(tokens[2], UINT8_MAX, &first))
+      {
+         error(self, "Expected <cycle> <register> <value>");
+         return STIMULUS_LINE_ERROR;
+      }
+
+      event->cycle = cycle;
+      event->value = (uint8_t)first;
+      return STIMULUS_LINE_WRITE;
+   }
+}
+
+/********************************************************************************
+* parse_repeat: Parses a repeat line of specified stimulus along with the
+*               writes of the block up to the end line, and sets up the
+*               repetitions. The kind of line is returned.
+*
+*               - cycle     : Cycle of the first repetition.
+*               - tokens    : Tokens of the repeat line.
+*               - num_tokens: Number of tokens of the repeat line.
+********************************************************************************/
+static enum stimulus_line parse_repeat(struct stimulus* self,
+                                       const uint64_t cycle,
+                                       char* tokens[],
+                                       const size_t num_tokens)
+{
+   uint64_t count, period, offset, value;
+   uint16_t size = 0;
+
+   if (num_tokens != 4 || !parse_number(tokens[2], UINT64_MAX, &count) ||
+       !parse_number(tokens[3], UINT64_MAX, &period))
+   {
+      error(self, "Expected <cycle> repeat <count> <period>");
+      return STIMULUS_LINE_ERROR;
+   }
+
+   while (true)
+   {
+      char line[STIMULUS_LINE_SIZE];
+      char* block[STIMULUS_MAX_TOKENS];
+      const size_t num_block_tokens = read_tokens(self, line, block);
+
+      if (num_block_tokens == 0)
+      {
+         if (self->ended) error(self, "Missing end of repeat block");
+         if (self->ended) return STIMULUS_LINE_ERROR;
+         continue;
+      }
+
+      if (num_block_tokens == 1 && names_equal(block[0], "end")) break;
+
+      if (size == STIMULUS_MAX_REPEAT)
+      {
+         error(self, "More than %d writes in repeat block", STIMULUS_MAX_REPEAT);
+         return STIMULUS_LINE_ERROR;
+      }
+
+      struct stimulus_event* event = &self->repeat[size];
+
+      if (num_block_tokens != 3 || !parse_number(block[0], UINT64_MAX, &offset) ||
+          !parse_register(block[1], &event->address) || !parse_number(block[2], UINT8_MAX, &value))
+      {
+         error(self, "Expected <offset> <register> <value> or end");
+         return STIMULUS_LINE_ERROR;
+      }
+
+      if ((size && offset < self->repeat[size - 1].cycle) || (count > 1 && offset >= period))
+      {
+         error(self, "Offsets must be in order and lower than the period");
+         return STIMULUS_LINE_ERROR;
+      }
+
+      event->cycle = offset;
+      event->value = (uint8_t)value;
+      size++;
+   }
+
+   self->repeat_size = size;
+   self->repeat_index = 0;
+   self->repeat_start = cycle;
+   self->repeat_period = period;
+   self->repeat_left = size ? count : 0;
+   return STIMULUS_LINE_GENERATOR;
+}
+
+/********************************************************************************
+* parse_register: Parses the name of a pin input register (PINB, PINC or PIND).
+*                 True is returned if the name is valid.
+*
+*                 - s      : The name to parse.
+*                 - address: Reference to variable storing the address.
+********************************************************************************/
+static bool parse_register(const char* s,
+                           uint16_t* address)
+{
+   if (names_equal(s, "PINB"))      *address = PINB;
+   else if (names_equal(s, "PINC")) *address = PINC;
+   else if (names_equal(s, "PIND")) *address = PIND;
+   else                             return false;
+   return true;
+}
+
+/********************************************************************************
+* error: Stores an error message prefixed by the current line number and ends
+*        the stimulus. Only the first error is stored.
+*
+*        - self  : Reference to the stimulus.
+*        - format: Format string of the message, followed by its arguments.
+********************************************************************************/
+static void error(struct stimulus* self,
+                  const char* format, ...)
+{
+   self->ended = true;
+   if (self->error[0]) return;
+
+   const int length = snprintf(self->error, STIMULUS_ERROR_SIZE, "Line %u: ", self->line);
+   va_list args;
+   va_start(args, format);
+   vsnprintf(self->error + length, STIMULUS_ERROR_SIZE - length, format, args);
+   va_end(args);
+   return;
+}
@@ -0,0 +1,147 @@
+/********************************************************************************
+* stimulus.h: Contains function declarations and macro definitions for
+*             driving the pin input registers PINB, PINC and PIND from a
+*             stimulus file while the CPU runs without keyboard input.
+*
+*             A stimulus file is a text file with one timestamped write per
+*             line. The timestamp is the number of clock cycles since the
+*             start of the stimulus, followed by the PIN register and the
+*             value to write, for instance "1000 PINB 0x20". Numbers are
+*             written in decimal, hexadecimal (0x) or binary (0b) form and
+*             text after # is ignored. The writes must be listed in order of
+*             time. Two primitives generate sequences of writes:
+*
+*             - <cycle> ramp <register> <first> <last> <interval>
+*               Writes the values from first to last, counting up or down
+*               by one, starting at the cycle with interval cycles between
+*               the writes.
+*
+*             - <cycle> repeat <count> <period>
+*                  <offset> <register> <value>
+*                  ...
+*               end
+*               Repeats the enclosed writes count times, starting at the
+*               cycle with period cycles between the repetitions. The
+*               offsets are relative to the start of each repetition and
+*               must be lower than the period.
+*
+*             The file is read line by line while the CPU runs, so its size
+*             isn't limited by the available memory. Each write is applied
+*             at the exact clock cycle given by its timestamp.
+********************************************************************************/
+#ifndef STIMULUS_H_
+#define STIMULUS_H_
+
+/* Include directives: */
+#include "cpu.h"
+#include "control_unit.h"
+
+/* Macro definitions: */
+#define STIMULUS_MAX_REPEAT 256 /* Max number of writes in a repeat block. */
+
+/* Forward declarations: */
+struct stimulus;
+
+/********************************************************************************
+* stimulus_event: A write to a pin input register at a specific clock cycle.
+********************************************************************************/
+struct stimulus_event
+{
+   uint64_t cycle;   /* Clock cycle of the write, counted from the start of the stimulus. */
+   uint16_t address; /* Address of the written register, i.e. PINB, PINC or PIND. */
+   uint8_t value;    /* The value to write. */
+};
+
+/********************************************************************************
+* stimulus_open: Returns a new stimulus read from the file at specified path.
+*                If the file can't be opened or memory can't be allocated, a
+*                null pointer is returned.
+*
+*                - path: Path to the stimulus file.
+********************************************************************************/
+struct stimulus* stimulus_open(const char* path);
+
+/********************************************************************************
+* stimulus_close: Closes the file of specified stimulus and deletes it. The
+*                 referenced pointer is set to null.
+*
+*                 - self: Reference to pointer to the stimulus.
+********************************************************************************/
+void stimulus_close(struct stimulus** self);
+
+/********************************************************************************
+* stimulus_next: Reads the next write of specified stimulus. Success code 0 is
+*                returned on success, otherwise error code 1 is returned at
+*                the end of the file or if the file is invalid, in which case
+*                an error message is available, see stimulus_error.
+*
+*                - self : Reference to the stimulus.
+*                - event: Reference to variable storing the write.
+********************************************************************************/
+int stimulus_next(struct stimulus* self,
+                  struct stimulus_event* event);
+
+/********************************************************************************
+* stimulus_error: Returns the error message of specified stimulus if the file
+*                 is invalid, otherwise a null pointer.
+*
+*                 - self: Reference to the stimulus.
+********************************************************************************/
+const char* stimulus_error(const struct stimulus* self);
+
+/********************************************************************************
+* stimulus_cycle: Returns the number of clock cycles run through specified
+*                 stimulus.
+*
+*                 - self: Reference to the stimulus.
+********************************************************************************/
+uint64_t stimulus_cycle(const struct stimulus* self);
+
+/********************************************************************************
+* stimulus_num_applied: Returns the number of writes of specified stimulus
+*                       applied so far.
+*
+*                       - self: Reference to the stimulus.
+********************************************************************************/
+uint64_t stimulus_num_applied(const struct stimulus* self);
+
+/********************************************************************************
+* stimulus_run_ctx: Runs specified CPU context while applying the writes of
+*                   specified stimulus at their clock cycles. The run is split
+*                   into batch runs ending at the cycle of each write, see
+*                   control_unit_run_ctx, so the CPU runs at full speed
+*                   between the writes. The run continues until the limits of
+*                   the configuration have been reached or one of its stop
+*                   conditions occurs. If no limits are set, the run continues
+*                   until the last write has been applied. A later call
+*                   continues where the previous one stopped. The result of
+*                   the entire run is returned.
+*
+*                   - self    : Reference to the CPU context.
+*                   - stimulus: Reference to the stimulus.
+*                   - config  : Reference to the configuration of the run.
+********************************************************************************/
+struct control_unit_result stimulus_run_ctx(struct cpu_context* self,
+                                            struct stimulus* stimulus,
+                                            const struct control_unit_run_config* config);
+
+/********************************************************************************
+* stimulus_detect: Indicates if the file at specified path is a stimulus file,
+*                  i.e. if its first line that isn't empty or a comment
+*                  starts with a timestamp.
+*
+*                  - path: Path to the file.
+********************************************************************************/
+bool stimulus_detect(const char* path);
+
+/********************************************************************************
+* stimulus_run: Runs the default CPU context while applying the writes of
+*               specified stimulus, see stimulus_run_ctx.
+*
+*               - stimulus: Reference to the stimulus.
+*               - config  : Reference to the configuration of the run.
+********************************************************************************/
+struct control_unit_result stimulus_run(struct stimulus* stimulus,
+                                        const struct control_unit_run_config* config);
+
+#endif /* STIMULUS_H_ */
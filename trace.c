@@ -0,0 +1,613 @@
+/********************************************************************************
+* trace.c: Contains function definitions for writing and dumping binary
+*          execution traces. The ring buffer has a single producer (the
+*          emulator) and a single consumer (the writer), so the head and tail
+*          indexes are the only shared state.
+********************************************************************************/
+#if defined(__unix__) || defined(__APPLE__)
+/* Included before cpu.h, since the POSIX headers use names cpu.h defines as macros. */
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#endif
+
+#include "trace.h"
+#include "cpu_context.h"
+
+#include <string.h>
+
+/* Macro definitions: */
+#define TRACE_RING_SIZE   65536         /* Capacity of the ring buffer in records (power of 2). */
+#define TRACE_BUFFER_SIZE (1024 * 1024) /* Size of the encoding buffer in bytes. */
+#define TRACE_MAX_ENCODED 16            /* Max size of an encoded record in bytes. */
+#define TRACE_HEADER_SIZE 8             /* Magic number, version and reserved bytes. */
+#define TRACE_NO_IR       0xFFFFFFFF    /* Indicates that no instruction has been seen at an address. */
+#define TRACE_IDLE_NS     100000        /* Time the writer sleeps when the ring buffer is empty. */
+
+#define TRACE_ENCODED_PC        0x01 /* The address of the instruction follows (2 bytes). */
+#define TRACE_ENCODED_IR        0x02 /* The instruction follows (3 bytes). */
+#define TRACE_ENCODED_REGISTER  0x04 /* The written register and its value follow. */
+#define TRACE_ENCODED_MEMORY    0x08 /* The address delta and value of a memory write follow. */
+#define TRACE_ENCODED_SR        0x10 /* The status register follows. */
+#define TRACE_ENCODED_INTERRUPT 0x80 /* The vector and interrupted address (2 bytes) follow. */
+
+#if TRACE_WRITER_THREAD
+typedef atomic_size_t trace_index;
+#else
+typedef size_t trace_index;
+#endif
+
+/********************************************************************************
+* trace_codec: State shared by the encoder and the decoder, used to predict
+*              fields that are left out of the encoded records.
+********************************************************************************/
+struct trace_codec
+{
+   uint16_t next_pc;                                /* Predicted address of the next record. */
+   uint8_t sr;                                      /* Status register of the previous record. */
+   uint16_t address;                                /* Address of the previous memory write. */
+   uint32_t last_ir[PROGRAM_MEMORY_ADDRESS_WIDTH];  /* Last instruction seen at each address. */
+};
+
+/********************************************************************************
+* trace: Execution trace written to a file.
+********************************************************************************/
+struct trace
+{
+   /* Emulator side: */
+   trace_index head;                          /* Number of records added. */
+   size_t tail_cached;                        /* Last tail seen by the emulator. */
+   struct trace_record ring[TRACE_RING_SIZE]; /* Ring buffer of unencoded records. */
+
+   /* Writer side, kept apart from the head so that they don't share a cache line: */
+   trace_index tail;                          /* Number of records encoded. */
+   struct trace_codec codec;                  /* Encoder state. */
+   FILE* file;                                /* The trace file. */
+   bool error;                                /* Indicates if a write has failed. */
+   size_t buffer_used;                        /* Number of bytes in the encoding buffer. */
+   uint8_t buffer[TRACE_BUFFER_SIZE];         /* Encoding buffer, written to the file when full. */
+#if TRACE_WRITER_THREAD
+   pthread_t writer;                          /* Thread draining the ring buffer. */
+   atomic_bool stopping;                      /* Set when no more records will be added. */
+#endif
+};
+
+/* Static functions: */
+static inline size_t load_index(const trace_index* index);
+static inline void store_index(trace_index* index,
+                               const size_t value);
+static void drain(struct trace* self);
+static void encode(struct trace* self,
+                   const struct trace_record* record);
+static void flush_buffer(struct trace* self);
+static void codec_reset(struct trace_codec* self);
+static uint8_t* put_varint(uint8_t* destination,
+                           uint32_t value);
+static bool get_varint(FILE* file,
+                       uint32_t* value);
+#if TRACE_WRITER_THREAD
+static void* writer_main(void* arg);
+#endif
+
+/********************************************************************************
+* trace_open: Returns a new trace written to the file at specified path. If
+*             the file can't be created or memory can't be allocated, a null
+*             pointer is returned.
+*
+*             - path: Path to the trace file.
+********************************************************************************/
+struct trace* trace_open(const char* path)
+{
+   struct trace* self = (struct trace*)malloc(sizeof(struct trace));
+   const uint8_t header[TRACE_HEADER_SIZE] = { 'E', '2', '2', 'T', TRACE_VERSION, 0, 0, 0 };
+   if (!self) return 0;
+
+   self->file = fopen(path, "wb");
+
+   if (!self->file || fwrite(header, 1, sizeof(header), self->file) != sizeof(header))
+   {
+      if (self->file) fclose(self->file);
+      free(self);
+      return 0;
+   }
+
+   self->error = false;
+   store_index(&self->head, 0);
+   store_index(&self->tail, 0);
+   self->tail_cached = 0;
+   self->buffer_used = 0;
+   codec_reset(&self->codec);
+
+#if TRACE_WRITER_THREAD
+   atomic_init(&self->stopping, false);
+
+   if (pthread_create(&self->writer, 0, writer_main, self))
+   {
+      fclose(self->file);
+      free(self);
+      return 0;
+   }
+#endif
+   return self;
+}
+
+/********************************************************************************
+* trace_close: Writes all remaining records of specified trace, closes the
+*              file and deletes the trace. The referenced pointer is set to
+*              null. Success code 0 is returned if the entire trace was
+*              written, otherwise error code 1 is returned.
+*
+*              - self: Reference to pointer to the trace.
+********************************************************************************/
+int trace_close(struct trace** self)
+{
+   struct trace* trace = *self;
+   if (!trace) return 0;
+
+#if TRACE_WRITER_THREAD
+   atomic_store_explicit(&trace->stopping, true, memory_order_release);
+   pthread_join(trace->writer, 0);
+#else
+   drain(trace);
+   flush_buffer(trace);
+#endif
+
+   if (fclose(trace->file)) trace->error = true;
+   const int result = trace->error ? 1 : 0;
+   free(trace);
+   *self = 0;
+   return result;
+}
+
+/********************************************************************************
+* trace_write: Adds referenced record to the ring buffer of specified trace.
+*              If the ring buffer is full, the call waits until there is room,
+*              so no records are lost.
+*
+*              - self  : Reference to the trace.
+*              - record: Reference to the record.
+********************************************************************************/
+void trace_write(struct trace* self,
+                 const struct trace_record* record)
+{
+#if TRACE_WRITER_THREAD
+   const size_t head = atomic_load_explicit(&self->head, memory_order_relaxed);
+
+   while (head - self->tail_cached == TRACE_RING_SIZE)
+   {
+      self->tail_cached = load_index(&self->tail);
+      if (head - self->tail_cached == TRACE_RING_SIZE) sched_yield();
+   }
+#else
+   const size_t head = self->head;
+   if (head - self->tail == TRACE_RING_SIZE) drain(self);
+#endif
+
+   self->ring[head & (TRACE_RING_SIZE - 1)] = *record;
+   store_index(&self->head, head + 1);
+   return;
+}
+
+/********************************************************************************
+* trace_enable_ctx: Starts or stops tracing of specified CPU context. When
+*                   started, a new trace is written to the file at specified
+*                   path, replacing any running trace. While tracing, batch
+*                   runs are interpreted instruction by instruction, also
+*                   when JIT compilation is enabled. Success code 0 is
+*                   returned on success, otherwise error code 1 is returned.
+*
+*                   - self   : Reference to the CPU context.
+*                   - enabled: Indicates if tracing is enabled.
+*                   - path   : Path to the trace file (ignored when stopping).
+********************************************************************************/
+int trace_enable_ctx(struct cpu_context* self,
+                     const bool enabled,
+                     const char* path)
+{
+   int result = trace_close(&self->trace);
+   if (!enabled) return result;
+   self->trace = trace_open(path);
+   return self->trace ? result : 1;
+}
+
+/********************************************************************************
+* trace_detect: Indicates if the file at specified path starts with the magic
+*               number of a trace.
+*
+*               - path: Path to the file.
+********************************************************************************/
+bool trace_detect(const char* path)
+{
+   char magic[4] = { '\0' };
+   FILE* file = fopen(path, "rb");
+   if (!file) return false;
+   const bool detected = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+                         !memcmp(magic, TRACE_MAGIC, sizeof(magic));
+   fclose(file);
+   return detected;
+}
+
+/********************************************************************************
+* trace_dump: Decodes the trace file at specified path and prints one line of
+*             text per record. Success code 0 is returned on success,
+*             otherwise error code 1 is returned if the file can't be read or
+*             isn't a valid trace.
+*
+*             - path   : Path to the trace file.
+*             - ostream: Reference to the output stream.
+********************************************************************************/
+int trace_dump(const char* path,
+               FILE* ostream)
+{
+   FILE* file = fopen(path, "rb");
+   uint8_t header[TRACE_HEADER_SIZE];
+   struct trace_codec* codec = (struct trace_codec*)malloc(sizeof(struct trace_codec));
+   uint64_t num_instructions = 0;
+   int result = 0;
+   int kind = 0;
+
+   if (!file || !codec || fread(header, 1, sizeof(header), file) != sizeof(header) ||
+       memcmp(header, TRACE_MAGIC, 4) || header[4] != TRACE_VERSION)
+   {
+      if (file) fclose(file);
+      free(codec);
+      return 1;
+   }
+
+   codec_reset(codec);
+
+   while ((kind = fgetc(file)) != EOF)
+   {
+      uint8_t fields[5] = { 0 };
+      uint32_t delta = 0;
+
+      if (kind & TRACE_ENCODED_INTERRUPT)
+      {
+         if (fread(fields, 1, 3, file) != 3)
+         {
+            result = 1;
+            break;
+         }
+
+         fprintf(ostream, "%10llu  %04X  IRQ   -> %02X\n", (unsigned long long)num_instructions,
+                 fields[1] | (fields[2] << 8), fields[0]);
+         codec->next_pc = fields[0];
+         continue;
+      }
+
+      uint16_t pc = codec->next_pc;
+
+      if (kind & TRACE_ENCODED_PC)
+      {
+         if (fread(fields, 1, 2, file) != 2)
+         {
+            result = 1;
+            break;
+         }
+         pc = fields[0] | (fields[1] << 8);
+      }
+
+      if (kind & TRACE_ENCODED_IR)
+      {
+         if (fread(fields, 1, 3, file) != 3)
+         {
+            result = 1;
+            break;
+         }
+         codec->last_ir[pc] = ((uint32_t)fields[0] << 16) | ((uint32_t)fields[1] << 8) | fields[2];
+      }
+
+      if ((kind & TRACE_ENCODED_SR) && fread(&codec->sr, 1, 1, file) != 1)
+      {
+         result = 1;
+         break;
+      }
+
+      if (codec->last_ir[pc] == TRACE_NO_IR)
+      {
+         result = 1;
+         break;
+      }
+
+      const uint32_t ir = codec->last_ir[pc];
+      fprintf(ostream, "%10llu  %04X  %06X  %-5s SR=%02X", (unsigned long long)num_instructions++,
+              pc, (unsigned)ir, cpu_instruction_name((uint8_t)(ir >> 16)), codec->sr);
+
+      if (kind & TRACE_ENCODED_REGISTER)
+      {
+         if (fread(fields, 1, 2, file) != 2)
+         {
+            result = 1;
+            break;
+         }
+         fprintf(ostream, "  R%u=%02X", fields[0], fields[1]);
+      }
+
+      if (kind & TRACE_ENCODED_MEMORY)
+      {
+         if (!get_varint(file, &delta) || fread(fields, 1, 1, file) != 1)
+         {
+            result = 1;
+            break;
+         }
+
+         codec->address += (uint16_t)((delta >> 1) ^ -(int32_t)(delta & 1));
+         fprintf(ostream, "  [%04X]=%02X", codec->address, fields[0]);
+      }
+
+      fprintf(ostream, "\n");
+      codec->next_pc = pc + 1;
+   }
+
+   fclose(file);
+   free(codec);
+   return result;
+}
+
+/********************************************************************************
+* trace_enable: Starts or stops tracing of the default CPU context, see
+*               trace_enable_ctx.
+*
+*               - enabled: Indicates if tracing is enabled.
+*               - path   : Path to the trace file (ignored when stopping).
+********************************************************************************/
+int trace_enable(const bool enabled,
+                 const char* path)
+{
+   return trace_enable_ctx(cpu_context_default(), enabled, path);
+}
+
+/********************************************************************************
+* trace_enabled: Indicates if tracing is enabled for the default CPU context.
+********************************************************************************/
+bool trace_enabled(void)
+{
+   return cpu_context_default()->trace != 0;
+}
+
+/********************************************************************************
+* load_index: Returns the value of referenced ring buffer index. With a writer
+*             thread, the load synchronizes with the store of the other side,
+*             so that the records it refers to are visible.
+*
+*             - index: Reference to the index.
+********************************************************************************/
+static inline size_t load_index(const trace_index* index)
+{
+#if TRACE_WRITER_THREAD
+   return atomic_load_explicit((trace_index*)index, memory_order_acquire);
+#else
+   return *index;
+#endif
+}
+
+/********************************************************************************
+* store_index: Sets referenced ring buffer index, publishing the records
+*              written before to the other side.
+*
+*              - index: Reference to the index.
+*              - value: The new value of the index.
+********************************************************************************/
+static inline void store_index(trace_index* index,
+                               const size_t value)
+{
+#if TRACE_WRITER_THREAD
+   atomic_store_explicit(index, value, memory_order_release);
+#else
+   *index = value;
+#endif
+   return;
+}
+
+/********************************************************************************
+* drain: Encodes all records currently in the ring buffer and frees their
+*        slots.
+*
+*        - self: Reference to the trace.
+********************************************************************************/
+static void drain(struct trace* self)
+{
+   const size_t head = load_index(&self->head);
+   size_t tail = load_index(&self->tail);
+
+   while (tail != head)
+   {
+      encode(self, &self->ring[tail & (TRACE_RING_SIZE - 1)]);
+      tail++;
+
+      if (!(tail & 4095)) store_index(&self->tail, tail); /* Frees slots while encoding. */
+   }
+
+   store_index(&self->tail, tail);
+   return;
+}
+
+/********************************************************************************
+* encode: Delta encodes referenced record into the encoding buffer, which is
+*         written to the file first if it might not have room for the record.
+*
+*         - self  : Reference to the trace.
+*         - record: Reference to the record.
+********************************************************************************/
+static void encode(struct trace* self,
+                   const struct trace_record* record)
+{
+   struct trace_codec* codec = &self->codec;
+   if (self->buffer_used > TRACE_BUFFER_SIZE - TRACE_MAX_ENCODED) flush_buffer(self);
+
+   uint8_t* start = self->buffer + self->buffer_used;
+   uint8_t* destination = start + 1;
+   uint8_t kind = 0;
+
+   if (record->flags & TRACE_RECORD_INTERRUPT)
+   {
+      *start = TRACE_ENCODED_INTERRUPT;
+      *destination++ = (uint8_t)record->ir;
+      *destination++ = (uint8_t)record->pc;
+      *destination++ = (uint8_t)(record->pc >> 8);
+      codec->next_pc = (uint8_t)record->ir;
+      self->buffer_used += destination - start;
+      return;
+   }
+
+   if (record->pc != codec->next_pc)
+   {
+      kind |= TRACE_ENCODED_PC;
+      *destination++ = (uint8_t)record->pc;
+      *destination++ = (uint8_t)(record->pc >> 8);
+   }
+
+   if (record->ir != codec->last_ir[record->pc])
+   {
+      kind |= TRACE_ENCODED_IR;
+      *destination++ = (uint8_t)(record->ir >> 16);
+      *destination++ = (uint8_t)(record->ir >> 8);
+      *destination++ = (uint8_t)(record->ir);
+      codec->last_ir[record->pc] = record->ir;
+   }
+
+   if (record->sr != codec->sr)
+   {
+      kind |= TRACE_ENCODED_SR;
+      *destination++ = record->sr;
+      codec->sr = record->sr;
+   }
+
+   if (record->flags & TRACE_RECORD_REGISTER)
+   {
+      kind |= TRACE_ENCODED_REGISTER;
+      *destination++ = record->reg;
+      *destination++ = record->reg_value;
+   }
+
+   if (record->flags & TRACE_RECORD_MEMORY)
+   {
+      const int32_t delta = (int16_t)(record->address - codec->address);
+      kind |= TRACE_ENCODED_MEMORY;
+      destination = put_varint(destination, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+      *destination++ = record->value;
+      codec->address = record->address;
+   }
+
+   *start = kind;
+   codec->next_pc = record->pc + 1;
+   self->buffer_used += destination - start;
+   return;
+}
+
+/********************************************************************************
+* flush_buffer: Writes the content of the encoding buffer to the trace file.
+*
+*               - self: Reference to the trace.
+********************************************************************************/
+static void flush_buffer(struct trace* self)
+{
+   if (self->buffer_used && fwrite(self->buffer, 1, self->buffer_used, self->file) != self->buffer_used)
+   {
+      self->error = true;
+   }
+
+   self->buffer_used = 0;
+   return;
+}
+
+/********************************************************************************
+* codec_reset: Sets referenced codec state to the state at the start of a
+*              trace.
+*
+*              - self: Reference to the codec state.
+********************************************************************************/
+static void codec_reset(struct trace_codec* self)
+{
+   self->next_pc = 0;
+   self->sr = 0;
+   self->address = 0;
+
+   for (uint32_t i = 0; i < PROGRAM_MEMORY_ADDRESS_WIDTH; ++i)
+   {
+      self->last_ir[i] = TRACE_NO_IR;
+   }
+   return;
+}
+
+/********************************************************************************
+* put_varint: Writes specified value with 7 bits per byte, least significant
+*             bits first, where the highest bit is set in all bytes but the
+*             last. A pointer to the byte after the value is returned.
+*
+*             - destination: Reference to the destination.
+*             - value      : The value to write.
+********************************************************************************/
+static uint8_t* put_varint(uint8_t* destination,
+                           uint32_t value)
+{
+   while (value >= 0x80)
+   {
+      *destination++ = (uint8_t)(value | 0x80);
+      value >>= 7;
+   }
+
+   *destination++ = (uint8_t)value;
+   return destination;
+}
+
+/********************************************************************************
+* get_varint: Reads a value written by put_varint from specified file. False
+*             is returned if the file ends before the value.
+*
+*             - file : Reference to the file.
+*             - value: Reference to variable storing the value.
+********************************************************************************/
+static bool get_varint(FILE* file,
+                       uint32_t* value)
+{
+   *value = 0;
+
+   for (uint8_t shift = 0; shift < 32; shift += 7)
+   {
+      const int byte = fgetc(file);
+      if (byte == EOF) return false;
+      *value |= (uint32_t)(byte & 0x7F) << shift;
+      if (!(byte & 0x80)) return true;
+   }
+   return false;
+}
+
+#if TRACE_WRITER_THREAD
+/********************************************************************************
+* writer_main: Entry point of the writer thread, which drains the ring buffer
+*              until the trace is closed and all records have been encoded.
+*              The encoding buffer is written to the file whenever full and
+*              once more at the end.
+*
+*              - arg: Reference to the trace.
+********************************************************************************/
+static void* writer_main(void* arg)
+{
+   struct trace* self = (struct trace*)arg;
+
+   while (1)
+   {
+      const bool stopping = atomic_load_explicit(&self->stopping, memory_order_acquire);
+
+      if (load_index(&self->head) != load_index(&self->tail))
+      {
+         drain(self);
+      }
+      else if (stopping)
+      {
+         break;
+      }
+      else
+      {
+         const struct timespec idle = { 0, TRACE_IDLE_NS };
+         nanosleep(&idle, 0);
+      }
+   }
+
+   flush_buffer(self);
+   return 0;
+}
+#endif /* TRACE_WRITER_THREAD */
@@ -0,0 +1,143 @@
+/********************************************************************************
+* trace.h: Contains function declarations and macro definitions for a binary
+*          execution trace, holding one record per executed instruction and
+*          per taken interrupt.
+*
+*          Records are added to an in-memory ring buffer without locking and
+*          drained by a writer thread, which delta encodes them into a large
+*          buffer that is written to the trace file in big sequential writes.
+*          On systems without POSIX threads, the ring buffer is drained by
+*          the emulator itself whenever it's full.
+*
+*          Each encoded record starts with a byte indicating which fields
+*          follow. Fields equal to what the decoder can predict are left out,
+*          i.e. the address when the previous instruction fell through, the
+*          instruction when it's the same as last time at that address and
+*          the status register when unchanged. The address of memory writes
+*          is stored as the difference from the previous write. A typical
+*          record is 1 - 3 bytes. The file is turned back into text by
+*          trace_dump.
+********************************************************************************/
+#ifndef TRACE_H_
+#define TRACE_H_
+
+/* Include directives: */
+#include "cpu.h"
+
+/* Macro definitions: */
+#define TRACE_MAGIC   "E22T" /* Identifies a trace file. */
+#define TRACE_VERSION 2      /* Current version of the trace format (16-bit addresses). */
+
+#define TRACE_RECORD_INSTRUCTION 0x00 /* The record holds an executed instruction. */
+#define TRACE_RECORD_REGISTER    0x01 /* A CPU register was written by the instruction. */
+#define TRACE_RECORD_MEMORY      0x02 /* Data memory was written by the instruction. */
+#define TRACE_RECORD_INTERRUPT   0x80 /* The record holds a taken interrupt. */
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TRACE_WRITER_THREAD 1 /* The ring buffer is drained by a POSIX writer thread. */
+#else
+#define TRACE_WRITER_THREAD 0 /* The ring buffer is drained by the emulator when full. */
+#endif
+
+/* Forward declarations: */
+struct cpu_context;
+struct trace;
+
+/********************************************************************************
+* trace_record: Unencoded record of an executed instruction or a taken
+*               interrupt, as stored in the ring buffer.
+********************************************************************************/
+struct trace_record
+{
+   uint32_t ir;       /* The executed instruction, or the vector of an interrupt. */
+   uint16_t address;  /* Data memory address written by the instruction, if any. */
+   uint16_t pc;       /* Address of the instruction, or of the interrupted instruction. */
+   uint8_t sr;        /* Status register after the instruction. */
+   uint8_t reg;       /* CPU register written by the instruction, if any. */
+   uint8_t reg_value; /* Value written to the CPU register. */
+   uint8_t value;     /* Value written to data memory. */
+   uint8_t flags;     /* Kind of record and fields used, see TRACE_RECORD_*. */
+};
+
+/********************************************************************************
+* trace_open: Returns a new trace written to the file at specified path. If
+*             the file can't be created or memory can't be allocated, a null
+*             pointer is returned.
+*
+*             - path: Path to the trace file.
+********************************************************************************/
+struct trace* trace_open(const char* path);
+
+/********************************************************************************
+* trace_close: Writes all remaining records of specified trace, closes the
+*              file and deletes the trace. The referenced pointer is set to
+*              null. Success code 0 is returned if the entire trace was
+*              written, otherwise error code 1 is returned.
+*
+*              - self: Reference to pointer to the trace.
+********************************************************************************/
+int trace_close(struct trace** self);
+
+/********************************************************************************
+* trace_write: Adds referenced record to the ring buffer of specified trace.
+*              If the ring buffer is full, the call waits until there is room,
+*              so no records are lost.
+*
+*              - self  : Reference to the trace.
+*              - record: Reference to the record.
+********************************************************************************/
+void trace_write(struct trace* self,
+                 const struct trace_record* record);
+
+/********************************************************************************
+* trace_enable_ctx: Starts or stops tracing of specified CPU context. When
+*                   started, a new trace is written to the file at specified
+*                   path, replacing any running trace. While tracing, batch
+*                   runs are interpreted instruction by instruction, also
+*                   when JIT compilation is enabled. Success code 0 is
+*                   returned on success, otherwise error code 1 is returned.
+*
+*                   - self   : Reference to the CPU context.
+*                   - enabled: Indicates if tracing is enabled.
+*                   - path   : Path to the trace file (ignored when stopping).
+********************************************************************************/
+int trace_enable_ctx(struct cpu_context* self,
+                     const bool enabled,
+                     const char* path);
+
+/********************************************************************************
+* trace_detect: Indicates if the file at specified path starts with the magic
+*               number of a trace.
+*
+*               - path: Path to the file.
+********************************************************************************/
+bool trace_detect(const char* path);
+
+/********************************************************************************
+* trace_dump: Decodes the trace file at specified path and prints one line of
+*             text per record. Success code 0 is returned on success,
+*             otherwise error code 1 is returned if the file can't be read or
+*             isn't a valid trace.
+*
+*             - path   : Path to the trace file.
+*             - ostream: Reference to the output stream.
+********************************************************************************/
+int trace_dump(const char* path,
+               FILE* ostream);
+
+/********************************************************************************
+* trace_enable: Starts or stops tracing of the default CPU context, see
+*               trace_enable_ctx.
+*
+*               - enabled: Indicates if tracing is enabled.
+*               - path   : Path to the trace file (ignored when stopping).
+********************************************************************************/
+int trace_enable(const bool enabled,
+                 const char* path);
+
+/********************************************************************************
+* trace_enabled: Indicates if tracing is enabled for the default CPU context.
+********************************************************************************/
+bool trace_enabled(void);
+
+#endif /* TRACE_H_ */
@@ -0,0 +1,817 @@
+/********************************************************************************
+* unittest.c: Table-driven tests of the modules parsing untrusted input on
+*             Linux. The assembler is tested with directives, expressions and
+*             erroneous sources, whose error messages must match exactly,
+*             after which led_toggle.asm must assemble to the built-in
+*             program. A program image is then written and loaded back, and
+*             corrupt or truncated copies of it must be rejected without
+*             changing the CPU context. Stimulus files are expanded into
+*             their writes, and a stimulus run must apply each write at the
+*             same clock cycle as a run one state at a time. Finally a batch
+*             of scenarios must result in the same JSON report when run on
+*             one and on several worker threads.
+*
+*             Usage: unittest
+*
+*             Each failed check is printed to stderr and the exit code is 1,
+*             otherwise the number of checks is printed and the exit code
+*             is 0. The test is run from the repository root, where the
+*             example programs are found.
+********************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L /* For mkstemp. */
+
+/* Include directives: */
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cpu_context.h"
+#include "data_memory.h"
+#include "program_memory.h"
+#include "assembler.h"
+#include "program_image.h"
+#include "control_unit.h"
+#include "stimulus.h"
+#include "scenario.h"
+
+/* Macro definitions: */
+#define UNITTEST_INSTRUCTION(op_code, op1, op2) \
+   ((uint32_t)(op_code) << 16 | (uint32_t)(op1) << 8 | (uint32_t)(op2))
+#define UNITTEST_MAX_EVENTS 8 /* Max number of writes checked per stimulus test. */
+#define UNITTEST_SCENARIOS  48 /* Number of scenarios run by the scenario test. */
+#define UNITTEST_THREADS    4  /* Number of worker threads compared with one thread. */
+#define UNITTEST_REPORT_SIZE 32768 /* Max size of a scenario report in bytes. */
+
+/********************************************************************************
+* assembler_test: Valid source assembled by the assembler test, along with
+*                 the instruction expected at the specified address. The
+*                 value of a symbol and a byte of the initial data are
+*                 optionally checked as well.
+********************************************************************************/
+struct assembler_test
+{
+   const char* source;       /* The assembly source. */
+   uint16_t address;         /* Address of the checked instruction. */
+   uint32_t instruction;     /* Expected instruction at the address. */
+   const char* symbol;       /* Name of the checked symbol, null if none. */
+   int32_t value;            /* Expected value of the symbol. */
+   uint16_t data_address;    /* Address of the checked initial data, 0 if none. */
+   uint8_t data;             /* Expected initial data at the address. */
+};
+
+/********************************************************************************
+* assembler_error: Invalid source assembled by the assembler test, along with
+*                  the expected error message.
+********************************************************************************/
+struct assembler_error
+{
+   const char* source; /* The assembly source. */
+   const char* error;  /* Expected error message. */
+};
+
+/********************************************************************************
+* image_test: Change made to a valid program image, which must then be
+*             rejected by the loader. Each test flips the bits of one byte
+*             and/or changes the size of the image.
+********************************************************************************/
+struct image_test
+{
+   const char* name;   /* Description of the change. */
+   int32_t offset;     /* Offset of the changed byte, counted from the end if negative. */
+   uint8_t mask;       /* Bits flipped at the offset, 0 if none. */
+   uint32_t truncate;  /* Size the image is truncated to, 0 if not truncated. */
+   int32_t resize;     /* Number of bytes removed at the end if negative, otherwise
+                          the number of zeros appended. */
+};
+
+/********************************************************************************
+* stimulus_test: Stimulus file read by the stimulus test, along with the
+*                writes it must expand to and the error expected after them.
+********************************************************************************/
+struct stimulus_test
+{
+   const char* text;                                  /* Content of the stimulus file. */
+   const char* error;                                 /* Expected error message, null if valid. */
+   uint32_t num_events;                               /* Number of expected writes. */
+   struct stimulus_event events[UNITTEST_MAX_EVENTS]; /* The expected writes. */
+};
+
+/* Static variables: */
+static uint32_t num_checks = 0;
+static uint32_t num_failures = 0;
+
+/********************************************************************************
+* assembler_tests: Sources covering the instructions, the expression
+*                  evaluator, the directives and symbols of the assembler.
+********************************************************************************/
+static const struct assembler_test assembler_tests[] =
+{
+   /* Instructions and expressions: */
+   { "LDI R16, 0x55", 0, UNITTEST_INSTRUCTION(LDI, 16, 0x55), 0, 0, 0, 0 },
+   { "ldi r16, 0b1010", 0, UNITTEST_INSTRUCTION(LDI, 16, 10), 0, 0, 0, 0 },
+   { "LDI R16, (1 << 3) | (0b0001 + 2 * 3)", 0, UNITTEST_INSTRUCTION(LDI, 16, 15), 0, 0, 0, 0 },
+   { "LDI R16, 100 / 7 - 4", 0, UNITTEST_INSTRUCTION(LDI, 16, 10), 0, 0, 0, 0 },
+   { "LDI R16, ~0x0F & 0xFF", 0, UNITTEST_INSTRUCTION(LDI, 16, 0xF0), 0, 0, 0, 0 },
+   { "LDI R16, 0x80 >> 2 ^ 0x01", 0, UNITTEST_INSTRUCTION(LDI, 16, 0x21), 0, 0, 0, 0 },
+   { "LDI R16, low(0x1234)", 0, UNITTEST_INSTRUCTION(LDI, 16, 0x34), 0, 0, 0, 0 },
+   { "LDI R16, high(0x1234)", 0, UNITTEST_INSTRUCTION(LDI, 16, 0x12), 0, 0, 0, 0 },
+   { "LDI ZL, 5", 0, UNITTEST_INSTRUCTION(LDI, 30, 5), 0, 0, 0, 0 },
+   { "MOVW R16, R18", 1, UNITTEST_INSTRUCTION(MOV, 17, 19), 0, 0, 0, 0 },
+   { "NOP\nRJMP 0", 1, UNITTEST_INSTRUCTION(JMP, 0, 0), 0, 0, 0, 0 },
+
+   /* Directives and symbols: */
+   { ".EQU LIMIT = 10\nLDI R16, LIMIT + 1", 0, UNITTEST_INSTRUCTION(LDI, 16, 11), "LIMIT", 10, 0, 0 },
+   { ".ORG 0x120\nloop: JMP loop", 0x120, UNITTEST_INSTRUCTION(JMP, 0x20, 0x01), "loop", 0x120, 0, 0 },
+   { "JMP end\nNOP\nend: NOP", 0, UNITTEST_INSTRUCTION(JMP, 2, 0), "end", 2, 0, 0 },
+   { ".DSEG\nbuffer: .BYTE 4\nnext: .BYTE 1\n.CSEG\nLDI R16, low(next)",
+     0, UNITTEST_INSTRUCTION(LDI, 16, 4), "buffer", ASSEMBLER_DATA_SEGMENT_START, 0, 0 },
+   { ".DSEG\n.ORG 0x10\ntable: .DB 1, 2, 0x33\n.CSEG\nNOP",
+     0, UNITTEST_INSTRUCTION(NOP, 0, 0), "table", 0x10, 0x112, 0x33 },
+};
+
+/********************************************************************************
+* assembler_errors: Invalid sources covering the error messages of the
+*                   assembler.
+********************************************************************************/
+static const struct assembler_error assembler_errors[] =
+{
+   { "FOO R16", "Line 1: Unknown instruction FOO" },
+   { "NOP\n.FOO", "Line 2: Unknown directive .FOO" },
+   { "JMP nowhere", "Line 1: Undefined symbol nowhere" },
+   { "a: NOP\na: NOP", "Line 2: Symbol a is already defined" },
+   { ".ORG 5\nNOP\n.ORG 5\nNOP", "Line 4: Address 5 is already used" },
+   { ".ORG 0xFFFF\nNOP\nNOP", "Line 3: Address 65536 outside program memory" },
+   { "LDI R16, 1 / 0", "Line 1: Division by zero" },
+   { "LDI R16, 256", "Line 1: Value 256 out of range" },
+   { "LDI 32, 1", "Line 1: Invalid register 32" },
+   { "LDI R16, 0x1G", "Line 1: Invalid number '0x1G'" },
+   { "LDI R16, (1 + 2", "Line 1: Expected ')'" },
+   { "MOVW R17, R18", "Line 1: MOVW requires even registers" },
+   { ".DSEG\nNOP", "Line 2: Instruction NOP in the data segment" },
+   { ".BYTE 1", "Line 1: .BYTE is only allowed in the data segment" },
+   { ".DB 1", "Line 1: .DB is only allowed in the data segment" },
+   { ".DSEG\n.ORG 0xFEFF\nx: .BYTE 2", "Line 3: Reservation of 2 bytes at address 65279 outside data memory" },
+};
+
+/********************************************************************************
+* image_source: Program written as program image by the image test, holding
+*               code labels, initial data and an entry point past the
+*               interrupt vectors.
+********************************************************************************/
+static const char* image_source =
+   ".DSEG\n"
+   "counter: .DB 0x11, 0x22\n"
+   "message: .DB 0x33, 0x44, 0x55\n"
+   ".CSEG\n"
+   ".ORG 0x10\n"
+   "main:\n"
+   "   LDS R16, low(counter)\n"
+   "   CALL increment\n"
+   "   JMP main\n"
+   "increment:\n"
+   "   INC R16\n"
+   "   RET\n";
+
+/********************************************************************************
+* image_tests: Corrupt and truncated copies of the image of image_source, see
+*              program_image.h for the layout of the header.
+********************************************************************************/
+static const struct image_test image_tests[] =
+{
+   { "bad magic",                0,  0x01, 0, 0 },
+   { "bad version",              4,  0x01, 0, 0 },
+   { "bad header size",          6,  0x08, 0, 0 },
+   { "bad checksum",             8,  0x01, 0, 0 },
+   { "bad image size",           12, 0x01, 0, 0 },
+   { "code offset out of range", 31, 0x80, 0, 0 },
+   { "flipped code byte",        PROGRAM_IMAGE_HEADER_SIZE, 0x01, 0, 0 },
+   { "flipped last byte",        -1, 0x01, 0, 0 },
+   { "truncated header",         0,  0x00, PROGRAM_IMAGE_HEADER_SIZE - 1, 0 },
+   { "header only",              0,  0x00, PROGRAM_IMAGE_HEADER_SIZE, 0 },
+   { "truncated last byte",      0,  0x00, 0, -1 },
+   { "appended byte",            0,  0x00, 0, 1 },
+};
+
+/********************************************************************************
+* stimulus_tests: Stimulus files covering single writes, ramps, repeat blocks
+*                 and the errors of the parser.
+********************************************************************************/
+static const struct stimulus_test stimulus_tests[] =
+{
+   { "10 PINB 0x20\n# Comment\n\n20 pinc 0b101\n30 PIND 7 # Trailing comment\n", 0, 3,
+     { { 10, PINB, 0x20 }, { 20, PINC, 5 }, { 30, PIND, 7 } } },
+   { "100 ramp PINB 1 3 10\n", 0, 3,
+     { { 100, PINB, 1 }, { 110, PINB, 2 }, { 120, PINB, 3 } } },
+   { "0 ramp PINC 5 3 4\n8 PIND 1\n", 0, 4,
+     { { 0, PINC, 5 }, { 4, PINC, 4 }, { 8, PINC, 3 }, { 8, PIND, 1 } } },
+   { "50 repeat 3 100\n   0 PINB 1\n   10 PINB 0\nend\n300 PIND 9\n", 0, 7,
+     { { 50, PINB, 1 }, { 60, PINB, 0 }, { 150, PINB, 1 }, { 160, PINB, 0 },
+       { 250, PINB, 1 }, { 260, PINB, 0 }, { 300, PIND, 9 } } },
+   { "20 PINB 1\n10 PINB 2\n", "Line 2: Write at cycle 10 is earlier than the previous write", 1,
+     { { 20, PINB, 1 } } },
+   { "0 repeat 3 10\n0 PINB 1\nend\n15 PINB 2\n",
+     "Line 4: Write at cycle 15 is earlier than the previous write", 3,
+     { { 0, PINB, 1 }, { 10, PINB, 1 }, { 20, PINB, 1 } } },
+   { "0 repeat 2 10\n10 PINB 1\nend\n", "Line 2: Offsets must be in order and lower than the period",
+     0, { { 0, 0, 0 } } },
+   { "0 repeat 2 10\n0 PINB 1\n", "Line 2: Missing end of repeat block", 0, { { 0, 0, 0 } } },
+   { "0 ramp PINB 1 256 10\n", "Line 1: Expected <cycle> ramp <register> <first> <last> <interval>",
+     0, { { 0, 0, 0 } } },
+   { "5 PORTB 1\n", "Line 1: Expected <cycle> <register> <value>", 0, { { 0, 0, 0 } } },
+   { "-5 PINB 1\n", "Line 1: Invalid timestamp -5", 0, { { 0, 0, 0 } } },
+};
+
+/********************************************************************************
+* stimulus_program: Program run by the cycle test of the stimulus runner. The
+*                   main loop accumulates PINB and counts its iterations,
+*                   while the pin change interrupt accumulates the iteration
+*                   count, so that the state depends on the exact clock cycle
+*                   of each write.
+********************************************************************************/
+static const char* stimulus_program =
+   ".ORG RESET_vect\n"
+   "   JMP main\n"
+   ".ORG PCINT0_vect\n"
+   "   JMP ISR_PCINT0\n"
+   ".ORG 0x08\n"
+   "main:\n"
+   "   LDI R16, (1 << PCIE0)\n"
+   "   STS PCICR, R16\n"
+   "   LDI R16, 0xFF\n"
+   "   STS PCMSK0, R16\n"
+   "   SEI\n"
+   "loop:\n"
+   "   IN R17, PINB\n"
+   "   ADD R18, R17\n"
+   "   INC R19\n"
+   "   JMP loop\n"
+   "ISR_PCINT0:\n"
+   "   INC R20\n"
+   "   ADD R21, R19\n"
+   "   RETI\n";
+
+/********************************************************************************
+* stimulus_timing: Stimulus applied by the cycle test, with writes in the
+*                  middle of instructions and several writes at one cycle.
+********************************************************************************/
+static const char* stimulus_timing =
+   "3 PINB 0x01\n"
+   "7 ramp PINB 2 9 11\n"
+   "200 repeat 5 23\n"
+   "   0 PINB 0x10\n"
+   "   5 PINB 0x20\n"
+   "   17 PINB 0x30\n"
+   "end\n"
+   "400 PINB 0xFF\n"
+   "400 PINB 0x00\n"
+   "401 PINB 0x80\n";
+
+/********************************************************************************
+* scenario_program: Program run by most scenarios of the scenario test. PORTB
+*                   accumulates PINB, PORTD counts the iterations of the main
+*                   loop and PORTC the pin change interrupts.
+********************************************************************************/
+static const char* scenario_program =
+   ".ORG RESET_vect\n"
+   "   JMP main\n"
+   ".ORG PCINT0_vect\n"
+   "   JMP ISR_PCINT0\n"
+   ".ORG 0x08\n"
+   "main:\n"
+   "   LDI R16, (1 << PCIE0)\n"
+   "   STS PCICR, R16\n"
+   "   LDI R16, 0xFF\n"
+   "   STS PCMSK0, R16\n"
+   "   SEI\n"
+   "loop:\n"
+   "   IN R17, PINB\n"
+   "   ADD R18, R17\n"
+   "   OUT PORTB, R18\n"
+   "   INC R19\n"
+   "   OUT PORTD, R19\n"
+   "   JMP loop\n"
+   "ISR_PCINT0:\n"
+   "   INC R20\n"
+   "   OUT PORTC, R20\n"
+   "   RETI\n";
+
+/* Static function declarations: */
+static void check(const bool condition,
+                  const char* format, ...);
+static void test_assembler(void);
+static void test_image(void);
+static void test_stimulus(void);
+static void test_stimulus_timing(void);
+static void test_scenarios(void);
+static size_t print_report(const struct scenario_batch* batch,
+                           char* report);
+static bool write_file(const char* path,
+                       const void* data,
+                       const size_t size);
+static bool image_loaded(struct cpu_context* context,
+                         const struct assembler_program* program,
+                         const uint16_t entry_point);
+
+/********************************************************************************
+* main: Runs the tests and prints the number of checks.
+********************************************************************************/
+int main(void)
+{
+   test_assembler();
+   test_image();
+   test_stimulus();
+   test_stimulus_timing();
+   test_scenarios();
+
+   if (num_failures)
+   {
+      fprintf(stderr, "%u of %u checks failed\n", (unsigned)num_failures, (unsigned)num_checks);
+      return 1;
+   }
+
+   printf("ok %u checks\n", (unsigned)num_checks);
+   return 0;
+}
+
+/********************************************************************************
+* check: Counts a check and prints specified message to stderr if it failed.
+*
+*        - condition: Indicates if the check passed.
+*        - format   : Format string of the message, followed by its arguments.
+********************************************************************************/
+static void check(const bool condition,
+                  const char* format, ...)
+{
+   num_checks++;
+
+   if (!condition)
+   {
+      va_list args;
+      va_start(args, format);
+      vfprintf(stderr, format, args);
+      va_end(args);
+      fputc('\n', stderr);
+      num_failures++;
+   }
+   return;
+}
+
+/********************************************************************************
+* test_assembler: Assembles the sources in assembler_tests and checks the
+*                 outcome of each, after which each source in
+*                 assembler_errors must fail with its error message. Finally
+*                 led_toggle.asm is assembled, which must result in the
+*                 program written by program_memory_write_ctx.
+********************************************************************************/
+static void test_assembler(void)
+{
+   static struct assembler_program program;
+   struct cpu_context* context = 0;
+
+   for (size_t i = 0; i < sizeof(assembler_tests) / sizeof(assembler_tests[0]); ++i)
+   {
+      const struct assembler_test* test = &assembler_tests[i];
+      const int status = assembler_assemble(&program, test->source);
+
+      check(!status, "assembler test %u: %s", (unsigned)i, program.error);
+      if (status) continue;
+
+      check(program.code[test->address] == test->instruction,
+            "assembler test %u: instruction 0x%06X at address %u, expected 0x%06X",
+            (unsigned)i, (unsigned)program.code[test->address], (unsigned)test->address,
+            (unsigned)test->instruction);
+
+      if (test->symbol)
+      {
+         const struct assembler_symbol* symbol = assembler_symbol_find(&program, test->symbol);
+         check(symbol && symbol->value == test->value,
+               "assembler test %u: symbol %s is %d, expected %d", (unsigned)i, test->symbol,
+               symbol ? (int)symbol->value : -1, (int)test->value);
+      }
+
+      if (test->data_address)
+      {
+         check(program.data[test->data_address] == test->data,
+               "assembler test %u: data 0x%02X at address %u, expected 0x%02X", (unsigned)i,
+               (unsigned)program.data[test->data_address], (unsigned)test->data_address,
+               (unsigned)test->data);
+      }
+   }
+
+   for (size_t i = 0; i < sizeof(assembler_errors) / sizeof(assembler_errors[0]); ++i)
+   {
+      const struct assembler_error* test = &assembler_errors[i];
+      const int status = assembler_assemble(&program, test->source);
+
+      check(status && !strcmp(program.error, test->error),
+            "assembler error %u: expected \"%s\", got \"%s\"",
+            (unsigned)i, test->error, status ? program.error : "success");
+   }
+
+   context = cpu_context_new();
+   check(context != 0, "assembler test: out of memory");
+   if (!context) return;
+
+   if (assembler_assemble_file(&program, "led_toggle.asm"))
+   {
+      check(false, "led_toggle.asm: %s", program.error);
+   }
+   else
+   {
+      check(program.code_size == 40, "led_toggle.asm: %u instructions, expected 40",
+            (unsigned)program.code_size);
+      check(!memcmp(program.code, context->program, 40 * sizeof(program.code[0])),
+            "led_toggle.asm: differs from the built-in program");
+   }
+
+   cpu_context_delete(&context);
+   return;
+}
+
+/********************************************************************************
+* test_image: Writes image_source as program image to a temporary file and
+*             loads it back, after which the CPU context must hold the
+*             program, its entry point, initial data and code labels. Each
+*             change in image_tests is then applied to a copy of the image,
+*             which must be rejected without changing the CPU context.
+********************************************************************************/
+static void test_image(void)
+{
+   static struct assembler_program program;
+   static uint8_t image[4096];
+   static uint8_t copy[sizeof(image) + 1];
+   char path[] = "/tmp/unittest-XXXXXX";
+   struct cpu_context* context = 0;
+   const struct assembler_symbol* main_symbol = 0;
+   FILE* file = 0;
+   size_t size = 0;
+   const int fd = mkstemp(path);
+
+   check(fd >= 0, "image test: can't create a temporary file");
+   if (fd < 0) return;
+   close(fd);
+
+   if (assembler_assemble(&program, image_source) || !(main_symbol = assembler_symbol_find(&program, "main")))
+   {
+      check(false, "image test: %s", program.error);
+      unlink(path);
+      return;
+   }
+
+   const uint16_t entry_point = (uint16_t)main_symbol->value;
+   check(!program_image_write(&program, entry_point, path), "image test: can't write %s", path);
+   check(program_image_detect(path), "image test: %s isn't detected as program image", path);
+
+   if ((file = fopen(path, "rb")))
+   {
+      size = fread(image, 1, sizeof(image), file);
+      fclose(file);
+   }
+
+   check(size > PROGRAM_IMAGE_HEADER_SIZE && size < sizeof(image), "image test: can't read %s", path);
+   context = cpu_context_new();
+   check(context != 0, "image test: out of memory");
+
+   if (!context || size <= PROGRAM_IMAGE_HEADER_SIZE || size >= sizeof(image))
+   {
+      cpu_context_delete(&context);
+      unlink(path);
+      return;
+   }
+
+   check(!program_image_load_ctx(context, path), "image test: can't load %s", path);
+   check(image_loaded(context, &program, entry_point), "image test: the loaded image differs from the program");
+
+   for (size_t i = 0; i < sizeof(image_tests) / sizeof(image_tests[0]); ++i)
+   {
+      const struct image_test* test = &image_tests[i];
+      size_t copy_size = test->truncate ? test->truncate : size;
+
+      memcpy(copy, image, size);
+      copy[size] = 0;
+      copy[test->offset < 0 ? size + test->offset : (size_t)test->offset] ^= test->mask;
+      copy_size += test->resize;
+
+      if (!write_file(path, copy, copy_size))
+      {
+         check(false, "image test: can't write %s", path);
+         break;
+      }
+
+      check(program_image_load_ctx(context, path), "image test: %s image was loaded", test->name);
+      check(image_loaded(context, &program, entry_point),
+            "image test: %s image changed the CPU context", test->name);
+   }
+
+   cpu_context_delete(&context);
+   unlink(path);
+   return;
+}
+
+/********************************************************************************
+* test_stimulus: Writes each stimulus file in stimulus_tests to a temporary
+*                file and reads its writes, which must match the expected
+*                writes, followed by the end of the file or the expected
+*                error.
+********************************************************************************/
+static void test_stimulus(void)
+{
+   char path[] = "/tmp/unittest-XXXXXX";
+   const int fd = mkstemp(path);
+
+   check(fd >= 0, "stimulus test: can't create a temporary file");
+   if (fd < 0) return;
+   close(fd);
+
+   for (size_t i = 0; i < sizeof(stimulus_tests) / sizeof(stimulus_tests[0]); ++i)
+   {
+      const struct stimulus_test* test = &stimulus_tests[i];
+      struct stimulus* stimulus = 0;
+      struct stimulus_event event;
+      uint32_t num_events = 0;
+
+      if (!write_file(path, test->text, strlen(test->text)) || !(stimulus = stimulus_open(path)))
+      {
+         check(false, "stimulus test %u: can't write and open %s", (unsigned)i, path);
+         continue;
+      }
+
+      while (!stimulus_next(stimulus, &event))
+      {
+         const struct stimulus_event* expected = &test->events[num_events];
+
+         if (num_events == test->num_events)
+         {
+            check(false, "stimulus test %u: more than %u writes", (unsigned)i, (unsigned)test->num_events);
+            break;
+         }
+
+         check(event.cycle == expected->cycle && event.address == expected->address &&
+               event.value == expected->value,
+               "stimulus test %u, write %u: %llu 0x%02X 0x%02X, expected %llu 0x%02X 0x%02X",
+               (unsigned)i, (unsigned)num_events, (unsigned long long)event.cycle,
+               (unsigned)event.address, (unsigned)event.value, (unsigned long long)expected->cycle,
+               (unsigned)expected->address, (unsigned)expected->value);
+         num_events++;
+      }
+
+      const char* error = stimulus_error(stimulus);
+      check(num_events == test->num_events, "stimulus test %u: %u writes, expected %u",
+            (unsigned)i, (unsigned)num_events, (unsigned)test->num_events);
+      check(test->error ? error && !strcmp(error, test->error) : !error,
+            "stimulus test %u: expected \"%s\", got \"%s\"", (unsigned)i,
+            test->error ? test->error : "success", error ? error : "success");
+      stimulus_close(&stimulus);
+   }
+
+   unlink(path);
+   return;
+}
+
+/********************************************************************************
+* test_stimulus_timing: Runs stimulus_program through stimulus_timing by
+*                       stimulus_run_ctx, which splits the run at the cycle of
+*                       each write. A second CPU context is run one state,
+*                       i.e. one clock cycle, at a time with each write
+*                       applied at its cycle. Both contexts must end up in
+*                       the same state after the same number of cycles.
+********************************************************************************/
+static void test_stimulus_timing(void)
+{
+   static struct assembler_program program;
+   struct cpu_context* batch = cpu_context_new();
+   struct cpu_context* step = cpu_context_new();
+   struct stimulus* stimulus = 0;
+   char path[] = "/tmp/unittest-XXXXXX";
+   const int fd = mkstemp(path);
+
+   if (fd >= 0) close(fd);
+   check(batch && step && fd >= 0, "stimulus timing test: out of memory");
+
+   if (batch && step && fd >= 0 && assembler_assemble(&program, stimulus_program))
+   {
+      check(false, "stimulus timing test: %s", program.error);
+   }
+   else if (batch && step && fd >= 0 && (!write_file(path, stimulus_timing, strlen(stimulus_timing)) ||
+                                          !(stimulus = stimulus_open(path))))
+   {
+      check(false, "stimulus timing test: can't write and open %s", path);
+   }
+
+   if (!stimulus)
+   {
+      cpu_context_delete(&batch);
+      cpu_context_delete(&step);
+      if (fd >= 0) unlink(path);
+      return;
+   }
+
+   const struct control_unit_run_config config = { 0, 0, 0, 0 };
+   assembler_load_ctx(batch, &program);
+   assembler_load_ctx(step, &program);
+   const struct control_unit_result result = stimulus_run_ctx(batch, stimulus, &config);
+
+   check(!stimulus_error(stimulus), "stimulus timing test: %s", stimulus_error(stimulus));
+   check(stimulus_num_applied(stimulus) == 27 && stimulus_cycle(stimulus) == 401 && result.num_cycles == 401,
+         "stimulus timing test: %llu writes applied after %llu cycles, expected 27 after 401",
+         (unsigned long long)stimulus_num_applied(stimulus), (unsigned long long)result.num_cycles);
+   stimulus_close(&stimulus);
+
+   if ((stimulus = stimulus_open(path)))
+   {
+      struct stimulus_event event;
+      bool pending = !stimulus_next(stimulus, &event);
+
+      for (uint64_t cycle = 0; pending; ++cycle)
+      {
+         while (pending && event.cycle == cycle)
+         {
+            data_memory_write_ctx(step, event.address, event.value);
+            pending = !stimulus_next(stimulus, &event);
+         }
+         if (pending) control_unit_run_next_state_ctx(step);
+      }
+      stimulus_close(&stimulus);
+   }
+
+   check(batch->pc == step->pc && batch->state == step->state && batch->sr == step->sr &&
+         !memcmp(batch->reg, step->reg, sizeof(batch->reg)) &&
+         !memcmp(batch->data, step->data, sizeof(batch->data)),
+         "stimulus timing test: the state differs from the run one state at a time");
+   check(batch->reg[20] > 0, "stimulus timing test: no pin change interrupt");
+
+   cpu_context_delete(&batch);
+   cpu_context_delete(&step);
+   unlink(path);
+   return;
+}
+
+/********************************************************************************
+* test_scenarios: Writes scenario_program, a stimulus and a list of
+*                 UNITTEST_SCENARIOS scenarios to temporary files. The
+*                 scenarios differ in cycle budget and assertions, some run
+*                 the built-in program or no stimulus, and one refers to a
+*                 missing program. The batch is run on one worker thread and
+*                 then on UNITTEST_THREADS worker threads, after which the
+*                 JSON reports must be identical apart from the number of
+*                 threads.
+********************************************************************************/
+static void test_scenarios(void)
+{
+   static char reports[2][UNITTEST_REPORT_SIZE];
+   static char list[UNITTEST_SCENARIOS * 2 * SCENARIO_PATH_SIZE];
+   static const char* stimulus = "10 ramp PINB 0 255 7\n";
+   char paths[3][24] = { "/tmp/unittest-XXXXXX", "/tmp/unittest-XXXXXX", "/tmp/unittest-XXXXXX" };
+   struct scenario_batch batch = { 0 };
+   size_t length = 0;
+   size_t report_size[2] = { 0, 0 };
+   bool created = true;
+
+   for (int i = 0; i < 3; ++i)
+   {
+      const int fd = mkstemp(paths[i]);
+      if (fd >= 0) close(fd);
+      else paths[i][0] = '\0';
+      created = created && fd >= 0;
+   }
+
+   for (uint32_t i = 0; created && i < UNITTEST_SCENARIOS; ++i)
+   {
+      const char* program = i % 8 == 7 ? "-" : paths[0];
+      const char* stimulus_path = i % 4 == 3 ? "-" : paths[1];
+      const uint32_t cycles = i % 8 == 5 ? 0 : 100 + 37 * i;
+
+      length += (size_t)snprintf(list + length, sizeof(list) - length,
+                                 "scenario_%u %s %s %u PORTD&0x01=0 PORTC&0x80=0 # Comment\n",
+                                 (unsigned)i, i == 13 ? "/nonexistent.asm" : program, stimulus_path,
+                                 (unsigned)cycles);
+   }
+
+   check(created && write_file(paths[0], scenario_program, strlen(scenario_program)) &&
+         write_file(paths[1], stimulus, strlen(stimulus)) && write_file(paths[2], list, length),
+         "scenario test: can't write the temporary files");
+
+   if (scenario_batch_load(&batch, paths[2]))
+   {
+      check(false, "scenario test: %s", batch.error);
+   }
+   else
+   {
+      size_t num_status[3] = { 0, 0, 0 };
+
+      scenario_batch_run(&batch, 1);
+      report_size[0] = print_report(&batch, reports[0]);
+
+      for (size_t i = 0; i < batch.size; ++i)
+      {
+         num_status[batch.results[i].status]++;
+      }
+
+      check(batch.size == UNITTEST_SCENARIOS && num_status[SCENARIO_PASSED] && num_status[SCENARIO_FAILED] &&
+            num_status[SCENARIO_ERROR] == 1,
+            "scenario test: %u scenarios, %u passed, %u failed, %u errors", (unsigned)batch.size,
+            (unsigned)num_status[SCENARIO_PASSED], (unsigned)num_status[SCENARIO_FAILED],
+            (unsigned)num_status[SCENARIO_ERROR]);
+
+      scenario_batch_run(&batch, UNITTEST_THREADS);
+      check(batch.num_threads == UNITTEST_THREADS, "scenario test: %u threads, expected %u",
+            batch.num_threads, (unsigned)UNITTEST_THREADS);
+
+      /* The report holds the number of threads, which is the only expected difference. */
+      batch.num_threads = 1;
+      report_size[1] = print_report(&batch, reports[1]);
+
+      check(report_size[0] && report_size[0] == report_size[1] && !memcmp(reports[0], reports[1], report_size[0]),
+            "scenario test: the reports of 1 and %u threads differ", (unsigned)UNITTEST_THREADS);
+   }
+
+   scenario_batch_free(&batch);
+
+   for (int i = 0; i < 3; ++i)
+   {
+      if (paths[i][0]) unlink(paths[i]);
+   }
+   return;
+}
+
+/********************************************************************************
+* print_report: Prints the JSON report of referenced batch into specified
+*               buffer of UNITTEST_REPORT_SIZE bytes and returns its size. If
+*               the report can't be printed or doesn't fit, 0 is returned.
+*
+*               - batch : Reference to the batch.
+*               - report: Reference to the buffer.
+********************************************************************************/
+static size_t print_report(const struct scenario_batch* batch,
+                           char* report)
+{
+   FILE* file = tmpfile();
+   size_t size = 0;
+   if (!file) return 0;
+
+   scenario_batch_print(batch, file);
+   rewind(file);
+   size = fread(report, 1, UNITTEST_REPORT_SIZE, file);
+   fclose(file);
+   return size < UNITTEST_REPORT_SIZE ? size : 0;
+}
+
+/********************************************************************************
+* write_file: Writes specified data to the file at specified path, replacing
+*             its content. True is returned on success.
+*
+*             - path: Path to the file.
+*             - data: Reference to the data.
+*             - size: Number of bytes to write.
+********************************************************************************/
+static void test_scenarios(void);
+static size_t print_report(const struct scenario_batch* batch,
+                           char* report);
+static bool write_file(const char* path,
+                       const void* data,
+                       const size_t size)
+{
+   FILE* file = fopen(path, "wb");
+   if (!file) return false;
+   const bool written = fwrite(data, 1, size, file) == size;
+   return !fclose(file) && written;
+}
+
+/********************************************************************************
+* image_loaded: Indicates if the program memory, entry point, initial data
+*               and code labels of specified CPU context match referenced
+*               assembled program.
+*
+*               - context    : Reference to the CPU context.
+*               - program    : Reference to the assembled program.
+*               - entry_point: The expected entry point.
+********************************************************************************/
+static void test_stimulus(void);
+static void test_stimulus_timing(void);
+static void test_scenarios(void);
+static size_t print_report(const struct scenario_batch* batch,
+                           char* report);
+static bool write_file(const char* path,
+                       const void* data,
+                       const size_t size);
+static bool image_loaded(struct cpu_context* context,
+                         const struct assembler_program* program,
+                         const uint16_t entry_point)
+{
+   const struct assembler_symbol* increment = assembler_symbol_find(program, "increment");
+   const char* label = increment ? program_memory_label_ctx(context, (uint16_t)increment->value) : 0;
+
+   if (memcmp(context->program, program->code, sizeof(program->code)) ||
+       context->entry_point != entry_point || context->pc != entry_point ||
+       !label || strcmp(label, "increment"))
+   {
+      return false;
+   }
+
+   for (uint32_t address = program->data_start; address < program->data_end; ++address)
+   {
+      if (data_memory_read_ctx(context, (uint16_t)address) != program->data[address]) return false;
+   }
+   return true;
+}
@@ -0,0 +1,291 @@
+/********************************************************************************
+* vcd.c: Contains function definitions for recording the I/O registers of the
+*        emulated microcontroller as a waveform in Value Change Dump format.
+*        Each sample is compared to the previous one as a whole first, so
+*        that samples without changes cost a single comparison.
+********************************************************************************/
+#include "vcd.h"
+#include "cpu_context.h"
+
+#include <string.h>
+
+/* Macro definitions: */
+#define VCD_BUFFER_SIZE (4 * 1024 * 1024) /* Size of the output buffer in bytes. */
+#define VCD_MAX_SAMPLE  512               /* Max size of the output of one sample in bytes. */
+#define VCD_NUM_SIGNALS 12                /* Number of recorded signals. */
+#define VCD_SIGNAL_I    10                /* Index of the global interrupt flag. */
+#define VCD_SIGNAL_PC   11                /* Index of the program counter. */
+#define VCD_FIRST_ID    'A'               /* Identifier code of the first signal. */
+
+/********************************************************************************
+* vcd_signal: A recorded signal. The I/O registers come first, in the order
+*             of the signal table, followed by the I flag and the PC.
+********************************************************************************/
+struct vcd_signal
+{
+   const char* name; /* Name of the signal shown in the viewer. */
+   uint8_t address;  /* Address of the I/O register, if any. */
+   uint8_t width;    /* Width of the signal in bits. */
+};
+
+/********************************************************************************
+* vcd: Waveform written to a file.
+********************************************************************************/
+struct vcd
+{
+   FILE* file;                          /* The VCD file. */
+   bool error;                          /* Indicates if a write has failed. */
+   bool started;                        /* Indicates if the initial values have been written. */
+   uint64_t cycle;                      /* Number of clock cycles since the start. */
+   uint64_t time_written;               /* Last time written, in clock cycles. */
+   uint16_t values[VCD_NUM_SIGNALS];    /* Last written value of each signal. */
+   size_t buffer_used;                  /* Number of bytes in the output buffer. */
+   char buffer[VCD_BUFFER_SIZE];        /* Output buffer, written to the file when full. */
+};
+
+/* Static variables: */
+static const struct vcd_signal signals[VCD_NUM_SIGNALS] =
+{
+   { "DDRB", DDRB, 8 }, { "PORTB", PORTB, 8 }, { "PINB", PINB, 8 },
+   { "DDRC", DDRC, 8 }, { "PORTC", PORTC, 8 }, { "PINC", PINC, 8 },
+   { "DDRD", DDRD, 8 }, { "PORTD", PORTD, 8 }, { "PIND", PIND, 8 },
+   { "PCIFR", PCIFR, 8 }, { "I", 0, 1 }, { "PC", 0, 8 * sizeof(((struct cpu_context*)0)->pc) }
+};
+
+/* Static functions: */
+static void put_time(struct vcd* self);
+static void put_value(struct vcd* self,
+                      const size_t signal,
+                      const uint16_t value);
+static void flush_buffer(struct vcd* self);
+
+/********************************************************************************
+* vcd_open: Returns a new waveform written to the file at specified path. The
+*           header declaring the signals is written right away. If the file
+*           can't be created or memory can't be allocated, a null pointer is
+*           returned.
+*
+*           - path: Path to the VCD file.
+********************************************************************************/
+struct vcd* vcd_open(const char* path)
+{
+   struct vcd* self = (struct vcd*)malloc(sizeof(struct vcd));
+   if (!self) return 0;
+
+   self->file = fopen(path, "w");
+
+   if (!self->file)
+   {
+      free(self);
+      return 0;
+   }
+
+   fprintf(self->file, "$version Ela22 embedded computer system $end\n");
+   fprintf(self->file, "$timescale %s $end\n", VCD_TIMESCALE);
+   fprintf(self->file, "$scope module cpu $end\n");
+
+   for (size_t i = 0; i < VCD_NUM_SIGNALS; ++i)
+   {
+      fprintf(self->file, "$var wire %u %c %s $end\n", signals[i].width,
+              (char)(VCD_FIRST_ID + i), signals[i].name);
+   }
+
+   fprintf(self->file, "$upscope $end\n$enddefinitions $end\n");
+   self->error = ferror(self->file) != 0;
+   self->started = false;
+   self->cycle = 0;
+   self->time_written = 0;
+   self->buffer_used = 0;
+   return self;
+}
+
+/********************************************************************************
+* vcd_close: Writes all buffered value changes of specified waveform, closes
+*            the file and deletes the waveform. The referenced pointer is set
+*            to null. Success code 0 is returned if the entire waveform was
+*            written, otherwise error code 1 is returned.
+*
+*            - self: Reference to pointer to the waveform.
+********************************************************************************/
+int vcd_close(struct vcd** self)
+{
+   struct vcd* vcd = *self;
+   if (!vcd) return 0;
+
+   put_time(vcd);
+   flush_buffer(vcd);
+   if (fclose(vcd->file)) vcd->error = true;
+   const int result = vcd->error ? 1 : 0;
+   free(vcd);
+   *self = 0;
+   return result;
+}
+
+/********************************************************************************
+* vcd_sample: Advances the time of specified waveform by specified number of
+*             clock cycles and records the signals of specified CPU context
+*             that have changed since the last sample.
+*
+*             - self      : Reference to the waveform.
+*             - context   : Reference to the sampled CPU context.
+*             - num_cycles: Number of clock cycles run since the last sample.
+********************************************************************************/
+void vcd_sample(struct vcd* self,
+                const struct cpu_context* context,
+                const uint64_t num_cycles)
+{
+   uint16_t values[VCD_NUM_SIGNALS];
+   self->cycle += num_cycles;
+
+   for (size_t i = 0; i < VCD_SIGNAL_I; ++i)
+   {
+      values[i] = context->data[signals[i].address];
+   }
+
+   values[VCD_SIGNAL_I] = read(context->sr, I) ? 1 : 0;
+   values[VCD_SIGNAL_PC] = context->pc;
+
+   if (!self->started)
+   {
+      put_time(self);
+      memcpy(self->buffer + self->buffer_used, "$dumpvars\n", 10);
+      self->buffer_used += 10;
+      for (size_t i = 0; i < VCD_NUM_SIGNALS; ++i) put_value(self, i, values[i]);
+      memcpy(self->buffer + self->buffer_used, "$end\n", 5);
+      self->buffer_used += 5;
+      memcpy(self->values, values, sizeof(values));
+      self->started = true;
+      return;
+   }
+
+   if (!memcmp(values, self->values, sizeof(values))) return;
+   put_time(self);
+
+   for (size_t i = 0; i < VCD_NUM_SIGNALS; ++i)
+   {
+      if (values[i] != self->values[i]) put_value(self, i, values[i]);
+   }
+
+   memcpy(self->values, values, sizeof(values));
+   if (self->buffer_used > VCD_BUFFER_SIZE - VCD_MAX_SAMPLE) flush_buffer(self);
+   return;
+}
+
+/********************************************************************************
+* vcd_enable_ctx: Starts or stops recording a waveform of specified CPU
+*                 context. When started, a new waveform is written to the
+*                 file at specified path, replacing any running recording.
+*                 While recording, batch runs are interpreted instruction by
+*                 instruction, also when JIT compilation is enabled. Success
+*                 code 0 is returned on success, otherwise error code 1 is
+*                 returned.
+*
+*                 - self   : Reference to the CPU context.
+*                 - enabled: Indicates if recording is enabled.
+*                 - path   : Path to the VCD file (ignored when stopping).
+********************************************************************************/
+int vcd_enable_ctx(struct cpu_context* self,
+                   const bool enabled,
+                   const char* path)
+{
+   int result = vcd_close(&self->vcd);
+   if (!enabled) return result;
+   self->vcd = vcd_open(path);
+   return self->vcd ? result : 1;
+}
+
+/********************************************************************************
+* vcd_enable: Starts or stops recording a waveform of the default CPU
+*             context, see vcd_enable_ctx.
+*
+*             - enabled: Indicates if recording is enabled.
+*             - path   : Path to the VCD file (ignored when stopping).
+********************************************************************************/
+int vcd_enable(const bool enabled,
+               const char* path)
+{
+   return vcd_enable_ctx(cpu_context_default(), enabled, path);
+}
+
+/********************************************************************************
+* vcd_enabled: Indicates if a waveform of the default CPU context is being
+*              recorded.
+********************************************************************************/
+bool vcd_enabled(void)
+{
+   return cpu_context_default()->vcd != 0;
+}
+
+/********************************************************************************
+* put_time: Adds the current time of specified waveform to the output buffer,
+*           unless it's the same as the last time written.
+*
+*           - self: Reference to the waveform.
+********************************************************************************/
+static void put_time(struct vcd* self)
+{
+   char digits[24];
+   uint64_t time = self->cycle * VCD_CLOCK_PERIOD;
+   size_t num_digits = 0;
+   if (self->started && self->cycle == self->time_written) return;
+   self->time_written = self->cycle;
+
+   do
+   {
+      digits[num_digits++] = (char)('0' + time % 10);
+      time /= 10;
+   } while (time);
+
+   self->buffer[self->buffer_used++] = '#';
+   while (num_digits) self->buffer[self->buffer_used++] = digits[--num_digits];
+   self->buffer[self->buffer_used++] = '\n';
+   return;
+}
+
+/********************************************************************************
+* put_value: Adds a value change of specified signal to the output buffer.
+*            Single bit signals are written as the bit followed by the
+*            identifier code, wider signals as a binary vector.
+*
+*            - self  : Reference to the waveform.
+*            - signal: Index of the signal.
+*            - value : The new value of the signal.
+********************************************************************************/
+static void put_value(struct vcd* self,
+                      const size_t signal,
+                      const uint16_t value)
+{
+   char* destination = self->buffer + self->buffer_used;
+
+   if (signals[signal].width == 1)
+   {
+      *destination++ = value ? '1' : '0';
+   }
+   else
+   {
+      *destination++ = 'b';
+      for (int i = signals[signal].width - 1; i >= 0; --i) *destination++ = (value & (1 << i)) ? '1' : '0';
+      *destination++ = ' ';
+   }
+
+   *destination++ = (char)(VCD_FIRST_ID + signal);
+   *destination++ = '\n';
+   self->buffer_used = destination - self->buffer;
+   return;
+}
+
+/********************************************************************************
+* flush_buffer: Writes the content of the output buffer to the VCD file.
+*
+*               - self: Reference to the waveform.
+********************************************************************************/
+static void flush_buffer(struct vcd* self)
+{
+   if (self->buffer_used && fwrite(self->buffer, 1, self->buffer_used, self->file) != self->buffer_used)
+   {
+      self->error = true;
+   }
+
+   self->buffer_used = 0;
+   return;
+}
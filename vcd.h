@@ -0,0 +1,95 @@
+/********************************************************************************
+* vcd.h: Contains function declarations and macro definitions for recording
+*        the I/O registers of the emulated microcontroller as a waveform in
+*        Value Change Dump (VCD) format, which can be viewed in standard
+*        waveform viewers such as GTKWave.
+*
+*        The signals are the DDRx, PORTx and PINx registers of port B, C and
+*        D, the pin change interrupt flag register PCIFR, the global
+*        interrupt flag I and the program counter. The time is counted in
+*        emulated clock cycles of a 16 MHz clock. The signals are sampled
+*        after each clock cycle, or each instruction in batch runs, and only
+*        changed values are written, via a large buffer that is written to
+*        the file in big sequential writes.
+********************************************************************************/
+#ifndef VCD_H_
+#define VCD_H_
+
+/* Include directives: */
+#include "cpu.h"
+
+/* Macro definitions: */
+#define VCD_TIMESCALE    "100 ps" /* Time unit of the waveform. */
+#define VCD_CLOCK_PERIOD 625      /* Time units per clock cycle (16 MHz). */
+
+/* Forward declarations: */
+struct cpu_context;
+struct vcd;
+
+/********************************************************************************
+* vcd_open: Returns a new waveform written to the file at specified path. The
+*           header declaring the signals is written right away. If the file
+*           can't be created or memory can't be allocated, a null pointer is
+*           returned.
+*
+*           - path: Path to the VCD file.
+********************************************************************************/
+struct vcd* vcd_open(const char* path);
+
+/********************************************************************************
+* vcd_close: Writes all buffered value changes of specified waveform, closes
+*            the file and deletes the waveform. The referenced pointer is set
+*            to null. Success code 0 is returned if the entire waveform was
+*            written, otherwise error code 1 is returned.
+*
+*            - self: Reference to pointer to the waveform.
+********************************************************************************/
+int vcd_close(struct vcd** self);
+
+/********************************************************************************
+* vcd_sample: Advances the time of specified waveform by specified number of
+*             clock cycles and records the signals of specified CPU context
+*             that have changed since the last sample.
+*
+*             - self      : Reference to the waveform.
+*             - context   : Reference to the sampled CPU context.
+*             - num_cycles: Number of clock cycles run since the last sample.
+********************************************************************************/
+void vcd_sample(struct vcd* self,
+                const struct cpu_context* context,
+                const uint64_t num_cycles);
+
+/********************************************************************************
+* vcd_enable_ctx: Starts or stops recording a waveform of specified CPU
+*                 context. When started, a new waveform is written to the
+*                 file at specified path, replacing any running recording.
+*                 While recording, batch runs are interpreted instruction by
+*                 instruction, also when JIT compilation is enabled. Success
+*                 code 0 is returned on success, otherwise error code 1 is
+*                 returned.
+*
+*                 - self   : Reference to the CPU context.
+*                 - enabled: Indicates if recording is enabled.
+*                 - path   : Path to the VCD file (ignored when stopping).
+********************************************************************************/
+int vcd_enable_ctx(struct cpu_context* self,
+                   const bool enabled,
+                   const char* path);
+
+/********************************************************************************
+* vcd_enable: Starts or stops recording a waveform of the default CPU
+*             context, see vcd_enable_ctx.
+*
+*             - enabled: Indicates if recording is enabled.
+*             - path   : Path to the VCD file (ignored when stopping).
+********************************************************************************/
+int vcd_enable(const bool enabled,
+               const char* path);
+
+/********************************************************************************
+* vcd_enabled: Indicates if a waveform of the default CPU context is being
+*              recorded.
+********************************************************************************/
+bool vcd_enabled(void);
+
+#endif /* VCD_H_ */